@@ -0,0 +1,101 @@
+DIR_NAME=`basename ${PWD}`
+mkdir -p ../${DIR_NAME}-native-perf
+cd ../${DIR_NAME}-native-perf
+# instrumented build, train it with dmaster-bench against a local dmaster
+# and with bulk TCP through dnode's TUN device, then rebuild using the
+# profile. Extra arguments go to cmake, e.g. -DDTUN_PERF_MARCH=native.
+cmake \
+-DCMAKE_BUILD_TYPE="Release" \
+-DDTUN_PERF=ON \
+-DDTUN_PGO=GENERATE \
+"$@" \
+../${DIR_NAME} || exit 1
+make -j`nproc` || exit 1
+rm -rf pgo
+./out/bin/dmaster --port 2345 --log4cplus_level WARN &
+DMASTER_PID=$!
+sleep 1
+./out/bin/dmaster-bench --port 2345 --master_pid ${DMASTER_PID} --nodes 500 --rate 1000 --duration 20
+# dnode training: a TUN device in a network namespace, routed by dnode
+# straight back to a TCP server on this host, bulk transfers both ways,
+# with and without offloads. Needs root, iproute2 and python3.
+HOST_IP=`ip -4 route get 1.1.1.1 2>/dev/null | sed -n 's/.* src \([0-9.]*\).*/\1/p'`
+if [ "`id -u`" = "0" ] && [ -n "${HOST_IP}" ] && command -v python3 > /dev/null; then
+    cat > pgo-dnode.ini << EOF
+[server]
+address = 127.0.0.1
+port = 2345
+probeAddress = 127.0.0.1
+probePort = 2345
+
+[node]
+id = 1
+numSymmPorts = 100
+numFastPorts = 100
+decayTimeoutMs = 1000
+route.0.ip = 0.0.0.0
+route.0.mask = 0.0.0.0
+route.0.node = -1
+EOF
+    python3 - ${HOST_IP} << 'EOF' &
+import socket, sys, threading
+def serve(c):
+    if c.recv(1) == b'd':
+        buf = b'x' * 65536
+        for i in range(3200):
+            c.sendall(buf)
+    else:
+        while c.recv(262144):
+            pass
+    c.close()
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind((sys.argv[1], 5001))
+s.listen(16)
+while True:
+    c, _ = s.accept()
+    threading.Thread(target=serve, args=(c,), daemon=True).start()
+EOF
+    SERVER_PID=$!
+    for TUN_ARGS in "" "--tun-offload"; do
+        ip netns add dtun-pgo || break
+        ./out/bin/dnode --app_config pgo-dnode.ini --log4cplus_level WARN --loglevel warning \
+            --tun-ns dtun-pgo --tundev tun0 --netif-ipaddr 10.0.0.2 --netif-netmask 255.255.255.0 ${TUN_ARGS} &
+        DNODE_PID=$!
+        sleep 2
+        ip -n dtun-pgo link set tun0 up
+        ip -n dtun-pgo addr add 10.0.0.1/24 dev tun0
+        ip -n dtun-pgo route add ${HOST_IP}/32 dev tun0
+        ip netns exec dtun-pgo python3 - ${HOST_IP} << 'EOF'
+import socket, sys, time
+for mode in (b'd', b'u'):
+    s = socket.create_connection((sys.argv[1], 5001))
+    s.sendall(mode)
+    n = 0
+    t = time.time()
+    if mode == b'd':
+        while True:
+            d = s.recv(262144)
+            if not d:
+                break
+            n += len(d)
+    else:
+        buf = b'y' * 65536
+        while n < 3200 * 65536:
+            s.sendall(buf)
+            n += len(buf)
+    s.close()
+    print('dnode %s %.1f MB/s' % ('down' if mode == b'd' else 'up', n / (time.time() - t) / 1e6))
+EOF
+        kill -INT ${DNODE_PID}
+        wait ${DNODE_PID}
+        ip netns del dtun-pgo
+    done
+    kill ${SERVER_PID}
+else
+    echo "dnode training skipped, needs root, iproute2 and python3"
+fi
+kill -INT ${DMASTER_PID}
+wait ${DMASTER_PID}
+cmake -DDTUN_PGO=USE ../${DIR_NAME} || exit 1
+make -j`nproc`
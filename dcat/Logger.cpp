@@ -2,8 +2,9 @@
 
 namespace DCat
 {
-    log4cplus::Logger logger()
+    const log4cplus::Logger& logger()
     {
-        return log4cplus::Logger::getInstance("DCat");
+        static const log4cplus::Logger instance = log4cplus::Logger::getInstance("DCat");
+        return instance;
     }
 }
@@ -0,0 +1,637 @@
+#include "Bench.h"
+#include "Logger.h"
+#include "DTun/Utils.h"
+#include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
+
+#define BENCH_TICK_MS 10
+#define BENCH_SETTLE_MS 1000
+
+namespace DMasterBench
+{
+    Bench::Bench(DTun::SManager& remoteMgr, DTun::SManager& localMgr, const Options& opts)
+    : remoteMgr_(remoteMgr)
+    , localMgr_(localMgr)
+    , opts_(opts)
+    , phase_(PhaseConnect)
+    , tokens_(0)
+    , nextNode_(0)
+    , numConnecting_(0)
+    , numConnected_(0)
+    , numConnectFailed_(0)
+    , numLost_(0)
+    , connectUs_(0)
+    , masterPid_(opts.masterPid)
+    , runMasterCpu_(0)
+    , lastMasterCpu_(0)
+    {
+    }
+
+    Bench::~Bench()
+    {
+    }
+
+    bool Bench::start()
+    {
+        if (opts_.numNodes < 2) {
+            LOG4CPLUS_ERROR(logger(), "Need at least 2 nodes");
+            return false;
+        }
+
+        if (masterPid_ == 0) {
+            masterPid_ = findMasterPid();
+            if (masterPid_ == 0) {
+                LOG4CPLUS_WARN(logger(), "dmaster process not found, no CPU/RSS stats");
+            }
+        }
+
+        nodes_.resize(opts_.numNodes);
+        readyNodes_.reserve(opts_.numNodes);
+
+        phase_ = PhaseConnect;
+        phaseStarted_ = lastTick_ = lastReport_ = boost::chrono::steady_clock::now();
+
+        LOG4CPLUS_INFO(logger(), "Connecting " << opts_.numNodes << " nodes to "
+            << opts_.address << ":" << opts_.port);
+
+        localMgr_.reactor().post(boost::bind(&Bench::onTick, this));
+
+        return true;
+    }
+
+    void Bench::report(bool final)
+    {
+        boost::mutex::scoped_lock lock(m_);
+
+        doReport(final);
+    }
+
+    void Bench::doReport(bool final)
+    {
+        TimePoint now = boost::chrono::steady_clock::now();
+
+        if (phase_ == PhaseConnect) {
+            LOG4CPLUS_INFO(logger(), "nodes: connected = " << numConnected_
+                << ", connecting = " << numConnecting_
+                << ", failed = " << numConnectFailed_);
+            return;
+        }
+
+        Stats& stats = final ? totalStats_ : intervalStats_;
+        DTun::UInt32 us = elapsedUs(final ? runStarted_ : lastReport_, now);
+        double sec = (us > 0) ? (static_cast<double>(us) / 1000000.0) : 1.0;
+
+        std::ostringstream os;
+
+        if (final) {
+            os << "total: build = " << DTun::buildProfile()
+                << ", nodes = " << numConnected_ << "/" << opts_.numNodes
+                << ", sessions/s = " << (connectUs_ ? (static_cast<DTun::UInt64>(numConnected_) * 1000000 / connectUs_) : 0)
+                << ", connect p50 = " << percentile(connectLatency_, 50)
+                << "us, p99 = " << percentile(connectLatency_, 99)
+                << "us, lost = " << numLost_ << "; ";
+        }
+
+        os << "rendezvous: created = " << stats.created
+            << ", completed = " << stats.completed
+            << " (" << static_cast<DTun::UInt64>(stats.completed / sec) << "/s)"
+            << ", failed = " << stats.failed
+            << ", timed out = " << stats.timedOut
+            << ", outstanding = " << rendezvous_.size()
+            << "; create p50 = " << percentile(stats.createLatency, 50)
+            << "us, p99 = " << percentile(stats.createLatency, 99)
+            << "us; rendezvous p50 = " << percentile(stats.rendezvousLatency, 50)
+            << "us, p99 = " << percentile(stats.rendezvousLatency, 99) << "us";
+
+        DTun::UInt64 cpuTicks = 0;
+        DTun::UInt64 rssKb = 0;
+
+        if (readMasterStats(cpuTicks, rssKb)) {
+            DTun::UInt64 prevCpu = final ? runMasterCpu_ : lastMasterCpu_;
+            double cpu = static_cast<double>(cpuTicks - prevCpu) * 100.0 /
+                (static_cast<double>(::sysconf(_SC_CLK_TCK)) * sec);
+
+            os << "; dmaster cpu = " << static_cast<int>(cpu) << "%, rss = " << rssKb << "KB";
+
+            lastMasterCpu_ = cpuTicks;
+        }
+
+        LOG4CPLUS_INFO(logger(), os.str());
+
+        if (!final) {
+            intervalStats_ = Stats();
+            lastReport_ = now;
+        }
+    }
+
+    void Bench::onTick()
+    {
+        TimePoint now = boost::chrono::steady_clock::now();
+
+        boost::mutex::scoped_lock lock(m_);
+
+        DTun::UInt32 phaseMs = elapsedUs(phaseStarted_, now) / 1000;
+
+        switch (phase_) {
+        case PhaseConnect:
+            connectNodes(now);
+            if ((nextNode_ >= opts_.numNodes) && (numConnecting_ == 0)) {
+                connectUs_ = elapsedUs(phaseStarted_, now);
+                doReport(false);
+                phase_ = PhaseSettle;
+                phaseStarted_ = now;
+            }
+            break;
+        case PhaseSettle:
+            // let dmaster process last HELLOs.
+            if (phaseMs >= BENCH_SETTLE_MS) {
+                LOG4CPLUS_INFO(logger(), "Running " << opts_.rate << " rendezvous/s for " << opts_.durationSec << "s"
+                    << (opts_.fast ? "" : ", no HELLO_FAST") << (opts_.batch ? "" : ", no batching"));
+                phase_ = PhaseRun;
+                phaseStarted_ = runStarted_ = lastReport_ = now;
+                tokens_ = 0;
+                DTun::UInt64 rssKb = 0;
+                if (readMasterStats(runMasterCpu_, rssKb)) {
+                    lastMasterCpu_ = runMasterCpu_;
+                }
+            }
+            break;
+        case PhaseRun:
+            createRendezvous(now);
+            checkTimeouts(now);
+            if (phaseMs >= static_cast<DTun::UInt32>(opts_.durationSec) * 1000) {
+                phase_ = PhaseDrain;
+                phaseStarted_ = now;
+            }
+            break;
+        case PhaseDrain:
+            checkTimeouts(now);
+            if (rendezvous_.empty() || (phaseMs >= static_cast<DTun::UInt32>(opts_.timeoutMs))) {
+                phase_ = PhaseDone;
+                localMgr_.reactor().stop();
+                releaseGarbage(lock);
+                return;
+            }
+            break;
+        default:
+            return;
+        }
+
+        if (elapsedUs(lastReport_, now) >= static_cast<DTun::UInt32>(opts_.reportIntervalSec) * 1000000) {
+            doReport(false);
+            lastReport_ = now;
+        }
+
+        lastTick_ = now;
+
+        localMgr_.reactor().post(boost::bind(&Bench::onTick, this), BENCH_TICK_MS);
+
+        releaseGarbage(lock);
+    }
+
+    void Bench::releaseGarbage(boost::mutex::scoped_lock& lock)
+    {
+        // sessions are only destroyed here, never from within their own callbacks,
+        // and not under m_ since UDT waits for its reactor thread on close.
+        std::vector<boost::shared_ptr<BenchSession> > garbage;
+
+        garbage.swap(garbage_);
+
+        lock.unlock();
+    }
+
+    void Bench::connectNodes(const TimePoint& now)
+    {
+        int budget = opts_.maxConnecting - numConnecting_;
+
+        if (opts_.connectRate > 0) {
+            tokens_ += static_cast<double>(opts_.connectRate) * elapsedUs(lastTick_, now) / 1000000.0;
+            budget = std::min(budget, static_cast<int>(tokens_));
+        }
+
+        while ((budget > 0) && (nextNode_ < opts_.numNodes)) {
+            int idx = nextNode_++;
+            --budget;
+            if (opts_.connectRate > 0) {
+                tokens_ -= 1.0;
+            }
+
+            Node& node = nodes_[idx];
+
+            node.sess = boost::make_shared<BenchSession>(boost::ref(remoteMgr_), opts_.address, opts_.port);
+            node.sess->setMessageCallback(boost::bind(&Bench::onNodeMessage, this, idx, _1, _2));
+            node.sess->setErrorCallback(boost::bind(&Bench::onNodeError, this, idx, _1));
+            node.connectStarted = now;
+
+            ++numConnecting_;
+
+            if (!node.sess->startPersistent(opts_.baseNodeId + idx, opts_.batch, boost::bind(&Bench::onNodeStart, this, idx, _1))) {
+                --numConnecting_;
+                ++numConnectFailed_;
+                garbage_.push_back(node.sess);
+                node.sess.reset();
+            }
+        }
+    }
+
+    void Bench::createRendezvous(const TimePoint& now)
+    {
+        tokens_ += static_cast<double>(opts_.rate) * elapsedUs(lastTick_, now) / 1000000.0;
+
+        int num = static_cast<int>(tokens_);
+        tokens_ -= num;
+
+        for (int i = 0; (i < num) && (readyNodes_.size() >= 2); ++i) {
+            int srcIdx = readyNodes_[rand() % readyNodes_.size()];
+            int dstIdx = readyNodes_[rand() % readyNodes_.size()];
+
+            if ((srcIdx == dstIdx) || !nodes_[srcIdx].ready || !nodes_[dstIdx].ready) {
+                continue;
+            }
+
+            DTun::UInt32 connIdx = ++nodes_[srcIdx].nextConnIdx;
+            if (connIdx == 0) {
+                connIdx = ++nodes_[srcIdx].nextConnIdx;
+            }
+
+            DTun::ConnId connId(opts_.baseNodeId + srcIdx, connIdx);
+
+            Rendezvous& r = rendezvous_[connId];
+
+            r.srcIdx = srcIdx;
+            r.dstIdx = dstIdx;
+            r.created = now;
+
+            timeouts_.push_back(std::make_pair(now + boost::chrono::milliseconds(opts_.timeoutMs), connId));
+
+            ++intervalStats_.created;
+            ++totalStats_.created;
+
+            DTun::DProtocolMsgConnCreate msg;
+
+            msg.connId = DTun::toProtocolConnId(connId);
+            msg.dstNodeId = opts_.baseNodeId + dstIdx;
+            msg.remoteIp = 0;
+            msg.remotePort = 0;
+            msg.flags = 0;
+
+            sendMsg(srcIdx, DPROTOCOL_MSG_CONN_CREATE, &msg, sizeof(msg));
+        }
+    }
+
+    void Bench::checkTimeouts(const TimePoint& now)
+    {
+        while (!timeouts_.empty() && (timeouts_.front().first <= now)) {
+            RendezvousMap::iterator it = rendezvous_.find(timeouts_.front().second);
+            if (it != rendezvous_.end()) {
+                LOG4CPLUS_TRACE(logger(), "rendezvous " << it->first << " timed out");
+                ++intervalStats_.timedOut;
+                ++totalStats_.timedOut;
+                if (!it->second.closed) {
+                    closeRendezvous(it->first, it->second, false);
+                }
+                removeRendezvous(it);
+            }
+            timeouts_.pop_front();
+        }
+    }
+
+    void Bench::onNodeStart(int idx, int err)
+    {
+        LOG4CPLUS_TRACE(logger(), "Bench::onNodeStart(" << idx << ", " << err << ")");
+
+        boost::mutex::scoped_lock lock(m_);
+
+        --numConnecting_;
+
+        Node& node = nodes_[idx];
+
+        if (err) {
+            ++numConnectFailed_;
+            garbage_.push_back(node.sess);
+            node.sess.reset();
+            return;
+        }
+
+        ++numConnected_;
+        node.ready = true;
+        readyNodes_.push_back(idx);
+        connectLatency_.push_back(elapsedUs(node.connectStarted, boost::chrono::steady_clock::now()));
+    }
+
+    void Bench::onNodeMessage(int idx, DTun::UInt8 msgCode, const void* msg)
+    {
+
+        boost::mutex::scoped_lock lock(m_);
+        switch (msgCode) {
+        case DPROTOCOL_MSG_CONN_STATUS:
+            onConnStatus(idx, *(const DTun::DProtocolMsgConnStatus*)msg);
+            break;
+        case DPROTOCOL_MSG_CONN:
+            onConn(idx, *(const DTun::DProtocolMsgConn*)msg);
+            break;
+        case DPROTOCOL_MSG_READY:
+            onReady(idx, *(const DTun::DProtocolMsgReady*)msg);
+            break;
+        case DPROTOCOL_MSG_FAST:
+            onFast(idx, *(const DTun::DProtocolMsgFast*)msg);
+            break;
+        default:
+            LOG4CPLUS_TRACE(logger(), "node " << idx << ", unexpected msg " << (int)msgCode);
+            break;
+        }
+    }
+
+    void Bench::onNodeError(int idx, int err)
+    {
+        LOG4CPLUS_ERROR(logger(), "node " << (opts_.baseNodeId + idx) << " lost connection to dmaster: " << err);
+
+        boost::mutex::scoped_lock lock(m_);
+
+        Node& node = nodes_[idx];
+
+        if (node.ready) {
+            ++numLost_;
+        }
+
+        node.ready = false;
+        garbage_.push_back(node.sess);
+        node.sess.reset();
+    }
+
+    void Bench::onConnStatus(int idx, const DTun::DProtocolMsgConnStatus& msg)
+    {
+        RendezvousMap::iterator it = rendezvous_.find(DTun::fromProtocolConnId(msg.connId));
+        if (it == rendezvous_.end()) {
+            return;
+        }
+
+        DTun::UInt32 us = elapsedUs(it->second.created, boost::chrono::steady_clock::now());
+
+        if (msg.statusCode == DPROTOCOL_STATUS_PENDING) {
+            if (idx == it->second.srcIdx) {
+                intervalStats_.createLatency.push_back(us);
+                totalStats_.createLatency.push_back(us);
+            }
+        } else if (msg.statusCode == DPROTOCOL_STATUS_ESTABLISHED) {
+            if (idx == it->second.dstIdx) {
+                intervalStats_.rendezvousLatency.push_back(us);
+                totalStats_.rendezvousLatency.push_back(us);
+                ++intervalStats_.completed;
+                ++totalStats_.completed;
+                removeRendezvous(it);
+            }
+        } else {
+            LOG4CPLUS_TRACE(logger(), "rendezvous " << it->first << " failed: " << (int)msg.statusCode);
+            ++intervalStats_.failed;
+            ++totalStats_.failed;
+            removeRendezvous(it);
+        }
+    }
+
+    void Bench::onConn(int idx, const DTun::DProtocolMsgConn& msg)
+    {
+        DTun::ConnId connId = DTun::fromProtocolConnId(msg.connId);
+
+        RendezvousMap::iterator it = rendezvous_.find(connId);
+        if ((it == rendezvous_.end()) || (idx != it->second.dstIdx)) {
+            return;
+        }
+
+        DTun::DProtocolMsgReady msgReady;
+
+        msgReady.connId = msg.connId;
+
+        sendMsg(idx, DPROTOCOL_MSG_READY, &msgReady, sizeof(msgReady));
+
+        if (opts_.fast) {
+            startFast(connId, it->second, false);
+        }
+    }
+
+    void Bench::onReady(int idx, const DTun::DProtocolMsgReady& msg)
+    {
+        DTun::ConnId connId = DTun::fromProtocolConnId(msg.connId);
+
+        RendezvousMap::iterator it = rendezvous_.find(connId);
+        if ((it == rendezvous_.end()) || (idx != it->second.srcIdx) || it->second.closed) {
+            return;
+        }
+
+        if (opts_.fast) {
+            startFast(connId, it->second, true);
+        } else {
+            closeRendezvous(connId, it->second, true);
+        }
+    }
+
+    void Bench::onFast(int idx, const DTun::DProtocolMsgFast& msg)
+    {
+        DTun::ConnId connId = DTun::fromProtocolConnId(msg.connId);
+
+        RendezvousMap::iterator it = rendezvous_.find(connId);
+        if ((it == rendezvous_.end()) || it->second.closed) {
+            return;
+        }
+
+        if (idx == it->second.srcIdx) {
+            it->second.srcFast = true;
+        } else if (idx == it->second.dstIdx) {
+            it->second.dstFast = true;
+        }
+
+        if (it->second.srcFast && it->second.dstFast) {
+            closeRendezvous(connId, it->second, true);
+        }
+    }
+
+    void Bench::onFastStart(const DTun::ConnId& connId, bool src, int err)
+    {
+        if (!err) {
+            return;
+        }
+
+        boost::mutex::scoped_lock lock(m_);
+
+        RendezvousMap::iterator it = rendezvous_.find(connId);
+        if (it == rendezvous_.end()) {
+            return;
+        }
+
+        LOG4CPLUS_TRACE(logger(), "rendezvous " << connId << " HELLO_FAST failed: " << err);
+
+        ++intervalStats_.failed;
+        ++totalStats_.failed;
+
+        if (!it->second.closed) {
+            closeRendezvous(connId, it->second, false);
+        }
+        removeRendezvous(it);
+    }
+
+    void Bench::startFast(const DTun::ConnId& connId, Rendezvous& r, bool src)
+    {
+        boost::shared_ptr<BenchSession>& sess = src ? r.srcFastSess : r.dstFastSess;
+
+        sess = boost::make_shared<BenchSession>(boost::ref(remoteMgr_), opts_.address, opts_.port);
+
+        if (!sess->startFast(opts_.baseNodeId + (src ? r.srcIdx : r.dstIdx), connId,
+            boost::bind(&Bench::onFastStart, this, connId, src, _1))) {
+            // can't fail synchronously because of posting, but just in case.
+            localMgr_.reactor().post(boost::bind(&Bench::onFastStart, this, connId, src, 1));
+        }
+    }
+
+    void Bench::closeRendezvous(const DTun::ConnId& connId, Rendezvous& r, bool established)
+    {
+        DTun::DProtocolMsgConnClose msg;
+
+        msg.connId = DTun::toProtocolConnId(connId);
+        msg.established = established;
+
+        sendMsg(r.srcIdx, DPROTOCOL_MSG_CONN_CLOSE, &msg, sizeof(msg));
+
+        r.closed = true;
+
+        if (r.srcFastSess) {
+            garbage_.push_back(r.srcFastSess);
+            r.srcFastSess.reset();
+        }
+        if (r.dstFastSess) {
+            garbage_.push_back(r.dstFastSess);
+            r.dstFastSess.reset();
+        }
+    }
+
+    void Bench::removeRendezvous(RendezvousMap::iterator it)
+    {
+        if (it->second.srcFastSess) {
+            garbage_.push_back(it->second.srcFastSess);
+        }
+        if (it->second.dstFastSess) {
+            garbage_.push_back(it->second.dstFastSess);
+        }
+        rendezvous_.erase(it);
+    }
+
+    void Bench::sendMsg(int idx, DTun::UInt8 msgCode, const void* msg, int msgSize)
+    {
+        if (nodes_[idx].sess) {
+            nodes_[idx].sess->sendMsg(msgCode, msg, msgSize);
+        }
+    }
+
+    int Bench::findMasterPid()
+    {
+        DIR* dir = ::opendir("/proc");
+        if (!dir) {
+            return 0;
+        }
+
+        int res = 0;
+
+        struct dirent* entry;
+
+        while ((entry = ::readdir(dir)) != NULL) {
+            int pid = ::atoi(entry->d_name);
+            if (pid <= 0) {
+                continue;
+            }
+
+            std::ostringstream os;
+            os << "/proc/" << pid << "/comm";
+
+            std::ifstream f(os.str().c_str());
+            std::string comm;
+
+            if (std::getline(f, comm) && (comm == "dmaster")) {
+                res = pid;
+                break;
+            }
+        }
+
+        ::closedir(dir);
+
+        return res;
+    }
+
+    bool Bench::readMasterStats(DTun::UInt64& cpuTicks, DTun::UInt64& rssKb) const
+    {
+        if (masterPid_ == 0) {
+            return false;
+        }
+
+        std::ostringstream os;
+        os << "/proc/" << masterPid_ << "/stat";
+
+        std::ifstream statFile(os.str().c_str());
+        std::string line;
+
+        if (!std::getline(statFile, line)) {
+            return false;
+        }
+
+        // skip "pid (comm)", comm may contain spaces.
+        std::string::size_type pos = line.rfind(')');
+        if (pos == std::string::npos) {
+            return false;
+        }
+
+        std::istringstream is(line.substr(pos + 1));
+        std::string field;
+
+        // fields 3 - 13
+        for (int i = 0; i < 11; ++i) {
+            is >> field;
+        }
+
+        DTun::UInt64 utime = 0, stime = 0;
+
+        if (!(is >> utime >> stime)) {
+            return false;
+        }
+
+        cpuTicks = utime + stime;
+
+        std::ostringstream os2;
+        os2 << "/proc/" << masterPid_ << "/status";
+
+        std::ifstream statusFile(os2.str().c_str());
+
+        rssKb = 0;
+
+        while (std::getline(statusFile, line)) {
+            if (line.compare(0, 6, "VmRSS:") == 0) {
+                std::istringstream is2(line.substr(6));
+                is2 >> rssKb;
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    DTun::UInt32 Bench::elapsedUs(const TimePoint& from, const TimePoint& to)
+    {
+        return boost::chrono::duration_cast<boost::chrono::microseconds>(to - from).count();
+    }
+
+    DTun::UInt32 Bench::percentile(std::vector<DTun::UInt32>& values, int p)
+    {
+        if (values.empty()) {
+            return 0;
+        }
+
+        std::vector<DTun::UInt32>::iterator it = values.begin() + (values.size() - 1) * p / 100;
+
+        std::nth_element(values.begin(), it, values.end());
+
+        return *it;
+    }
+}
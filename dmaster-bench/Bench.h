@@ -0,0 +1,204 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include "BenchSession.h"
+#include <boost/unordered_map.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/mutex.hpp>
+#include <deque>
+
+namespace DMasterBench
+{
+    /*
+     * Drives dmaster with simulated nodes: opens 'numNodes' persistent
+     * sessions, then runs rendezvous between random node pairs at 'rate' per
+     * second, same message sequence as dnode uses for fast mode:
+     *
+     * src: CONN_CREATE -> CONN_STATUS(PENDING)
+     * dst: CONN -> READY, HELLO_FAST
+     * src: READY -> HELLO_FAST
+     * src,dst: FAST
+     * src: CONN_CLOSE(established) -> dst: CONN_STATUS(ESTABLISHED)
+     *
+     * Timers run on 'localMgr' reactor, sessions use 'remoteMgr' which may
+     * have a reactor thread of its own (UDT).
+     */
+    class Bench : boost::noncopyable
+    {
+    public:
+        struct Options
+        {
+            Options()
+            : port(2345)
+            , numNodes(1000)
+            , baseNodeId(1000000)
+            , connectRate(0)
+            , maxConnecting(256)
+            , rate(100)
+            , durationSec(30)
+            , timeoutMs(10000)
+            , reportIntervalSec(5)
+            , fast(true)
+            , batch(true)
+            , masterPid(0) {}
+
+            std::string address;
+            int port;
+            int numNodes;
+            DTun::UInt32 baseNodeId;
+            // sessions/sec, 0 - as fast as possible.
+            int connectRate;
+            int maxConnecting;
+            // rendezvous/sec.
+            int rate;
+            int durationSec;
+            int timeoutMs;
+            int reportIntervalSec;
+            // open HELLO_FAST sessions as a part of rendezvous.
+            bool fast;
+            // negotiate batched framing on persistent sessions.
+            bool batch;
+            // dmaster pid for CPU/RSS stats, 0 - look up "dmaster" process.
+            int masterPid;
+        };
+
+        Bench(DTun::SManager& remoteMgr, DTun::SManager& localMgr, const Options& opts);
+        ~Bench();
+
+        bool start();
+
+        void report(bool final);
+
+    private:
+        typedef boost::chrono::steady_clock::time_point TimePoint;
+
+        enum Phase
+        {
+            PhaseConnect = 0,
+            PhaseSettle,
+            PhaseRun,
+            PhaseDrain,
+            PhaseDone
+        };
+
+        struct Node
+        {
+            Node()
+            : ready(false)
+            , nextConnIdx(0) {}
+
+            boost::shared_ptr<BenchSession> sess;
+            TimePoint connectStarted;
+            bool ready;
+            DTun::UInt32 nextConnIdx;
+        };
+
+        struct Rendezvous
+        {
+            Rendezvous()
+            : srcIdx(0)
+            , dstIdx(0)
+            , srcFast(false)
+            , dstFast(false)
+            , closed(false) {}
+
+            int srcIdx;
+            int dstIdx;
+            TimePoint created;
+            bool srcFast;
+            bool dstFast;
+            bool closed;
+            boost::shared_ptr<BenchSession> srcFastSess;
+            boost::shared_ptr<BenchSession> dstFastSess;
+        };
+
+        typedef boost::unordered_map<DTun::ConnId, Rendezvous> RendezvousMap;
+
+        struct Stats
+        {
+            Stats()
+            : created(0)
+            , completed(0)
+            , failed(0)
+            , timedOut(0) {}
+
+            DTun::UInt64 created;
+            DTun::UInt64 completed;
+            DTun::UInt64 failed;
+            DTun::UInt64 timedOut;
+            // CONN_CREATE -> CONN_STATUS(PENDING), us
+            std::vector<DTun::UInt32> createLatency;
+            // CONN_CREATE -> CONN_STATUS(ESTABLISHED), us
+            std::vector<DTun::UInt32> rendezvousLatency;
+        };
+
+        void doReport(bool final);
+
+        void onTick();
+
+        void releaseGarbage(boost::mutex::scoped_lock& lock);
+
+        void connectNodes(const TimePoint& now);
+        void createRendezvous(const TimePoint& now);
+        void checkTimeouts(const TimePoint& now);
+
+        void onNodeStart(int idx, int err);
+        void onNodeMessage(int idx, DTun::UInt8 msgCode, const void* msg);
+        void onNodeError(int idx, int err);
+
+        void onConnStatus(int idx, const DTun::DProtocolMsgConnStatus& msg);
+        void onConn(int idx, const DTun::DProtocolMsgConn& msg);
+        void onReady(int idx, const DTun::DProtocolMsgReady& msg);
+        void onFast(int idx, const DTun::DProtocolMsgFast& msg);
+
+        void onFastStart(const DTun::ConnId& connId, bool src, int err);
+
+        void startFast(const DTun::ConnId& connId, Rendezvous& r, bool src);
+        void closeRendezvous(const DTun::ConnId& connId, Rendezvous& r, bool established);
+        void removeRendezvous(RendezvousMap::iterator it);
+
+        void sendMsg(int idx, DTun::UInt8 msgCode, const void* msg, int msgSize);
+
+        static int findMasterPid();
+        bool readMasterStats(DTun::UInt64& cpuTicks, DTun::UInt64& rssKb) const;
+
+        static DTun::UInt32 elapsedUs(const TimePoint& from, const TimePoint& to);
+        static DTun::UInt32 percentile(std::vector<DTun::UInt32>& values, int p);
+
+        DTun::SManager& remoteMgr_;
+        DTun::SManager& localMgr_;
+        Options opts_;
+
+        boost::mutex m_;
+
+        Phase phase_;
+        TimePoint phaseStarted_;
+        TimePoint lastTick_;
+        TimePoint runStarted_;
+        TimePoint lastReport_;
+        double tokens_;
+
+        std::vector<Node> nodes_;
+        std::vector<int> readyNodes_;
+        int nextNode_;
+        int numConnecting_;
+        int numConnected_;
+        int numConnectFailed_;
+        int numLost_;
+        DTun::UInt32 connectUs_;
+        std::vector<DTun::UInt32> connectLatency_;
+
+        RendezvousMap rendezvous_;
+        std::deque<std::pair<TimePoint, DTun::ConnId> > timeouts_;
+        std::vector<boost::shared_ptr<BenchSession> > garbage_;
+
+        Stats intervalStats_;
+        Stats totalStats_;
+
+        int masterPid_;
+        DTun::UInt64 runMasterCpu_;
+        DTun::UInt64 lastMasterCpu_;
+    };
+}
+
+#endif
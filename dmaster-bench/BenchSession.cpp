@@ -0,0 +1,171 @@
+#include "BenchSession.h"
+#include "Logger.h"
+#include "DTun/Utils.h"
+#include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
+#include <sstream>
+
+namespace DMasterBench
+{
+    BenchSession::BenchSession(DTun::SManager& mgr, const std::string& address, int port)
+    : mgr_(mgr)
+    , address_(address)
+    , port_(port)
+    , persistent_(false)
+    , batch_(false)
+    , helloCode_(0)
+    {
+    }
+
+    BenchSession::~BenchSession()
+    {
+        boost::shared_ptr<DTun::DProtocolConnection> conn = getConn();
+        if (conn) {
+            conn->close();
+        }
+    }
+
+    bool BenchSession::startPersistent(DTun::UInt32 nodeId, bool batch, const StartCallback& callback)
+    {
+        DTun::DProtocolMsgHello msg;
+
+        msg.nodeId = nodeId;
+        // no probe, dmaster treats us as not being behind symmetrical NAT.
+        msg.probeIp = 0;
+        msg.probePort = 0;
+
+        helloCode_ = batch ? DPROTOCOL_MSG_HELLO_BATCH : DPROTOCOL_MSG_HELLO;
+        hello_.resize(sizeof(msg));
+        memcpy(&hello_[0], &msg, sizeof(msg));
+
+        persistent_ = true;
+        batch_ = batch;
+
+        return start(callback);
+    }
+
+    bool BenchSession::startFast(DTun::UInt32 nodeId, const DTun::ConnId& connId, const StartCallback& callback)
+    {
+        DTun::DProtocolMsgHelloFast msg;
+
+        msg.nodeId = nodeId;
+        msg.connId = DTun::toProtocolConnId(connId);
+
+        helloCode_ = DPROTOCOL_MSG_HELLO_FAST;
+        hello_.resize(sizeof(msg));
+        memcpy(&hello_[0], &msg, sizeof(msg));
+
+        persistent_ = false;
+        batch_ = false;
+
+        return start(callback);
+    }
+
+    void BenchSession::sendMsg(DTun::UInt8 msgCode, const void* msg, int msgSize)
+    {
+        boost::shared_ptr<DTun::DProtocolConnection> conn = getConn();
+        if (conn) {
+            conn->sendMsg(msgCode, msg, msgSize);
+        }
+    }
+
+    bool BenchSession::start(const StartCallback& callback)
+    {
+        boost::shared_ptr<DTun::SHandle> handle = mgr_.createStreamSocket();
+        if (!handle) {
+            return false;
+        }
+
+        startCallback_ = callback;
+
+        connector_ = handle->createConnector();
+
+        std::ostringstream os;
+        os << port_;
+
+        return connector_->connect(address_, os.str(), boost::bind(&BenchSession::onConnect, this, _1), DTun::SConnector::ModeNormal);
+    }
+
+    void BenchSession::onConnect(int err)
+    {
+        LOG4CPLUS_TRACE(logger(), "BenchSession::onConnect(" << err << ")");
+
+        boost::shared_ptr<DTun::SHandle> handle = connector_->handle();
+
+        connector_->close();
+
+        StartCallback cb = startCallback_;
+        startCallback_ = StartCallback();
+
+        if (err) {
+            handle->close();
+            cb(err);
+            return;
+        }
+
+        boost::shared_ptr<DTun::DProtocolConnection> conn =
+            boost::make_shared<DTun::DProtocolConnection>(handle->createConnection());
+
+        conn->setMessageCallback(boost::bind(&BenchSession::onMsg, this, _1, _2, _3));
+        conn->setErrorCallback(boost::bind(&BenchSession::fail, this, _1));
+
+        {
+            boost::mutex::scoped_lock lock(m_);
+            conn_ = conn;
+        }
+
+        conn->sendMsg(helloCode_, &hello_[0], hello_.size());
+        if (batch_) {
+            conn->setSendBatched();
+        }
+
+        if (persistent_) {
+            conn->start();
+        }
+
+        cb(0);
+    }
+
+    void BenchSession::onMsg(DTun::UInt8 msgCode, const char* msg, int msgSize)
+    {
+        if (msgCode == DPROTOCOL_MSG_BATCH) {
+            boost::shared_ptr<DTun::DProtocolConnection> conn = getConn();
+            if (conn) {
+                conn->setRecvBatched();
+            }
+            return;
+        }
+
+        if (messageCallback_) {
+            messageCallback_(msgCode, msg);
+        }
+    }
+
+    void BenchSession::fail(int err)
+    {
+        boost::mutex::scoped_lock lock(m_);
+
+        if (!conn_) {
+            return;
+        }
+
+        boost::shared_ptr<DTun::DProtocolConnection> tmp = conn_;
+        conn_.reset();
+
+        lock.unlock();
+
+        tmp->close();
+
+        if (errorCallback_) {
+            ErrorCallback cb = errorCallback_;
+            errorCallback_ = ErrorCallback();
+            cb(err);
+        }
+    }
+
+    boost::shared_ptr<DTun::DProtocolConnection> BenchSession::getConn()
+    {
+        boost::mutex::scoped_lock lock(m_);
+        return conn_;
+    }
+}
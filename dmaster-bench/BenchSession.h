@@ -0,0 +1,65 @@
+#ifndef _BENCHSESSION_H_
+#define _BENCHSESSION_H_
+
+#include "DTun/DProtocol.h"
+#include "DTun/DProtocolConnection.h"
+#include "DTun/SManager.h"
+#include "DTun/SConnector.h"
+#include <boost/noncopyable.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+namespace DMasterBench
+{
+    /*
+     * One simulated dnode <-> dmaster session, either persistent (HELLO) or
+     * per-connection fast one (HELLO_FAST). sendMsg can be called from any
+     * thread, callbacks come on the manager's reactor thread.
+     */
+    class BenchSession : boost::noncopyable
+    {
+    public:
+        typedef boost::function<void (int)> StartCallback;
+        typedef boost::function<void (DTun::UInt8, const void*)> MessageCallback;
+        typedef boost::function<void (int)> ErrorCallback;
+
+        BenchSession(DTun::SManager& mgr, const std::string& address, int port);
+        ~BenchSession();
+
+        // 'callback' is called once hello is queued.
+        bool startPersistent(DTun::UInt32 nodeId, bool batch, const StartCallback& callback);
+        bool startFast(DTun::UInt32 nodeId, const DTun::ConnId& connId, const StartCallback& callback);
+
+        inline void setMessageCallback(const MessageCallback& cb) { messageCallback_ = cb; }
+        inline void setErrorCallback(const ErrorCallback& cb) { errorCallback_ = cb; }
+
+        void sendMsg(DTun::UInt8 msgCode, const void* msg, int msgSize);
+
+    private:
+        bool start(const StartCallback& callback);
+
+        void onConnect(int err);
+        void onMsg(DTun::UInt8 msgCode, const char* msg, int msgSize);
+
+        void fail(int err);
+
+        boost::shared_ptr<DTun::DProtocolConnection> getConn();
+
+        DTun::SManager& mgr_;
+        std::string address_;
+        int port_;
+        bool persistent_;
+        bool batch_;
+        DTun::UInt8 helloCode_;
+        std::vector<char> hello_;
+        StartCallback startCallback_;
+        MessageCallback messageCallback_;
+        ErrorCallback errorCallback_;
+        boost::mutex m_;
+        boost::shared_ptr<DTun::DProtocolConnection> conn_;
+        boost::shared_ptr<DTun::SConnector> connector_;
+    };
+}
+
+#endif
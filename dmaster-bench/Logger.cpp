@@ -0,0 +1,10 @@
+#include "Logger.h"
+
+namespace DMasterBench
+{
+    const log4cplus::Logger& logger()
+    {
+        static const log4cplus::Logger instance = log4cplus::Logger::getInstance("DMasterBench");
+        return instance;
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <log4cplus/loggingmacros.h>
+#include <log4cplus/logger.h>
+#include <log4cplus/ndc.h>
+
+namespace DMasterBench
+{
+    const log4cplus::Logger& logger();
+}
+
+#endif
@@ -0,0 +1,176 @@
+#include "Bench.h"
+#include "Logger.h"
+#include "DTun/SignalHandler.h"
+#include "DTun/SignalBlocker.h"
+#include "DTun/UDTManager.h"
+#include "DTun/UDTReactor.h"
+#include "DTun/SysReactor.h"
+#include "DTun/SysManager.h"
+#include "DTun/LTUDPManager.h"
+#include "DTun/UTPManager.h"
+#include "DTun/Utils.h"
+#include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/program_options.hpp>
+#include <boost/thread.hpp>
+#include <log4cplus/configurator.h>
+#include <iostream>
+
+using namespace DMasterBench;
+
+static DTun::SReactor* benchReactor = NULL;
+
+static void udtReactorThreadFn(DTun::UDTReactor& reactor)
+{
+    reactor.run();
+}
+
+static void signalHandler(int sig)
+{
+    LOG4CPLUS_INFO(logger(), "Signal " << sig << " received");
+    if (benchReactor) {
+        benchReactor->stop();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    boost::program_options::variables_map vm;
+    std::string logLevel = "INFO";
+    bool ltudp = false;
+    bool utp = false;
+    Bench::Options opts;
+
+    opts.address = "127.0.0.1";
+
+    try {
+        boost::program_options::options_description desc("Options");
+
+        desc.add_options()
+            ("log4cplus_level", boost::program_options::value<std::string>(&logLevel), "Log level")
+            ("address", boost::program_options::value<std::string>(&opts.address), "dmaster address")
+            ("port", boost::program_options::value<int>(&opts.port), "dmaster port")
+            ("ltudp", "LTUDP")
+            ("utp", "UTP")
+            ("nodes", boost::program_options::value<int>(&opts.numNodes), "Number of simulated nodes")
+            ("base_node_id", boost::program_options::value<DTun::UInt32>(&opts.baseNodeId), "First simulated node id")
+            ("connect_rate", boost::program_options::value<int>(&opts.connectRate), "Node connect rate, sessions/s, 0 - as fast as possible")
+            ("max_connecting", boost::program_options::value<int>(&opts.maxConnecting), "Max number of nodes connecting at once")
+            ("rate", boost::program_options::value<int>(&opts.rate), "Rendezvous rate, 1/s")
+            ("duration", boost::program_options::value<int>(&opts.durationSec), "Test duration, s")
+            ("timeout", boost::program_options::value<int>(&opts.timeoutMs), "Rendezvous timeout, ms")
+            ("report_interval", boost::program_options::value<int>(&opts.reportIntervalSec), "Report interval, s")
+            ("no_fast", "Don't open HELLO_FAST sessions, signalling over persistent sessions only")
+            ("no_batch", "Use legacy framing on persistent sessions")
+            ("master_pid", boost::program_options::value<int>(&opts.masterPid), "dmaster pid for CPU/RSS stats, default - look up by name");
+
+        boost::program_options::store(boost::program_options::command_line_parser(
+            argc, argv).options(desc).allow_unregistered().run(), vm);
+
+        boost::program_options::notify(vm);
+
+        ltudp = (vm.count("ltudp") > 0);
+        utp = (vm.count("utp") > 0);
+        opts.fast = (vm.count("no_fast") == 0);
+        opts.batch = (vm.count("no_batch") == 0);
+    } catch (const boost::program_options::error& e) {
+        std::cerr << "Invalid command line arguments: " << e.what() << std::endl;
+        return 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    log4cplus::helpers::Properties props;
+
+    props.setProperty("log4cplus.rootLogger", logLevel +  ", console");
+    props.setProperty("log4cplus.appender.console", "log4cplus::ConsoleAppender");
+    props.setProperty("log4cplus.appender.console.layout", "log4cplus::PatternLayout");
+    props.setProperty("log4cplus.appender.console.layout.ConversionPattern", "%D{%m/%d/%y %H:%M:%S.%q} %-5p %c [%x] - %m%n");
+
+    log4cplus::PropertyConfigurator propConf(props);
+    propConf.configure();
+
+    bool isDebugged = DTun::isDebuggerPresent();
+
+    DTun::SignalBlocker signalBlocker(!isDebugged);
+
+    boost::scoped_ptr<DTun::SignalHandler> sigHandler;
+
+    if (!isDebugged) {
+        sigHandler.reset(new DTun::SignalHandler(&signalHandler));
+    }
+
+    DTun::SysReactor sysReactor;
+
+    if (!sysReactor.start()) {
+        return 1;
+    }
+
+    boost::scoped_ptr<DTun::UDTReactor> udtReactor;
+    boost::scoped_ptr<DTun::SManager> innerRemoteMgr;
+    boost::scoped_ptr<DTun::SManager> remoteMgr;
+
+    if (ltudp) {
+        DTun::LTUDPManager* ltudpMgr;
+        innerRemoteMgr.reset(new DTun::SysManager(sysReactor));
+        remoteMgr.reset(ltudpMgr = new DTun::LTUDPManager(*innerRemoteMgr));
+        if (!ltudpMgr->start()) {
+            return 1;
+        }
+    } else if (utp) {
+        DTun::UTPManager* utpMgr;
+        innerRemoteMgr.reset(new DTun::SysManager(sysReactor));
+        remoteMgr.reset(utpMgr = new DTun::UTPManager(*innerRemoteMgr));
+        if (!utpMgr->start()) {
+            return 1;
+        }
+    } else {
+        udtReactor.reset(new DTun::UDTReactor());
+        if (!udtReactor->start()) {
+            return 1;
+        }
+        remoteMgr.reset(new DTun::UDTManager(*udtReactor));
+    }
+
+    DTun::SysManager localMgr(sysReactor);
+
+    boost::scoped_ptr<Bench> bench(new Bench(*remoteMgr, localMgr, opts));
+
+    if (!bench->start()) {
+        return 1;
+    }
+
+    boost::scoped_ptr<boost::thread> udtReactorThread;
+
+    if (udtReactor) {
+        udtReactorThread.reset(new boost::thread(
+            boost::bind(&udtReactorThreadFn, boost::ref(*udtReactor))));
+    }
+
+    benchReactor = &sysReactor;
+
+    sysReactor.run();
+
+    benchReactor = NULL;
+
+    if (udtReactor) {
+        udtReactor->stop();
+        udtReactorThread->join();
+    }
+
+    bench->report(true);
+
+    bench.reset();
+
+    remoteMgr.reset();
+    innerRemoteMgr.reset();
+    if (udtReactor) {
+        udtReactor->processUpdates();
+    }
+    sysReactor.processUpdates();
+
+    LOG4CPLUS_INFO(logger(), "Done!");
+
+    return 0;
+}
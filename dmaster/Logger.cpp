@@ -2,8 +2,9 @@
 
 namespace DMaster
 {
-    log4cplus::Logger logger()
+    const log4cplus::Logger& logger()
     {
-        return log4cplus::Logger::getInstance("DMaster");
+        static const log4cplus::Logger instance = log4cplus::Logger::getInstance("DMaster");
+        return instance;
     }
 }
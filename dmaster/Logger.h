@@ -7,7 +7,7 @@
 
 namespace DMaster
 {
-    log4cplus::Logger logger();
+    const log4cplus::Logger& logger();
 }
 
 #endif
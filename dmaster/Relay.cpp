@@ -0,0 +1,504 @@
+#include "Relay.h"
+#include "Logger.h"
+#include "DTun/Utils.h"
+#include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+#define RELAY_BATCH_SIZE 32
+#define RELAY_MAX_DGRAM 2048
+#define RELAY_POLL_TIMEOUT_MS 1000
+
+namespace DMaster
+{
+    static bool readRandom(void* buffer, size_t numBytes)
+    {
+        int fd = ::open("/dev/urandom", O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+
+        size_t total = 0;
+
+        while (total < numBytes) {
+            ssize_t res = ::read(fd, (char*)buffer + total, numBytes - total);
+            if (res <= 0) {
+                if ((res == -1) && (errno == EINTR)) {
+                    continue;
+                }
+                ::close(fd);
+                return false;
+            }
+            total += res;
+        }
+
+        ::close(fd);
+
+        return true;
+    }
+
+    Relay::Allocation::~Allocation()
+    {
+        if (sock != SYS_INVALID_SOCKET) {
+            DTun::closeSysSocketChecked(sock);
+        }
+    }
+
+    Relay::Relay(DTun::UInt32 ip, DTun::UInt32 rateLimit, DTun::UInt32 idleTimeoutMs)
+    : ip_(ip)
+    , rateLimit_(rateLimit)
+    , idleTimeoutMs_(idleTimeoutMs)
+    , eid_(-1)
+    , wakeupFd_(-1)
+    , stopping_(false)
+    {
+    }
+
+    Relay::~Relay()
+    {
+        stop();
+    }
+
+    bool Relay::start()
+    {
+        eid_ = ::epoll_create(1);
+        if (eid_ == -1) {
+            LOG4CPLUS_ERROR(logger(), "Cannot create epoll: " << strerror(errno));
+            return false;
+        }
+
+        wakeupFd_ = ::eventfd(0, EFD_NONBLOCK);
+        if (wakeupFd_ == -1) {
+            LOG4CPLUS_ERROR(logger(), "Cannot create eventfd: " << strerror(errno));
+            ::close(eid_);
+            eid_ = -1;
+            return false;
+        }
+
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = wakeupFd_;
+        if (::epoll_ctl(eid_, EPOLL_CTL_ADD, wakeupFd_, &ev) == -1) {
+            LOG4CPLUS_ERROR(logger(), "epoll_ctl(add): " << strerror(errno));
+        }
+
+        thread_.reset(new boost::thread(boost::bind(&Relay::run, this)));
+
+        LOG4CPLUS_INFO(logger(), "Relay is ready, ip = " << DTun::ipToString(ip_)
+            << ", rateLimit = " << rateLimit_ << ", idleTimeoutMs = " << idleTimeoutMs_);
+
+        return true;
+    }
+
+    void Relay::stop()
+    {
+        if (thread_) {
+            {
+                boost::mutex::scoped_lock lock(m_);
+                stopping_ = true;
+            }
+            DTun::UInt64 one = 1;
+            if (::write(wakeupFd_, &one, sizeof(one)) == -1) {
+                LOG4CPLUS_ERROR(logger(), "Cannot wakeup relay thread: " << strerror(errno));
+            }
+            thread_->join();
+            thread_.reset();
+        }
+
+        boost::mutex::scoped_lock lock(m_);
+
+        allocations_.clear();
+        connIds_.clear();
+
+        if (wakeupFd_ != -1) {
+            ::close(wakeupFd_);
+            wakeupFd_ = -1;
+        }
+
+        if (eid_ != -1) {
+            ::close(eid_);
+            eid_ = -1;
+        }
+    }
+
+    DTun::UInt16 Relay::allocate(const DTun::ConnId& connId, DTun::UInt32 nodeId1, DTun::UInt32 nodeId2,
+        DTun::UInt64& token1, DTun::UInt64& token2)
+    {
+        boost::shared_ptr<Allocation> alloc = boost::make_shared<Allocation>();
+
+        DTun::UInt64 tokens[2];
+
+        if (!readRandom(tokens, sizeof(tokens))) {
+            LOG4CPLUS_ERROR(logger(), "Cannot generate relay tokens");
+            return 0;
+        }
+
+        alloc->sock = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+        if (alloc->sock == SYS_INVALID_SOCKET) {
+            LOG4CPLUS_ERROR(logger(), "Cannot create UDP socket: " << strerror(errno));
+            return 0;
+        }
+
+        struct sockaddr_in addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+        if (::bind(alloc->sock, (const struct sockaddr*)&addr, sizeof(addr)) == SYS_SOCKET_ERROR) {
+            LOG4CPLUS_ERROR(logger(), "Cannot bind UDP socket: " << strerror(errno));
+            return 0;
+        }
+
+        socklen_t addrLen = sizeof(addr);
+
+        if (::getsockname(alloc->sock, (struct sockaddr*)&addr, &addrLen) == SYS_SOCKET_ERROR) {
+            LOG4CPLUS_ERROR(logger(), "Cannot get UDP sock name: " << strerror(errno));
+            return 0;
+        }
+
+        alloc->connId = connId;
+        alloc->port = addr.sin_port;
+        alloc->ep[0].nodeId = nodeId1;
+        alloc->ep[0].token = tokens[0];
+        alloc->ep[1].nodeId = nodeId2;
+        alloc->ep[1].token = tokens[1];
+        alloc->created = alloc->lastActivity = boost::chrono::steady_clock::now();
+        for (int i = 0; i < 2; ++i) {
+            alloc->ep[i].tokens = rateLimit_;
+            alloc->ep[i].tokensTime = alloc->created;
+        }
+
+        boost::mutex::scoped_lock lock(m_);
+
+        if (connIds_.count(connId) > 0) {
+            LOG4CPLUS_ERROR(logger(), "relay for connId " << connId << " already exists");
+            return 0;
+        }
+
+        allocations_[alloc->sock] = alloc;
+        connIds_[connId] = alloc->sock;
+
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = alloc->sock;
+        if (::epoll_ctl(eid_, EPOLL_CTL_ADD, alloc->sock, &ev) == -1) {
+            LOG4CPLUS_ERROR(logger(), "epoll_ctl(add): " << strerror(errno));
+            allocations_.erase(alloc->sock);
+            connIds_.erase(connId);
+            return 0;
+        }
+
+        LOG4CPLUS_TRACE(logger(), "Relay::allocate(" << connId << ", " << nodeId1 << ", " << nodeId2
+            << ") = " << DTun::portToString(alloc->port));
+
+        token1 = tokens[0];
+        token2 = tokens[1];
+
+        return alloc->port;
+    }
+
+    void Relay::release(const DTun::ConnId& connId)
+    {
+        boost::mutex::scoped_lock lock(m_);
+
+        ConnIdMap::iterator it = connIds_.find(connId);
+        if (it == connIds_.end()) {
+            return;
+        }
+
+        AllocationMap::iterator jt = allocations_.find(it->second);
+        assert(jt != allocations_.end());
+
+        removeAllocation(jt, "released");
+    }
+
+    std::string Relay::dump()
+    {
+        boost::mutex::scoped_lock lock(m_);
+
+        std::ostringstream os;
+        os << "relays=" << allocations_.size() << ", relayPkts=" << totalStats_.packets
+           << ", relayBytes=" << totalStats_.bytes << ", relayDropped=" << totalStats_.dropped;
+        return os.str();
+    }
+
+    void Relay::run()
+    {
+        log4cplus::NDCContextCreator ndc("Relay");
+
+        std::vector<epoll_event> ev(64);
+
+        boost::chrono::steady_clock::time_point lastIdleCheck =
+            boost::chrono::steady_clock::now();
+
+        while (true) {
+            {
+                boost::mutex::scoped_lock lock(m_);
+                if (stopping_) {
+                    break;
+                }
+            }
+
+            int numReady = ::epoll_wait(eid_, &ev[0], ev.size(), RELAY_POLL_TIMEOUT_MS);
+
+            if ((numReady == -1) && (errno != EINTR)) {
+                LOG4CPLUS_ERROR(logger(), "epoll_wait: " << strerror(errno));
+                break;
+            }
+
+            for (int i = 0; i < numReady; ++i) {
+                if (ev[i].data.fd == wakeupFd_) {
+                    DTun::UInt64 tmp;
+                    if (::read(wakeupFd_, &tmp, sizeof(tmp)) == -1) {}
+                    continue;
+                }
+
+                boost::shared_ptr<Allocation> alloc;
+
+                {
+                    boost::mutex::scoped_lock lock(m_);
+                    AllocationMap::iterator it = allocations_.find(ev[i].data.fd);
+                    if (it != allocations_.end()) {
+                        alloc = it->second;
+                    }
+                }
+
+                if (alloc) {
+                    processAllocation(alloc);
+                }
+            }
+
+            boost::chrono::steady_clock::time_point now =
+                boost::chrono::steady_clock::now();
+
+            if ((now - lastIdleCheck) >= boost::chrono::milliseconds(RELAY_POLL_TIMEOUT_MS)) {
+                lastIdleCheck = now;
+                checkIdle();
+            }
+        }
+    }
+
+    void Relay::processAllocation(const boost::shared_ptr<Allocation>& alloc)
+    {
+        static char bufs[RELAY_BATCH_SIZE][RELAY_MAX_DGRAM];
+
+        struct mmsghdr inMsgs[RELAY_BATCH_SIZE];
+        struct iovec inIovs[RELAY_BATCH_SIZE];
+        struct sockaddr_in inAddrs[RELAY_BATCH_SIZE];
+
+        struct mmsghdr outMsgs[RELAY_BATCH_SIZE];
+        struct iovec outIovs[RELAY_BATCH_SIZE];
+        struct sockaddr_in outAddrs[RELAY_BATCH_SIZE];
+
+        while (true) {
+            memset(inMsgs, 0, sizeof(inMsgs));
+
+            for (int i = 0; i < RELAY_BATCH_SIZE; ++i) {
+                inIovs[i].iov_base = bufs[i];
+                inIovs[i].iov_len = RELAY_MAX_DGRAM;
+                inMsgs[i].msg_hdr.msg_iov = &inIovs[i];
+                inMsgs[i].msg_hdr.msg_iovlen = 1;
+                inMsgs[i].msg_hdr.msg_name = &inAddrs[i];
+                inMsgs[i].msg_hdr.msg_namelen = sizeof(inAddrs[i]);
+            }
+
+            int numRcvd = ::recvmmsg(alloc->sock, inMsgs, RELAY_BATCH_SIZE, 0, NULL);
+
+            if (numRcvd <= 0) {
+                if ((numRcvd == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+                    LOG4CPLUS_ERROR(logger(), "recvmmsg(" << alloc->connId << "): " << strerror(errno));
+                }
+                break;
+            }
+
+            boost::chrono::steady_clock::time_point now =
+                boost::chrono::steady_clock::now();
+
+            int numOut = 0;
+            int numDropped = 0;
+            DTun::UInt64 numBytes = 0;
+
+            boost::mutex::scoped_lock lock(m_);
+
+            for (int i = 0; i < numRcvd; ++i) {
+                int len = inMsgs[i].msg_len;
+                DTun::UInt32 srcIp = inAddrs[i].sin_addr.s_addr;
+                DTun::UInt16 srcPort = inAddrs[i].sin_port;
+
+                DTun::DProtocolRelayBind bindMsg;
+
+                if (len == sizeof(bindMsg)) {
+                    memcpy(&bindMsg, bufs[i], sizeof(bindMsg));
+                    if ((bindMsg.magic == DPROTOCOL_RELAY_MAGIC) &&
+                        (DTun::fromProtocolConnId(bindMsg.connId) == alloc->connId)) {
+                        bool bound = false;
+                        for (int j = 0; j < 2; ++j) {
+                            if ((alloc->ep[j].nodeId == bindMsg.nodeId) && (alloc->ep[j].token == bindMsg.token)) {
+                                if ((alloc->ep[j].ip != srcIp) || (alloc->ep[j].port != srcPort)) {
+                                    LOG4CPLUS_TRACE(logger(), "Relay bind(" << alloc->connId << ", " << bindMsg.nodeId
+                                        << ") = " << DTun::ipPortToString(srcIp, srcPort));
+                                }
+                                alloc->ep[j].ip = srcIp;
+                                alloc->ep[j].port = srcPort;
+                                bound = true;
+                                break;
+                            }
+                        }
+                        if (!bound) {
+                            // bad token, don't ack and don't forward.
+                            ++numDropped;
+                            continue;
+                        }
+                        if ((alloc->ep[0].port != 0) && (alloc->ep[1].port != 0)) {
+                            // both bound, ack.
+                            outIovs[numOut].iov_base = bufs[i];
+                            outIovs[numOut].iov_len = len;
+                            outAddrs[numOut] = inAddrs[i];
+                            ++numOut;
+                        }
+                        alloc->lastActivity = now;
+                        continue;
+                    }
+                }
+
+                int from = -1;
+
+                for (int j = 0; j < 2; ++j) {
+                    if ((alloc->ep[j].ip == srcIp) && (alloc->ep[j].port == srcPort) && (srcPort != 0)) {
+                        from = j;
+                        break;
+                    }
+                }
+
+                if ((from == -1) || (alloc->ep[1 - from].port == 0) ||
+                    !rateAllowed(alloc->ep[from], len, now)) {
+                    if (from != -1) {
+                        ++alloc->ep[from].stats.dropped;
+                    }
+                    ++numDropped;
+                    continue;
+                }
+
+                const Endpoint& to = alloc->ep[1 - from];
+
+                memset(&outAddrs[numOut], 0, sizeof(outAddrs[numOut]));
+                outAddrs[numOut].sin_family = AF_INET;
+                outAddrs[numOut].sin_addr.s_addr = to.ip;
+                outAddrs[numOut].sin_port = to.port;
+                outIovs[numOut].iov_base = bufs[i];
+                outIovs[numOut].iov_len = len;
+                ++numOut;
+
+                ++alloc->ep[from].stats.packets;
+                alloc->ep[from].stats.bytes += len;
+                numBytes += len;
+                alloc->lastActivity = now;
+            }
+
+            totalStats_.packets += numOut;
+            totalStats_.bytes += numBytes;
+            totalStats_.dropped += numDropped;
+
+            lock.unlock();
+
+            memset(outMsgs, 0, sizeof(outMsgs));
+
+            for (int i = 0; i < numOut; ++i) {
+                outMsgs[i].msg_hdr.msg_iov = &outIovs[i];
+                outMsgs[i].msg_hdr.msg_iovlen = 1;
+                outMsgs[i].msg_hdr.msg_name = &outAddrs[i];
+                outMsgs[i].msg_hdr.msg_namelen = sizeof(outAddrs[i]);
+            }
+
+            int numSent = 0;
+
+            while (numSent < numOut) {
+                int res = ::sendmmsg(alloc->sock, &outMsgs[numSent], numOut - numSent, 0);
+                if (res <= 0) {
+                    if ((res == -1) && (errno == EINTR)) {
+                        continue;
+                    }
+                    // UDP, just drop the rest.
+                    LOG4CPLUS_TRACE(logger(), "sendmmsg(" << alloc->connId << "): " << strerror(errno));
+                    break;
+                }
+                numSent += res;
+            }
+
+            if (numRcvd < RELAY_BATCH_SIZE) {
+                break;
+            }
+        }
+    }
+
+    void Relay::checkIdle()
+    {
+        boost::chrono::steady_clock::time_point now =
+            boost::chrono::steady_clock::now();
+
+        boost::mutex::scoped_lock lock(m_);
+
+        for (AllocationMap::iterator it = allocations_.begin(); it != allocations_.end();) {
+            if ((now - it->second->lastActivity) >= boost::chrono::milliseconds(idleTimeoutMs_)) {
+                removeAllocation(it++, "idle");
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    bool Relay::rateAllowed(Endpoint& ep, int numBytes, const boost::chrono::steady_clock::time_point& now)
+    {
+        if (rateLimit_ == 0) {
+            return true;
+        }
+
+        // token bucket with 1 second burst.
+        DTun::UInt64 elapsedUs = boost::chrono::duration_cast<boost::chrono::microseconds>(
+            now - ep.tokensTime).count();
+
+        // bucket is full after a second anyway, don't let the product overflow.
+        elapsedUs = std::min<DTun::UInt64>(elapsedUs, 1000000);
+
+        ep.tokens = std::min<DTun::UInt64>(rateLimit_, ep.tokens + (elapsedUs * rateLimit_) / 1000000);
+        ep.tokensTime = now;
+
+        if (ep.tokens < (DTun::UInt64)numBytes) {
+            return false;
+        }
+
+        ep.tokens -= numBytes;
+
+        return true;
+    }
+
+    void Relay::removeAllocation(AllocationMap::iterator it, const char* reason)
+    {
+        boost::shared_ptr<Allocation> alloc = it->second;
+
+        if (::epoll_ctl(eid_, EPOLL_CTL_DEL, alloc->sock, NULL) == -1) {
+            LOG4CPLUS_ERROR(logger(), "epoll_ctl(del): " << strerror(errno));
+        }
+
+        connIds_.erase(alloc->connId);
+        allocations_.erase(it);
+
+        DTun::UInt64 lifetimeMs = boost::chrono::duration_cast<boost::chrono::milliseconds>(
+            boost::chrono::steady_clock::now() - alloc->created).count();
+
+        LOG4CPLUS_INFO(logger(), "relay " << alloc->connId << " " << reason << " after " << lifetimeMs << "ms"
+            << ", node " << alloc->ep[0].nodeId << " -> " << alloc->ep[1].nodeId << ": "
+            << alloc->ep[0].stats.packets << " pkts/" << alloc->ep[0].stats.bytes << " bytes/" << alloc->ep[0].stats.dropped << " dropped"
+            << ", node " << alloc->ep[1].nodeId << " -> " << alloc->ep[0].nodeId << ": "
+            << alloc->ep[1].stats.packets << " pkts/" << alloc->ep[1].stats.bytes << " bytes/" << alloc->ep[1].stats.dropped << " dropped");
+    }
+}
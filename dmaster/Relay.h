@@ -0,0 +1,123 @@
+#ifndef _RELAY_H_
+#define _RELAY_H_
+
+#include "DTun/DProtocol.h"
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread.hpp>
+#include <boost/chrono.hpp>
+#include <map>
+#include <vector>
+
+namespace DMaster
+{
+    /*
+     * TURN-like UDP relay for peers that cannot hole-punch, i.e. both
+     * behind symmetrical NAT. Every ConnId gets its own UDP port, nodes bind
+     * to it with DProtocolRelayBind datagrams and then everything else is
+     * forwarded between the two bound endpoints as is. Every node gets a random
+     * token via DPROTOCOL_MSG_RELAY, binds without it are ignored, so nobody else
+     * can steal the endpoint. Forwarding runs on its own thread, using
+     * recvmmsg/sendmmsg batches.
+     */
+    class Relay : boost::noncopyable
+    {
+    public:
+        // 'rateLimit' is in bytes/sec per relay and direction, 0 - unlimited.
+        Relay(DTun::UInt32 ip, DTun::UInt32 rateLimit, DTun::UInt32 idleTimeoutMs);
+        ~Relay();
+
+        bool start();
+
+        void stop();
+
+        // returns relay port or 0 on failure, 'token1' and 'token2' are bind tokens
+        // for 'nodeId1' and 'nodeId2'.
+        DTun::UInt16 allocate(const DTun::ConnId& connId, DTun::UInt32 nodeId1, DTun::UInt32 nodeId2,
+            DTun::UInt64& token1, DTun::UInt64& token2);
+
+        void release(const DTun::ConnId& connId);
+
+        inline DTun::UInt32 ip() const { return ip_; }
+
+        std::string dump();
+
+    private:
+        struct Stats
+        {
+            Stats()
+            : packets(0)
+            , bytes(0)
+            , dropped(0) {}
+
+            DTun::UInt64 packets;
+            DTun::UInt64 bytes;
+            DTun::UInt64 dropped;
+        };
+
+        struct Endpoint
+        {
+            Endpoint()
+            : nodeId(0)
+            , token(0)
+            , ip(0)
+            , port(0)
+            , tokens(0) {}
+
+            DTun::UInt32 nodeId;
+            DTun::UInt64 token;
+            DTun::UInt32 ip;
+            DTun::UInt16 port;
+            // rate limiter state for traffic coming from this endpoint
+            DTun::UInt64 tokens;
+            boost::chrono::steady_clock::time_point tokensTime;
+            Stats stats;
+        };
+
+        struct Allocation : boost::noncopyable
+        {
+            Allocation()
+            : sock(SYS_INVALID_SOCKET)
+            , port(0) {}
+            ~Allocation();
+
+            DTun::ConnId connId;
+            SYSSOCKET sock;
+            DTun::UInt16 port;
+            Endpoint ep[2];
+            boost::chrono::steady_clock::time_point created;
+            boost::chrono::steady_clock::time_point lastActivity;
+        };
+
+        typedef std::map<SYSSOCKET, boost::shared_ptr<Allocation> > AllocationMap;
+        typedef std::map<DTun::ConnId, SYSSOCKET> ConnIdMap;
+
+        void run();
+
+        void processAllocation(const boost::shared_ptr<Allocation>& alloc);
+
+        void checkIdle();
+
+        bool rateAllowed(Endpoint& ep, int numBytes, const boost::chrono::steady_clock::time_point& now);
+
+        void removeAllocation(AllocationMap::iterator it, const char* reason);
+
+        DTun::UInt32 ip_;
+        DTun::UInt32 rateLimit_;
+        DTun::UInt32 idleTimeoutMs_;
+
+        int eid_;
+        int wakeupFd_;
+        bool stopping_;
+        boost::scoped_ptr<boost::thread> thread_;
+
+        boost::mutex m_;
+        AllocationMap allocations_;
+        ConnIdMap connIds_;
+        Stats totalStats_;
+    };
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include "DTun/Utils.h"
 #include <boost/make_shared.hpp>
 #include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <sstream>
 #include <unistd.h>
 #include <cstdlib>
@@ -11,10 +12,15 @@
 
 namespace DMaster
 {
-    Server::Server(DTun::SManager& mgr, int port)
+    Server::Server(const Managers& mgrs, int port, Relay* relay)
     : port_(port)
-    , mgr_(mgr)
+    , relay_(relay)
     {
+        assert(!mgrs.empty());
+
+        for (size_t i = 0; i < mgrs.size(); ++i) {
+            shards_.push_back(boost::make_shared<Shard>(boost::ref(*mgrs[i])));
+        }
     }
 
     Server::~Server()
@@ -23,8 +29,10 @@ namespace DMaster
 
     bool Server::start()
     {
-        if (!mgr_.reactor().start()) {
-            return false;
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            if (!shards_[i]->mgr.reactor().start()) {
+                return false;
+            }
         }
 
         addrinfo hints;
@@ -45,57 +53,182 @@ namespace DMaster
             return false;
         }
 
-        boost::shared_ptr<DTun::SHandle> serverHandle = mgr_.createStreamSocket();
-        if (!serverHandle) {
-            freeaddrinfo(res);
-            return false;
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            if (!listen(i, res->ai_addr, res->ai_addrlen)) {
+                freeaddrinfo(res);
+                for (size_t j = 0; j < shards_.size(); ++j) {
+                    shards_[j]->acceptor.reset();
+                }
+                return false;
+            }
+        }
+
+        freeaddrinfo(res);
+
+        LOG4CPLUS_INFO(logger(), "Server is ready at port " << port_ << ", shards = " << shards_.size());
+
+        return true;
+    }
+
+    void Server::run()
+    {
+        std::vector<boost::shared_ptr<boost::thread> > threads;
+
+        for (size_t i = 1; i < shards_.size(); ++i) {
+            threads.push_back(boost::make_shared<boost::thread>(
+                boost::bind(&Server::reactorThreadFn, boost::ref(shards_[i]->mgr.reactor()))));
+        }
+
+        shards_[0]->mgr.reactor().run();
+
+        for (size_t i = 1; i < shards_.size(); ++i) {
+            shards_[i]->mgr.reactor().stop();
+            threads[i - 1]->join();
         }
 
-        if (!serverHandle->bind(res->ai_addr, res->ai_addrlen)) {
-            freeaddrinfo(res);
+        // all reactors are stopped, sessions can go while managers are still alive.
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            Shard& shard = *shards_[i];
+
+            shard.acceptor.reset();
+
+            std::vector<Callback> inbox;
+
+            {
+                boost::mutex::scoped_lock lock(shard.m);
+                inbox.swap(shard.inbox);
+            }
+
+            shard.sessions.clear();
+            shard.persistentSessions.clear();
+            shard.conns.clear();
+            shard.sessionConns.clear();
+        }
+    }
+
+    void Server::stop()
+    {
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            shards_[i]->mgr.reactor().stop();
+        }
+    }
+
+    void Server::reactorThreadFn(DTun::SReactor& reactor)
+    {
+        reactor.run();
+    }
+
+    bool Server::listen(size_t shardIdx, const struct sockaddr* addr, int addrLen)
+    {
+        Shard& shard = *shards_[shardIdx];
+
+        boost::shared_ptr<DTun::SHandle> serverHandle = shard.mgr.createStreamSocket();
+        if (!serverHandle) {
             return false;
         }
 
-        freeaddrinfo(res);
+        if (shards_.size() == 1) {
+            if (!serverHandle->bind(addr, addrLen)) {
+                return false;
+            }
+        } else {
+            SYSSOCKET s = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            if (s == SYS_INVALID_SOCKET) {
+                LOG4CPLUS_ERROR(logger(), "Cannot create UDP socket: " << strerror(errno));
+                return false;
+            }
+
+            int optval = 1;
 
-        acceptor_ = serverHandle->createAcceptor();
+            if ((::setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == SYS_SOCKET_ERROR) ||
+                (::setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == SYS_SOCKET_ERROR)) {
+                LOG4CPLUS_ERROR(logger(), "Cannot set SO_REUSEPORT: " << strerror(errno));
+                DTun::closeSysSocketChecked(s);
+                return false;
+            }
+
+            if (::bind(s, addr, addrLen) == SYS_SOCKET_ERROR) {
+                LOG4CPLUS_ERROR(logger(), "Cannot bind UDP socket: " << strerror(errno));
+                DTun::closeSysSocketChecked(s);
+                return false;
+            }
 
-        if (!acceptor_->listen(10, boost::bind(&Server::onAccept, this, _1))) {
-           acceptor_.reset();
+            if (!serverHandle->bind(s)) {
+                DTun::closeSysSocketChecked(s);
+                return false;
+            }
+        }
+
+        boost::shared_ptr<DTun::SAcceptor> acceptor = serverHandle->createAcceptor();
+
+        if (!acceptor->listen(10, boost::bind(&Server::onAccept, this, shardIdx, _1))) {
            return false;
         }
 
-        LOG4CPLUS_INFO(logger(), "Server is ready at port " << port_);
+        shard.acceptor = acceptor;
 
         return true;
     }
 
-    void Server::run()
+    void Server::send(size_t shardIdx, const Callback& cb)
     {
-        mgr_.reactor().run();
-        acceptor_.reset();
-        sessions_.clear();
-        conns_.clear();
+        if (shards_.size() == 1) {
+            // everything's on one thread, no need to queue.
+            cb();
+            return;
+        }
+
+        Shard& shard = *shards_[shardIdx];
+
+        bool wakeup;
+
+        {
+            boost::mutex::scoped_lock lock(shard.m);
+            wakeup = shard.inbox.empty();
+            shard.inbox.push_back(cb);
+        }
+
+        if (wakeup) {
+            shard.mgr.reactor().post(boost::bind(&Server::onInbox, this, shardIdx));
+        }
     }
 
-    void Server::stop()
+    void Server::broadcast(const boost::function<void (size_t)>& cb)
+    {
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            send(i, boost::bind(cb, i));
+        }
+    }
+
+    void Server::onInbox(size_t shardIdx)
     {
-        mgr_.reactor().stop();
+        Shard& shard = *shards_[shardIdx];
+
+        std::vector<Callback> inbox;
+
+        {
+            boost::mutex::scoped_lock lock(shard.m);
+            inbox.swap(shard.inbox);
+        }
+
+        for (size_t i = 0; i < inbox.size(); ++i) {
+            inbox[i]();
+        }
     }
 
-    void Server::onAccept(const boost::shared_ptr<DTun::SHandle>& handle)
+    void Server::onAccept(size_t shardIdx, const boost::shared_ptr<DTun::SHandle>& handle)
     {
         LOG4CPLUS_TRACE(logger(), "Server::onAccept(" << handle << ")");
 
         boost::shared_ptr<Session> session = boost::make_shared<Session>(handle->createConnection());
 
-        sessions_.insert(session);
-
         session->setStartPersistentCallback(boost::bind(&Server::onSessionStartPersistent, this, boost::weak_ptr<Session>(session)));
         session->setStartFastCallback(boost::bind(&Server::onSessionStartFast, this, boost::weak_ptr<Session>(session), _1));
         session->setStartSymmCallback(boost::bind(&Server::onSessionStartSymm, this, boost::weak_ptr<Session>(session), _1));
         session->setMessageCallback(boost::bind(&Server::onSessionMessage, this, boost::weak_ptr<Session>(session), _1, _2));
-        session->setErrorCallback(boost::bind(&Server::onSessionError, this, boost::weak_ptr<Session>(session), _1));
+        session->setErrorCallback(boost::bind(&Server::onSessionError, this, shardIdx, boost::weak_ptr<Session>(session), _1));
+
+        shards_[shardIdx]->sessions.insert(session);
 
         session->start();
     }
@@ -107,19 +240,7 @@ namespace DMaster
             return;
         }
 
-        for (Sessions::const_iterator it = sessions_.begin(); it != sessions_.end(); ++it) {
-            boost::shared_ptr<Session> other = *it;
-            if ((other->nodeId() == sess_shared->nodeId()) &&
-                (other->type() == Session::TypePersistent) &&
-                (other != sess_shared)) {
-                LOG4CPLUS_WARN(logger(), "new persistent node " << sess_shared->nodeId() << ", overriding");
-                removeSession(other);
-                break;
-            }
-        }
-
-        LOG4CPLUS_INFO(logger(), "client " << DTun::ipPortToString(sess_shared->peerIp(), sess_shared->peerPort())
-            << ", nodeId = " << sess_shared->nodeId() << ", symm = " << sess_shared->isSymm() << " connected");
+        send(homeShard(sess_shared->nodeId()), boost::bind(&Server::onNodeUp, this, sess_shared));
     }
 
     void Server::onSessionStartFast(const boost::weak_ptr<Session>& sess, const DTun::ConnId& connId)
@@ -129,7 +250,16 @@ namespace DMaster
             return;
         }
 
-        onSessionHelloFast(sess_shared, connId);
+        LOG4CPLUS_TRACE(logger(), "Server::onSessionStartFast(" << sess_shared->nodeId() << ", "
+            << connId << ")");
+
+        if (sess_shared->peerIp() == 0) {
+            LOG4CPLUS_ERROR(logger(), "no src peer address, cannot proceed with HelloFast");
+            return;
+        }
+
+        send(homeShard(connId.nodeId), boost::bind(&Server::onHello, this, connId, sess_shared->nodeId(),
+            sess_shared->peerIp(), sess_shared->peerPort(), false));
     }
 
     void Server::onSessionStartSymm(const boost::weak_ptr<Session>& sess, const DTun::ConnId& connId)
@@ -139,7 +269,16 @@ namespace DMaster
             return;
         }
 
-        onSessionHelloSymm(sess_shared, connId);
+        LOG4CPLUS_TRACE(logger(), "Server::onSessionStartSymm(" << sess_shared->nodeId() << ", "
+            << connId << ")");
+
+        if (sess_shared->peerIp() == 0) {
+            LOG4CPLUS_ERROR(logger(), "no src peer address, cannot proceed with HelloSymm");
+            return;
+        }
+
+        send(homeShard(connId.nodeId), boost::bind(&Server::onHello, this, connId, sess_shared->nodeId(),
+            sess_shared->peerIp(), sess_shared->peerPort(), true));
     }
 
     void Server::onSessionMessage(const boost::weak_ptr<Session>& sess, DTun::UInt8 msgCode, const void* msg)
@@ -152,23 +291,29 @@ namespace DMaster
         switch (msgCode) {
         case DPROTOCOL_MSG_CONN_CREATE: {
             const DTun::DProtocolMsgConnCreate* msgConnCreate = (const DTun::DProtocolMsgConnCreate*)msg;
-            onSessionConnCreate(sess_shared, DTun::fromProtocolConnId(msgConnCreate->connId), msgConnCreate->dstNodeId,
-                msgConnCreate->remoteIp, msgConnCreate->remotePort, msgConnCreate->bestEffort);
+            DTun::ConnId connId = DTun::fromProtocolConnId(msgConnCreate->connId);
+            send(homeShard(connId.nodeId), boost::bind(&Server::onConnCreate, this, sess_shared, connId,
+                (DTun::UInt32)msgConnCreate->dstNodeId, (DTun::UInt32)msgConnCreate->remoteIp,
+                (DTun::UInt16)msgConnCreate->remotePort, (DTun::UInt8)msgConnCreate->flags));
             break;
         }
         case DPROTOCOL_MSG_CONN_CLOSE: {
             const DTun::DProtocolMsgConnClose* msgConnClose = (const DTun::DProtocolMsgConnClose*)msg;
-            onSessionConnClose(sess_shared, DTun::fromProtocolConnId(msgConnClose->connId), msgConnClose->established);
+            DTun::ConnId connId = DTun::fromProtocolConnId(msgConnClose->connId);
+            send(homeShard(connId.nodeId), boost::bind(&Server::onConnClose, this, sess_shared, connId,
+                (bool)msgConnClose->established));
             break;
         }
         case DPROTOCOL_MSG_READY: {
             const DTun::DProtocolMsgReady* msgReady = (const DTun::DProtocolMsgReady*)msg;
-            onSessionReady(sess_shared, DTun::fromProtocolConnId(msgReady->connId));
+            DTun::ConnId connId = DTun::fromProtocolConnId(msgReady->connId);
+            send(homeShard(connId.nodeId), boost::bind(&Server::onConnReady, this, sess_shared, connId));
             break;
         }
         case DPROTOCOL_MSG_NEXT: {
             const DTun::DProtocolMsgNext* msgNext = (const DTun::DProtocolMsgNext*)msg;
-            onSessionNext(sess_shared, DTun::fromProtocolConnId(msgNext->connId));
+            DTun::ConnId connId = DTun::fromProtocolConnId(msgNext->connId);
+            send(homeShard(connId.nodeId), boost::bind(&Server::onConnNext, this, sess_shared, connId));
             break;
         }
         default:
@@ -177,7 +322,7 @@ namespace DMaster
         }
     }
 
-    void Server::onSessionError(const boost::weak_ptr<Session>& sess, int errCode)
+    void Server::onSessionError(size_t shardIdx, const boost::weak_ptr<Session>& sess, int errCode)
     {
         boost::shared_ptr<Session> sess_shared = sess.lock();
         if (!sess_shared) {
@@ -186,85 +331,107 @@ namespace DMaster
 
         LOG4CPLUS_TRACE(logger(), "Server::onSessionError(" << sess_shared->nodeId() << ", " << errCode << ")");
 
+        shards_[shardIdx]->sessions.erase(sess_shared);
+
         if (sess_shared->type() == Session::TypePersistent) {
             LOG4CPLUS_INFO(logger(), "client " << DTun::ipPortToString(sess_shared->peerIp(), sess_shared->peerPort())
                 << ", nodeId = " << sess_shared->nodeId() << " disconnected");
+            send(homeShard(sess_shared->nodeId()), boost::bind(&Server::onNodeDown, this, sess_shared));
         }
-
-        removeSession(sess_shared);
     }
 
-    void Server::onSessionHelloFast(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId)
+    void Server::onNodeUp(const boost::shared_ptr<Session>& sess)
     {
-        LOG4CPLUS_TRACE(logger(), "Server::onSessionHelloFast(" << sess->nodeId() << ", "
-            << connId << ")");
+        Shard& shard = *shards_[homeShard(sess->nodeId())];
 
-        if (sess->peerIp() == 0) {
-            LOG4CPLUS_ERROR(logger(), "no src peer address, cannot proceed with HelloFast");
-            return;
-        }
+        boost::shared_ptr<Session>& entry = shard.persistentSessions[sess->nodeId()];
 
-        boost::shared_ptr<Session> pSess = findPersistentSession(sess->nodeId());
+        boost::shared_ptr<Session> other = entry;
 
-        if (!pSess) {
-            LOG4CPLUS_ERROR(logger(), "persistent session not found for nodeId = " << sess->nodeId());
-            return;
+        entry = sess;
+
+        if (other && (other != sess)) {
+            LOG4CPLUS_WARN(logger(), "new persistent node " << sess->nodeId() << ", overriding");
+            broadcast(boost::bind(&Server::onSessionGone, this, _1, other));
         }
 
-        ConnMap::iterator it = conns_.find(connId);
-        if (it == conns_.end()) {
-            LOG4CPLUS_TRACE(logger(), "connId = " << connId << " not found");
+        LOG4CPLUS_INFO(logger(), "client " << DTun::ipPortToString(sess->peerIp(), sess->peerPort())
+            << ", nodeId = " << sess->nodeId() << ", symm = " << sess->isSymm()
+            << ", batched = " << sess->isBatched() << " connected");
+    }
+
+    void Server::onNodeDown(const boost::shared_ptr<Session>& sess)
+    {
+        Shard& shard = *shards_[homeShard(sess->nodeId())];
+
+        NodeMap::iterator it = shard.persistentSessions.find(sess->nodeId());
+        if ((it == shard.persistentSessions.end()) || (it->second != sess)) {
+            // already overridden, conns are gone already.
             return;
         }
 
-        if (pSess == it->second.srcSess) {
-            it->second.dstSess->sendFast(connId, sess->peerIp(), sess->peerPort());
-        } else if (pSess == it->second.dstSess) {
-            it->second.srcSess->sendFast(connId, sess->peerIp(), sess->peerPort());
-        } else {
-            LOG4CPLUS_ERROR(logger(), "cannot send fast for connId = " << connId << ", not allowed");
-        }
+        shard.persistentSessions.erase(it);
+
+        // after this no shard can find 'sess' anymore, lookups sent before it
+        // are answered before this, so conns can't pick it up later.
+        broadcast(boost::bind(&Server::onSessionGone, this, _1, sess));
     }
 
-    void Server::onSessionHelloSymm(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId)
+    void Server::onNodeLookup(const DTun::ConnId& connId,
+        DTun::UInt32 dstNodeId,
+        DTun::UInt32 remoteIp,
+        DTun::UInt16 remotePort,
+        DTun::UInt8 flags)
     {
-        LOG4CPLUS_TRACE(logger(), "Server::onSessionHelloSymm(" << sess->nodeId() << ", "
-            << connId << ")");
+        Shard& shard = *shards_[homeShard(dstNodeId)];
 
-        if (sess->peerIp() == 0) {
-            LOG4CPLUS_ERROR(logger(), "no src peer address, cannot proceed with HelloSymm");
-            return;
+        boost::shared_ptr<Session> dstSess;
+
+        NodeMap::const_iterator it = shard.persistentSessions.find(dstNodeId);
+        if (it != shard.persistentSessions.end()) {
+            dstSess = it->second;
         }
 
-        boost::shared_ptr<Session> pSess = findPersistentSession(sess->nodeId());
+        send(homeShard(connId.nodeId), boost::bind(&Server::onConnCreateLookup, this, connId, dstSess,
+            remoteIp, remotePort, flags));
+    }
+
+    void Server::onHello(const DTun::ConnId& connId, DTun::UInt32 nodeId,
+        DTun::UInt32 peerIp, DTun::UInt16 peerPort, bool symm)
+    {
+        Shard& shard = *shards_[homeShard(connId.nodeId)];
 
-        if (!pSess) {
-            LOG4CPLUS_ERROR(logger(), "persistent session not found for nodeId = " << sess->nodeId());
+        ConnMap::iterator it = shard.conns.find(connId);
+        if ((it == shard.conns.end()) || !it->second.dstSess) {
+            LOG4CPLUS_TRACE(logger(), "connId = " << connId << " not found");
             return;
         }
 
-        ConnMap::iterator it = conns_.find(connId);
-        if (it == conns_.end()) {
-            LOG4CPLUS_TRACE(logger(), "connId = " << connId << " not found");
+        boost::shared_ptr<Session> other;
+
+        if (it->second.srcSess->nodeId() == nodeId) {
+            other = it->second.dstSess;
+        } else if (it->second.dstSess->nodeId() == nodeId) {
+            other = it->second.srcSess;
+        } else {
+            LOG4CPLUS_ERROR(logger(), "cannot send " << (symm ? "symm" : "fast") << " for connId = " << connId << ", not allowed");
             return;
         }
 
-        if (pSess == it->second.srcSess) {
-            it->second.dstSess->sendSymm(connId, sess->peerIp(), sess->peerPort());
-        } else if (pSess == it->second.dstSess) {
-            it->second.srcSess->sendSymm(connId, sess->peerIp(), sess->peerPort());
+        if (symm) {
+            other->sendSymm(connId, peerIp, peerPort);
         } else {
-            LOG4CPLUS_ERROR(logger(), "cannot send symm for connId = " << connId << ", not allowed");
+            other->sendFast(connId, peerIp, peerPort);
         }
     }
 
-    void Server::onSessionConnCreate(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId,
+    void Server::onConnCreate(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId,
         DTun::UInt32 dstNodeId,
         DTun::UInt32 remoteIp,
         DTun::UInt16 remotePort,
-        bool bestEffort)
+        DTun::UInt8 flags)
     {
-        LOG4CPLUS_TRACE(logger(), "Server::onSessionConnCreate(" << sess->nodeId() << ", "
+        LOG4CPLUS_TRACE(logger(), "Server::onConnCreate(" << sess->nodeId() << ", "
             << connId << ", " << dstNodeId << ", " << DTun::ipPortToString(remoteIp, remotePort) << ")");
 
         if (sess->nodeId() != connId.nodeId) {
@@ -285,37 +452,74 @@ namespace DMaster
             return;
         }
 
-        if (conns_.count(connId) > 0) {
+        Shard& shard = *shards_[homeShard(connId.nodeId)];
+
+        if (shard.conns.count(connId) > 0) {
             LOG4CPLUS_ERROR(logger(), "connId " << connId << " already exists");
             sess->sendConnStatus(connId, DPROTOCOL_STATUS_ERR_UNKNOWN);
             return;
         }
 
-        boost::shared_ptr<Session> dstSess = findPersistentSession(dstNodeId);
+        // reserve connId until dst node is looked up on its home shard.
+        addConn(shard, connId, Conn(sess, boost::shared_ptr<Session>(),
+            DPROTOCOL_RMODE_FAST, DPROTOCOL_RMODE_FAST, 0, 0, 0));
+
+        send(homeShard(dstNodeId), boost::bind(&Server::onNodeLookup, this, connId, dstNodeId,
+            remoteIp, remotePort, flags));
+    }
+
+    void Server::onConnCreateLookup(const DTun::ConnId& connId,
+        const boost::shared_ptr<Session>& dstSess,
+        DTun::UInt32 remoteIp,
+        DTun::UInt16 remotePort,
+        DTun::UInt8 flags)
+    {
+        Shard& shard = *shards_[homeShard(connId.nodeId)];
+
+        ConnMap::iterator it = shard.conns.find(connId);
+        if ((it == shard.conns.end()) || it->second.dstSess) {
+            // src closed it or went away while we were looking up.
+            return;
+        }
+
+        boost::shared_ptr<Session> sess = it->second.srcSess;
 
         if (!dstSess) {
-            LOG4CPLUS_ERROR(logger(), "persistent dest session not found for dstNodeId = "
-                << dstNodeId << ", addr = " << DTun::ipPortToString(remoteIp, remotePort));
+            LOG4CPLUS_ERROR(logger(), "persistent dest session not found for connId = "
+                << connId << ", addr = " << DTun::ipPortToString(remoteIp, remotePort));
             sess->sendConnStatus(connId, DPROTOCOL_STATUS_ERR_NOTFOUND);
+            eraseConn(shard, it);
             return;
         }
 
         if (dstSess->peerIp() == 0) {
             LOG4CPLUS_ERROR(logger(), "no dst peer address, cannot proceed with ConnCreate");
             sess->sendConnStatus(connId, DPROTOCOL_STATUS_ERR_UNKNOWN);
-            return;
-        }
-
-        if (sess->isSymm() && dstSess->isSymm()) {
-            LOG4CPLUS_ERROR(logger(), "both peers behind symmetrical NAT, cannot proceed");
-            sess->sendConnStatus(connId, DPROTOCOL_STATUS_ERR_SYMM);
+            eraseConn(shard, it);
             return;
         }
 
         DTun::UInt8 srcMode = DPROTOCOL_RMODE_FAST;
         DTun::UInt8 dstMode = DPROTOCOL_RMODE_FAST;
+        DTun::UInt16 relayPort = 0;
+        DTun::UInt64 srcRelayToken = 0;
+        DTun::UInt64 dstRelayToken = 0;
 
-        if (sess->isSymm() || dstSess->isSymm()) {
+        if (sess->isSymm() && dstSess->isSymm()) {
+            if (relay_) {
+                relayPort = relay_->allocate(connId, sess->nodeId(), dstSess->nodeId(), srcRelayToken, dstRelayToken);
+            }
+            if (!relayPort) {
+                LOG4CPLUS_ERROR(logger(), "both peers behind symmetrical NAT, cannot proceed");
+                sess->sendConnStatus(connId, DPROTOCOL_STATUS_ERR_SYMM);
+                eraseConn(shard, it);
+                return;
+            }
+            LOG4CPLUS_TRACE(logger(), "both peers behind symmetrical NAT, relaying " << connId
+                << " via port " << DTun::portToString(relayPort));
+            srcMode = DPROTOCOL_RMODE_RELAY;
+            dstMode = DPROTOCOL_RMODE_RELAY;
+        } else if (sess->isSymm() || dstSess->isSymm()) {
             if (sess->isSymm()) {
                 srcMode = DPROTOCOL_RMODE_SYMM_CONN;
                 dstMode = DPROTOCOL_RMODE_SYMM_ACC;
@@ -325,20 +529,23 @@ namespace DMaster
             }
         }
 
-        conns_[connId] = Conn(sess, dstSess, srcMode, dstMode);
+        eraseConn(shard, it);
+        addConn(shard, connId, Conn(sess, dstSess, srcMode, dstMode, relayPort, srcRelayToken, dstRelayToken));
 
         sess->sendConnStatus(connId, DPROTOCOL_STATUS_PENDING, srcMode, dstSess->peerIp());
 
-        dstSess->sendConnRequest(connId, remoteIp, remotePort, dstMode, sess->peerIp(), bestEffort);
+        dstSess->sendConnRequest(connId, remoteIp, remotePort, dstMode, sess->peerIp(), flags);
     }
 
-    void Server::onSessionConnClose(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId, bool established)
+    void Server::onConnClose(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId, bool established)
     {
-        LOG4CPLUS_TRACE(logger(), "Server::onSessionConnClose(" << sess->nodeId() << ", "
+        LOG4CPLUS_TRACE(logger(), "Server::onConnClose(" << sess->nodeId() << ", "
             << connId << ", " << established << ")");
 
-        ConnMap::iterator it = conns_.find(connId);
-        if (it == conns_.end()) {
+        Shard& shard = *shards_[homeShard(connId.nodeId)];
+
+        ConnMap::iterator it = shard.conns.find(connId);
+        if (it == shard.conns.end()) {
             LOG4CPLUS_TRACE(logger(), "connId = " << connId << " not found");
             return;
         }
@@ -346,28 +553,49 @@ namespace DMaster
         DTun::UInt8 statusCode = established ? DPROTOCOL_STATUS_ESTABLISHED : DPROTOCOL_STATUS_ERR_CANCELED;
 
         if (sess == it->second.srcSess) {
-            it->second.dstSess->sendConnStatus(connId, statusCode, it->second.dstMode);
-        } else if (sess == it->second.dstSess) {
+            if (it->second.dstSess) {
+                it->second.dstSess->sendConnStatus(connId, statusCode, it->second.dstMode);
+            }
+        } else if (it->second.dstSess && (sess == it->second.dstSess)) {
             it->second.srcSess->sendConnStatus(connId, statusCode, it->second.srcMode);
         } else {
             LOG4CPLUS_ERROR(logger(), "cannot close connId = " << connId << ", not allowed");
             return;
         }
 
-        conns_.erase(it);
+        if (it->second.relayPort && !established) {
+            // established relays live until they become idle.
+            relay_->release(connId);
+        }
+
+        eraseConn(shard, it);
     }
 
-    void Server::onSessionReady(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId)
+    void Server::onConnReady(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId)
     {
-        LOG4CPLUS_TRACE(logger(), "Server::onSessionReady(" << sess->nodeId() << ", "
+        LOG4CPLUS_TRACE(logger(), "Server::onConnReady(" << sess->nodeId() << ", "
             << connId << ")");
 
-        ConnMap::iterator it = conns_.find(connId);
-        if (it == conns_.end()) {
+        Shard& shard = *shards_[homeShard(connId.nodeId)];
+
+        ConnMap::iterator it = shard.conns.find(connId);
+        if ((it == shard.conns.end()) || !it->second.dstSess) {
             LOG4CPLUS_TRACE(logger(), "connId = " << connId << " not found");
             return;
         }
 
+        if (it->second.relayPort) {
+            // relay mode, peers don't talk to each other, just tell where the relay is.
+            if (sess == it->second.srcSess) {
+                sess->sendRelay(connId, relay_->ip(), it->second.relayPort, it->second.srcRelayToken);
+            } else if (sess == it->second.dstSess) {
+                sess->sendRelay(connId, relay_->ip(), it->second.relayPort, it->second.dstRelayToken);
+            } else {
+                LOG4CPLUS_ERROR(logger(), "cannot Ready connId = " << connId << ", not allowed");
+            }
+            return;
+        }
+
         if (sess == it->second.srcSess) {
             it->second.dstSess->sendReady(connId);
         } else if (sess == it->second.dstSess) {
@@ -378,13 +606,15 @@ namespace DMaster
         }
     }
 
-    void Server::onSessionNext(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId)
+    void Server::onConnNext(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId)
     {
-        LOG4CPLUS_TRACE(logger(), "Server::onSessionNext(" << sess->nodeId() << ", "
+        LOG4CPLUS_TRACE(logger(), "Server::onConnNext(" << sess->nodeId() << ", "
             << connId << ")");
 
-        ConnMap::iterator it = conns_.find(connId);
-        if (it == conns_.end()) {
+        Shard& shard = *shards_[homeShard(connId.nodeId)];
+
+        ConnMap::iterator it = shard.conns.find(connId);
+        if ((it == shard.conns.end()) || !it->second.dstSess) {
             LOG4CPLUS_TRACE(logger(), "connId = " << connId << " not found");
             return;
         }
@@ -399,36 +629,67 @@ namespace DMaster
         }
     }
 
-    boost::shared_ptr<Session> Server::findPersistentSession(DTun::UInt32 nodeId) const
+    void Server::onSessionGone(size_t shardIdx, const boost::shared_ptr<Session>& sess)
     {
-        for (Sessions::const_iterator it = sessions_.begin(); it != sessions_.end(); ++it) {
-            boost::shared_ptr<Session> other = *it;
-            if ((other->nodeId() == nodeId) &&
-                (other->type() == Session::TypePersistent)) {
-                return other;
+        Shard& shard = *shards_[shardIdx];
+
+        SessionConnMap::iterator jt = shard.sessionConns.find(sess);
+        if (jt != shard.sessionConns.end()) {
+            std::set<DTun::ConnId> connIds;
+            connIds.swap(jt->second);
+            shard.sessionConns.erase(jt);
+
+            for (std::set<DTun::ConnId>::const_iterator kt = connIds.begin(); kt != connIds.end(); ++kt) {
+                ConnMap::iterator it = shard.conns.find(*kt);
+                if (it == shard.conns.end()) {
+                    continue;
+                }
+                if (it->second.srcSess == sess) {
+                    if (it->second.dstSess) {
+                        it->second.dstSess->sendConnStatus(it->first,
+                            DPROTOCOL_STATUS_ERR_CANCELED, it->second.dstMode);
+                    }
+                } else {
+                    it->second.srcSess->sendConnStatus(it->first,
+                        DPROTOCOL_STATUS_ERR_CANCELED, it->second.srcMode);
+                }
+                if (it->second.relayPort) {
+                    relay_->release(it->first);
+                }
+                eraseConn(shard, it);
             }
         }
-        return boost::shared_ptr<Session>();
+
+        // overridden persistent sessions are dropped here, by the shard that accepted them.
+        shard.sessions.erase(sess);
     }
 
-    void Server::removeSession(const boost::shared_ptr<Session>& sess)
+    void Server::addConn(Shard& shard, const DTun::ConnId& connId, const Conn& conn)
     {
-        if (sess->type() == Session::TypePersistent) {
-            for (ConnMap::iterator it = conns_.begin(); it != conns_.end();) {
-                if (it->second.srcSess == sess) {
-                    it->second.dstSess->sendConnStatus(it->first,
-                        DPROTOCOL_STATUS_ERR_CANCELED, it->second.dstMode);
-                    conns_.erase(it++);
-                } else if (it->second.dstSess == sess) {
-                    it->second.srcSess->sendConnStatus(it->first,
-                        DPROTOCOL_STATUS_ERR_CANCELED, it->second.srcMode);
-                    conns_.erase(it++);
-                } else {
-                    ++it;
+        shard.conns[connId] = conn;
+        shard.sessionConns[conn.srcSess].insert(connId);
+        if (conn.dstSess) {
+            shard.sessionConns[conn.dstSess].insert(connId);
+        }
+    }
+
+    void Server::eraseConn(Shard& shard, ConnMap::iterator it)
+    {
+        const boost::shared_ptr<Session>* sessions[2] = { &it->second.srcSess, &it->second.dstSess };
+
+        for (int i = 0; i < 2; ++i) {
+            if (!*sessions[i]) {
+                continue;
+            }
+            SessionConnMap::iterator jt = shard.sessionConns.find(*sessions[i]);
+            if (jt != shard.sessionConns.end()) {
+                jt->second.erase(it->first);
+                if (jt->second.empty()) {
+                    shard.sessionConns.erase(jt);
                 }
             }
         }
 
-        sessions_.erase(sess);
+        shard.conns.erase(it);
     }
 }
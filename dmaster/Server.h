@@ -2,18 +2,31 @@
 #define _SERVER_H_
 
 #include "Session.h"
+#include "Relay.h"
 #include "DTun/SManager.h"
 #include "DTun/SAcceptor.h"
 #include <boost/noncopyable.hpp>
 #include <boost/weak_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/function.hpp>
 #include <set>
+#include <vector>
 
 namespace DMaster
 {
     class Server : boost::noncopyable
     {
     public:
-        explicit Server(DTun::SManager& mgr, int port);
+        typedef std::vector<DTun::SManager*> Managers;
+
+        /*
+         * Each manager is a shard with its own reactor thread, all shards listen
+         * on 'port' with SO_REUSEPORT, so kernel spreads nodes over them.
+         * 'relay' can be NULL, in which case peers behind symmetrical NATs cannot connect.
+         */
+        Server(const Managers& mgrs, int port, Relay* relay);
         ~Server();
 
         bool start();
@@ -27,27 +40,83 @@ namespace DMaster
         {
             Conn()
             : srcMode(DPROTOCOL_RMODE_FAST)
-            , dstMode(DPROTOCOL_RMODE_FAST) {}
+            , dstMode(DPROTOCOL_RMODE_FAST)
+            , relayPort(0)
+            , srcRelayToken(0)
+            , dstRelayToken(0) {}
 
             Conn(const boost::shared_ptr<Session>& srcSess,
                 const boost::shared_ptr<Session>& dstSess,
                 DTun::UInt8 srcMode,
-                DTun::UInt8 dstMode)
+                DTun::UInt8 dstMode,
+                DTun::UInt16 relayPort,
+                DTun::UInt64 srcRelayToken,
+                DTun::UInt64 dstRelayToken)
             : srcSess(srcSess)
             , dstSess(dstSess)
             , srcMode(srcMode)
-            , dstMode(dstMode) {}
+            , dstMode(dstMode)
+            , relayPort(relayPort)
+            , srcRelayToken(srcRelayToken)
+            , dstRelayToken(dstRelayToken) {}
 
             boost::shared_ptr<Session> srcSess;
             boost::shared_ptr<Session> dstSess;
             DTun::UInt8 srcMode;
             DTun::UInt8 dstMode;
+            DTun::UInt16 relayPort;
+            DTun::UInt64 srcRelayToken;
+            DTun::UInt64 dstRelayToken;
         };
 
-        typedef std::map<DTun::ConnId, Conn> ConnMap;
-        typedef std::set<boost::shared_ptr<Session> > Sessions;
+        typedef boost::unordered_map<DTun::ConnId, Conn> ConnMap;
+        typedef boost::unordered_set<boost::shared_ptr<Session> > Sessions;
+        typedef boost::unordered_map<DTun::UInt32, boost::shared_ptr<Session> > NodeMap;
+        typedef boost::unordered_map<boost::shared_ptr<Session>, std::set<DTun::ConnId> > SessionConnMap;
+        typedef boost::function<void ()> Callback;
+
+        /*
+         * Shard state is only touched from the shard's reactor thread, other shards
+         * talk to it through 'inbox'. A node is homed at shard nodeId % numShards,
+         * that shard has its persistent session in 'persistentSessions' and owns
+         * all conns the node creates, so everything about a conn is handled on
+         * one thread. Sessions themselves live on the shard that accepted them.
+         */
+        struct Shard : boost::noncopyable
+        {
+            explicit Shard(DTun::SManager& mgr)
+            : mgr(mgr) {}
+
+            DTun::SManager& mgr;
+            boost::shared_ptr<DTun::SAcceptor> acceptor;
+
+            boost::mutex m;
+            std::vector<Callback> inbox;
+
+            Sessions sessions;
+            NodeMap persistentSessions;
+            ConnMap conns;
+            SessionConnMap sessionConns;
+        };
+
+        typedef std::vector<boost::shared_ptr<Shard> > Shards;
+
+        static void reactorThreadFn(DTun::SReactor& reactor);
+
+        bool listen(size_t shardIdx, const struct sockaddr* addr, int addrLen);
+
+        inline size_t homeShard(DTun::UInt32 nodeId) const { return nodeId % shards_.size(); }
+
+        // runs 'cb' on shard's thread, in order with everything else sent from this thread.
+        void send(size_t shardIdx, const Callback& cb);
+
+        void broadcast(const boost::function<void (size_t)>& cb);
+
+        void onInbox(size_t shardIdx);
+
+        void onAccept(size_t shardIdx, const boost::shared_ptr<DTun::SHandle>& handle);
 
-        void onAccept(const boost::shared_ptr<DTun::SHandle>& handle);
+        // accepting shard, session callbacks.
 
         void onSessionStartPersistent(const boost::weak_ptr<Session>& sess);
 
@@ -57,33 +126,54 @@ namespace DMaster
 
         void onSessionMessage(const boost::weak_ptr<Session>& sess, DTun::UInt8 msgCode, const void* msg);
 
-        void onSessionError(const boost::weak_ptr<Session>& sess, int errCode);
+        void onSessionError(size_t shardIdx, const boost::weak_ptr<Session>& sess, int errCode);
 
-        void onSessionHelloFast(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId);
+        // node's home shard.
 
-        void onSessionHelloSymm(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId);
+        void onNodeUp(const boost::shared_ptr<Session>& sess);
 
-        void onSessionConnCreate(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId,
+        void onNodeDown(const boost::shared_ptr<Session>& sess);
+
+        void onNodeLookup(const DTun::ConnId& connId,
+            DTun::UInt32 dstNodeId,
+            DTun::UInt32 remoteIp,
+            DTun::UInt16 remotePort,
+            DTun::UInt8 flags);
+
+        // conn's shard, i.e. home shard of connId.nodeId.
+
+        void onHello(const DTun::ConnId& connId, DTun::UInt32 nodeId,
+            DTun::UInt32 peerIp, DTun::UInt16 peerPort, bool symm);
+
+        void onConnCreate(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId,
             DTun::UInt32 dstNodeId,
             DTun::UInt32 remoteIp,
             DTun::UInt16 remotePort,
-            bool bestEffort);
+            DTun::UInt8 flags);
+
+        void onConnCreateLookup(const DTun::ConnId& connId,
+            const boost::shared_ptr<Session>& dstSess,
+            DTun::UInt32 remoteIp,
+            DTun::UInt16 remotePort,
+            DTun::UInt8 flags);
+
+        void onConnClose(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId, bool established);
+
+        void onConnReady(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId);
 
-        void onSessionConnClose(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId, bool established);
+        void onConnNext(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId);
 
-        void onSessionReady(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId);
+        // every shard.
 
-        void onSessionNext(const boost::shared_ptr<Session>& sess, const DTun::ConnId& connId);
+        void onSessionGone(size_t shardIdx, const boost::shared_ptr<Session>& sess);
 
-        boost::shared_ptr<Session> findPersistentSession(DTun::UInt32 nodeId) const;
+        void addConn(Shard& shard, const DTun::ConnId& connId, const Conn& conn);
 
-        void removeSession(const boost::shared_ptr<Session>& sess);
+        void eraseConn(Shard& shard, ConnMap::iterator it);
 
         int port_;
-        DTun::SManager& mgr_;
-        ConnMap conns_;
-        Sessions sessions_;
-        boost::shared_ptr<DTun::SAcceptor> acceptor_;
+        Relay* relay_;
+        Shards shards_;
     };
 }
 
@@ -9,8 +9,12 @@ namespace DMaster
     : type_(TypeUnknown)
     , nodeId_(0)
     , symm_(false)
-    , conn_(conn)
+    , batched_(false)
+    , conn_(boost::make_shared<DTun::DProtocolConnection>(conn))
     {
+        conn_->setMessageCallback(boost::bind(&Session::onMsg, this, _1, _2, _3));
+        conn_->setErrorCallback(boost::bind(&Session::onError, this, _1));
+
         // Another UDT crap, if we do this later after receiving
         // HELLO we might run into situation when UDT library implicitly closes
         // our socket and doesn't allow us to query for peer address...
@@ -22,11 +26,12 @@ namespace DMaster
 
     Session::~Session()
     {
+        conn_->close();
     }
 
     void Session::start()
     {
-        startRecvHeader();
+        conn_->start();
     }
 
     void Session::sendConnRequest(const DTun::ConnId& connId,
@@ -34,7 +39,7 @@ namespace DMaster
         DTun::UInt16 port,
         DTun::UInt8 mode,
         DTun::UInt32 srcIp,
-        bool bestEffort)
+        DTun::UInt8 flags)
     {
         DTun::DProtocolMsgConn msg;
 
@@ -43,7 +48,7 @@ namespace DMaster
         msg.port = port;
         msg.mode = mode;
         msg.srcIp = srcIp;
-        msg.bestEffort = bestEffort;
+        msg.flags = flags;
 
         sendMsg(DPROTOCOL_MSG_CONN, &msg, sizeof(msg));
     }
@@ -107,81 +112,65 @@ namespace DMaster
         sendMsg(DPROTOCOL_MSG_READY, &msg, sizeof(msg));
     }
 
-    void Session::onSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff)
+    void Session::sendRelay(const DTun::ConnId& connId,
+        DTun::UInt32 relayIp,
+        DTun::UInt16 relayPort,
+        DTun::UInt64 token)
     {
-        LOG4CPLUS_TRACE(logger(), "Session::onSend(" << err << ")");
+        DTun::DProtocolMsgRelay msg;
 
-        if (err) {
-            if (errorCallback_) {
-                errorCallback_(err);
-            }
-            return;
-        }
+        msg.connId = DTun::toProtocolConnId(connId);
+        msg.relayIp = relayIp;
+        msg.relayPort = relayPort;
+        msg.token = token;
+
+        sendMsg(DPROTOCOL_MSG_RELAY, &msg, sizeof(msg));
     }
 
-    void Session::onRecvHeader(int err, int numBytes)
+    void Session::onMsg(DTun::UInt8 msgCode, const char* msg, int msgSize)
     {
-        LOG4CPLUS_TRACE(logger(), "Session::onRecvHeader(" << err << ", " << numBytes << ")");
-
-        if (err) {
-            if (errorCallback_) {
-                errorCallback_(err);
-            }
-            return;
-        }
-
-        DTun::DProtocolHeader header;
-        assert(numBytes == sizeof(header));
-        memcpy(&header, &buff_[0], numBytes);
+        LOG4CPLUS_TRACE(logger(), "Session::onMsg(" << (int)msgCode << ", " << msgSize << ")");
 
-        switch (header.msgCode) {
-        case DPROTOCOL_MSG_HELLO:
-            buff_.resize(sizeof(DTun::DProtocolMsgHello));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&Session::onRecvMsgHello, this, _1, _2),
-                true);
+        switch (msgCode) {
+        case DPROTOCOL_MSG_HELLO_BATCH:
+            // ack in old framing, everything after it is batched both ways.
+            sendMsg(DPROTOCOL_MSG_BATCH, NULL, 0);
+            conn_->setSendBatched();
+            conn_->setRecvBatched();
+            batched_ = true;
+            // fall through
+        case DPROTOCOL_MSG_HELLO: {
+            DTun::DProtocolMsgHello msgHello;
+            memcpy(&msgHello, msg, sizeof(msgHello));
+            onMsgHello(msgHello);
             break;
+        }
         case DPROTOCOL_MSG_HELLO_PROBE:
-            onRecvMsgHelloProbe();
+            onMsgHelloProbe();
             break;
-        case DPROTOCOL_MSG_HELLO_FAST:
-            buff_.resize(sizeof(DTun::DProtocolMsgHelloFast));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&Session::onRecvMsgHelloFast, this, _1, _2),
-                true);
+        case DPROTOCOL_MSG_HELLO_FAST: {
+            DTun::DProtocolMsgHelloFast msgHelloFast;
+            memcpy(&msgHelloFast, msg, sizeof(msgHelloFast));
+            onMsgHelloFast(msgHelloFast);
             break;
-        case DPROTOCOL_MSG_HELLO_SYMM:
-            buff_.resize(sizeof(DTun::DProtocolMsgHelloSymm));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&Session::onRecvMsgHelloSymm, this, _1, _2),
-                true);
+        }
+        case DPROTOCOL_MSG_HELLO_SYMM: {
+            DTun::DProtocolMsgHelloSymm msgHelloSymm;
+            memcpy(&msgHelloSymm, msg, sizeof(msgHelloSymm));
+            onMsgHelloSymm(msgHelloSymm);
             break;
+        }
         case DPROTOCOL_MSG_CONN_CREATE:
-            buff_.resize(sizeof(DTun::DProtocolMsgConnCreate));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&Session::onRecvMsgOther, this, _1, _2, header.msgCode),
-                true);
-            break;
         case DPROTOCOL_MSG_CONN_CLOSE:
-            buff_.resize(sizeof(DTun::DProtocolMsgConnClose));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&Session::onRecvMsgOther, this, _1, _2, header.msgCode),
-                true);
-            break;
         case DPROTOCOL_MSG_READY:
-            buff_.resize(sizeof(DTun::DProtocolMsgReady));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&Session::onRecvMsgOther, this, _1, _2, header.msgCode),
-                true);
-            break;
         case DPROTOCOL_MSG_NEXT:
-            buff_.resize(sizeof(DTun::DProtocolMsgNext));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&Session::onRecvMsgOther, this, _1, _2, header.msgCode),
-                true);
+            if (messageCallback_) {
+                messageCallback_(msgCode, msg);
+            }
             break;
         default:
-            LOG4CPLUS_ERROR(logger(), "bad msg code: " << header.msgCode);
+            LOG4CPLUS_ERROR(logger(), "bad msg code: " << (int)msgCode);
+            conn_->close();
             if (errorCallback_) {
                 errorCallback_(1);
             }
@@ -189,37 +178,20 @@ namespace DMaster
         }
     }
 
-    void Session::onRecvMsgHello(int err, int numBytes)
+    void Session::onMsgHello(const DTun::DProtocolMsgHello& msg)
     {
-        LOG4CPLUS_TRACE(logger(), "Session::onRecvMsgHello(" << err << ", " << numBytes << ")");
-
-        if (err) {
-            if (errorCallback_) {
-                errorCallback_(err);
-            }
-            return;
-        }
-
-        DTun::DProtocolMsgHello msg;
-        assert(numBytes == sizeof(msg));
-        memcpy(&msg, &buff_[0], numBytes);
-
         type_ = TypePersistent;
         nodeId_ = msg.nodeId;
         symm_ = msg.probePort && (msg.probePort != peerPort_);
         //symm_ = (nodeId_ == 1);
 
-        startRecvHeader();
-
         if (startPersistentCallback_) {
             startPersistentCallback_();
         }
     }
 
-    void Session::onRecvMsgHelloProbe()
+    void Session::onMsgHelloProbe()
     {
-        LOG4CPLUS_TRACE(logger(), "Session::onRecvMsgHelloProbe()");
-
         type_ = TypeProbe;
 
         DTun::DProtocolMsgProbe msg;
@@ -228,99 +200,39 @@ namespace DMaster
         msg.srcPort = peerPort_;
 
         sendMsg(DPROTOCOL_MSG_PROBE, &msg, sizeof(msg));
-
-        startRecvHeader();
     }
 
-    void Session::onRecvMsgHelloFast(int err, int numBytes)
+    void Session::onMsgHelloFast(const DTun::DProtocolMsgHelloFast& msg)
     {
-        LOG4CPLUS_TRACE(logger(), "Session::onRecvMsgHelloFast(" << err << ", " << numBytes << ")");
-
-        if (err) {
-            if (errorCallback_) {
-                errorCallback_(err);
-            }
-            return;
-        }
-
-        DTun::DProtocolMsgHelloFast msg;
-        assert(numBytes == sizeof(msg));
-        memcpy(&msg, &buff_[0], numBytes);
-
         type_ = TypeFast;
         nodeId_ = msg.nodeId;
 
-        startRecvHeader();
-
         if (startFastCallback_) {
             startFastCallback_(DTun::fromProtocolConnId(msg.connId));
         }
     }
 
-    void Session::onRecvMsgHelloSymm(int err, int numBytes)
+    void Session::onMsgHelloSymm(const DTun::DProtocolMsgHelloSymm& msg)
     {
-        LOG4CPLUS_TRACE(logger(), "Session::onRecvMsgHelloSymm(" << err << ", " << numBytes << ")");
-
-        if (err) {
-            if (errorCallback_) {
-                errorCallback_(err);
-            }
-            return;
-        }
-
-        DTun::DProtocolMsgHelloSymm msg;
-        assert(numBytes == sizeof(msg));
-        memcpy(&msg, &buff_[0], numBytes);
-
         type_ = TypeSymm;
         nodeId_ = msg.nodeId;
 
-        startRecvHeader();
-
         if (startSymmCallback_) {
             startSymmCallback_(DTun::fromProtocolConnId(msg.connId));
         }
     }
 
-    void Session::onRecvMsgOther(int err, int numBytes, DTun::UInt8 msgCode)
+    void Session::onError(int err)
     {
-        LOG4CPLUS_TRACE(logger(), "Session::onRecvMsgOther(" << err << ", " << numBytes << ", " << (int)msgCode << ")");
+        LOG4CPLUS_TRACE(logger(), "Session::onError(" << err << ")");
 
-        if (err) {
-            if (errorCallback_) {
-                errorCallback_(err ? err : 1);
-            }
-            return;
+        if (errorCallback_) {
+            errorCallback_(err);
         }
-
-        if (messageCallback_) {
-            messageCallback_(msgCode, &buff_[0]);
-        }
-
-        startRecvHeader();
-    }
-
-    void Session::startRecvHeader()
-    {
-        buff_.resize(sizeof(DTun::DProtocolHeader));
-        conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-            boost::bind(&Session::onRecvHeader, this, _1, _2),
-            true);
     }
 
     void Session::sendMsg(DTun::UInt8 msgCode, const void* msg, int msgSize)
     {
-        DTun::DProtocolHeader header;
-
-        header.msgCode = msgCode;
-
-        boost::shared_ptr<std::vector<char> > sndBuff =
-            boost::make_shared<std::vector<char> >(sizeof(header) + msgSize);
-
-        memcpy(&(*sndBuff)[0], &header, sizeof(header));
-        memcpy(&(*sndBuff)[0] + sizeof(header), msg, msgSize);
-
-        conn_->write(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
-            boost::bind(&Session::onSend, this, _1, sndBuff));
+        conn_->sendMsg(msgCode, msg, msgSize);
     }
 }
@@ -2,7 +2,7 @@
 #define _SESSION_H_
 
 #include "DTun/DProtocol.h"
-#include "DTun/SConnection.h"
+#include "DTun/DProtocolConnection.h"
 #include <boost/noncopyable.hpp>
 #include <boost/optional.hpp>
 #include <map>
@@ -43,6 +43,8 @@ namespace DMaster
 
         inline bool isSymm() const { return symm_; }
 
+        inline bool isBatched() const { return batched_; }
+
         inline DTun::UInt32 peerIp() const { return peerIp_; }
         inline DTun::UInt16 peerPort() const { return peerPort_; }
 
@@ -53,7 +55,7 @@ namespace DMaster
             DTun::UInt16 port,
             DTun::UInt8 mode,
             DTun::UInt32 srcIp,
-            bool bestEffort);
+            DTun::UInt8 flags);
 
         void sendConnStatus(const DTun::ConnId& connId,
             DTun::UInt8 statusCode,
@@ -72,16 +74,18 @@ namespace DMaster
 
         void sendNext(const DTun::ConnId& connId);
 
-    private:
-        void onSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff);
-        void onRecvHeader(int err, int numBytes);
-        void onRecvMsgHello(int err, int numBytes);
-        void onRecvMsgHelloProbe();
-        void onRecvMsgHelloFast(int err, int numBytes);
-        void onRecvMsgHelloSymm(int err, int numBytes);
-        void onRecvMsgOther(int err, int numBytes, DTun::UInt8 msgCode);
+        void sendRelay(const DTun::ConnId& connId,
+            DTun::UInt32 relayIp,
+            DTun::UInt16 relayPort,
+            DTun::UInt64 token);
 
-        void startRecvHeader();
+    private:
+        void onMsg(DTun::UInt8 msgCode, const char* msg, int msgSize);
+        void onMsgHello(const DTun::DProtocolMsgHello& msg);
+        void onMsgHelloProbe();
+        void onMsgHelloFast(const DTun::DProtocolMsgHelloFast& msg);
+        void onMsgHelloSymm(const DTun::DProtocolMsgHelloSymm& msg);
+        void onError(int err);
 
         void sendMsg(DTun::UInt8 msgCode, const void* msg, int msgSize);
 
@@ -94,13 +98,12 @@ namespace DMaster
         Type type_;
         DTun::UInt32 nodeId_;
         bool symm_;
-
-        std::vector<char> buff_;
+        bool batched_;
 
         DTun::UInt32 peerIp_;
         DTun::UInt16 peerPort_;
 
-        boost::shared_ptr<DTun::SConnection> conn_;
+        boost::shared_ptr<DTun::DProtocolConnection> conn_;
     };
 }
 
@@ -34,6 +34,13 @@ int main(int argc, char* argv[])
     int port = 2345;
     bool ltudp = false;
     bool utp = false;
+    std::string udtCCStr = "udt";
+    DTun::UDTManager::CongestionControl udtCC = DTun::UDTManager::CongestionControlUDT;
+    bool noRelay = false;
+    std::string relayIpStr;
+    DTun::UInt32 relayRateKBs = 0;
+    DTun::UInt32 relayTimeoutMs = 60000;
+    int numShards = 1;
 
     try {
         boost::program_options::options_description desc("Options");
@@ -42,7 +49,13 @@ int main(int argc, char* argv[])
             ("log4cplus_level", boost::program_options::value<std::string>(&logLevel), "Log level")
             ("port", boost::program_options::value<int>(&port), "Port")
             ("ltudp", "LTUDP")
-            ("utp", "UTP");
+            ("utp", "UTP")
+            ("udt_cc", boost::program_options::value<std::string>(&udtCCStr), "UDT congestion control: udt, bbr or cubic")
+            ("no_relay", "Disable relay for peers behind symmetrical NATs")
+            ("relay_ip", boost::program_options::value<std::string>(&relayIpStr), "Relay ip advertised to nodes, default is dmaster address nodes use")
+            ("relay_rate", boost::program_options::value<DTun::UInt32>(&relayRateKBs), "Relay rate limit per connection and direction, KB/s, 0 - unlimited")
+            ("relay_timeout", boost::program_options::value<DTun::UInt32>(&relayTimeoutMs), "Relay idle timeout, ms")
+            ("shards", boost::program_options::value<int>(&numShards), "Number of reactor threads, each one accepts on its own SO_REUSEPORT socket");
 
         boost::program_options::store(boost::program_options::command_line_parser(
             argc, argv).options(desc).allow_unregistered().run(), vm);
@@ -51,6 +64,21 @@ int main(int argc, char* argv[])
 
         ltudp = (vm.count("ltudp") > 0);
         utp = (vm.count("utp") > 0);
+        noRelay = (vm.count("no_relay") > 0);
+
+        if (!DTun::UDTManager::parseCongestionControl(udtCCStr, udtCC)) {
+            throw boost::program_options::error("udt_cc must be udt, bbr or cubic");
+        }
+
+        if (numShards < 1) {
+            throw boost::program_options::error("shards must be >= 1");
+        }
+
+        if (ltudp && (numShards > 1)) {
+            // lwIP state is global, only one LTUDPManager per process.
+            std::cerr << "LTUDP doesn't support --shards, using 1" << std::endl;
+            numShards = 1;
+        }
     } catch (const boost::program_options::error& e) {
         std::cerr << "Invalid command line arguments: " << e.what() << std::endl;
         return 1;
@@ -79,35 +107,64 @@ int main(int argc, char* argv[])
         sigHandler.reset(new DTun::SignalHandler(&signalHandler));
     }
 
-    boost::scoped_ptr<DTun::SReactor> reactor;
-    boost::scoped_ptr<DTun::SManager> innerMgr;
-    boost::scoped_ptr<DTun::SManager> mgr;
-
-    if (ltudp) {
-        DTun::SysReactor* sysReactor;
-        DTun::LTUDPManager* ltudpMgr;
-        reactor.reset(sysReactor = new DTun::SysReactor());
-        innerMgr.reset(new DTun::SysManager(*sysReactor));
-        mgr.reset(ltudpMgr = new DTun::LTUDPManager(*innerMgr));
-        if (!ltudpMgr->start()) {
+    std::vector<boost::shared_ptr<DTun::SReactor> > reactors;
+    std::vector<boost::shared_ptr<DTun::SManager> > innerMgrs;
+    std::vector<boost::shared_ptr<DTun::SManager> > mgrs;
+    Server::Managers serverMgrs;
+
+    for (int i = 0; i < numShards; ++i) {
+        boost::shared_ptr<DTun::SReactor> reactor;
+        boost::shared_ptr<DTun::SManager> innerMgr;
+        boost::shared_ptr<DTun::SManager> mgr;
+
+        if (ltudp) {
+            DTun::SysReactor* sysReactor;
+            DTun::LTUDPManager* ltudpMgr;
+            reactor.reset(sysReactor = new DTun::SysReactor());
+            innerMgr.reset(new DTun::SysManager(*sysReactor));
+            mgr.reset(ltudpMgr = new DTun::LTUDPManager(*innerMgr));
+            if (!ltudpMgr->start()) {
+                return 1;
+            }
+        } else if (utp) {
+            DTun::SysReactor* sysReactor;
+            DTun::UTPManager* utpMgr;
+            reactor.reset(sysReactor = new DTun::SysReactor());
+            innerMgr.reset(new DTun::SysManager(*sysReactor));
+            mgr.reset(utpMgr = new DTun::UTPManager(*innerMgr));
+            if (!utpMgr->start()) {
+                return 1;
+            }
+        } else {
+            DTun::UDTReactor* udtReactor;
+            reactor.reset(udtReactor = new DTun::UDTReactor());
+            mgr.reset(new DTun::UDTManager(*udtReactor, udtCC));
+        }
+
+        reactors.push_back(reactor);
+        innerMgrs.push_back(innerMgr);
+        mgrs.push_back(mgr);
+        serverMgrs.push_back(mgr.get());
+    }
+
+    boost::scoped_ptr<Relay> relay;
+
+    if (!noRelay) {
+        DTun::UInt32 relayIp = 0;
+
+        if (!relayIpStr.empty() && !DTun::stringToIp(relayIpStr, relayIp)) {
+            LOG4CPLUS_ERROR(logger(), "Cannot parse relay ip address: " << relayIpStr);
             return 1;
         }
-    } else if (utp) {
-        DTun::SysReactor* sysReactor;
-        DTun::UTPManager* utpMgr;
-        reactor.reset(sysReactor = new DTun::SysReactor());
-        innerMgr.reset(new DTun::SysManager(*sysReactor));
-        mgr.reset(utpMgr = new DTun::UTPManager(*innerMgr));
-        if (!utpMgr->start()) {
+
+        relay.reset(new Relay(relayIp, relayRateKBs * 1024, relayTimeoutMs));
+
+        if (!relay->start()) {
             return 1;
         }
-    } else {
-        DTun::UDTReactor* udtReactor;
-        reactor.reset(udtReactor = new DTun::UDTReactor());
-        mgr.reset(new DTun::UDTManager(*udtReactor));
     }
 
-    boost::shared_ptr<Server> server_tmp = boost::make_shared<Server>(boost::ref(*mgr), port);
+    boost::shared_ptr<Server> server_tmp = boost::make_shared<Server>(serverMgrs, port, relay.get());
 
     if (!server_tmp->start()) {
         return 1;
@@ -120,10 +177,14 @@ int main(int argc, char* argv[])
     server.reset();
     server_tmp.reset();
 
-    mgr.reset();
-    innerMgr.reset();
-    reactor->processUpdates();
-    reactor.reset();
+    relay.reset();
+
+    for (int i = 0; i < numShards; ++i) {
+        mgrs[i].reset();
+        innerMgrs[i].reset();
+        reactors[i]->processUpdates();
+        reactors[i].reset();
+    }
 
     LOG4CPLUS_INFO(logger(), "Done!");
 
@@ -0,0 +1,80 @@
+# Two nodes, each behind its own simulated symmetrical NAT (MASQUERADE --random),
+# so dmaster has to relay. dmaster runs in the default namespace.
+#
+# ./relay-test-netns.sh setup
+# ./dmaster --log4cplus_level=INFO --port=2345 --ltudp
+# sudo ip netns exec rnode1 ./dnode --tundev rtun1 --netif-ipaddr 20.0.0.2 --netif-netmask 255.255.255.0 --app_config=/tmp/relay1.ini --ltudp
+# sudo ip netns exec rnode2 ./dnode --tundev rtun2 --netif-ipaddr 11.0.0.2 --netif-netmask 255.255.255.0 --app_config=/tmp/relay2.ini --ltudp
+# sudo ip netns exec rnode2 nc -l 11.0.0.1 5555
+# sudo ip netns exec rnode1 nc 11.0.0.1 5555
+# ./relay-test-netns.sh teardown
+
+if [ "$1" = "teardown" ]; then
+    for i in 1 2; do
+        sudo ip netns delete rnode$i
+        sudo ip netns delete rnat$i
+        sudo ip link delete rwan$i
+    done
+    exit 0
+fi
+
+for i in 1 2; do
+    sudo ip netns add rnat$i
+    sudo ip netns add rnode$i
+    sudo ip netns exec rnat$i ip link set dev lo up
+    sudo ip netns exec rnode$i ip link set dev lo up
+
+    # default namespace <-> NAT box
+    sudo ip link add rwan$i type veth peer name rwan${i}n
+    sudo ip link set rwan${i}n netns rnat$i
+    sudo ip addr add 172.31.$i.1/24 dev rwan$i
+    sudo ip link set rwan$i up
+    sudo ip netns exec rnat$i ip addr add 172.31.$i.2/24 dev rwan${i}n
+    sudo ip netns exec rnat$i ip link set rwan${i}n up
+    sudo ip netns exec rnat$i ip route add default via 172.31.$i.1
+
+    # NAT box <-> node
+    sudo ip link add rlan$i type veth peer name rlan${i}n
+    sudo ip link set rlan$i netns rnat$i
+    sudo ip link set rlan${i}n netns rnode$i
+    sudo ip netns exec rnat$i ip addr add 192.168.$i.1/24 dev rlan$i
+    sudo ip netns exec rnat$i ip link set rlan$i up
+    sudo ip netns exec rnode$i ip addr add 192.168.$i.2/24 dev rlan${i}n
+    sudo ip netns exec rnode$i ip link set rlan${i}n up
+    sudo ip netns exec rnode$i ip route add default via 192.168.$i.1
+
+    # symmetrical NAT, random source port for every new mapping
+    sudo ip netns exec rnat$i sysctl -q -w net.ipv4.ip_forward=1
+    sudo ip netns exec rnat$i iptables -t nat -A POSTROUTING -o rwan${i}n -j MASQUERADE --random
+done
+
+sudo ip tuntap add dev rtun1 mode tun user $USER
+sudo ip link set rtun1 netns rnode1
+sudo ip netns exec rnode1 ifconfig rtun1 20.0.0.1 netmask 255.255.255.0
+
+sudo ip tuntap add dev rtun2 mode tun user $USER
+sudo ip link set rtun2 netns rnode2
+sudo ip netns exec rnode2 ifconfig rtun2 11.0.0.1 netmask 255.255.255.0
+
+# probe address differs from master address, so dmaster can see that nodes are
+# behind symmetrical NAT.
+for i in 1 2; do
+    j=$((3 - i))
+    cat > /tmp/relay$i.ini <<EOF
+[server]
+address = 172.31.$i.1
+port = 2345
+probeAddress = 172.31.$j.1
+probePort = 2345
+
+[node]
+bestEffort = true
+numSymmPorts = 1850
+numFastPorts = 150
+decayTimeoutMs = 305000
+id = $i
+route.0.ip = $([ $i = 1 ] && echo 11.0.0.0 || echo 20.0.0.0)
+route.0.mask = 255.255.255.0
+route.0.node = $j
+EOF
+done
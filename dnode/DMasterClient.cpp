@@ -3,6 +3,7 @@
 #include "RendezvousFastSession.h"
 #include "RendezvousSymmConnSession.h"
 #include "RendezvousSymmAccSession.h"
+#include "RendezvousRelaySession.h"
 #include "DTun/Utils.h"
 #include "DTun/SConnector.h"
 #include "DTun/SConnection.h"
@@ -42,6 +43,7 @@ namespace DNode
         }
         nodeId_ = appConfig->getUInt32("node.id");
         bestEffort_ = appConfig->getBool("node.bestEffort");
+        batch_ = !appConfig->isPresent("server.batch") || appConfig->getBool("server.batch");
         portAllocator_ = boost::make_shared<PortAllocator>(boost::ref(localMgr_.reactor()),
             appConfig->getSInt32("node.numSymmPorts"),
             appConfig->getSInt32("node.numFastPorts"),
@@ -49,36 +51,7 @@ namespace DNode
 
         LOG4CPLUS_INFO(logger(), "Server used: " << address_ << ":" << port_ << ", this nodeId: " << nodeId_);
 
-        std::vector<std::string> routeKeys = appConfig->getSubKeys("node.route");
-
-        routes_.resize(routeKeys.size());
-
-        for (std::vector<std::string>::const_iterator it = routeKeys.begin();
-             it != routeKeys.end(); ++it) {
-            int i = ::atoi(it->c_str());
-            if ((i < 0) || (i >= (int)routes_.size())) {
-                LOG4CPLUS_WARN(logger(), "Bad route index: " << i);
-                continue;
-            }
-            std::string ipStr = appConfig->getString("node.route." + *it + ".ip");
-            if (!DTun::stringToIp(ipStr, routes_[i].ip)) {
-                LOG4CPLUS_WARN(logger(), "Cannot parse ip address: " << ipStr);
-            }
-            std::string maskStr = appConfig->getString("node.route." + *it + ".mask");
-            if (!DTun::stringToIp(maskStr, routes_[i].mask)) {
-                LOG4CPLUS_WARN(logger(), "Cannot parse ip address: " << ipStr);
-            }
-            int nodeId = appConfig->getSInt32("node.route." + *it + ".node");
-            if (nodeId >= 0) {
-                routes_[i].nodeId = nodeId;
-            }
-        }
-
-        LOG4CPLUS_INFO(logger(), "Routes:");
-        for (size_t i = 0; i < routes_.size(); ++i) {
-            LOG4CPLUS_INFO(logger(), "#" << i << ": " << DTun::ipToString(routes_[i].ip) << "/" << DTun::ipToString(routes_[i].mask)
-                << " -> " << (routes_[i].nodeId ? (int)*routes_[i].nodeId : -1));
-        }
+        routes_ = loadRoutes(appConfig);
     }
 
     DMasterClient::~DMasterClient()
@@ -117,6 +90,7 @@ namespace DNode
 
     DTun::ConnId DMasterClient::registerConnection(DTun::UInt32 remoteIp,
         DTun::UInt16 remotePort,
+        bool udp,
         const RegisterConnectionCallback& callback)
     {
         DTun::UInt32 dstNodeId = 0;
@@ -142,6 +116,7 @@ namespace DNode
         connState.connId = DTun::ConnId(nodeId_, connIdx);
         connState.remoteIp = remoteIp;
         connState.remotePort = remotePort;
+        connState.udp = udp;
         connState.callback = callback;
 
         bool running = false;
@@ -162,7 +137,7 @@ namespace DNode
             msg.dstNodeId = dstNodeId;
             msg.remoteIp = remoteIp;
             msg.remotePort = remotePort;
-            msg.bestEffort = bestEffort_;
+            msg.flags = connFlags(connState);
 
             sendMsg(DPROTOCOL_MSG_CONN_CREATE, &msg, sizeof(msg));
         }
@@ -192,6 +167,7 @@ namespace DNode
         rendezvousConnIds_.remove(connId);
 
         assert(!tmp.proxySession);
+        assert(!tmp.udpProxySession);
 
         if (tmp.status == ConnStatusPending) {
             DTun::DProtocolMsgConnClose msg;
@@ -230,6 +206,7 @@ namespace DNode
         int connSessActive = 0;
         int accSessActive = 0;
         int prx = 0;
+        int udpPrx = 0;
         int numOut = 0;
         for (ConnStateMap::const_iterator it = connStates_.begin(); it != connStates_.end(); ++it) {
             if (it->second.mode != RendezvousModeUnknown) {
@@ -251,13 +228,23 @@ namespace DNode
             if (it->second.proxySession) {
                 ++prx;
             }
+            if (it->second.udpProxySession) {
+                ++udpPrx;
+            }
             if (it->second.callback) {
                 ++numOut;
             }
         }
 
+        DTun::UInt64 numMsgs = 0;
+        DTun::UInt64 numWrites = 0;
+        if (conn_) {
+            conn_->getStats(numMsgs, numWrites);
+        }
+
         LOG4CPLUS_INFO(logger(), "totStates=" << totStates << "(" << totStatesReported << "), connSess=" << connSess << "(" << connSessActive
-            << "), accSess=" << accSess << "(" << accSessActive << "), prx=" << prx << ", numOut=" << numOut
+            << "), accSess=" << accSess << "(" << accSessActive << "), prx=" << prx << ", udpPrx=" << udpPrx << ", numOut=" << numOut
+            << ", masterMsgs=" << numMsgs << "/" << numWrites << " writes"
             << ", " << remoteMgr_.reactor().dump()
             << ", " << portAllocator_->dump()
             << ", numFds=" << numFds << ", maxFds=" << fdMax);
@@ -265,17 +252,35 @@ namespace DNode
 
     bool DMasterClient::getDstNodeId(DTun::UInt32 remoteIp, DTun::UInt32& dstNodeId) const
     {
-        for (size_t i = 0; i < routes_.size(); ++i) {
-            if ((remoteIp & routes_[i].mask) == (routes_[i].ip & routes_[i].mask)) {
-                if (routes_[i].nodeId) {
-                    dstNodeId = *routes_[i].nodeId;
-                    return true;
-                } else {
-                    return false;
-                }
-            }
+        boost::shared_ptr<const RouteTable> routes = boost::atomic_load(&routes_);
+
+        return routes->lookup(remoteIp, dstNodeId);
+    }
+
+    void DMasterClient::reloadConfig(const boost::shared_ptr<DTun::AppConfig>& appConfig)
+    {
+        boost::chrono::steady_clock::time_point start =
+            boost::chrono::steady_clock::now();
+
+        boost::shared_ptr<const RouteTable> routes = loadRoutes(appConfig);
+        bool bestEffort = appConfig->getBool("node.bestEffort");
+        int numSymmPorts = appConfig->getSInt32("node.numSymmPorts");
+        int numFastPorts = appConfig->getSInt32("node.numFastPorts");
+        int decayTimeoutMs = appConfig->getSInt32("node.decayTimeoutMs");
+
+        portAllocator_->resize(numSymmPorts, numFastPorts, decayTimeoutMs);
+
+        boost::atomic_store(&routes_, routes);
+
+        {
+            boost::mutex::scoped_lock lock(m_);
+            bestEffort_ = bestEffort;
         }
-        return false;
+
+        LOG4CPLUS_INFO(logger(), "Config reloaded in "
+            << boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - start).count()
+            << "us, bestEffort=" << bestEffort << ", symmPorts=" << numSymmPorts << ", fastPorts=" << numFastPorts
+            << ", decayTimeoutMs=" << decayTimeoutMs);
     }
 
     void DMasterClient::onProbeConnect(int err)
@@ -295,78 +300,44 @@ namespace DNode
         } else {
             LOG4CPLUS_INFO(logger(), "Connected to probe server");
 
-            conn_ = handle->createConnection();
-
-            DTun::DProtocolHeader header;
-
-            header.msgCode = DPROTOCOL_MSG_HELLO_PROBE;
+            conn_ = boost::make_shared<DTun::DProtocolConnection>(handle->createConnection());
+            conn_->setMessageCallback(boost::bind(&DMasterClient::onProbeMsg, this, _1, _2, _3));
+            conn_->setErrorCallback(boost::bind(&DMasterClient::onProbeError, this, _1));
 
-            buff_.resize(sizeof(header));
-            memcpy(&buff_[0], &header, sizeof(header));
-
-            conn_->write(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onProbeSend, this, _1));
+            conn_->sendMsg(DPROTOCOL_MSG_HELLO_PROBE, NULL, 0);
+            conn_->start();
         }
     }
 
-    void DMasterClient::onProbeSend(int err)
+    void DMasterClient::onProbeMsg(DTun::UInt8 msgCode, const char* msg, int msgSize)
     {
-        LOG4CPLUS_TRACE(logger(), "DMasterClient::onProbeSend(" << err << ")");
+        LOG4CPLUS_TRACE(logger(), "DMasterClient::onProbeMsg(" << (int)msgCode << ", " << msgSize << ")");
 
         boost::mutex::scoped_lock lock(m_);
 
-        if (err) {
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
-            conn_.reset();
-            lock.unlock();
-            LOG4CPLUS_ERROR(logger(), "Connection to probe server lost");
-            return;
-        }
-
-        buff_.resize(sizeof(DTun::DProtocolHeader) + sizeof(DTun::DProtocolMsgProbe));
-        conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-            boost::bind(&DMasterClient::onProbeRecv, this, _1, _2),
-            true);
-    }
-
-    void DMasterClient::onProbeRecv(int err, int numBytes)
-    {
-        LOG4CPLUS_TRACE(logger(), "DMasterClient::onProbeRecv(" << err << ", " << numBytes << ")");
-
-        boost::mutex::scoped_lock lock(m_);
-
-        if (err) {
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
-            conn_.reset();
-            lock.unlock();
-            LOG4CPLUS_ERROR(logger(), "Connection to probe server lost");
-            return;
-        }
-
-        DTun::DProtocolHeader header;
-        DTun::DProtocolMsgProbe msg;
-        assert(numBytes == (sizeof(header) + sizeof(msg)));
-        memcpy(&header, &buff_[0], sizeof(header));
-        memcpy(&msg, &buff_[0] + sizeof(header), sizeof(msg));
-
-        if (header.msgCode != DPROTOCOL_MSG_PROBE) {
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
+        if (msgCode != DPROTOCOL_MSG_PROBE) {
+            boost::shared_ptr<DTun::DProtocolConnection> tmp = conn_;
             conn_.reset();
             lock.unlock();
+            tmp->close();
             LOG4CPLUS_ERROR(logger(), "Bad probe response");
             return;
         }
 
-        probedIp_ = msg.srcIp;
-        probedPort_ = msg.srcPort;
+        DTun::DProtocolMsgProbe msgProbe;
+        memcpy(&msgProbe, msg, sizeof(msgProbe));
+
+        probedIp_ = msgProbe.srcIp;
+        probedPort_ = msgProbe.srcPort;
 
         LOG4CPLUS_INFO(logger(), "Probed addr = " << DTun::ipPortToString(probedIp_, probedPort_));
 
-        SYSSOCKET sock = conn_->handle()->duplicate();
+        SYSSOCKET sock = conn_->conn()->handle()->duplicate();
         if (sock == SYS_INVALID_SOCKET) {
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
+            boost::shared_ptr<DTun::DProtocolConnection> tmp = conn_;
             conn_.reset();
             lock.unlock();
+            tmp->close();
             return;
         }
 
@@ -393,6 +364,18 @@ namespace DNode
         }
     }
 
+    void DMasterClient::onProbeError(int err)
+    {
+        LOG4CPLUS_TRACE(logger(), "DMasterClient::onProbeError(" << err << ")");
+
+        boost::mutex::scoped_lock lock(m_);
+
+        boost::shared_ptr<DTun::DProtocolConnection> tmp = conn_;
+        conn_.reset();
+        lock.unlock();
+        LOG4CPLUS_ERROR(logger(), "Connection to probe server lost");
+    }
+
     void DMasterClient::onConnect(int err)
     {
         LOG4CPLUS_TRACE(logger(), "DMasterClient::onConnect(" << err << ")");
@@ -410,141 +393,88 @@ namespace DNode
         } else {
             LOG4CPLUS_INFO(logger(), "Connected to server");
 
-            conn_ = handle->createConnection();
+            conn_ = boost::make_shared<DTun::DProtocolConnection>(handle->createConnection());
+            conn_->setMessageCallback(boost::bind(&DMasterClient::onMsg, this, _1, _2, _3));
+            conn_->setErrorCallback(boost::bind(&DMasterClient::onError, this, _1));
 
-            DTun::DProtocolHeader header;
             DTun::DProtocolMsgHello msg;
 
-            header.msgCode = DPROTOCOL_MSG_HELLO;
             msg.nodeId = nodeId_;
             msg.probeIp = probedIp_;
             msg.probePort = probedPort_;
 
-            buff_.resize(sizeof(header) + sizeof(msg));
-            memcpy(&buff_[0], &header, sizeof(header));
-            memcpy(&buff_[0] + sizeof(header), &msg, sizeof(msg));
-
-            conn_->write(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onHelloSend, this, _1));
-        }
-    }
-
-    void DMasterClient::onHelloSend(int err)
-    {
-        LOG4CPLUS_TRACE(logger(), "DMasterClient::onHelloSend(" << err << ")");
-
-        boost::mutex::scoped_lock lock(m_);
-
-        if (err) {
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
-            conn_.reset();
-            lock.unlock();
-            LOG4CPLUS_ERROR(logger(), "DMasterClient::onHelloSend(" << err << "): Connection to server lost");
-            return;
-        }
-
-        buff_.resize(sizeof(DTun::DProtocolHeader));
-        conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-            boost::bind(&DMasterClient::onRecvHeader, this, _1, _2),
-            true);
-    }
-
-    void DMasterClient::onSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff)
-    {
-        LOG4CPLUS_TRACE(logger(), "DMasterClient::onSend(" << err << ")");
-
-        boost::mutex::scoped_lock lock(m_);
+            if (batch_) {
+                // Server switches to batched framing right after reading this, so
+                // we can frame everything that follows without waiting for the ack.
+                conn_->sendMsg(DPROTOCOL_MSG_HELLO_BATCH, &msg, sizeof(msg));
+                conn_->setSendBatched();
+            } else {
+                conn_->sendMsg(DPROTOCOL_MSG_HELLO, &msg, sizeof(msg));
+            }
 
-        if (err && conn_) {
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
-            conn_.reset();
-            lock.unlock();
-            LOG4CPLUS_ERROR(logger(), "DMasterClient::onSend(" << err << "): Connection to server lost");
+            conn_->start();
         }
     }
 
-    void DMasterClient::onRecvHeader(int err, int numBytes)
+    void DMasterClient::onMsg(DTun::UInt8 msgCode, const char* msg, int msgSize)
     {
-        LOG4CPLUS_TRACE(logger(), "DMasterClient::onRecvHeader(" << err << ", " << numBytes << ")");
+        LOG4CPLUS_TRACE(logger(), "DMasterClient::onMsg(" << (int)msgCode << ", " << msgSize << ")");
 
         boost::mutex::scoped_lock lock(m_);
 
-        if (err) {
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
-            conn_.reset();
-            lock.unlock();
-            LOG4CPLUS_ERROR(logger(), "DMasterClient::onRecvHeader(" << err << ", " << numBytes << "): Connection to server lost");
+        if (!conn_) {
             return;
         }
 
-        DTun::DProtocolHeader header;
-        assert(numBytes == sizeof(header));
-        memcpy(&header, &buff_[0], numBytes);
-
-        switch (header.msgCode) {
-        case DPROTOCOL_MSG_CONN:
-            buff_.resize(sizeof(DTun::DProtocolMsgConn));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onRecvMsgConn, this, _1, _2),
-                true);
+        switch (msgCode) {
+        case DPROTOCOL_MSG_BATCH:
+            LOG4CPLUS_INFO(logger(), "Server supports batching");
+            conn_->setRecvBatched();
             break;
-        case DPROTOCOL_MSG_CONN_STATUS:
-            buff_.resize(sizeof(DTun::DProtocolMsgConnStatus));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onRecvMsgConnStatus, this, _1, _2),
-                true);
+        case DPROTOCOL_MSG_CONN: {
+            DTun::DProtocolMsgConn msgConn;
+            memcpy(&msgConn, msg, sizeof(msgConn));
+            onMsgConn(msgConn, lock);
             break;
-        case DPROTOCOL_MSG_FAST:
-            buff_.resize(sizeof(DTun::DProtocolMsgFast));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onRecvMsgOther, this, _1, _2, header.msgCode),
-                true);
+        }
+        case DPROTOCOL_MSG_CONN_STATUS: {
+            DTun::DProtocolMsgConnStatus msgConnStatus;
+            memcpy(&msgConnStatus, msg, sizeof(msgConnStatus));
+            onMsgConnStatus(msgConnStatus, lock);
             break;
+        }
+        case DPROTOCOL_MSG_FAST:
         case DPROTOCOL_MSG_SYMM:
-            buff_.resize(sizeof(DTun::DProtocolMsgSymm));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onRecvMsgOther, this, _1, _2, header.msgCode),
-                true);
-            break;
         case DPROTOCOL_MSG_READY:
-            buff_.resize(sizeof(DTun::DProtocolMsgReady));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onRecvMsgOther, this, _1, _2, header.msgCode),
-                true);
-            break;
         case DPROTOCOL_MSG_NEXT:
-            buff_.resize(sizeof(DTun::DProtocolMsgNext));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onRecvMsgOther, this, _1, _2, header.msgCode),
-                true);
+        case DPROTOCOL_MSG_RELAY:
+            onMsgOther(msgCode, msg, lock);
             break;
-        default:
-            LOG4CPLUS_ERROR(logger(), "bad msg code: " << static_cast<int>(header.msgCode));
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
+        default: {
+            LOG4CPLUS_ERROR(logger(), "bad msg code: " << static_cast<int>(msgCode));
+            boost::shared_ptr<DTun::DProtocolConnection> tmp = conn_;
             conn_.reset();
             lock.unlock();
+            tmp->close();
             break;
         }
+        }
     }
 
-    void DMasterClient::onRecvMsgConn(int err, int numBytes)
+    void DMasterClient::onError(int err)
     {
-        LOG4CPLUS_TRACE(logger(), "DMasterClient::onRecvMsgConn(" << err << ", " << numBytes << ")");
+        LOG4CPLUS_TRACE(logger(), "DMasterClient::onError(" << err << ")");
 
         boost::mutex::scoped_lock lock(m_);
 
-        if (err) {
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
-            conn_.reset();
-            lock.unlock();
-            LOG4CPLUS_ERROR(logger(), "DMasterClient::onRecvMsgConn(" << err << ", " << numBytes << "): Connection to server lost");
-            return;
-        }
-
-        DTun::DProtocolMsgConn msg;
-        assert(numBytes == sizeof(msg));
-        memcpy(&msg, &buff_[0], numBytes);
+        boost::shared_ptr<DTun::DProtocolConnection> tmp = conn_;
+        conn_.reset();
+        lock.unlock();
+        LOG4CPLUS_ERROR(logger(), "DMasterClient::onError(" << err << "): Connection to server lost");
+    }
 
+    void DMasterClient::onMsgConn(const DTun::DProtocolMsgConn& msg, boost::mutex::scoped_lock& lock)
+    {
         LOG4CPLUS_TRACE(logger(), "Proxy request: connId = " << DTun::fromProtocolConnId(msg.connId) << ", remote_addr = " << DTun::ipPortToString(msg.ip, msg.port)
             << ", mode = " << (int)msg.mode);
 
@@ -553,6 +483,9 @@ namespace DNode
         connState.connId = DTun::fromProtocolConnId(msg.connId);
         connState.remoteIp = msg.ip;
         connState.remotePort = msg.port;
+        connState.udp = ((msg.flags & DPROTOCOL_CONN_FLAG_UDP) != 0);
+
+        bool bestEffort = ((msg.flags & DPROTOCOL_CONN_FLAG_BEST_EFFORT) != 0);
 
         switch (msg.mode) {
         default:
@@ -561,19 +494,25 @@ namespace DNode
             connState.mode = RendezvousModeFast;
             connState.rSess =
                 boost::make_shared<RendezvousFastSession>(boost::ref(localMgr_), boost::ref(remoteMgr_), nodeId_, connState.connId,
-                    address_, port_, portAllocator_, msg.bestEffort);
+                    address_, port_, portAllocator_, bestEffort);
             break;
         case DPROTOCOL_RMODE_SYMM_CONN:
             connState.mode = RendezvousModeSymmConn;
             connState.rSess =
                 boost::make_shared<RendezvousSymmConnSession>(boost::ref(localMgr_), boost::ref(remoteMgr_),
-                    nodeId_, connState.connId, portAllocator_, msg.bestEffort);
+                    nodeId_, connState.connId, portAllocator_, bestEffort);
             break;
         case DPROTOCOL_RMODE_SYMM_ACC:
             connState.mode = RendezvousModeSymmAcc;
             connState.rSess =
                 boost::make_shared<RendezvousSymmAccSession>(boost::ref(localMgr_), boost::ref(remoteMgr_),
-                    nodeId_, connState.connId, address_, port_, msg.srcIp, portAllocator_, msg.bestEffort);
+                    nodeId_, connState.connId, address_, port_, msg.srcIp, portAllocator_, bestEffort);
+            break;
+        case DPROTOCOL_RMODE_RELAY:
+            connState.mode = RendezvousModeRelay;
+            connState.rSess =
+                boost::make_shared<RendezvousRelaySession>(boost::ref(localMgr_),
+                    nodeId_, connState.connId, address_, portAllocator_, bestEffort);
             break;
         }
 
@@ -581,55 +520,24 @@ namespace DNode
 
         if (connStates_.count(connState.connId) > 0) {
             LOG4CPLUS_ERROR(logger(), "Conn " << connState.connId << " already exists");
-
-            buff_.resize(sizeof(DTun::DProtocolHeader));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onRecvHeader, this, _1, _2),
-                true);
         } else {
             connStates_[connState.connId] = connState;
             rendezvousConnIds_.push_back(connState.connId);
 
-            buff_.resize(sizeof(DTun::DProtocolHeader));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onRecvHeader, this, _1, _2),
-                true);
-
             while (processRendezvous(lock)) {}
         }
     }
 
-    void DMasterClient::onRecvMsgConnStatus(int err, int numBytes)
+    void DMasterClient::onMsgConnStatus(const DTun::DProtocolMsgConnStatus& msg, boost::mutex::scoped_lock& lock)
     {
-        boost::mutex::scoped_lock lock(m_);
-
-        if (err) {
-            LOG4CPLUS_TRACE(logger(), "DMasterClient::onRecvMsgConnStatus(" << err << ", " << numBytes << ")");
-
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
-            conn_.reset();
-            lock.unlock();
-            LOG4CPLUS_ERROR(logger(), "DMasterClient::onRecvMsgConnStatus(" << err << ", " << numBytes << "): Connection to server lost");
-            return;
-        }
-
-        DTun::DProtocolMsgConnStatus msg;
-        assert(numBytes == sizeof(msg));
-        memcpy(&msg, &buff_[0], numBytes);
-
         DTun::ConnId connId = DTun::fromProtocolConnId(msg.connId);
 
-        LOG4CPLUS_TRACE(logger(), "DMasterClient::onRecvMsgConnStatus(connId = " << connId << ", mode = "
+        LOG4CPLUS_TRACE(logger(), "DMasterClient::onMsgConnStatus(connId = " << connId << ", mode = "
             << (int)msg.mode << ", status = " << (int)msg.statusCode << ")");
 
-        buff_.resize(sizeof(DTun::DProtocolHeader));
-        conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-            boost::bind(&DMasterClient::onRecvHeader, this, _1, _2),
-            true);
-
         ConnStateMap::iterator it = connStates_.find(connId);
         if (it == connStates_.end()) {
-            LOG4CPLUS_WARN(logger(), "DMasterClient::onRecvMsgConnStatus: conn " << connId << " not found");
+            LOG4CPLUS_WARN(logger(), "DMasterClient::onMsgConnStatus: conn " << connId << " not found");
             return;
         }
 
@@ -649,6 +557,9 @@ namespace DNode
             case DPROTOCOL_RMODE_SYMM_ACC:
                 it->second.mode = RendezvousModeSymmAcc;
                 break;
+            case DPROTOCOL_RMODE_RELAY:
+                it->second.mode = RendezvousModeRelay;
+                break;
             default:
                 LOG4CPLUS_ERROR(logger(), "Bad rmode = " << msg.mode);
                 it->second.mode = RendezvousModeFast;
@@ -684,52 +595,26 @@ namespace DNode
         while (processRendezvous(lock)) {}
     }
 
-    void DMasterClient::onRecvMsgOther(int err, int numBytes, DTun::UInt8 msgId)
+    void DMasterClient::onMsgOther(DTun::UInt8 msgId, const char* msg, boost::mutex::scoped_lock& lock)
     {
-        LOG4CPLUS_TRACE(logger(), "DMasterClient::onRecvMsgOther(" << err << ", " << numBytes << ", " << (int)msgId << ")");
-
-        boost::mutex::scoped_lock lock(m_);
-
-        if (err) {
-            boost::shared_ptr<DTun::SConnection> tmp = conn_;
-            conn_.reset();
-            lock.unlock();
-            LOG4CPLUS_ERROR(logger(), "DMasterClient::onRecvMsgOther(" << err << ", " << numBytes << ", " << (int)msgId << "): Connection to server lost");
-            return;
-        }
-
         DTun::DProtocolConnId dConnId;
-        assert(numBytes >= (int)sizeof(dConnId));
-        memcpy(&dConnId, &buff_[0], sizeof(dConnId));
+        memcpy(&dConnId, msg, sizeof(dConnId));
 
         DTun::ConnId connId = DTun::fromProtocolConnId(dConnId);
 
+        LOG4CPLUS_TRACE(logger(), "DMasterClient::onMsgOther(" << (int)msgId << ", " << connId << ")");
+
         ConnStateMap::iterator it = connStates_.find(connId);
         if (it == connStates_.end()) {
-            LOG4CPLUS_WARN(logger(), "DMasterClient::onRecvMsgOther: conn " << connId << " not found");
-            buff_.resize(sizeof(DTun::DProtocolHeader));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onRecvHeader, this, _1, _2),
-                true);
+            LOG4CPLUS_WARN(logger(), "DMasterClient::onMsgOther: conn " << connId << " not found");
             return;
         }
 
         if (it->second.rSess && (it->second.status != ConnStatusEstablished)) {
             boost::shared_ptr<RendezvousSession> rSess = it->second.rSess;
             lock.unlock();
-            rSess->onMsg(msgId, &buff_[0]);
+            rSess->onMsg(msgId, msg);
             lock.lock();
-            if (conn_) {
-                buff_.resize(sizeof(DTun::DProtocolHeader));
-                conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                    boost::bind(&DMasterClient::onRecvHeader, this, _1, _2),
-                    true);
-            }
-        } else {
-            buff_.resize(sizeof(DTun::DProtocolHeader));
-            conn_->read(&buff_[0], &buff_[0] + buff_.size(),
-                boost::bind(&DMasterClient::onRecvHeader, this, _1, _2),
-                true);
         }
     }
 
@@ -785,7 +670,15 @@ namespace DNode
 
         boost::shared_ptr<DTun::SHandle> handle;
 
-        if (!err) {
+        if (!err && tmp.udp) {
+            // UDP tunnel, see UdpProxyHeader.
+            handle = localMgr_.createDatagramSocket(s);
+            if (!handle) {
+                err = DPROTOCOL_STATUS_ERR_UNKNOWN;
+                DTun::closeSysSocketChecked(s);
+            }
+            s = SYS_INVALID_SOCKET;
+        } else if (!err) {
             handle = remoteMgr_.createStreamSocket();
             if (!handle || !handle->bind(s)) {
                 err = DPROTOCOL_STATUS_ERR_UNKNOWN;
@@ -819,6 +712,25 @@ namespace DNode
 
         if (tmp.callback) {
             tmp.callback(err, handle, ip, port);
+        } else if (!err && tmp.udp) {
+            boost::shared_ptr<UdpProxySession> udpProxySession =
+                boost::make_shared<UdpProxySession>(boost::ref(localMgr_));
+            bool res = udpProxySession->start(handle, ip, port,
+                boost::bind(&DMasterClient::onProxyDone, this, connId));
+            if (!res) {
+                handle->close();
+            }
+            lock.lock();
+            it = connStates_.find(connId);
+            if (it != connStates_.end()) {
+                if (res) {
+                    it->second.udpProxySession = udpProxySession;
+                } else {
+                    connStates_.erase(it);
+                }
+            }
+            lock.unlock();
+            udpProxySession.reset();
         } else if (!err) {
             boost::shared_ptr<ProxySession> proxySession =
                 boost::make_shared<ProxySession>(boost::ref(remoteMgr_), boost::ref(localMgr_));
@@ -844,20 +756,73 @@ namespace DNode
 
     void DMasterClient::sendMsg(DTun::UInt8 msgCode, const void* msg, int msgSize)
     {
-        DTun::DProtocolHeader header;
+        if (conn_) {
+            conn_->sendMsg(msgCode, msg, msgSize);
+        }
+    }
 
-        header.msgCode = msgCode;
+    DTun::UInt8 DMasterClient::connFlags(const ConnState& connState) const
+    {
+        DTun::UInt8 flags = 0;
 
-        boost::shared_ptr<std::vector<char> > sndBuff =
-            boost::make_shared<std::vector<char> >(sizeof(header) + msgSize);
+        if (bestEffort_) {
+            flags |= DPROTOCOL_CONN_FLAG_BEST_EFFORT;
+        }
+        if (connState.udp) {
+            flags |= DPROTOCOL_CONN_FLAG_UDP;
+        }
 
-        memcpy(&(*sndBuff)[0], &header, sizeof(header));
-        memcpy(&(*sndBuff)[0] + sizeof(header), msg, msgSize);
+        return flags;
+    }
 
-        if (conn_) {
-            conn_->write(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
-                boost::bind(&DMasterClient::onSend, this, _1, sndBuff));
+    boost::shared_ptr<const RouteTable> DMasterClient::loadRoutes(const boost::shared_ptr<DTun::AppConfig>& appConfig)
+    {
+        std::vector<std::string> routeKeys = appConfig->getSubKeys("node.route");
+
+        std::vector<boost::optional<RouteTable::Route> > routes(routeKeys.size());
+
+        for (std::vector<std::string>::const_iterator it = routeKeys.begin();
+             it != routeKeys.end(); ++it) {
+            int i = ::atoi(it->c_str());
+            if ((i < 0) || (i >= (int)routes.size())) {
+                LOG4CPLUS_WARN(logger(), "Bad route index: " << i);
+                continue;
+            }
+            RouteTable::Route route;
+            std::string ipStr = appConfig->getString("node.route." + *it + ".ip");
+            if (!DTun::stringToIp(ipStr, route.ip)) {
+                LOG4CPLUS_WARN(logger(), "Cannot parse ip address: " << ipStr);
+                continue;
+            }
+            std::string maskStr = appConfig->getString("node.route." + *it + ".mask");
+            if (!DTun::stringToIp(maskStr, route.mask)) {
+                LOG4CPLUS_WARN(logger(), "Cannot parse ip address: " << maskStr);
+                continue;
+            }
+            int nodeId = appConfig->getSInt32("node.route." + *it + ".node");
+            if (nodeId >= 0) {
+                route.nodeId = nodeId;
+            }
+            routes[i] = route;
         }
+
+        boost::shared_ptr<RouteTable> routeTable = boost::make_shared<RouteTable>();
+
+        for (size_t i = 0; i < routes.size(); ++i) {
+            if (!routes[i]) {
+                continue;
+            }
+            if (!routeTable->add(routes[i]->ip, routes[i]->mask, routes[i]->nodeId)) {
+                LOG4CPLUS_WARN(logger(), "Non-contiguous mask in route #" << i << ", ignored");
+                continue;
+            }
+            LOG4CPLUS_DEBUG(logger(), "#" << i << ": " << DTun::ipToString(routes[i]->ip) << "/" << DTun::ipToString(routes[i]->mask)
+                << " -> " << (routes[i]->nodeId ? (int)*routes[i]->nodeId : -1));
+        }
+
+        LOG4CPLUS_INFO(logger(), "Routes: " << routeTable->routes().size() << ", trie nodes: " << routeTable->numNodes());
+
+        return routeTable;
     }
 
     bool DMasterClient::processRendezvous(boost::mutex::scoped_lock& lock)
@@ -889,6 +854,7 @@ namespace DNode
             assert(!jt->second.rSess || !jt->second.rSess->started());
             assert(!jt->second.keepalive);
             assert(!jt->second.proxySession);
+            assert(!jt->second.udpProxySession);
 
             if ((jt->second.mode == RendezvousModeUnknown) && (jt->second.status == ConnStatusNone)) {
                 jt->second.status = ConnStatusPending;
@@ -896,16 +862,28 @@ namespace DNode
                 DTun::DProtocolMsgConnCreate msg;
 
                 msg.connId = DTun::toProtocolConnId(connId);
-                bool res = getDstNodeId(jt->second.remoteIp, msg.dstNodeId);
-                assert(res);
+                if (!getDstNodeId(jt->second.remoteIp, msg.dstNodeId)) {
+                    // route removed by config reload while queued.
+                    LOG4CPLUS_WARN(logger(), "No route to " << DTun::ipToString(jt->second.remoteIp) << " anymore");
+                    rendezvousConnIds_.erase(it);
+                    RegisterConnectionCallback cb = jt->second.callback;
+                    connStates_.erase(jt);
+                    lock.unlock();
+                    if (cb) {
+                        cb(DPROTOCOL_STATUS_ERR_CANCELED, boost::shared_ptr<DTun::SHandle>(), 0, 0);
+                    }
+                    lock.lock();
+                    return true;
+                }
                 msg.remoteIp = jt->second.remoteIp;
                 msg.remotePort = jt->second.remotePort;
-                msg.bestEffort = bestEffort_;
+                msg.flags = connFlags(jt->second);
 
                 sendMsg(DPROTOCOL_MSG_CONN_CREATE, &msg, sizeof(msg));
                 break;
             } else if ((jt->second.mode == RendezvousModeFast) ||
                 (jt->second.mode == RendezvousModeSymmAcc) ||
+                (jt->second.mode == RendezvousModeRelay) ||
                 (!symmConnRunning && (jt->second.mode == RendezvousModeSymmConn))) {
                 rendezvousConnIds_.erase(it++);
 
@@ -951,6 +929,19 @@ namespace DNode
                     res = rSess->start(conn_, boost::bind(&DMasterClient::onRendezvous, this, connId, _1, _2, _3, _4, _5));
                     break;
                 }
+                case RendezvousModeRelay: {
+                    boost::shared_ptr<RendezvousRelaySession> rSess;
+                    if (jt->second.rSess) {
+                        rSess = boost::dynamic_pointer_cast<RendezvousRelaySession>(jt->second.rSess);
+                        assert(rSess);
+                    } else {
+                        rSess = boost::make_shared<RendezvousRelaySession>(boost::ref(localMgr_),
+                            nodeId_, connId, address_, portAllocator_, bestEffort_);
+                        jt->second.rSess = rSess;
+                    }
+                    res = rSess->start(conn_, boost::bind(&DMasterClient::onRendezvous, this, connId, _1, _2, _3, _4, _5));
+                    break;
+                }
                 default:
                     assert(false);
                     break;
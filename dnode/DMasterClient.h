@@ -3,11 +3,14 @@
 
 #include "DTun/Types.h"
 #include "DTun/DProtocol.h"
+#include "DTun/DProtocolConnection.h"
 #include "DTun/SManager.h"
 #include "DTun/AppConfig.h"
 #include "ProxySession.h"
+#include "UdpProxySession.h"
 #include "RendezvousSession.h"
 #include "PortAllocator.h"
+#include "RouteTable.h"
 #include <boost/optional.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/weak_ptr.hpp>
@@ -27,8 +30,11 @@ namespace DNode
 
         bool start();
 
+        // 'udp' - the callback gets a datagram handle over the
+        // hole-punched socket instead of a stream one.
         DTun::ConnId registerConnection(DTun::UInt32 remoteIp,
             DTun::UInt16 remotePort,
+            bool udp,
             const RegisterConnectionCallback& callback);
 
         void closeConnection(const DTun::ConnId& connId);
@@ -37,13 +43,18 @@ namespace DNode
 
         bool getDstNodeId(DTun::UInt32 remoteIp, DTun::UInt32& dstNodeId) const;
 
+        // Applies routes, bestEffort and port pool settings from 'appConfig',
+        // established connections are not affected.
+        void reloadConfig(const boost::shared_ptr<DTun::AppConfig>& appConfig);
+
     private:
         enum RendezvousMode
         {
             RendezvousModeUnknown = 0,
             RendezvousModeFast,
             RendezvousModeSymmConn,
-            RendezvousModeSymmAcc
+            RendezvousModeSymmAcc,
+            RendezvousModeRelay
         };
 
         enum ConnStatus
@@ -53,23 +64,13 @@ namespace DNode
             ConnStatusEstablished
         };
 
-        struct RouteEntry
-        {
-            RouteEntry()
-            : ip(0)
-            , mask(0) {}
-
-            DTun::UInt32 ip;
-            DTun::UInt32 mask;
-            boost::optional<DTun::UInt32> nodeId;
-        };
-
         struct ConnState
         {
             ConnState()
             : remoteIp(0)
             , remotePort(0)
             , dstNodeIp(0)
+            , udp(false)
             , mode(RendezvousModeUnknown)
             , status(ConnStatusNone) {}
 
@@ -77,34 +78,38 @@ namespace DNode
             DTun::UInt32 remoteIp;
             DTun::UInt16 remotePort;
             DTun::UInt32 dstNodeIp;
+            bool udp;
             RegisterConnectionCallback callback;
             RendezvousMode mode;
             ConnStatus status;
             boost::shared_ptr<RendezvousSession> rSess;
             boost::shared_ptr<PortReservation> keepalive;
             boost::shared_ptr<ProxySession> proxySession;
+            boost::shared_ptr<UdpProxySession> udpProxySession;
         };
 
-        typedef std::vector<RouteEntry> Routes;
         typedef std::map<DTun::ConnId, ConnState> ConnStateMap;
         typedef std::list<DTun::ConnId> ConnIdList;
 
         void onProbeConnect(int err);
-        void onProbeSend(int err);
-        void onProbeRecv(int err, int numBytes);
+        void onProbeMsg(DTun::UInt8 msgCode, const char* msg, int msgSize);
+        void onProbeError(int err);
         void onConnect(int err);
-        void onHelloSend(int err);
-        void onSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff);
-        void onRecvHeader(int err, int numBytes);
-        void onRecvMsgConn(int err, int numBytes);
-        void onRecvMsgConnStatus(int err, int numBytes);
-        void onRecvMsgOther(int err, int numBytes, DTun::UInt8 msgId);
+        void onMsg(DTun::UInt8 msgCode, const char* msg, int msgSize);
+        void onError(int err);
+        void onMsgConn(const DTun::DProtocolMsgConn& msg, boost::mutex::scoped_lock& lock);
+        void onMsgConnStatus(const DTun::DProtocolMsgConnStatus& msg, boost::mutex::scoped_lock& lock);
+        void onMsgOther(DTun::UInt8 msgId, const char* msg, boost::mutex::scoped_lock& lock);
         void onProxyDone(const DTun::ConnId& connId);
         void onRendezvous(const DTun::ConnId& connId, int err, SYSSOCKET s, DTun::UInt32 remoteIp, DTun::UInt16 remotePort,
             const boost::shared_ptr<PortReservation>& portReservation);
 
         void sendMsg(DTun::UInt8 msgCode, const void* msg, int msgSize);
 
+        DTun::UInt8 connFlags(const ConnState& connState) const;
+
+        static boost::shared_ptr<const RouteTable> loadRoutes(const boost::shared_ptr<DTun::AppConfig>& appConfig);
+
         bool processRendezvous(boost::mutex::scoped_lock& lock);
 
         DTun::SManager& remoteMgr_;
@@ -114,19 +119,20 @@ namespace DNode
         std::string probeAddress_;
         int probePort_;
         DTun::UInt32 nodeId_;
-        bool bestEffort_;
+        bool batch_;
         boost::shared_ptr<PortAllocator> portAllocator_;
-        Routes routes_;
+        // replaced as a whole, access with boost::atomic_load/store.
+        boost::shared_ptr<const RouteTable> routes_;
 
         boost::mutex m_;
         bool closing_;
+        bool bestEffort_;
         DTun::UInt32 probedIp_;
         DTun::UInt16 probedPort_;
         DTun::UInt32 nextConnIdx_;
-        std::vector<char> buff_;
         ConnIdList rendezvousConnIds_;
         ConnStateMap connStates_;
-        boost::shared_ptr<DTun::SConnection> conn_;
+        boost::shared_ptr<DTun::DProtocolConnection> conn_;
         boost::shared_ptr<DTun::SConnector> connector_;
     };
 
@@ -1,4 +1,6 @@
 #include "DNodeDirectTCPClient.h"
+#include <stdlib.h>
+#include <string.h>
 #include <misc/debug.h>
 #include <misc/debugerror.h>
 #include <misc/socks_proto.h>
@@ -16,6 +18,8 @@ typedef struct {
     int state;
     BConnector connector;
     BConnection con;
+    // gathered data staged for the connection while sending
+    uint8_t* send_buf;
     DebugError d_err;
     DebugObject d_obj;
 } DNodeDirectTCPClient;
@@ -39,6 +43,16 @@ static void connection_handler(DNodeDirectTCPClient* dtcp_client, int event)
     return;
 }
 
+static void send_handler_done(DNodeDirectTCPClient* dtcp_client, int data_len)
+{
+    DebugObject_Access(&dtcp_client->d_obj);
+
+    free(dtcp_client->send_buf);
+    dtcp_client->send_buf = NULL;
+
+    dtcp_client->base.send_handler_done(dtcp_client->base.send_handler_user, data_len);
+}
+
 static void init_io(DNodeDirectTCPClient* dtcp_client)
 {
     // init receiving
@@ -46,12 +60,14 @@ static void init_io(DNodeDirectTCPClient* dtcp_client)
 
     // init sending
     BConnection_SendAsync_Init(&dtcp_client->con);
+    StreamPassInterface_Sender_Init(BConnection_SendAsync_GetIf(&dtcp_client->con), (StreamPassInterface_handler_done)send_handler_done, dtcp_client);
 }
 
 static void free_io(DNodeDirectTCPClient* dtcp_client)
 {
     // free sending
     BConnection_SendAsync_Free(&dtcp_client->con);
+    free(dtcp_client->send_buf);
 
     // free receiving
     BConnection_RecvAsync_Free(&dtcp_client->con);
@@ -91,14 +107,33 @@ fail0:
     return;
 }
 
-static StreamPassInterface* DNodeDirectTCPClient_GetSendInterface(struct DNodeTCPClient* dtcp_client_)
+static void DNodeDirectTCPClient_SendV(struct DNodeTCPClient* dtcp_client_, const struct iovec* iov, int iov_count)
 {
     DNodeDirectTCPClient* dtcp_client = (DNodeDirectTCPClient*)dtcp_client_;
 
     ASSERT(dtcp_client->state == STATE_UP)
+    ASSERT(!dtcp_client->send_buf)
     DebugObject_Access(&dtcp_client->d_obj);
 
-    return BConnection_SendAsync_GetIf(&dtcp_client->con);
+    // the kernel copies anyway, so stage the buffers for one write,
+    // if that's not possible send the first one, the rest goes next time
+    int len = 0;
+    for (int i = 0; i < iov_count; i++) {
+        len += iov[i].iov_len;
+    }
+
+    if (iov_count == 1 || !(dtcp_client->send_buf = malloc(len))) {
+        StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&dtcp_client->con), (uint8_t*)iov[0].iov_base, iov[0].iov_len);
+        return;
+    }
+
+    int pos = 0;
+    for (int i = 0; i < iov_count; i++) {
+        memcpy(dtcp_client->send_buf + pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+
+    StreamPassInterface_Sender_Send(BConnection_SendAsync_GetIf(&dtcp_client->con), dtcp_client->send_buf, len);
 }
 
 static StreamRecvInterface* DNodeDirectTCPClient_GetRecvInterface(struct DNodeTCPClient* dtcp_client_)
@@ -143,11 +178,12 @@ struct DNodeTCPClient* DNodeDirectTCPClient_Create(BAddr dest_addr, DNodeTCPClie
     }
 
     // init arguments
-    dtcp_client->base.get_sender_interface = &DNodeDirectTCPClient_GetSendInterface;
+    dtcp_client->base.send_v = &DNodeDirectTCPClient_SendV;
     dtcp_client->base.get_recv_interface = &DNodeDirectTCPClient_GetRecvInterface;
     dtcp_client->base.destroy = &DNodeDirectTCPClient_Destroy;
     dtcp_client->base.handler = handler;
     dtcp_client->base.handler_data = handler_data;
+    dtcp_client->base.send_handler_done = NULL;
 
     dtcp_client->dest_addr = dest_addr;
     dtcp_client->reactor = reactor;
@@ -158,6 +194,7 @@ struct DNodeTCPClient* DNodeDirectTCPClient_Create(BAddr dest_addr, DNodeTCPClie
     }
 
     dtcp_client->state = STATE_CONNECTING;
+    dtcp_client->send_buf = NULL;
 
     DebugError_Init(&dtcp_client->d_err, BReactor_PendingGroup(dtcp_client->reactor));
     DebugObject_Init(&dtcp_client->d_obj);
@@ -62,7 +62,7 @@ namespace DNode
         {
             boost::mutex::scoped_lock lock(m_);
 
-            connId_ = theMasterClient->registerConnection(remoteIp, remotePort,
+            connId_ = theMasterClient->registerConnection(remoteIp, remotePort, false,
                 boost::bind(&ProxyTCPClient::onConnectionRegister, this, _1, _2, _3, _4));
             if (!connId_) {
                 return false;
@@ -79,16 +79,24 @@ namespace DNode
             return state_;
         }
 
-        void send(const uint8_t* data, int dataLen)
+        void send(const struct iovec* iov, int iovCount)
         {
+            DTun::SConnection::Buffers buffers(iovCount);
+            int dataLen = 0;
+
+            for (int i = 0; i < iovCount; ++i) {
+                const char* data = (const char*)iov[i].iov_base;
+                buffers[i] = std::make_pair(data, data + iov[i].iov_len);
+                dataLen += iov[i].iov_len;
+            }
+
             boost::mutex::scoped_lock lock(m_);
             assert(conn_);
             assert(!sending_);
 
             sending_ = 1;
 
-            conn_->write((const char*)data, (const char*)(data + dataLen),
-                boost::bind(&ProxyTCPClient::onSend, this, _1, dataLen));
+            conn_->writev(buffers, boost::bind(&ProxyTCPClient::onSend, this, _1, dataLen));
         }
 
         bool isSending(int& bytesSent) const
@@ -284,18 +292,22 @@ typedef struct {
     int bytes_sent;
     int bytes_received;
     BTimer conn_timer;
+    BPending send_done_job;
     DNode::ProxyTCPClient* client;
-    StreamPassInterface send_iface;
     StreamRecvInterface recv_iface;
 } DNodeProxyTCPClient;
 
-extern "C" StreamPassInterface* DNodeProxyTCPClient_GetSendInterface(struct DNodeTCPClient* dtcp_client_)
+extern "C" void DNodeProxyTCPClient_SendV(struct DNodeTCPClient* dtcp_client_, const struct iovec* iov, int iov_count)
 {
     DNodeProxyTCPClient* dtcp_client = (DNodeProxyTCPClient*)dtcp_client_;
 
+    LOG4CPLUS_TRACE(DNode::logger(), "ProxyTCPClient_SendV(" << iov_count << ")");
+
     ASSERT(dtcp_client->state == STATE_UP)
+    ASSERT(!dtcp_client->sending)
 
-    return &dtcp_client->send_iface;
+    dtcp_client->sending = 1;
+    dtcp_client->client->send(iov, iov_count);
 }
 
 extern "C" StreamRecvInterface* DNodeProxyTCPClient_GetRecvInterface(struct DNodeTCPClient* dtcp_client_)
@@ -317,14 +329,9 @@ extern "C" void DNodeProxyTCPClient_RecvHandler(DNodeProxyTCPClient* dtcp_client
     dtcp_client->client->receive(data, data_avail);
 }
 
-extern "C" void DNodeProxyTCPClient_SendHandler(DNodeProxyTCPClient* dtcp_client, uint8_t* data, int data_len)
+extern "C" void DNodeProxyTCPClient_SendDoneJobHandler(DNodeProxyTCPClient* dtcp_client)
 {
-    LOG4CPLUS_TRACE(DNode::logger(), "ProxyTCPClient_SendHandler(" << data_len << ")");
-
-    ASSERT(!dtcp_client->sending)
-
-    dtcp_client->sending = 1;
-    dtcp_client->client->send(data, data_len);
+    dtcp_client->base.send_handler_done(dtcp_client->base.send_handler_user, dtcp_client->bytes_sent);
 }
 
 extern "C" void DNodeProxyTCPClient_SignalHandler(BThreadSignal* reactor_signal)
@@ -339,9 +346,6 @@ extern "C" void DNodeProxyTCPClient_SignalHandler(BThreadSignal* reactor_signal)
             LOG4CPLUS_TRACE(DNode::logger(), "ProxyTCPClient_SignalHandler(UP)");
             dtcp_client->was_connected = 1;
             BReactor_RemoveTimer(dtcp_client->reactor_signal.reactor, &dtcp_client->conn_timer);
-            StreamPassInterface_Init(&dtcp_client->send_iface,
-                (StreamPassInterface_handler_send)DNodeProxyTCPClient_SendHandler, dtcp_client,
-                BReactor_PendingGroup(reactor_signal->reactor));
             StreamRecvInterface_Init(&dtcp_client->recv_iface,
                 (StreamRecvInterface_handler_recv)DNodeProxyTCPClient_RecvHandler, dtcp_client,
                 BReactor_PendingGroup(reactor_signal->reactor));
@@ -370,7 +374,8 @@ extern "C" void DNodeProxyTCPClient_SignalHandler(BThreadSignal* reactor_signal)
     }
     if (dtcp_client->sending && !dtcp_client->client->isSending(bytes)) {
         dtcp_client->sending = 0;
-        StreamPassInterface_Done(&dtcp_client->send_iface, bytes);
+        dtcp_client->bytes_sent = bytes;
+        BPending_Set(&dtcp_client->send_done_job);
     }
 }
 
@@ -388,7 +393,6 @@ extern "C" void DNodeProxyTCPClient_Destroy(struct DNodeTCPClient* dtcp_client_)
     DNodeProxyTCPClient* dtcp_client = (DNodeProxyTCPClient*)dtcp_client_;
 
     if (dtcp_client->was_connected) {
-        StreamPassInterface_Free(&dtcp_client->send_iface);
         StreamRecvInterface_Free(&dtcp_client->recv_iface);
     } else {
         BReactor_RemoveTimer(dtcp_client->reactor_signal.reactor, &dtcp_client->conn_timer);
@@ -398,6 +402,8 @@ extern "C" void DNodeProxyTCPClient_Destroy(struct DNodeTCPClient* dtcp_client_)
 
     delete dtcp_client->client;
 
+    BPending_Free(&dtcp_client->send_done_job);
+
     BThreadSignal_Free(&dtcp_client->reactor_signal);
 
     free(dtcp_client);
@@ -415,11 +421,12 @@ extern "C" struct DNodeTCPClient* DNodeProxyTCPClient_Create(BAddr dest_addr, DN
     }
 
     // init arguments
-    dtcp_client->base.get_sender_interface = &DNodeProxyTCPClient_GetSendInterface;
+    dtcp_client->base.send_v = &DNodeProxyTCPClient_SendV;
     dtcp_client->base.get_recv_interface = &DNodeProxyTCPClient_GetRecvInterface;
     dtcp_client->base.destroy = &DNodeProxyTCPClient_Destroy;
     dtcp_client->base.handler = handler;
     dtcp_client->base.handler_data = handler_data;
+    dtcp_client->base.send_handler_done = NULL;
 
     if (!BThreadSignal_Init(&dtcp_client->reactor_signal, reactor, DNodeProxyTCPClient_SignalHandler)) {
         LOG4CPLUS_ERROR(DNode::logger(), "BThreadSignal_Init");
@@ -437,10 +444,13 @@ extern "C" struct DNodeTCPClient* DNodeProxyTCPClient_Create(BAddr dest_addr, DN
     BTimer_Init(&dtcp_client->conn_timer, 60000 * 7, (BTimer_handler)&DNodeProxyTCPClient_ConnTimerHandler, dtcp_client);
     BReactor_SetTimer(reactor, &dtcp_client->conn_timer);
 
+    BPending_Init(&dtcp_client->send_done_job, BReactor_PendingGroup(reactor), (BPending_handler)DNodeProxyTCPClient_SendDoneJobHandler, dtcp_client);
+
     dtcp_client->client = new DNode::ProxyTCPClient(&dtcp_client->reactor_signal);
 
     if (!dtcp_client->client->start(dest_addr.ipv4.ip, dest_addr.ipv4.port)) {
         delete dtcp_client->client;
+        BPending_Free(&dtcp_client->send_done_job);
         BReactor_RemoveTimer(reactor, &dtcp_client->conn_timer);
         BThreadSignal_Free(&dtcp_client->reactor_signal);
         free(dtcp_client);
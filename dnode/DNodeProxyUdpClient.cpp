@@ -0,0 +1,551 @@
+extern "C" {
+#include "DNodeProxyUdpClient.h"
+#include <system/BThreadSignal.h>
+#include <misc/offset.h>
+}
+#include "DMasterClient.h"
+#include "UdpProxySession.h"
+#include "Logger.h"
+#include "DTun/Utils.h"
+#include "DTun/SConnection.h"
+#include "DTun/OpWatch.h"
+#include <boost/make_shared.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/bind.hpp>
+#include <map>
+#include <list>
+
+// datagrams queued per peer while its rendezvous is in progress
+#define DNODE_UDP_PROXY_MAX_PENDING 256
+// datagrams being written per peer
+#define DNODE_UDP_PROXY_MAX_SENDING 256
+
+#define DNODE_UDP_PROXY_BUFF_SIZE (64 * 1024)
+
+namespace DNode
+{
+    extern DTun::SManager* theRemoteMgr;
+
+    class ProxyUdpClient : boost::noncopyable
+    {
+    public:
+        struct Datagram
+        {
+            DTun::UInt32 localIp;
+            DTun::UInt16 localPort;
+            DTun::UInt32 remoteIp;
+            DTun::UInt16 remotePort;
+            std::vector<char> data;
+        };
+
+        typedef std::list<Datagram> Datagrams;
+
+        ProxyUdpClient(BThreadSignal* reactorSignal, int maxFlows)
+        : reactorSignal_(reactorSignal)
+        , maxFlows_(maxFlows)
+        , watch_(boost::make_shared<DTun::OpWatch>(boost::ref(theRemoteMgr->reactor())))
+        {
+        }
+
+        ~ProxyUdpClient()
+        {
+            watch_->close();
+
+            Peers peers;
+
+            {
+                boost::mutex::scoped_lock lock(m_);
+                flows_.clear();
+                peers.swap(peers_);
+                for (Peers::iterator it = peers.begin(); it != peers.end(); ++it) {
+                    it->second->closed = true;
+                    it->second->flows.clear();
+                }
+            }
+
+            for (Peers::iterator it = peers.begin(); it != peers.end(); ++it) {
+                closePeer(*it->second);
+            }
+        }
+
+        // Called from the tun2socks reactor only, same as expireIdle().
+        void send(DTun::UInt32 localIp, DTun::UInt16 localPort, DTun::UInt32 remoteIp, DTun::UInt16 remotePort,
+            const char* data, int dataLen)
+        {
+            FlowKey key(localIp, localPort, remoteIp, remotePort);
+
+            boost::mutex::scoped_lock lock(m_);
+
+            boost::shared_ptr<Flow> flow;
+            bool newPeer = false;
+
+            Flows::iterator it = flows_.find(key);
+            if (it != flows_.end()) {
+                flow = it->second;
+            } else {
+                if ((int)flows_.size() >= maxFlows_) {
+                    LOG4CPLUS_WARN(logger(), "too many UDP flows, dropping datagram to " << DTun::ipPortToString(remoteIp, remotePort));
+                    return;
+                }
+
+                lock.unlock();
+
+                DTun::UInt32 nodeId = 0;
+                if (!theMasterClient->getDstNodeId(remoteIp, nodeId)) {
+                    return;
+                }
+
+                lock.lock();
+
+                boost::shared_ptr<Peer>& peer = peers_[nodeId];
+                if (!peer) {
+                    peer = boost::make_shared<Peer>();
+                    peer->nodeId = nodeId;
+                    newPeer = true;
+                }
+
+                flow = boost::make_shared<Flow>();
+
+                flow->flowId = peer->nextFlowId++;
+                flow->localIp = localIp;
+                flow->localPort = localPort;
+                flow->remoteIp = remoteIp;
+                flow->remotePort = remotePort;
+                flow->peer = peer;
+
+                flows_[key] = flow;
+                peer->flows[flow->flowId] = flow;
+
+                LOG4CPLUS_INFO(logger(), "new UDP flow to " << DTun::ipPortToString(remoteIp, remotePort)
+                    << " over node " << nodeId << ", flow = " << flow->flowId);
+            }
+
+            Peer& peer = *flow->peer;
+
+            if (peer.failed) {
+                // dropped until expireIdle() closes the peer, the next
+                // datagram after that retries the rendezvous.
+                return;
+            }
+
+            flow->active = true;
+
+            if (peer.conn || ((int)peer.pending.size() < DNODE_UDP_PROXY_MAX_PENDING)) {
+                boost::shared_ptr<std::vector<char> > buff =
+                    boost::make_shared<std::vector<char> >(sizeof(UdpProxyHeader) + dataLen);
+
+                UdpProxyHeader header;
+                header.magic = DNODE_UDP_PROXY_MAGIC;
+                header.flowId = flow->flowId;
+                header.ip = remoteIp;
+                header.port = remotePort;
+                memcpy(&(*buff)[0], &header, sizeof(header));
+                memcpy(&(*buff)[0] + sizeof(header), data, dataLen);
+
+                if (peer.conn) {
+                    sendPeer(flow->peer, buff);
+                } else {
+                    peer.pending.push_back(buff);
+                }
+            }
+
+            if (!newPeer) {
+                return;
+            }
+
+            boost::shared_ptr<Peer> newPeerPtr = flow->peer;
+
+            lock.unlock();
+
+            // callbacks of other connections may run from here, so not under our lock.
+            DTun::ConnId connId = theMasterClient->registerConnection(remoteIp, remotePort, true,
+                watch_->wrap<int, boost::shared_ptr<DTun::SHandle>, DTun::UInt32, DTun::UInt16>(
+                    boost::bind(&ProxyUdpClient::onConnectionRegister, this, boost::weak_ptr<Peer>(newPeerPtr), _1, _2, _3, _4)));
+
+            lock.lock();
+
+            if (!connId) {
+                newPeerPtr->failed = true;
+                newPeerPtr->pending.clear();
+                return;
+            }
+
+            LOG4CPLUS_INFO(logger(), "new UDP tunnel to node " << newPeerPtr->nodeId << ", id = " << connId);
+
+            if (newPeerPtr->closed) {
+                lock.unlock();
+                theMasterClient->closeConnection(connId);
+                return;
+            }
+
+            newPeerPtr->connId = connId;
+        }
+
+        void takeReceived(Datagrams& datagrams)
+        {
+            boost::mutex::scoped_lock lock(m_);
+            datagrams.swap(received_);
+        }
+
+        // Drops flows that had no datagrams since the last call, closes
+        // failed tunnels and tunnels left without flows.
+        void expireIdle()
+        {
+            std::vector<boost::shared_ptr<Peer> > idle;
+
+            {
+                boost::mutex::scoped_lock lock(m_);
+                for (Flows::iterator it = flows_.begin(); it != flows_.end();) {
+                    Flow& flow = *it->second;
+                    if (flow.active && !flow.peer->failed) {
+                        flow.active = false;
+                        ++it;
+                    } else {
+                        flow.peer->flows.erase(flow.flowId);
+                        flows_.erase(it++);
+                    }
+                }
+                for (Peers::iterator it = peers_.begin(); it != peers_.end();) {
+                    if (it->second->flows.empty()) {
+                        it->second->closed = true;
+                        idle.push_back(it->second);
+                        peers_.erase(it++);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < idle.size(); ++i) {
+                closePeer(*idle[i]);
+            }
+        }
+
+    private:
+        struct FlowKey
+        {
+            FlowKey(DTun::UInt32 localIp, DTun::UInt16 localPort, DTun::UInt32 remoteIp, DTun::UInt16 remotePort)
+            : localIp(localIp)
+            , localPort(localPort)
+            , remoteIp(remoteIp)
+            , remotePort(remotePort) {}
+
+            bool operator<(const FlowKey& other) const
+            {
+                if (localIp != other.localIp) {
+                    return localIp < other.localIp;
+                }
+                if (localPort != other.localPort) {
+                    return localPort < other.localPort;
+                }
+                if (remoteIp != other.remoteIp) {
+                    return remoteIp < other.remoteIp;
+                }
+                return remotePort < other.remotePort;
+            }
+
+            DTun::UInt32 localIp;
+            DTun::UInt16 localPort;
+            DTun::UInt32 remoteIp;
+            DTun::UInt16 remotePort;
+        };
+
+        struct Peer;
+
+        struct Flow
+        {
+            Flow()
+            : flowId(0)
+            , localIp(0)
+            , localPort(0)
+            , remoteIp(0)
+            , remotePort(0)
+            , active(true) {}
+
+            DTun::UInt32 flowId;
+            DTun::UInt32 localIp;
+            DTun::UInt16 localPort;
+            DTun::UInt32 remoteIp;
+            DTun::UInt16 remotePort;
+            // traffic since the last expireIdle().
+            bool active;
+            boost::shared_ptr<Peer> peer;
+        };
+
+        typedef std::map<FlowKey, boost::shared_ptr<Flow> > Flows;
+
+        // UDP tunnel to a node, one rendezvous and one hole-punched socket
+        // shared by all flows routed to the node.
+        struct Peer
+        {
+            Peer()
+            : nodeId(0)
+            , nextFlowId(1)
+            , peerIp(0)
+            , peerPort(0)
+            , failed(false)
+            , closed(false)
+            , sending(0) {}
+
+            DTun::UInt32 nodeId;
+            DTun::UInt32 nextFlowId;
+            DTun::ConnId connId;
+            DTun::UInt32 peerIp;
+            DTun::UInt16 peerPort;
+            // rendezvous or socket failed, drop datagrams until the tunnel expires.
+            bool failed;
+            bool closed;
+            int sending;
+            // flowId -> flow, flows are owned by flows_.
+            std::map<DTun::UInt32, boost::weak_ptr<Flow> > flows;
+            std::list<boost::shared_ptr<std::vector<char> > > pending;
+            std::vector<char> rcvBuff;
+            boost::shared_ptr<DTun::SConnection> conn;
+        };
+
+        typedef std::map<DTun::UInt32, boost::shared_ptr<Peer> > Peers;
+
+        void onConnectionRegister(const boost::weak_ptr<Peer>& weakPeer, int err,
+            const boost::shared_ptr<DTun::SHandle>& handle, DTun::UInt32 ip, DTun::UInt16 port)
+        {
+            LOG4CPLUS_TRACE(logger(), "ProxyUdpClient::onConnectionRegister(" << err << ", " << DTun::ipPortToString(ip, port) << ")");
+
+            boost::mutex::scoped_lock lock(m_);
+
+            boost::shared_ptr<Peer> peer = weakPeer.lock();
+
+            if (!peer || peer->closed) {
+                lock.unlock();
+                if (handle) {
+                    handle->close();
+                }
+                return;
+            }
+
+            if (err) {
+                LOG4CPLUS_WARN(logger(), "UDP tunnel " << peer->connId << " rendezvous failed: " << err);
+                peer->failed = true;
+                peer->connId = DTun::ConnId();
+                peer->pending.clear();
+                return;
+            }
+
+            peer->peerIp = ip;
+            peer->peerPort = port;
+            peer->conn = handle->createConnection();
+            peer->rcvBuff.resize(sizeof(UdpProxyHeader) + DNODE_UDP_PROXY_BUFF_SIZE);
+
+            std::list<boost::shared_ptr<std::vector<char> > > pending;
+            pending.swap(peer->pending);
+            for (std::list<boost::shared_ptr<std::vector<char> > >::iterator it = pending.begin(); it != pending.end(); ++it) {
+                sendPeer(peer, *it);
+            }
+
+            recvPeer(peer);
+        }
+
+        void onSend(const boost::weak_ptr<Peer>& weakPeer, int err, const boost::shared_ptr<std::vector<char> >& buff)
+        {
+            boost::mutex::scoped_lock lock(m_);
+
+            boost::shared_ptr<Peer> peer = weakPeer.lock();
+
+            if (!peer) {
+                return;
+            }
+
+            if (err) {
+                LOG4CPLUS_TRACE(logger(), "ProxyUdpClient::onSend(" << err << ")");
+            }
+
+            --peer->sending;
+        }
+
+        void onRecv(const boost::weak_ptr<Peer>& weakPeer, int err, int numBytes, DTun::UInt32 ip, DTun::UInt16 port)
+        {
+            boost::mutex::scoped_lock lock(m_);
+
+            boost::shared_ptr<Peer> peer = weakPeer.lock();
+
+            if (!peer || peer->closed) {
+                return;
+            }
+
+            if (err) {
+                LOG4CPLUS_ERROR(logger(), "UDP tunnel " << peer->connId << " recv error: " << err);
+                // the socket is closed with the tunnel on the next expireIdle().
+                peer->failed = true;
+                return;
+            }
+
+            UdpProxyHeader header;
+
+            if ((ip == peer->peerIp) && (port == peer->peerPort) && (numBytes >= (int)sizeof(header))) {
+                memcpy(&header, &peer->rcvBuff[0], sizeof(header));
+
+                std::map<DTun::UInt32, boost::weak_ptr<Flow> >::iterator it = peer->flows.find(header.flowId);
+
+                boost::shared_ptr<Flow> flow;
+                if ((header.magic == DNODE_UDP_PROXY_MAGIC) && (it != peer->flows.end())) {
+                    flow = it->second.lock();
+                }
+
+                if (flow && (header.ip == flow->remoteIp) && (header.port == flow->remotePort)) {
+                    flow->active = true;
+
+                    received_.push_back(Datagram());
+
+                    Datagram& datagram = received_.back();
+
+                    datagram.localIp = flow->localIp;
+                    datagram.localPort = flow->localPort;
+                    datagram.remoteIp = flow->remoteIp;
+                    datagram.remotePort = flow->remotePort;
+                    datagram.data.assign(peer->rcvBuff.begin() + sizeof(header), peer->rcvBuff.begin() + numBytes);
+
+                    if (received_.size() == 1) {
+                        signalReactor();
+                    }
+                }
+            }
+
+            recvPeer(peer);
+        }
+
+        void sendPeer(const boost::shared_ptr<Peer>& peer, const boost::shared_ptr<std::vector<char> >& buff)
+        {
+            if (peer->sending >= DNODE_UDP_PROXY_MAX_SENDING) {
+                return;
+            }
+
+            ++peer->sending;
+
+            peer->conn->writeTo(&(*buff)[0], &(*buff)[0] + buff->size(), peer->peerIp, peer->peerPort,
+                watch_->wrap<int>(boost::bind(&ProxyUdpClient::onSend, this, boost::weak_ptr<Peer>(peer), _1, buff)));
+        }
+
+        void recvPeer(const boost::shared_ptr<Peer>& peer)
+        {
+            peer->conn->readFrom(&peer->rcvBuff[0], &peer->rcvBuff[0] + peer->rcvBuff.size(),
+                watch_->wrap<int, int, DTun::UInt32, DTun::UInt16>(
+                    boost::bind(&ProxyUdpClient::onRecv, this, boost::weak_ptr<Peer>(peer), _1, _2, _3, _4)));
+        }
+
+        static void closePeer(Peer& peer)
+        {
+            if (peer.connId) {
+                theMasterClient->closeConnection(peer.connId);
+                LOG4CPLUS_INFO(logger(), "UDP tunnel to node " << peer.nodeId << " done, id = " << peer.connId);
+            }
+
+            if (peer.conn) {
+                peer.conn->close();
+            }
+        }
+
+        void signalReactor()
+        {
+            while (!BThreadSignal_Thread_Signal(reactorSignal_)) {
+                LOG4CPLUS_ERROR(logger(), "BThreadSignal_Thread_Signal failed");
+                ::usleep(1000);
+            }
+        }
+
+        BThreadSignal* reactorSignal_;
+        int maxFlows_;
+        boost::mutex m_;
+        Flows flows_;
+        Peers peers_;
+        Datagrams received_;
+        boost::shared_ptr<DTun::OpWatch> watch_;
+    };
+}
+
+struct DNodeProxyUdpClient {
+    BThreadSignal reactor_signal;
+    BTimer idle_timer;
+    int udp_mtu;
+    void* user;
+    DNodeProxyUdpClient_handler_received handler_received;
+    DNode::ProxyUdpClient* client;
+};
+
+extern "C" void DNodeProxyUdpClient_SignalHandler(BThreadSignal* reactor_signal)
+{
+    DNodeProxyUdpClient* o = UPPER_OBJECT(reactor_signal, DNodeProxyUdpClient, reactor_signal);
+
+    DNode::ProxyUdpClient::Datagrams datagrams;
+
+    o->client->takeReceived(datagrams);
+
+    for (DNode::ProxyUdpClient::Datagrams::const_iterator it = datagrams.begin(); it != datagrams.end(); ++it) {
+        BAddr local_addr;
+        BAddr remote_addr;
+
+        BAddr_InitIPv4(&local_addr, it->localIp, it->localPort);
+        BAddr_InitIPv4(&remote_addr, it->remoteIp, it->remotePort);
+
+        o->handler_received(o->user, local_addr, remote_addr,
+            (const uint8_t*)(it->data.empty() ? NULL : &it->data[0]), it->data.size());
+    }
+}
+
+extern "C" void DNodeProxyUdpClient_IdleTimerHandler(DNodeProxyUdpClient* o)
+{
+    o->client->expireIdle();
+
+    BReactor_SetTimer(o->reactor_signal.reactor, &o->idle_timer);
+}
+
+extern "C" struct DNodeProxyUdpClient* DNodeProxyUdpClient_Create(int udp_mtu, int max_flows, BReactor* reactor, void* user,
+    DNodeProxyUdpClient_handler_received handler_received)
+{
+    ASSERT(udp_mtu >= 0)
+    ASSERT(max_flows > 0)
+
+    DNodeProxyUdpClient* o;
+
+    if (!(o = (DNodeProxyUdpClient*)malloc(sizeof(*o)))) {
+        LOG4CPLUS_ERROR(DNode::logger(), "malloc failed");
+        return NULL;
+    }
+
+    o->udp_mtu = udp_mtu;
+    o->user = user;
+    o->handler_received = handler_received;
+
+    if (!BThreadSignal_Init(&o->reactor_signal, reactor, DNodeProxyUdpClient_SignalHandler)) {
+        LOG4CPLUS_ERROR(DNode::logger(), "BThreadSignal_Init");
+        free(o);
+        return NULL;
+    }
+
+    BTimer_Init(&o->idle_timer, DNODE_UDP_PROXY_IDLE_TIMEOUT_MS, (BTimer_handler)&DNodeProxyUdpClient_IdleTimerHandler, o);
+    BReactor_SetTimer(reactor, &o->idle_timer);
+
+    o->client = new DNode::ProxyUdpClient(&o->reactor_signal, max_flows);
+
+    return o;
+}
+
+extern "C" void DNodeProxyUdpClient_Destroy(struct DNodeProxyUdpClient* o)
+{
+    delete o->client;
+
+    BReactor_RemoveTimer(o->reactor_signal.reactor, &o->idle_timer);
+
+    BThreadSignal_Free(&o->reactor_signal);
+
+    free(o);
+}
+
+extern "C" void DNodeProxyUdpClient_SubmitPacket(struct DNodeProxyUdpClient* o, BAddr local_addr, BAddr remote_addr, const uint8_t* data, int data_len)
+{
+    ASSERT(local_addr.type == BADDR_TYPE_IPV4)
+    ASSERT(remote_addr.type == BADDR_TYPE_IPV4)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= o->udp_mtu)
+
+    o->client->send(local_addr.ipv4.ip, local_addr.ipv4.port, remote_addr.ipv4.ip, remote_addr.ipv4.port,
+        (const char*)data, data_len);
+}
@@ -0,0 +1,25 @@
+#ifndef DNODE_PROXYUDPCLIENT_H
+#define DNODE_PROXYUDPCLIENT_H
+
+#include <stdint.h>
+#include <system/BReactor.h>
+#include <system/BAddr.h>
+
+// Tunnels UDP flows to routed prefixes peer-to-peer, one hole-punched
+// socket per destination node shared by all flows to it, datagrams carry a
+// UdpProxyHeader and go with no reliable stream in between.
+
+typedef void (*DNodeProxyUdpClient_handler_received) (void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+
+struct DNodeProxyUdpClient;
+
+struct DNodeProxyUdpClient* DNodeProxyUdpClient_Create(int udp_mtu, int max_flows, BReactor* reactor, void* user,
+    DNodeProxyUdpClient_handler_received handler_received);
+
+void DNodeProxyUdpClient_Destroy(struct DNodeProxyUdpClient* o);
+
+// Packets are queued while the node's rendezvous is in progress and
+// dropped when there's no room, like any UDP.
+void DNodeProxyUdpClient_SubmitPacket(struct DNodeProxyUdpClient* o, BAddr local_addr, BAddr remote_addr, const uint8_t* data, int data_len);
+
+#endif
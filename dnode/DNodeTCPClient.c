@@ -5,9 +5,22 @@ void DNodeTCPClient_Free(struct DNodeTCPClient* dtcp_client)
     dtcp_client->destroy(dtcp_client);
 }
 
-StreamPassInterface* DNodeTCPClient_GetSendInterface(struct DNodeTCPClient* dtcp_client)
+void DNodeTCPClient_SendV_Init(struct DNodeTCPClient* dtcp_client, DNodeTCPClient_send_handler_done handler_done, void* user)
 {
-    return dtcp_client->get_sender_interface(dtcp_client);
+    ASSERT(handler_done)
+    ASSERT(!dtcp_client->send_handler_done)
+
+    dtcp_client->send_handler_done = handler_done;
+    dtcp_client->send_handler_user = user;
+}
+
+void DNodeTCPClient_SendV(struct DNodeTCPClient* dtcp_client, const struct iovec* iov, int iov_count)
+{
+    ASSERT(dtcp_client->send_handler_done)
+    ASSERT(iov_count > 0)
+    ASSERT(iov_count <= DNODE_TCPCLIENT_MAX_IOV)
+
+    dtcp_client->send_v(dtcp_client, iov, iov_count);
 }
 
 StreamRecvInterface* DNodeTCPClient_GetRecvInterface(struct DNodeTCPClient* dtcp_client)
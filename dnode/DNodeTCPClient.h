@@ -2,6 +2,7 @@
 #define DNODE_TCPCLIENT_H
 
 #include <stdint.h>
+#include <sys/uio.h>
 #include <flow/PacketStreamSender.h>
 #include <flow/StreamRecvInterface.h>
 
@@ -9,11 +10,16 @@
 #define DNODE_TCPCLIENT_EVENT_UP 2
 #define DNODE_TCPCLIENT_EVENT_ERROR_CLOSED 3
 
+// maximum number of buffers in one gathered send
+#define DNODE_TCPCLIENT_MAX_IOV 64
+
 typedef void (*DNodeTCPClient_handler) (void* handler_data, int event);
 
+typedef void (*DNodeTCPClient_send_handler_done) (void* user, int data_len);
+
 struct DNodeTCPClient
 {
-    StreamPassInterface* (*get_sender_interface)(struct DNodeTCPClient */*dtcp_client*/);
+    void (*send_v)(struct DNodeTCPClient */*dtcp_client*/, const struct iovec */*iov*/, int /*iov_count*/);
 
     StreamRecvInterface* (*get_recv_interface)(struct DNodeTCPClient */*dtcp_client*/);
 
@@ -21,11 +27,29 @@ struct DNodeTCPClient
 
     DNodeTCPClient_handler handler;
     void* handler_data;
+
+    DNodeTCPClient_send_handler_done send_handler_done;
+    void* send_handler_user;
 };
 
 void DNodeTCPClient_Free(struct DNodeTCPClient* dtcp_client);
 
-StreamPassInterface* DNodeTCPClient_GetSendInterface(struct DNodeTCPClient* dtcp_client);
+/**
+ * Sets the handler reporting completion of {@link DNodeTCPClient_SendV}.
+ * Must be called once the client is up, before the first send.
+ */
+void DNodeTCPClient_SendV_Init(struct DNodeTCPClient* dtcp_client, DNodeTCPClient_send_handler_done handler_done, void* user);
+
+/**
+ * Starts sending the data described by 'iov' in one operation, without copying
+ * it where the transport allows. The iovec array is only read during the call,
+ * the data it points to must stay valid until the done handler is called with
+ * the number of bytes consumed, which may be fewer than given. The done handler
+ * is never called from within this function.
+ *
+ * @param iov_count number of buffers, 1 to DNODE_TCPCLIENT_MAX_IOV
+ */
+void DNodeTCPClient_SendV(struct DNodeTCPClient* dtcp_client, const struct iovec* iov, int iov_count);
 
 StreamRecvInterface* DNodeTCPClient_GetRecvInterface(struct DNodeTCPClient* dtcp_client);
 
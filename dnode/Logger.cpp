@@ -2,8 +2,9 @@
 
 namespace DNode
 {
-    log4cplus::Logger logger()
+    const log4cplus::Logger& logger()
     {
-        return log4cplus::Logger::getInstance("DNode");
+        static const log4cplus::Logger instance = log4cplus::Logger::getInstance("DNode");
+        return instance;
     }
 }
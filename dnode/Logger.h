@@ -6,7 +6,7 @@
 
 namespace DNode
 {
-    log4cplus::Logger logger();
+    const log4cplus::Logger& logger();
 }
 
 #endif
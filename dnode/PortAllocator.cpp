@@ -1,11 +1,25 @@
 #include "PortAllocator.h"
 #include <boost/make_shared.hpp>
+#include <algorithm>
 
 namespace DNode
 {
+    static int decayTickMs(int decayTimeoutMs)
+    {
+        return (std::max)(1, (std::min)(1000, decayTimeoutMs / 256));
+    }
+
     PortAllocator::PortAllocator(DTun::SReactor& reactor, int numSymmPorts, int numFastPorts, int decayTimeoutMs)
     : reactor_(reactor)
     , decayTimeoutMs_(decayTimeoutMs)
+    , tickMs_(decayTickMs(decayTimeoutMs))
+    , startTime_(boost::chrono::steady_clock::now())
+    , usable_(numSymmPorts + numFastPorts)
+    , wheelEpoch_(0)
+    , numDecaying_(0)
+    , numKeepalive_(0)
+    , poolSize_(numSymmPorts + numFastPorts)
+    , excessPorts_(0)
     , decayRunning_(false)
     , watch_(boost::make_shared<DTun::OpWatch>(boost::ref(reactor)))
     {
@@ -13,9 +27,7 @@ namespace DNode
         numPorts_[1] = numFastPorts;
         reservedPorts_[0] = 0;
         reservedPorts_[1] = 0;
-        for (int i = 0; i < numSymmPorts + numFastPorts; ++i) {
-            ports_.insert(boost::make_shared<PortState>(i));
-        }
+        rebuildWheel(tickMs_, startTime_);
     }
 
     PortAllocator::~PortAllocator()
@@ -30,115 +42,76 @@ namespace DNode
 
     boost::shared_ptr<PortReservation> PortAllocator::reserveSymmPorts(int numPorts)
     {
-        boost::mutex::scoped_lock lock(m_);
-
-        if (numPorts > (numPorts_[0] - reservedPorts_[0])) {
-            return boost::shared_ptr<PortReservation>();
-        }
-
-        PortStates ports = reservePorts(numPorts, true);
-
-        if (ports.empty()) {
-            return boost::shared_ptr<PortReservation>();
-        }
-
-        boost::shared_ptr<PortReservation> res =
-            boost::make_shared<PortReservation>(this);
-
-        res->setPorts(ports);
-
-        return res;
+        return reservePorts(numPorts, true);
     }
 
     boost::shared_ptr<PortReservation> PortAllocator::reserveSymmPortsBestEffort(int numPorts, const ReserveCallback& callback)
     {
-        boost::shared_ptr<PortReservation> res =
-            boost::make_shared<PortReservation>(this);
-
-        boost::mutex::scoped_lock lock(m_);
-
-        requests_[0].push_back(Request(numPorts, res.get(), callback));
-
-        lock.unlock();
+        return reservePortsBestEffort(numPorts, true, callback);
+    }
 
-        reactor_.post(
-            watch_->wrap(boost::bind(&PortAllocator::onProcessRequests, this)));
+    boost::shared_ptr<PortReservation> PortAllocator::reserveFastPorts(int numPorts)
+    {
+        return reservePorts(numPorts, false);
+    }
 
-        return res;
+    boost::shared_ptr<PortReservation> PortAllocator::reserveFastPortsBestEffort(int numPorts, const ReserveCallback& callback)
+    {
+        return reservePortsBestEffort(numPorts, false, callback);
     }
 
-    boost::shared_ptr<PortReservation> PortAllocator::reserveFastPorts(int numPorts)
+    void PortAllocator::resize(int numSymmPorts, int numFastPorts, int decayTimeoutMs)
     {
         boost::mutex::scoped_lock lock(m_);
 
-        if (numPorts > (numPorts_[1] - reservedPorts_[1])) {
-            return boost::shared_ptr<PortReservation>();
-        }
-
-        PortStates ports = reservePorts(numPorts, false);
+        boost::chrono::steady_clock::time_point now =
+            boost::chrono::steady_clock::now();
 
-        if (ports.empty()) {
-            return boost::shared_ptr<PortReservation>();
-        }
+        advanceWheel(now);
 
-        boost::shared_ptr<PortReservation> res =
-            boost::make_shared<PortReservation>(this);
+        numPorts_[0] = numSymmPorts;
+        numPorts_[1] = numFastPorts;
+        decayTimeoutMs_ = decayTimeoutMs;
 
-        res->setPorts(ports);
+        int oldTickMs = tickMs_;
+        tickMs_ = decayTickMs(decayTimeoutMs);
 
-        return res;
-    }
+        rebuildWheel(oldTickMs, now);
 
-    boost::shared_ptr<PortReservation> PortAllocator::reserveFastPortsBestEffort(int numPorts, const ReserveCallback& callback)
-    {
-        boost::shared_ptr<PortReservation> res =
-            boost::make_shared<PortReservation>(this);
+        int numPorts = numSymmPorts + numFastPorts;
+        int poolSize = poolSize_ - excessPorts_;
 
-        boost::mutex::scoped_lock lock(m_);
+        if (numPorts > poolSize) {
+            int numKept = (std::min)(excessPorts_, numPorts - poolSize);
+            excessPorts_ -= numKept;
+            poolSize += numKept;
 
-        requests_[1].push_back(Request(numPorts, res.get(), callback));
+            usable_ += numPorts - poolSize;
+            poolSize_ += numPorts - poolSize;
+        } else {
+            excessPorts_ += poolSize - numPorts;
+            // free ones go now, most decayed first.
+            dropExcessPorts(usable_);
+            for (size_t i = 1; (i <= wheel_.size()) && (excessPorts_ > 0); ++i) {
+                numDecaying_ -= dropExcessPorts(wheel_[(wheelEpoch_ + i) % wheel_.size()]);
+            }
+        }
 
         lock.unlock();
 
         reactor_.post(
             watch_->wrap(boost::bind(&PortAllocator::onProcessRequests, this)));
-
-        return res;
     }
 
     std::string PortAllocator::dump()
     {
-        boost::chrono::steady_clock::time_point now =
-            boost::chrono::steady_clock::now();
-
         boost::mutex::scoped_lock lock(m_);
 
-        int portsRsvdSymm = 0;
-        int portsRsvdFast = 0;
-        int portsFree = 0;
-        int portsKeepalive = 0;
-        int portsUsable = 0;
-
-        for (PortStateSet::iterator it = ports_.begin(); it != ports_.end(); ++it) {
-            boost::shared_ptr<PortState> port = *it;
-            if (port->status == PortStatusReservedSymm) {
-                ++portsRsvdSymm;
-            } else if (port->status == PortStatusReservedFast) {
-                ++portsRsvdFast;
-            } else {
-                ++portsFree;
-            }
-
-            if ((*it)->decayTime == (boost::chrono::steady_clock::time_point::max)()) {
-                ++portsKeepalive;
-            } else if ((*it)->decayTime <= now) {
-                ++portsUsable;
-            }
-        }
+        advanceWheel(boost::chrono::steady_clock::now());
 
         std::ostringstream os;
-        os << "rsSymm=" << portsRsvdSymm << ", rsFast=" << portsRsvdFast << ", freePrts=" << portsFree << ", kpalive=" << portsKeepalive
-           << ", usable=" << portsUsable;
+        os << "rsSymm=" << reservedPorts_[0] << ", rsFast=" << reservedPorts_[1] << ", freePrts=" << (usable_ + numDecaying_)
+           << ", kpalive=" << numKeepalive_ << ", usable=" << usable_;
         return os.str();
     }
 
@@ -146,139 +119,107 @@ namespace DNode
     {
         boost::mutex::scoped_lock lock(m_);
 
-        boost::chrono::steady_clock::time_point now =
-            boost::chrono::steady_clock::now();
-
-        assert(!reservation->ports().empty());
+        assert(reservation->numPorts_ > 0);
 
-        for (size_t i = 0; i < reservation->ports().size(); ++i) {
-            boost::shared_ptr<PortState> port = reservation->ports()[i];
-            int cnt = ports_.erase(port);
-            assert(cnt == 1);
-            port->decayTime = now + boost::chrono::milliseconds(decayTimeoutMs_);
-            bool res = ports_.insert(port).second;
-            assert(res);
+        if (reservation->decayTime_ == (boost::chrono::steady_clock::time_point::max)()) {
+            numKeepalive_ -= reservation->numPorts_;
         }
 
-        if (decayRunning_) {
-            return;
-        }
-
-        decayRunning_ = true;
-
-        lock.unlock();
-
-        reactor_.post(
-            watch_->wrap(boost::bind(&PortAllocator::onDecayTimeout, this)), decayTimeoutMs_ + 1);
+        // ports start decaying once used, but stay reserved until freed.
+        reservation->decayTime_ = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(decayTimeoutMs_);
     }
 
     void PortAllocator::keepaliveReservation(PortReservation* reservation)
     {
         boost::mutex::scoped_lock lock(m_);
 
-        assert(!reservation->ports().empty());
+        assert(reservation->numPorts_ > 0);
 
-        bool isSymm = false;
+        boost::chrono::steady_clock::time_point now =
+            boost::chrono::steady_clock::now();
 
-        for (size_t i = 0; i < reservation->ports().size(); ++i) {
-            boost::shared_ptr<PortState> port = reservation->ports()[i];
-            assert(port->status != PortStatusFree);
-            isSymm = (port->status == PortStatusReservedSymm);
-            if (i > 0) {
-                port->status = PortStatusFree;
-            }
-        }
+        advanceWheel(now);
 
-        int idx = isSymm ? 0 : 1;
+        int rest = reservation->numPorts_ - 1;
+        reservation->numPorts_ = 1;
 
-        reservedPorts_[idx] -= (reservation->ports().size() - 1);
-        assert(reservedPorts_[idx] >= 0);
+        reservedPorts_[reservation->isSymm_ ? 0 : 1] -= rest;
+        assert(reservedPorts_[reservation->isSymm_ ? 0 : 1] >= 0);
 
-        PortStates newStates;
-        newStates.push_back(reservation->ports()[0]);
+        dropExcessPorts(rest);
 
-        reservation->setPorts(newStates);
+        int timeoutMs = 0;
 
-        boost::shared_ptr<PortState> port = reservation->ports()[0];
-        int cnt = ports_.erase(port);
-        assert(cnt == 1);
-        port->decayTime = (boost::chrono::steady_clock::time_point::max)();
-        bool res = ports_.insert(port).second;
-        assert(res);
+        if (releasePorts(rest, reservation->decayTime_, now)) {
+            timeoutMs = nextDecayTimeoutMs(now);
+        }
+
+        if (reservation->decayTime_ != (boost::chrono::steady_clock::time_point::max)()) {
+            reservation->decayTime_ = (boost::chrono::steady_clock::time_point::max)();
+            ++numKeepalive_;
+        }
 
         lock.unlock();
 
         reactor_.post(
             watch_->wrap(boost::bind(&PortAllocator::onProcessRequests, this)));
+
+        if (timeoutMs > 0) {
+            reactor_.post(
+                watch_->wrap(boost::bind(&PortAllocator::onDecayTimeout, this)), timeoutMs);
+        }
     }
 
     void PortAllocator::freeReservation(PortReservation* reservation)
     {
         boost::mutex::scoped_lock lock(m_);
 
-        if (reservation->ports().empty()) {
-            for (std::list<Request>::iterator it = requests_[0].begin();
-                it != requests_[0].end(); ++it) {
-                if (it->reservation == reservation) {
-                    requests_[0].erase(it);
-                    break;
-                }
-            }
-            for (std::list<Request>::iterator it = requests_[1].begin();
-                it != requests_[1].end(); ++it) {
-                if (it->reservation == reservation) {
-                    requests_[1].erase(it);
-                    break;
-                }
-            }
+        if (reservation->queued_) {
+            requests_[reservation->isSymm_ ? 0 : 1].erase(reservation->requestIt_);
+            reservation->queued_ = false;
+            ReserveCallback cb;
+            cb.swap(reservation->callback_);
+            lock.unlock();
             return;
         }
 
-        bool isSymm = false;
+        if (reservation->numPorts_ == 0) {
+            return;
+        }
 
         boost::chrono::steady_clock::time_point now =
             boost::chrono::steady_clock::now();
 
-        bool startDecay = false;
-
-        for (size_t i = 0; i < reservation->ports().size(); ++i) {
-            boost::shared_ptr<PortState> port = reservation->ports()[i];
-            assert(port->status != PortStatusFree);
-            isSymm = (port->status == PortStatusReservedSymm);
-            port->status = PortStatusFree;
-            if (port->decayTime == (boost::chrono::steady_clock::time_point::max)()) {
-                int cnt = ports_.erase(port);
-                assert(cnt == 1);
-                port->decayTime = now + boost::chrono::milliseconds(decayTimeoutMs_);
-                bool res = ports_.insert(port).second;
-                assert(res);
-                startDecay = true;
-            }
+        advanceWheel(now);
+
+        boost::chrono::steady_clock::time_point decayTime = reservation->decayTime_;
+
+        if (decayTime == (boost::chrono::steady_clock::time_point::max)()) {
+            numKeepalive_ -= reservation->numPorts_;
+            decayTime = now + boost::chrono::milliseconds(decayTimeoutMs_);
         }
 
-        int idx = isSymm ? 0 : 1;
+        reservedPorts_[reservation->isSymm_ ? 0 : 1] -= reservation->numPorts_;
+        assert(reservedPorts_[reservation->isSymm_ ? 0 : 1] >= 0);
 
-        reservedPorts_[idx] -= reservation->ports().size();
-        assert(reservedPorts_[idx] >= 0);
+        dropExcessPorts(reservation->numPorts_);
 
-        reservation->setPorts(PortStates());
+        int timeoutMs = 0;
 
-        if (!decayRunning_) {
-            if (startDecay) {
-                decayRunning_ = true;
-            }
-        } else {
-            startDecay = false;
+        if (releasePorts(reservation->numPorts_, decayTime, now)) {
+            timeoutMs = nextDecayTimeoutMs(now);
         }
 
+        reservation->decayTime_ = boost::chrono::steady_clock::time_point();
+
         lock.unlock();
 
         reactor_.post(
             watch_->wrap(boost::bind(&PortAllocator::onProcessRequests, this)));
 
-        if (startDecay) {
+        if (timeoutMs > 0) {
             reactor_.post(
-                watch_->wrap(boost::bind(&PortAllocator::onDecayTimeout, this)), decayTimeoutMs_ + 1);
+                watch_->wrap(boost::bind(&PortAllocator::onDecayTimeout, this)), timeoutMs);
         }
     }
 
@@ -286,25 +227,19 @@ namespace DNode
     {
         boost::mutex::scoped_lock lock(m_);
 
+        advanceWheel(boost::chrono::steady_clock::now());
+
         processRequests(lock, true);
         processRequests(lock, false);
 
-        decayRunning_ = false;
-
         boost::chrono::steady_clock::time_point now =
             boost::chrono::steady_clock::now();
 
-        int timeoutMs = 0;
+        advanceWheel(now);
 
-        for (PortStateSet::iterator it = ports_.begin(); it != ports_.end(); ++it) {
-            if (((*it)->decayTime != (boost::chrono::steady_clock::time_point::max)()) &&
-                ((*it)->decayTime > now)) {
-                decayRunning_ = true;
-                timeoutMs = boost::chrono::duration_cast<boost::chrono::milliseconds>(
-                    (*it)->decayTime - now).count() + 1;
-                break;
-            }
-        }
+        decayRunning_ = (numDecaying_ > 0);
+
+        int timeoutMs = decayRunning_ ? nextDecayTimeoutMs(now) : 0;
 
         lock.unlock();
 
@@ -317,38 +252,67 @@ namespace DNode
     void PortAllocator::onProcessRequests()
     {
         boost::mutex::scoped_lock lock(m_);
+        advanceWheel(boost::chrono::steady_clock::now());
         processRequests(lock, true);
         processRequests(lock, false);
     }
 
-    PortStates PortAllocator::reservePorts(int numPorts, bool isSymm)
+    boost::shared_ptr<PortReservation> PortAllocator::reservePorts(int numPorts, bool isSymm)
     {
-        boost::chrono::steady_clock::time_point now =
-            boost::chrono::steady_clock::now();
+        boost::shared_ptr<PortReservation> res =
+            boost::make_shared<PortReservation>(this);
 
-        PortStates states;
+        {
+            boost::mutex::scoped_lock lock(m_);
 
-        for (PortStateSet::iterator it = ports_.begin(); it != ports_.end(); ++it) {
-            if (((*it)->decayTime > now) || ((int)states.size() == numPorts)) {
-                break;
-            }
-            if ((*it)->status == PortStatusFree) {
-                (*it)->status = isSymm ? PortStatusReservedSymm : PortStatusReservedFast;
-                states.push_back(*it);
+            advanceWheel(boost::chrono::steady_clock::now());
+
+            if (reservePorts(res.get(), numPorts, isSymm)) {
+                return res;
             }
         }
 
-        if ((int)states.size() != numPorts) {
-            for (size_t i = 0; i < states.size(); ++i) {
-                states[i]->status = PortStatusFree;
-            }
-            states.clear();
-        } else {
-            reservedPorts_[isSymm ? 0 : 1] += numPorts;
-            assert(reservedPorts_[isSymm ? 0 : 1] <= numPorts_[isSymm ? 0 : 1]);
+        return boost::shared_ptr<PortReservation>();
+    }
+
+    bool PortAllocator::reservePorts(PortReservation* reservation, int numPorts, bool isSymm)
+    {
+        int idx = isSymm ? 0 : 1;
+
+        if ((numPorts <= 0) || (numPorts > (numPorts_[idx] - reservedPorts_[idx])) || (numPorts > usable_)) {
+            return false;
         }
 
-        return states;
+        reservation->isSymm_ = isSymm;
+        reservation->numPorts_ = numPorts;
+        usable_ -= numPorts;
+        reservation->decayTime_ = boost::chrono::steady_clock::time_point();
+
+        reservedPorts_[idx] += numPorts;
+
+        return true;
+    }
+
+    boost::shared_ptr<PortReservation> PortAllocator::reservePortsBestEffort(int numPorts, bool isSymm, const ReserveCallback& callback)
+    {
+        boost::shared_ptr<PortReservation> res =
+            boost::make_shared<PortReservation>(this);
+
+        res->isSymm_ = isSymm;
+        res->numRequested_ = numPorts;
+        res->callback_ = callback;
+
+        boost::mutex::scoped_lock lock(m_);
+
+        res->queued_ = true;
+        res->requestIt_ = requests_[isSymm ? 0 : 1].insert(requests_[isSymm ? 0 : 1].end(), res.get());
+
+        lock.unlock();
+
+        reactor_.post(
+            watch_->wrap(boost::bind(&PortAllocator::onProcessRequests, this)));
+
+        return res;
     }
 
     void PortAllocator::processRequests(boost::mutex::scoped_lock& lock, bool isSymm)
@@ -356,26 +320,144 @@ namespace DNode
         int idx = isSymm ? 0 : 1;
 
         while (!requests_[idx].empty()) {
-            Request& req = requests_[idx].front();
-
-            if (req.numPorts > (numPorts_[idx] - reservedPorts_[idx])) {
-                break;
-            }
-
-            PortStates ports = reservePorts(req.numPorts, isSymm);
+            PortReservation* reservation = requests_[idx].front();
 
-            if (ports.empty()) {
+            if (!reservePorts(reservation, reservation->numRequested_, isSymm)) {
                 break;
             }
 
-            req.reservation->setPorts(ports);
-
-            ReserveCallback cb = req.callback;
             requests_[idx].pop_front();
+            reservation->queued_ = false;
+
+            ReserveCallback cb;
+            cb.swap(reservation->callback_);
             lock.unlock();
             cb();
             cb = ReserveCallback();
             lock.lock();
         }
     }
+
+    bool PortAllocator::releasePorts(int& numPorts, const boost::chrono::steady_clock::time_point& decayTime,
+        const boost::chrono::steady_clock::time_point& now)
+    {
+        if (numPorts == 0) {
+            return false;
+        }
+
+        DTun::SInt64 epoch = 0;
+
+        if (decayTime > now) {
+            // round up, slot becomes usable when its epoch starts.
+            DTun::SInt64 ms = boost::chrono::duration_cast<boost::chrono::milliseconds>(decayTime - startTime_).count();
+            epoch = (std::min)((ms + tickMs_ - 1) / tickMs_, wheelEpoch_ + (DTun::SInt64)wheel_.size());
+        }
+
+        int n = numPorts;
+        numPorts = 0;
+
+        if (epoch <= wheelEpoch_) {
+            usable_ += n;
+            return false;
+        }
+
+        numDecaying_ += n;
+        wheel_[epoch % wheel_.size()] += n;
+
+        if (decayRunning_) {
+            // if epoch is earlier than the running timer's one (decay timeout
+            // lowered by resize) ports become usable a bit later, that's fine.
+            return false;
+        }
+
+        decayRunning_ = true;
+
+        return true;
+    }
+
+    int PortAllocator::dropExcessPorts(int& numPorts)
+    {
+        int numDropped = (std::min)(excessPorts_, numPorts);
+
+        if (numDropped <= 0) {
+            return 0;
+        }
+
+        numPorts -= numDropped;
+        excessPorts_ -= numDropped;
+        poolSize_ -= numDropped;
+
+        return numDropped;
+    }
+
+    void PortAllocator::advanceWheel(const boost::chrono::steady_clock::time_point& now)
+    {
+        DTun::SInt64 epoch = toEpoch(now);
+
+        if (epoch <= wheelEpoch_) {
+            return;
+        }
+
+        for (DTun::SInt64 e = wheelEpoch_ + 1; (e <= epoch) && (numDecaying_ > 0); ++e) {
+            int& slot = wheel_[e % wheel_.size()];
+            numDecaying_ -= slot;
+            usable_ += slot;
+            slot = 0;
+        }
+
+        wheelEpoch_ = epoch;
+    }
+
+    void PortAllocator::rebuildWheel(int oldTickMs, const boost::chrono::steady_clock::time_point& now)
+    {
+        // tick may have changed, so pending slots are remapped by their
+        // deadline rather than by position, the wheel shrinks as well.
+        size_t numSlots = (decayTimeoutMs_ / tickMs_) + 2;
+        DTun::SInt64 epoch = toEpoch(now);
+
+        std::vector<int> wheel(numSlots, 0);
+        int numLeft = numDecaying_;
+
+        for (size_t i = 1; (i <= wheel_.size()) && (numLeft > 0); ++i) {
+            int slot = wheel_[(wheelEpoch_ + i) % wheel_.size()];
+            if (slot == 0) {
+                continue;
+            }
+
+            numLeft -= slot;
+
+            DTun::SInt64 ms = (wheelEpoch_ + i) * oldTickMs;
+            DTun::SInt64 e = (std::min)((ms + tickMs_ - 1) / tickMs_, epoch + (DTun::SInt64)numSlots);
+
+            if (e <= epoch) {
+                numDecaying_ -= slot;
+                usable_ += slot;
+            } else {
+                wheel[e % numSlots] += slot;
+            }
+        }
+
+        wheel_.swap(wheel);
+        wheelEpoch_ = epoch;
+    }
+
+    int PortAllocator::nextDecayTimeoutMs(const boost::chrono::steady_clock::time_point& now)
+    {
+        assert(numDecaying_ > 0);
+
+        DTun::SInt64 epoch = wheelEpoch_ + 1;
+
+        while (wheel_[epoch % wheel_.size()] == 0) {
+            ++epoch;
+        }
+
+        DTun::SInt64 elapsedMs = boost::chrono::duration_cast<boost::chrono::milliseconds>(now - startTime_).count();
+
+        return (std::max)((DTun::SInt64)1, (epoch * tickMs_) - elapsedMs + 1);
+    }
+
+    DTun::SInt64 PortAllocator::toEpoch(const boost::chrono::steady_clock::time_point& t) const
+    {
+        return boost::chrono::duration_cast<boost::chrono::milliseconds>(t - startTime_).count() / tickMs_;
+    }
 }
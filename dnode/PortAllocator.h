@@ -8,10 +8,17 @@
 #include <boost/noncopyable.hpp>
 #include <boost/thread/mutex.hpp>
 #include <list>
-#include <set>
+#include <vector>
 
 namespace DNode
 {
+    /*
+     * Ports carry no identity (the actual UDP ports are picked when
+     * sockets are bound), so the pool is kept as counters: usable (free
+     * and decayed), timer wheel slots (free, still decaying, one slot per
+     * decay epoch) and one count per reservation. Reserving, releasing
+     * and decaying a whole slot are all O(1) regardless of port count.
+     */
     class PortAllocator : boost::noncopyable
     {
     public:
@@ -26,6 +33,10 @@ namespace DNode
         boost::shared_ptr<PortReservation> reserveFastPorts(int numPorts);
         boost::shared_ptr<PortReservation> reserveFastPortsBestEffort(int numPorts, const ReserveCallback& callback);
 
+        // Changes quotas and pool size in place, outstanding reservations
+        // stay valid, excess reserved ports are dropped as they're freed.
+        void resize(int numSymmPorts, int numFastPorts, int decayTimeoutMs);
+
         std::string dump();
 
         // For internal use.
@@ -34,39 +45,46 @@ namespace DNode
         void freeReservation(PortReservation* reservation);
 
     private:
-        struct Request
-        {
-            Request()
-            : numPorts(0) {}
-
-            Request(int numPorts,
-                PortReservation* reservation,
-                const ReserveCallback& callback)
-            : numPorts(numPorts)
-            , reservation(reservation)
-            , callback(callback) {}
-
-            int numPorts;
-            PortReservation* reservation;
-            ReserveCallback callback;
-        };
-
-        typedef std::set<boost::shared_ptr<PortState>, PortStateComparer> PortStateSet;
+        typedef std::list<PortReservation*> Requests;
 
         void onDecayTimeout();
         void onProcessRequests();
 
-        PortStates reservePorts(int numPorts, bool isSymm);
+        boost::shared_ptr<PortReservation> reservePorts(int numPorts, bool isSymm);
+        bool reservePorts(PortReservation* reservation, int numPorts, bool isSymm);
+        boost::shared_ptr<PortReservation> reservePortsBestEffort(int numPorts, bool isSymm, const ReserveCallback& callback);
         void processRequests(boost::mutex::scoped_lock& lock, bool isSymm);
 
+        // returns true if decay timer needs to be started.
+        bool releasePorts(int& numPorts, const boost::chrono::steady_clock::time_point& decayTime,
+            const boost::chrono::steady_clock::time_point& now);
+        // returns number of ports dropped.
+        int dropExcessPorts(int& numPorts);
+        void advanceWheel(const boost::chrono::steady_clock::time_point& now);
+        void rebuildWheel(int oldTickMs, const boost::chrono::steady_clock::time_point& now);
+        int nextDecayTimeoutMs(const boost::chrono::steady_clock::time_point& now);
+        DTun::SInt64 toEpoch(const boost::chrono::steady_clock::time_point& t) const;
+
         DTun::SReactor& reactor_;
         int numPorts_[2];
         int decayTimeoutMs_;
+        int tickMs_;
+        boost::chrono::steady_clock::time_point startTime_;
 
         boost::mutex m_;
-        PortStateSet ports_;
-        std::list<Request> requests_[2];
+        int usable_;
+        // slot for epoch E is wheel_[E % wheel_.size()], holds epochs
+        // (wheelEpoch_, wheelEpoch_ + wheel_.size()].
+        std::vector<int> wheel_;
+        DTun::SInt64 wheelEpoch_;
+        int numDecaying_;
+        int numKeepalive_;
+        Requests requests_[2];
         int reservedPorts_[2];
+        // usable + decaying + reserved.
+        int poolSize_;
+        // number of ports to drop from the pool after shrinking.
+        int excessPorts_;
         bool decayRunning_;
         boost::shared_ptr<DTun::OpWatch> watch_;
     };
@@ -5,6 +5,10 @@ namespace DNode
 {
     PortReservation::PortReservation(PortAllocator* allocator)
     : allocator_(allocator)
+    , isSymm_(false)
+    , numPorts_(0)
+    , queued_(false)
+    , numRequested_(0)
     {
     }
 
@@ -4,47 +4,14 @@
 #include "DTun/Types.h"
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
 #include <boost/chrono.hpp>
-#include <vector>
+#include <list>
 
 namespace DNode
 {
     class PortAllocator;
 
-    enum PortStatus
-    {
-        PortStatusFree = 0,
-        PortStatusReservedSymm,
-        PortStatusReservedFast,
-    };
-
-    struct PortState : boost::noncopyable
-    {
-        explicit PortState(int id)
-        : id(id)
-        , status(PortStatusFree) {}
-
-        int id;
-        PortStatus status;
-        boost::chrono::steady_clock::time_point decayTime;
-    };
-
-    class PortStateComparer: public std::binary_function<boost::shared_ptr<PortState>, boost::shared_ptr<PortState>, bool>
-    {
-    public:
-        bool operator()(const boost::shared_ptr<PortState>& l, const boost::shared_ptr<PortState>& r) const
-        {
-            if (l->decayTime < r->decayTime) {
-                return true;
-            } else if (l->decayTime > r->decayTime) {
-                return false;
-            }
-            return l->id < r->id;
-        }
-    };
-
-    typedef std::vector<boost::shared_ptr<PortState> > PortStates;
-
     class PortReservation : boost::noncopyable
     {
     public:
@@ -57,13 +24,22 @@ namespace DNode
 
         void cancel();
 
-        // For internal use only.
-        inline const PortStates& ports() const { return ports_; }
-        inline void setPorts(const PortStates& value) { ports_ = value; }
+        inline int numPorts() const { return numPorts_; }
 
     private:
+        friend class PortAllocator;
+
         PortAllocator* allocator_;
-        PortStates ports_;
+        bool isSymm_;
+        int numPorts_;
+        // time_point() - never used, max() - keepalive.
+        boost::chrono::steady_clock::time_point decayTime_;
+
+        // best effort request state.
+        bool queued_;
+        int numRequested_;
+        boost::function<void ()> callback_;
+        std::list<PortReservation*>::iterator requestIt_;
     };
 }
 
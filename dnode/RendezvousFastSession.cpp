@@ -32,7 +32,7 @@ namespace DNode
         watch_->close();
     }
 
-    bool RendezvousFastSession::start(const boost::shared_ptr<DTun::SConnection>& serverConn, const Callback& callback)
+    bool RendezvousFastSession::start(const boost::shared_ptr<DTun::DProtocolConnection>& serverConn, const Callback& callback)
     {
         setStarted();
 
@@ -232,11 +232,6 @@ namespace DNode
         cb(0, s, destIp_, destPort_, portReservation_);
     }
 
-    void RendezvousFastSession::onSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff)
-    {
-        LOG4CPLUS_TRACE(logger(), "RendezvousFastSession::onSend(" << err << ")");
-    }
-
     void RendezvousFastSession::onPortReservation()
     {
         LOG4CPLUS_TRACE(logger(), "RendezvousFastSession::onPortReservation()");
@@ -575,37 +570,19 @@ namespace DNode
 
     void RendezvousFastSession::sendReady()
     {
-        DTun::DProtocolHeader header;
         DTun::DProtocolMsgReady msg;
 
-        header.msgCode = DPROTOCOL_MSG_READY;
         msg.connId = DTun::toProtocolConnId(connId());
 
-        boost::shared_ptr<std::vector<char> > sndBuff =
-            boost::make_shared<std::vector<char> >(sizeof(header) + sizeof(msg));
-
-        memcpy(&(*sndBuff)[0], &header, sizeof(header));
-        memcpy(&(*sndBuff)[0] + sizeof(header), &msg, sizeof(msg));
-
-        serverConn_->write(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
-            boost::bind(&RendezvousFastSession::onSend, _1, sndBuff));
+        serverConn_->sendMsg(DPROTOCOL_MSG_READY, &msg, sizeof(msg));
     }
 
     void RendezvousFastSession::sendNext()
     {
-        DTun::DProtocolHeader header;
         DTun::DProtocolMsgNext msg;
 
-        header.msgCode = DPROTOCOL_MSG_NEXT;
         msg.connId = DTun::toProtocolConnId(connId());
 
-        boost::shared_ptr<std::vector<char> > sndBuff =
-            boost::make_shared<std::vector<char> >(sizeof(header) + sizeof(msg));
-
-        memcpy(&(*sndBuff)[0], &header, sizeof(header));
-        memcpy(&(*sndBuff)[0] + sizeof(header), &msg, sizeof(msg));
-
-        serverConn_->write(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
-            boost::bind(&RendezvousFastSession::onSend, _1, sndBuff));
+        serverConn_->sendMsg(DPROTOCOL_MSG_NEXT, &msg, sizeof(msg));
     }
 }
@@ -17,7 +17,7 @@ namespace DNode
             const boost::shared_ptr<PortAllocator>& portAllocator, bool bestEffort);
         ~RendezvousFastSession();
 
-        bool start(const boost::shared_ptr<DTun::SConnection>& serverConn,
+        bool start(const boost::shared_ptr<DTun::DProtocolConnection>& serverConn,
             const Callback& callback);
 
         virtual void onMsg(DTun::UInt8 msgId, const void* msg);
@@ -25,7 +25,6 @@ namespace DNode
         virtual void onEstablished();
 
     private:
-        static void onSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff);
 
         void onPortReservation();
         void onHelloSend(int err);
@@ -59,7 +58,7 @@ namespace DNode
         boost::shared_ptr<DTun::OpWatch> watch_;
         boost::shared_ptr<PortReservation> portReservation_;
         boost::shared_ptr<PortReservation> portReservationNext_;
-        boost::shared_ptr<DTun::SConnection> serverConn_;
+        boost::shared_ptr<DTun::DProtocolConnection> serverConn_;
         boost::shared_ptr<DTun::SHandle> masterHandle_;
         boost::shared_ptr<DMasterSession> masterSession_;
         boost::shared_ptr<DTun::SConnection> pingConn_;
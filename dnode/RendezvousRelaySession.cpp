@@ -0,0 +1,289 @@
+#include "RendezvousRelaySession.h"
+#include "Logger.h"
+#include "DTun/Utils.h"
+#include <boost/make_shared.hpp>
+
+namespace DNode
+{
+    RendezvousRelaySession::RendezvousRelaySession(DTun::SManager& localMgr, DTun::UInt32 nodeId, const DTun::ConnId& connId,
+        const std::string& serverAddr,
+        const boost::shared_ptr<PortAllocator>& portAllocator, bool bestEffort)
+    : RendezvousSession(nodeId, connId)
+    , localMgr_(localMgr)
+    , serverAddr_(serverAddr)
+    , portAllocator_(portAllocator)
+    , bestEffort_(bestEffort)
+    , numBinds_(0)
+    , relayIp_(0)
+    , relayPort_(0)
+    , relayToken_(0)
+    , watch_(boost::make_shared<DTun::OpWatch>(boost::ref(localMgr.reactor())))
+    {
+    }
+
+    RendezvousRelaySession::~RendezvousRelaySession()
+    {
+        watch_->close();
+    }
+
+    bool RendezvousRelaySession::start(const boost::shared_ptr<DTun::DProtocolConnection>& serverConn, const Callback& callback)
+    {
+        setStarted();
+
+        boost::mutex::scoped_lock lock(m_);
+
+        callback_ = callback;
+        serverConn_ = serverConn;
+
+        if (bestEffort_) {
+            portReservation_ =
+                portAllocator_->reserveFastPortsBestEffort(1,
+                    watch_->wrap(boost::bind(&RendezvousRelaySession::onPortReservation, this)));
+            return true;
+        }
+
+        portReservation_ = portAllocator_->reserveFastPorts(1);
+        if (!portReservation_) {
+            return false;
+        }
+
+        lock.unlock();
+
+        localMgr_.reactor().post(
+            watch_->wrap(boost::bind(&RendezvousRelaySession::onPortReservation, this)));
+
+        return true;
+    }
+
+    void RendezvousRelaySession::onMsg(DTun::UInt8 msgId, const void* msg)
+    {
+        LOG4CPLUS_TRACE(logger(), "RendezvousRelaySession::onMsg(" << (int)msgId << ")");
+
+        if (msgId != DPROTOCOL_MSG_RELAY) {
+            return;
+        }
+
+        const DTun::DProtocolMsgRelay* msgRelay = (const DTun::DProtocolMsgRelay*)msg;
+
+        DTun::UInt32 relayIp = msgRelay->relayIp;
+
+        if (relayIp == 0) {
+            // relay is at dmaster's address.
+            addrinfo hints;
+
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+
+            addrinfo* res;
+
+            if (::getaddrinfo(serverAddr_.c_str(), NULL, &hints, &res) != 0) {
+                LOG4CPLUS_ERROR(logger(), "Cannot resolve " << serverAddr_);
+            } else {
+                relayIp = ((const struct sockaddr_in*)res->ai_addr)->sin_addr.s_addr;
+                freeaddrinfo(res);
+            }
+        }
+
+        boost::mutex::scoped_lock lock(m_);
+
+        if (!callback_ || relayPort_) {
+            return;
+        }
+
+        if (relayIp == 0) {
+            finish(lock, 1);
+            return;
+        }
+
+        relayIp_ = relayIp;
+        relayPort_ = msgRelay->relayPort;
+        relayToken_ = msgRelay->token;
+
+        LOG4CPLUS_TRACE(logger(), "RendezvousRelaySession::onMsg(RELAY " << connId() << ", " << DTun::ipPortToString(relayIp_, relayPort_) << ")");
+
+        lock.unlock();
+
+        localMgr_.reactor().post(
+            watch_->wrap(boost::bind(&RendezvousRelaySession::onBindTimeout, this)));
+    }
+
+    void RendezvousRelaySession::onEstablished()
+    {
+        LOG4CPLUS_TRACE(logger(), "RendezvousRelaySession::onEstablished()");
+
+        boost::mutex::scoped_lock lock(m_);
+
+        if (!callback_) {
+            return;
+        }
+
+        // peer got relay ack, so we're bound too.
+        finish(lock, (relayPort_ && bindConn_) ? 0 : 1);
+    }
+
+    void RendezvousRelaySession::onPortReservation()
+    {
+        LOG4CPLUS_TRACE(logger(), "RendezvousRelaySession::onPortReservation()");
+
+        boost::mutex::scoped_lock lock(m_);
+
+        if (!callback_) {
+            return;
+        }
+
+        SYSSOCKET s = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (s == SYS_INVALID_SOCKET) {
+            LOG4CPLUS_ERROR(logger(), "Cannot create UDP socket");
+            finish(lock, 1);
+            return;
+        }
+
+        struct sockaddr_in addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+        if (::bind(s, (const struct sockaddr*)&addr, sizeof(addr)) == SYS_SOCKET_ERROR) {
+            LOG4CPLUS_ERROR(logger(), "Cannot bind UDP socket");
+            DTun::closeSysSocketChecked(s);
+            finish(lock, 1);
+            return;
+        }
+
+        boost::shared_ptr<DTun::SHandle> handle = localMgr_.createDatagramSocket(s);
+        if (!handle) {
+            DTun::closeSysSocketChecked(s);
+            finish(lock, 1);
+            return;
+        }
+
+        portReservation_->use();
+
+        bindConn_ = handle->createConnection();
+
+        rcvBuff_.resize(4096);
+        bindConn_->readFrom(&rcvBuff_[0], &rcvBuff_[0] + rcvBuff_.size(),
+            boost::bind(&RendezvousRelaySession::onRecvBind, this, _1, _2, _3, _4));
+
+        sendReady();
+    }
+
+    void RendezvousRelaySession::onBindSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff)
+    {
+        LOG4CPLUS_TRACE(logger(), "RendezvousRelaySession::onBindSend(" << err << ")");
+
+        if (!err) {
+            return;
+        }
+
+        boost::mutex::scoped_lock lock(m_);
+
+        if (!callback_) {
+            return;
+        }
+
+        finish(lock, err);
+    }
+
+    void RendezvousRelaySession::onRecvBind(int err, int numBytes, DTun::UInt32 ip, DTun::UInt16 port)
+    {
+        LOG4CPLUS_TRACE(logger(), "RendezvousRelaySession::onRecvBind(" << err << ", " << numBytes << ", src=" << DTun::ipPortToString(ip, port) << ")");
+
+        boost::mutex::scoped_lock lock(m_);
+
+        if (!callback_) {
+            return;
+        }
+
+        if (err) {
+            finish(lock, err);
+            return;
+        }
+
+        DTun::DProtocolRelayBind bindMsg;
+
+        if ((numBytes == sizeof(bindMsg)) && (ip == relayIp_) && (port == relayPort_)) {
+            memcpy(&bindMsg, &rcvBuff_[0], sizeof(bindMsg));
+            if ((bindMsg.magic == DPROTOCOL_RELAY_MAGIC) &&
+                (DTun::fromProtocolConnId(bindMsg.connId) == connId()) &&
+                (bindMsg.nodeId == nodeId()) &&
+                (bindMsg.token == relayToken_)) {
+                finish(lock, 0);
+                return;
+            }
+        }
+
+        // peer's transport might already be talking to us through the relay, it'll
+        // retransmit later in our own transport session...
+        bindConn_->readFrom(&rcvBuff_[0], &rcvBuff_[0] + rcvBuff_.size(),
+            boost::bind(&RendezvousRelaySession::onRecvBind, this, _1, _2, _3, _4));
+    }
+
+    void RendezvousRelaySession::onBindTimeout()
+    {
+        boost::mutex::scoped_lock lock(m_);
+
+        if (!callback_) {
+            return;
+        }
+
+        if (numBinds_ >= 100) {
+            LOG4CPLUS_WARN(logger(), "RendezvousRelaySession::onBindTimeout(FAILED, " << connId() << ")");
+            finish(lock, 1);
+            return;
+        }
+
+        ++numBinds_;
+
+        DTun::DProtocolRelayBind bindMsg;
+
+        bindMsg.magic = DPROTOCOL_RELAY_MAGIC;
+        bindMsg.connId = DTun::toProtocolConnId(connId());
+        bindMsg.nodeId = nodeId();
+        bindMsg.token = relayToken_;
+
+        boost::shared_ptr<std::vector<char> > sndBuff =
+            boost::make_shared<std::vector<char> >(sizeof(bindMsg));
+
+        memcpy(&(*sndBuff)[0], &bindMsg, sizeof(bindMsg));
+
+        bindConn_->writeTo(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
+            relayIp_, relayPort_,
+            boost::bind(&RendezvousRelaySession::onBindSend, this, _1, sndBuff));
+        portReservation_->use();
+
+        lock.unlock();
+
+        localMgr_.reactor().post(
+            watch_->wrap(boost::bind(&RendezvousRelaySession::onBindTimeout, this)), 100);
+    }
+
+    void RendezvousRelaySession::sendReady()
+    {
+        DTun::DProtocolMsgReady msg;
+
+        msg.connId = DTun::toProtocolConnId(connId());
+
+        serverConn_->sendMsg(DPROTOCOL_MSG_READY, &msg, sizeof(msg));
+    }
+
+    void RendezvousRelaySession::finish(boost::mutex::scoped_lock& lock, int err)
+    {
+        Callback cb = callback_;
+        callback_ = Callback();
+
+        if (err) {
+            lock.unlock();
+            cb(err, SYS_INVALID_SOCKET, 0, 0, boost::shared_ptr<PortReservation>());
+            return;
+        }
+
+        portReservation_->keepalive();
+        lock.unlock();
+        SYSSOCKET s = bindConn_->handle()->duplicate();
+        bindConn_->close();
+        cb(0, s, relayIp_, relayPort_, portReservation_);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef _RENDEZVOUSRELAYSESSION_H_
+#define _RENDEZVOUSRELAYSESSION_H_
+
+#include "RendezvousSession.h"
+#include "PortAllocator.h"
+#include "DTun/DProtocol.h"
+#include "DTun/OpWatch.h"
+#include "DTun/SManager.h"
+
+namespace DNode
+{
+    // Both peers behind symmetrical NAT, bind to dmaster relay and talk through it.
+    class RendezvousRelaySession : public RendezvousSession
+    {
+    public:
+        RendezvousRelaySession(DTun::SManager& localMgr, DTun::UInt32 nodeId, const DTun::ConnId& connId,
+            const std::string& serverAddr,
+            const boost::shared_ptr<PortAllocator>& portAllocator, bool bestEffort);
+        ~RendezvousRelaySession();
+
+        bool start(const boost::shared_ptr<DTun::DProtocolConnection>& serverConn,
+            const Callback& callback);
+
+        virtual void onMsg(DTun::UInt8 msgId, const void* msg);
+
+        virtual void onEstablished();
+
+    private:
+
+        void onPortReservation();
+        void onBindSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff);
+        void onRecvBind(int err, int numBytes, DTun::UInt32 ip, DTun::UInt16 port);
+        void onBindTimeout();
+
+        void sendReady();
+
+        void finish(boost::mutex::scoped_lock& lock, int err);
+
+        DTun::SManager& localMgr_;
+        std::string serverAddr_;
+        boost::shared_ptr<PortAllocator> portAllocator_;
+        bool bestEffort_;
+
+        boost::mutex m_;
+        int numBinds_;
+        std::vector<char> rcvBuff_;
+        Callback callback_;
+        DTun::UInt32 relayIp_;
+        DTun::UInt16 relayPort_;
+        DTun::UInt64 relayToken_;
+        boost::shared_ptr<DTun::OpWatch> watch_;
+        boost::shared_ptr<PortReservation> portReservation_;
+        boost::shared_ptr<DTun::DProtocolConnection> serverConn_;
+        boost::shared_ptr<DTun::SConnection> bindConn_;
+    };
+}
+
+#endif
@@ -3,7 +3,7 @@
 
 #include "PortReservation.h"
 #include "DTun/Types.h"
-#include "DTun/SConnection.h"
+#include "DTun/DProtocolConnection.h"
 #include <boost/noncopyable.hpp>
 #include <boost/function.hpp>
 #include <vector>
@@ -47,7 +47,7 @@ namespace DNode
         watch_->close();
     }
 
-    bool RendezvousSymmAccSession::start(const boost::shared_ptr<DTun::SConnection>& serverConn,
+    bool RendezvousSymmAccSession::start(const boost::shared_ptr<DTun::DProtocolConnection>& serverConn,
         const Callback& callback)
     {
         setStarted();
@@ -553,37 +553,19 @@ namespace DNode
 
     void RendezvousSymmAccSession::sendReady()
     {
-        DTun::DProtocolHeader header;
         DTun::DProtocolMsgReady msg;
 
-        header.msgCode = DPROTOCOL_MSG_READY;
         msg.connId = DTun::toProtocolConnId(connId());
 
-        boost::shared_ptr<std::vector<char> > sndBuff =
-            boost::make_shared<std::vector<char> >(sizeof(header) + sizeof(msg));
-
-        memcpy(&(*sndBuff)[0], &header, sizeof(header));
-        memcpy(&(*sndBuff)[0] + sizeof(header), &msg, sizeof(msg));
-
-        serverConn_->write(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
-            boost::bind(&RendezvousSymmAccSession::onSend, _1, sndBuff));
+        serverConn_->sendMsg(DPROTOCOL_MSG_READY, &msg, sizeof(msg));
     }
 
     void RendezvousSymmAccSession::sendNext()
     {
-        DTun::DProtocolHeader header;
         DTun::DProtocolMsgNext msg;
 
-        header.msgCode = DPROTOCOL_MSG_NEXT;
         msg.connId = DTun::toProtocolConnId(connId());
 
-        boost::shared_ptr<std::vector<char> > sndBuff =
-            boost::make_shared<std::vector<char> >(sizeof(header) + sizeof(msg));
-
-        memcpy(&(*sndBuff)[0], &header, sizeof(header));
-        memcpy(&(*sndBuff)[0] + sizeof(header), &msg, sizeof(msg));
-
-        serverConn_->write(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
-            boost::bind(&RendezvousSymmAccSession::onSend, _1, sndBuff));
+        serverConn_->sendMsg(DPROTOCOL_MSG_NEXT, &msg, sizeof(msg));
     }
 }
@@ -18,7 +18,7 @@ namespace DNode
             DTun::UInt32 destIp, const boost::shared_ptr<PortAllocator>& portAllocator, bool bestEffort);
         ~RendezvousSymmAccSession();
 
-        bool start(const boost::shared_ptr<DTun::SConnection>& serverConn,
+        bool start(const boost::shared_ptr<DTun::DProtocolConnection>& serverConn,
             const Callback& callback);
 
         virtual void onMsg(DTun::UInt8 msgId, const void* msg);
@@ -61,7 +61,7 @@ namespace DNode
         DTun::UInt16 destDiscoveredPort_;
         boost::shared_ptr<DTun::OpWatch> watch_;
         boost::shared_ptr<PortReservation> portReservation_;
-        boost::shared_ptr<DTun::SConnection> serverConn_;
+        boost::shared_ptr<DTun::DProtocolConnection> serverConn_;
         boost::shared_ptr<DTun::SConnection> pingConn_;
         boost::shared_ptr<DTun::SHandle> masterHandle_;
         boost::shared_ptr<DMasterSession> masterSession_;
@@ -28,7 +28,7 @@ namespace DNode
         watch_->close();
     }
 
-    bool RendezvousSymmConnSession::start(const boost::shared_ptr<DTun::SConnection>& serverConn,
+    bool RendezvousSymmConnSession::start(const boost::shared_ptr<DTun::DProtocolConnection>& serverConn,
         const Callback& callback)
     {
         setStarted();
@@ -232,11 +232,6 @@ namespace DNode
         }
     }
 
-    void RendezvousSymmConnSession::onServerSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff)
-    {
-        LOG4CPLUS_TRACE(logger(), "RendezvousSymmConnSession::onServerSend(" << err << ")");
-    }
-
     void RendezvousSymmConnSession::onRecvPing(int err, int numBytes, DTun::UInt32 ip, DTun::UInt16 port, int connIdx, const boost::shared_ptr<std::vector<char> >& rcvBuff)
     {
         boost::mutex::scoped_lock lock(m_);
@@ -332,37 +327,19 @@ namespace DNode
 
     void RendezvousSymmConnSession::sendReady()
     {
-        DTun::DProtocolHeader header;
         DTun::DProtocolMsgReady msg;
 
-        header.msgCode = DPROTOCOL_MSG_READY;
         msg.connId = DTun::toProtocolConnId(connId());
 
-        boost::shared_ptr<std::vector<char> > sndBuff =
-            boost::make_shared<std::vector<char> >(sizeof(header) + sizeof(msg));
-
-        memcpy(&(*sndBuff)[0], &header, sizeof(header));
-        memcpy(&(*sndBuff)[0] + sizeof(header), &msg, sizeof(msg));
-
-        serverConn_->write(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
-            boost::bind(&RendezvousSymmConnSession::onServerSend, _1, sndBuff));
+        serverConn_->sendMsg(DPROTOCOL_MSG_READY, &msg, sizeof(msg));
     }
 
     void RendezvousSymmConnSession::sendNext()
     {
-        DTun::DProtocolHeader header;
         DTun::DProtocolMsgNext msg;
 
-        header.msgCode = DPROTOCOL_MSG_NEXT;
         msg.connId = DTun::toProtocolConnId(connId());
 
-        boost::shared_ptr<std::vector<char> > sndBuff =
-            boost::make_shared<std::vector<char> >(sizeof(header) + sizeof(msg));
-
-        memcpy(&(*sndBuff)[0], &header, sizeof(header));
-        memcpy(&(*sndBuff)[0] + sizeof(header), &msg, sizeof(msg));
-
-        serverConn_->write(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
-            boost::bind(&RendezvousSymmConnSession::onServerSend, _1, sndBuff));
+        serverConn_->sendMsg(DPROTOCOL_MSG_NEXT, &msg, sizeof(msg));
     }
 }
@@ -19,7 +19,7 @@ namespace DNode
             const boost::shared_ptr<PortAllocator>& portAllocator, bool bestEffort);
         ~RendezvousSymmConnSession();
 
-        bool start(const boost::shared_ptr<DTun::SConnection>& serverConn,
+        bool start(const boost::shared_ptr<DTun::DProtocolConnection>& serverConn,
             const Callback& callback);
 
         virtual void onMsg(DTun::UInt8 msgId, const void* msg);
@@ -27,7 +27,6 @@ namespace DNode
         virtual void onEstablished();
 
     private:
-        static void onServerSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff);
 
         void onPortReservation();
         void onPingSend(int err, const boost::shared_ptr<std::vector<char> >& sndBuff);
@@ -53,7 +52,7 @@ namespace DNode
         DTun::UInt16 destPort_;
         boost::shared_ptr<DTun::OpWatch> watch_;
         boost::shared_ptr<PortReservation> portReservation_;
-        boost::shared_ptr<DTun::SConnection> serverConn_;
+        boost::shared_ptr<DTun::DProtocolConnection> serverConn_;
         std::vector<boost::shared_ptr<DTun::SConnection> > pingConns_;
     };
 }
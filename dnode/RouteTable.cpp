@@ -0,0 +1,105 @@
+#include "RouteTable.h"
+#include <arpa/inet.h>
+
+namespace DNode
+{
+    RouteTable::RouteTable()
+    : defaultRoute_(-1)
+    , nodes_(1)
+    {
+    }
+
+    RouteTable::~RouteTable()
+    {
+    }
+
+    bool RouteTable::add(DTun::UInt32 ip, DTun::UInt32 mask, const boost::optional<DTun::UInt32>& nodeId)
+    {
+        DTun::UInt32 hostIp = ntohl(ip);
+        DTun::UInt32 hostMask = ntohl(mask);
+
+        int prefixLen = 0;
+        while ((prefixLen < 32) && (hostMask & (0x80000000U >> prefixLen))) {
+            ++prefixLen;
+        }
+
+        if (hostMask != (prefixLen ? (0xFFFFFFFFU << (32 - prefixLen)) : 0)) {
+            return false;
+        }
+
+        hostIp &= hostMask;
+
+        Route route;
+
+        route.ip = htonl(hostIp);
+        route.mask = mask;
+        route.nodeId = nodeId;
+
+        routes_.push_back(route);
+
+        int routeIdx = routes_.size() - 1;
+
+        if (prefixLen == 0) {
+            if (defaultRoute_ < 0) {
+                defaultRoute_ = routeIdx;
+            }
+            return true;
+        }
+
+        // prefix ends at 'level', its last 'bits' bits are expanded over the node entries.
+        int level = (prefixLen - 1) / 8;
+        int bits = prefixLen - (level * 8);
+
+        DTun::UInt32 nodeIdx = 0;
+
+        for (int i = 0; i < level; ++i) {
+            int b = (hostIp >> (24 - (i * 8))) & 0xFF;
+            if (!nodes_[nodeIdx].entries[b].child) {
+                nodes_.push_back(Node());
+                nodes_[nodeIdx].entries[b].child = nodes_.size() - 1;
+            }
+            nodeIdx = nodes_[nodeIdx].entries[b].child;
+        }
+
+        int first = (hostIp >> (24 - (level * 8))) & 0xFF;
+        int last = first + (1 << (8 - bits));
+
+        for (int b = first; b < last; ++b) {
+            Entry& entry = nodes_[nodeIdx].entries[b];
+            if ((entry.route < 0) || (entry.prefixLen < prefixLen)) {
+                entry.route = routeIdx;
+                entry.prefixLen = prefixLen;
+            }
+        }
+
+        return true;
+    }
+
+    bool RouteTable::lookup(DTun::UInt32 ip, DTun::UInt32& nodeId) const
+    {
+        DTun::UInt32 hostIp = ntohl(ip);
+
+        // entries deeper in the trie always have longer prefixes.
+        int best = defaultRoute_;
+        DTun::UInt32 nodeIdx = 0;
+
+        for (int i = 0; i < 4; ++i) {
+            const Entry& entry = nodes_[nodeIdx].entries[(hostIp >> (24 - (i * 8))) & 0xFF];
+            if (entry.route >= 0) {
+                best = entry.route;
+            }
+            if (!entry.child) {
+                break;
+            }
+            nodeIdx = entry.child;
+        }
+
+        if ((best < 0) || !routes_[best].nodeId) {
+            return false;
+        }
+
+        nodeId = *routes_[best].nodeId;
+
+        return true;
+    }
+}
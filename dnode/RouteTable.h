@@ -0,0 +1,73 @@
+#ifndef _ROUTETABLE_H_
+#define _ROUTETABLE_H_
+
+#include "DTun/Types.h"
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <vector>
+
+namespace DNode
+{
+    /*
+     * Longest prefix match route table, multibit trie with 8 bit strides,
+     * so a lookup is at most 4 node visits regardless of the number of routes.
+     * Built once and never modified after, readers share it
+     * via shared_ptr snapshots, no locking needed.
+     */
+    class RouteTable : boost::noncopyable
+    {
+    public:
+        struct Route
+        {
+            Route()
+            : ip(0)
+            , mask(0) {}
+
+            DTun::UInt32 ip;
+            DTun::UInt32 mask;
+            // no nodeId - route excludes the prefix.
+            boost::optional<DTun::UInt32> nodeId;
+        };
+
+        typedef std::vector<Route> Routes;
+
+        RouteTable();
+        ~RouteTable();
+
+        // 'ip' and 'mask' in network byte order, 'mask' must be contiguous.
+        // For duplicate prefixes first one wins.
+        bool add(DTun::UInt32 ip, DTun::UInt32 mask, const boost::optional<DTun::UInt32>& nodeId);
+
+        // false if no route or the most specific one has no nodeId.
+        bool lookup(DTun::UInt32 ip, DTun::UInt32& nodeId) const;
+
+        inline const Routes& routes() const { return routes_; }
+
+        inline int numNodes() const { return nodes_.size(); }
+
+    private:
+        struct Entry
+        {
+            Entry()
+            : child(0)
+            , route(-1)
+            , prefixLen(0) {}
+
+            // 0 - no child, root is never a child.
+            DTun::UInt32 child;
+            int route;
+            int prefixLen;
+        };
+
+        struct Node
+        {
+            Entry entries[256];
+        };
+
+        Routes routes_;
+        int defaultRoute_;
+        std::vector<Node> nodes_;
+    };
+}
+
+#endif
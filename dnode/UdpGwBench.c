@@ -0,0 +1,221 @@
+/*
+ * Packets/s through udpgw_submit_packet with many flows, each flow has its
+ * socket and sends to a loopback socket that is never read, so this
+ * measures the path from the device to the kernel: flow lookup, connection
+ * management and the send itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <misc/debug.h>
+#include <misc/byteorder.h>
+#include <base/BLog.h>
+#include <system/BTime.h>
+#include <system/BNetwork.h>
+#include <system/BReactor.h>
+#include <udpgw/udpgw.h>
+
+#define BENCH_UDP_MTU 1472
+#define BENCH_PAYLOAD_LEN 100
+// packets submitted per reactor iteration
+#define BENCH_BATCH 64
+
+static BReactor reactor;
+static uint8_t payload[BENCH_PAYLOAD_LEN];
+
+static struct {
+    BAddr sink_addr;
+    int num_flows;
+    int rounds;
+    int max_connections;
+    int res;
+    // setting up connections, not measured unless flows are reused
+    int warming_up;
+    // always readable, stands in for a busy device
+    int busy_fds[2];
+    BFileDescriptor busy_bfd;
+    int num_packets;
+    int submitted;
+    btime_t start;
+} bench_state;
+
+static void udpgw_handler_received_func (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+{
+}
+
+static int open_sink (BAddr *addr)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t sa_len = sizeof(sa);
+
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || getsockname(fd, (struct sockaddr *)&sa, &sa_len) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    BAddr_InitIPv4(addr, sa.sin_addr.s_addr, sa.sin_port);
+
+    return fd;
+}
+
+static int bench_start (int num_flows, int max_connections, int rounds)
+{
+    char max_connections_str[16];
+    sprintf(max_connections_str, "%d", max_connections);
+    char *argv[] = {"udpgw-bench", "--max-connections-for-client", max_connections_str, NULL};
+
+    if (!udpgw_init(3, argv, &reactor, BENCH_UDP_MTU, NULL, udpgw_handler_received_func)) {
+        fprintf(stderr, "udpgw_init failed\n");
+        return 0;
+    }
+
+    bench_state.num_flows = num_flows;
+    bench_state.rounds = rounds;
+    bench_state.warming_up = 1;
+    bench_state.num_packets = (num_flows < max_connections ? num_flows : max_connections);
+    bench_state.submitted = 0;
+
+    return 1;
+}
+
+static void bench_finish (void)
+{
+    btime_t elapsed = btime_gettime() - bench_state.start;
+    if (elapsed <= 0) {
+        elapsed = 1;
+    }
+
+    printf("flows = %d, max connections = %d: %d packets in %d ms, %.0f packets/s\n",
+           bench_state.num_flows, bench_state.max_connections, bench_state.num_packets, (int)elapsed,
+           (double)bench_state.num_packets * 1000 / elapsed);
+
+    udpgw_cleanup();
+}
+
+// Packets are submitted in batches from a file descriptor event, letting
+// the reactor run in between like it does between device reads.
+static void busy_handler (void *unused, int events)
+{
+    if (bench_state.submitted == bench_state.num_packets) {
+        if (bench_state.warming_up) {
+            bench_state.warming_up = 0;
+            bench_state.num_packets = bench_state.num_flows * bench_state.rounds;
+            bench_state.submitted = 0;
+            bench_state.start = btime_gettime();
+        } else if (bench_state.num_flows == bench_state.max_connections) {
+            bench_finish();
+
+            // twice the flows, every packet replaces the least recently used
+            // connection, so this is socket setup and teardown
+            int rounds = bench_state.rounds / 20 > 0 ? bench_state.rounds / 20 : 1;
+            if (!bench_start(bench_state.num_flows * 2, bench_state.max_connections, rounds)) {
+                bench_state.res = 0;
+                BReactor_RemoveFileDescriptor(&reactor, &bench_state.busy_bfd);
+                BReactor_Quit(&reactor, 0);
+                return;
+            }
+        } else {
+            bench_finish();
+            BReactor_RemoveFileDescriptor(&reactor, &bench_state.busy_bfd);
+            BReactor_Quit(&reactor, 0);
+            return;
+        }
+    }
+
+    for (int i = 0; i < BENCH_BATCH && bench_state.submitted < bench_state.num_packets; i++) {
+        BAddr local_addr;
+        BAddr_InitIPv4(&local_addr, hton32(0x0A000001), hton16(1024 + bench_state.submitted % bench_state.num_flows));
+        udpgw_submit_packet(local_addr, bench_state.sink_addr, 0, payload, sizeof(payload));
+        bench_state.submitted++;
+    }
+}
+
+int main (int argc, char **argv)
+{
+    int num_flows = 1000;
+    int rounds = 1000;
+
+    if (argc > 1) {
+        num_flows = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        rounds = atoi(argv[2]);
+    }
+
+    if (num_flows <= 0 || num_flows > 30000 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [flows] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    BLog_InitStderr();
+    BLog_SetChannelLoglevel(0, BLOG_WARNING);
+
+    BTime_Init();
+
+    if (!BNetwork_GlobalInit()) {
+        fprintf(stderr, "BNetwork_GlobalInit failed\n");
+        return 1;
+    }
+
+    if (!BReactor_Init(&reactor)) {
+        fprintf(stderr, "BReactor_Init failed\n");
+        return 1;
+    }
+
+    BAddr sink_addr;
+    int sink_fd = open_sink(&sink_addr);
+    if (sink_fd < 0) {
+        fprintf(stderr, "failed to open sink socket\n");
+        BReactor_Free(&reactor);
+        return 1;
+    }
+
+    memset(payload, 0xAB, sizeof(payload));
+
+    bench_state.sink_addr = sink_addr;
+    bench_state.max_connections = num_flows;
+    bench_state.res = 1;
+
+    if (pipe(bench_state.busy_fds) < 0 || write(bench_state.busy_fds[1], "x", 1) != 1) {
+        fprintf(stderr, "failed to create pipe\n");
+        close(sink_fd);
+        BReactor_Free(&reactor);
+        return 1;
+    }
+
+    BFileDescriptor_Init(&bench_state.busy_bfd, bench_state.busy_fds[0], busy_handler, NULL);
+
+    // every flow has its connection
+    if (!bench_start(num_flows, num_flows, rounds)) {
+        bench_state.res = 0;
+    } else if (!BReactor_AddFileDescriptor(&reactor, &bench_state.busy_bfd)) {
+        fprintf(stderr, "BReactor_AddFileDescriptor failed\n");
+        bench_finish();
+        bench_state.res = 0;
+    } else {
+        BReactor_SetFileDescriptorEvents(&reactor, &bench_state.busy_bfd, BREACTOR_READ);
+        BReactor_Exec(&reactor);
+    }
+
+    close(bench_state.busy_fds[0]);
+    close(bench_state.busy_fds[1]);
+    close(sink_fd);
+    BReactor_Free(&reactor);
+    BLog_Free();
+
+    return bench_state.res ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+#include "UdpProxySession.h"
+#include "DTun/Utils.h"
+#include "Logger.h"
+#include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
+
+#define DTUN_UDP_PROXY_BUFF_SIZE (64 * 1024)
+
+namespace DNode
+{
+    UdpProxySession::UdpProxySession(DTun::SManager& localMgr)
+    : localMgr_(localMgr)
+    , remoteIp_(0)
+    , remotePort_(0)
+    , done_(false)
+    , active_(false)
+    , remoteRcvBuff_(sizeof(UdpProxyHeader) + DTUN_UDP_PROXY_BUFF_SIZE)
+    , watch_(boost::make_shared<DTun::OpWatch>(boost::ref(localMgr.reactor())))
+    {
+    }
+
+    UdpProxySession::~UdpProxySession()
+    {
+        watch_->close();
+
+        for (Flows::iterator it = flows_.begin(); it != flows_.end(); ++it) {
+            it->second->conn->close();
+        }
+
+        if (remoteConn_) {
+            remoteConn_->close();
+        }
+    }
+
+    bool UdpProxySession::start(const boost::shared_ptr<DTun::SHandle>& remoteHandle,
+        DTun::UInt32 remoteIp, DTun::UInt16 remotePort, const DoneCallback& callback)
+    {
+        DTun::UInt32 ip;
+        DTun::UInt16 port;
+        remoteHandle->getSockName(ip, port);
+        LOG4CPLUS_INFO(logger(), "UDP LOCAL PORT = " << ntohs(port) << ", PEER = " << DTun::ipPortToString(remoteIp, remotePort));
+
+        boost::mutex::scoped_lock lock(m_);
+
+        remoteIp_ = remoteIp;
+        remotePort_ = remotePort;
+        callback_ = callback;
+
+        remoteConn_ = remoteHandle->createConnection();
+
+        recvRemote();
+
+        localMgr_.reactor().post(
+            watch_->wrap(boost::bind(&UdpProxySession::onIdleTimeout, this)), DNODE_UDP_PROXY_IDLE_TIMEOUT_MS);
+
+        return true;
+    }
+
+    void UdpProxySession::onLocalSend(int err)
+    {
+        boost::mutex::scoped_lock lock(m_);
+        if (done_) {
+            return;
+        }
+
+        if (err) {
+            LOG4CPLUS_TRACE(logger(), "UdpProxySession::onLocalSend(" << err << ")");
+        }
+
+        recvRemote();
+    }
+
+    void UdpProxySession::onLocalRecv(const boost::shared_ptr<Flow>& flow, int err, int numBytes, DTun::UInt32 ip, DTun::UInt16 port)
+    {
+        boost::mutex::scoped_lock lock(m_);
+        if (done_) {
+            return;
+        }
+
+        Flows::iterator it = flows_.find(flow->flowId);
+        if ((it == flows_.end()) || (it->second != flow)) {
+            // expired.
+            return;
+        }
+
+        if (err) {
+            LOG4CPLUS_ERROR(logger(), "UdpProxySession::onLocalRecv(" << err << ")");
+            flows_.erase(it);
+            flow->conn->close();
+            return;
+        }
+
+        if ((ip != flow->ip) || (port != flow->port)) {
+            recvLocal(flow);
+            return;
+        }
+
+        active_ = true;
+        flow->active = true;
+
+        UdpProxyHeader header;
+        header.magic = DNODE_UDP_PROXY_MAGIC;
+        header.flowId = flow->flowId;
+        header.ip = flow->ip;
+        header.port = flow->port;
+        memcpy(&flow->rcvBuff[0], &header, sizeof(header));
+
+        remoteConn_->writeTo(&flow->rcvBuff[0], &flow->rcvBuff[0] + sizeof(header) + numBytes, remoteIp_, remotePort_,
+            watch_->wrap<int>(boost::bind(&UdpProxySession::onRemoteSend, this, flow, _1)));
+    }
+
+    void UdpProxySession::onRemoteSend(const boost::shared_ptr<Flow>& flow, int err)
+    {
+        boost::mutex::scoped_lock lock(m_);
+        if (done_) {
+            return;
+        }
+
+        if (err) {
+            LOG4CPLUS_TRACE(logger(), "UdpProxySession::onRemoteSend(" << err << ")");
+        }
+
+        Flows::iterator it = flows_.find(flow->flowId);
+        if ((it != flows_.end()) && (it->second == flow)) {
+            recvLocal(flow);
+        }
+    }
+
+    void UdpProxySession::onRemoteRecv(int err, int numBytes, DTun::UInt32 ip, DTun::UInt16 port)
+    {
+        boost::mutex::scoped_lock lock(m_);
+        if (done_) {
+            return;
+        }
+
+        if (err) {
+            LOG4CPLUS_ERROR(logger(), "UdpProxySession::onRemoteRecv(" << err << ")");
+            done(lock);
+            return;
+        }
+
+        UdpProxyHeader header;
+
+        if ((ip != remoteIp_) || (port != remotePort_) || (numBytes < (int)sizeof(header))) {
+            recvRemote();
+            return;
+        }
+
+        memcpy(&header, &remoteRcvBuff_[0], sizeof(header));
+
+        if (header.magic != DNODE_UDP_PROXY_MAGIC) {
+            recvRemote();
+            return;
+        }
+
+        active_ = true;
+
+        boost::shared_ptr<Flow> flow;
+
+        Flows::iterator it = flows_.find(header.flowId);
+        if (it != flows_.end()) {
+            flow = it->second;
+            if ((flow->ip != header.ip) || (flow->port != header.port)) {
+                recvRemote();
+                return;
+            }
+        } else if (!(flow = openFlow(header.flowId, header.ip, header.port))) {
+            recvRemote();
+            return;
+        }
+
+        flow->active = true;
+
+        flow->conn->writeTo(&remoteRcvBuff_[0] + sizeof(header), &remoteRcvBuff_[0] + numBytes, flow->ip, flow->port,
+            watch_->wrap<int>(boost::bind(&UdpProxySession::onLocalSend, this, _1)));
+    }
+
+    void UdpProxySession::onIdleTimeout()
+    {
+        boost::mutex::scoped_lock lock(m_);
+        if (done_) {
+            return;
+        }
+
+        for (Flows::iterator it = flows_.begin(); it != flows_.end();) {
+            if (it->second->active) {
+                it->second->active = false;
+                ++it;
+            } else {
+                LOG4CPLUS_INFO(logger(), "UDP flow to " << DTun::ipPortToString(it->second->ip, it->second->port) << " idle, closing");
+                it->second->conn->close();
+                flows_.erase(it++);
+            }
+        }
+
+        if (!active_ && flows_.empty()) {
+            LOG4CPLUS_INFO(logger(), "UDP tunnel from " << DTun::ipPortToString(remoteIp_, remotePort_) << " idle, closing");
+            done(lock);
+            return;
+        }
+
+        active_ = false;
+
+        localMgr_.reactor().post(
+            watch_->wrap(boost::bind(&UdpProxySession::onIdleTimeout, this)), DNODE_UDP_PROXY_IDLE_TIMEOUT_MS);
+    }
+
+    boost::shared_ptr<UdpProxySession::Flow> UdpProxySession::openFlow(DTun::UInt32 flowId, DTun::UInt32 ip, DTun::UInt16 port)
+    {
+        if (flows_.size() >= DNODE_UDP_PROXY_MAX_TUNNEL_FLOWS) {
+            LOG4CPLUS_WARN(logger(), "too many UDP flows from " << DTun::ipPortToString(remoteIp_, remotePort_)
+                << ", dropping datagram to " << DTun::ipPortToString(ip, port));
+            return boost::shared_ptr<Flow>();
+        }
+
+        boost::shared_ptr<DTun::SHandle> localHandle = localMgr_.createDatagramSocket();
+        if (!localHandle) {
+            return boost::shared_ptr<Flow>();
+        }
+
+        struct sockaddr_in addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = 0;
+
+        if (!localHandle->bind((const struct sockaddr*)&addr, sizeof(addr))) {
+            localHandle->close();
+            return boost::shared_ptr<Flow>();
+        }
+
+        LOG4CPLUS_INFO(logger(), "new UDP flow from " << DTun::ipPortToString(remoteIp_, remotePort_)
+            << " to " << DTun::ipPortToString(ip, port));
+
+        boost::shared_ptr<Flow> flow = boost::make_shared<Flow>();
+
+        flow->flowId = flowId;
+        flow->ip = ip;
+        flow->port = port;
+        flow->rcvBuff.resize(sizeof(UdpProxyHeader) + DTUN_UDP_PROXY_BUFF_SIZE);
+        flow->conn = localHandle->createConnection();
+
+        flows_[flowId] = flow;
+
+        recvLocal(flow);
+
+        return flow;
+    }
+
+    void UdpProxySession::recvLocal(const boost::shared_ptr<Flow>& flow)
+    {
+        flow->conn->readFrom(&flow->rcvBuff[0] + sizeof(UdpProxyHeader), &flow->rcvBuff[0] + flow->rcvBuff.size(),
+            watch_->wrap<int, int, DTun::UInt32, DTun::UInt16>(
+                boost::bind(&UdpProxySession::onLocalRecv, this, flow, _1, _2, _3, _4)));
+    }
+
+    void UdpProxySession::recvRemote()
+    {
+        remoteConn_->readFrom(&remoteRcvBuff_[0], &remoteRcvBuff_[0] + remoteRcvBuff_.size(),
+            watch_->wrap<int, int, DTun::UInt32, DTun::UInt16>(
+                boost::bind(&UdpProxySession::onRemoteRecv, this, _1, _2, _3, _4)));
+    }
+
+    void UdpProxySession::done(boost::mutex::scoped_lock& lock)
+    {
+        done_ = true;
+        DoneCallback cb = callback_;
+        lock.unlock();
+        // may destroy us.
+        cb();
+    }
+}
@@ -0,0 +1,114 @@
+#ifndef _UDPPROXYSESSION_H_
+#define _UDPPROXYSESSION_H_
+
+#include "DTun/Types.h"
+#include "DTun/SManager.h"
+#include "DTun/SConnection.h"
+#include "DTun/OpWatch.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/function.hpp>
+#include <vector>
+#include <map>
+
+// First byte of every datagram of a UDP tunnel, anything else arriving at
+// the hole-punched socket (late rendezvous pings, relay bind echoes) is
+// dropped.
+#define DNODE_UDP_PROXY_MAGIC 0xE2
+
+// Flow is closed after this long without datagrams in either direction,
+// the tunnel after this long without flows.
+#define DNODE_UDP_PROXY_IDLE_TIMEOUT_MS 60000
+
+// Flows the far end opens per tunnel.
+#define DNODE_UDP_PROXY_MAX_TUNNEL_FLOWS 1024
+
+namespace DNode
+{
+    #pragma pack(1)
+    // All UDP flows to a node share one hole-punched socket, every
+    // datagram is prefixed with this. 'flowId' is picked by the node that
+    // opened the tunnel, 'ip'/'port' - the flow's destination, so any
+    // datagram, not just the first one, opens the flow on the far end.
+    struct UdpProxyHeader
+    {
+        DTun::UInt8 magic;
+        DTun::UInt32 flowId;
+        DTun::UInt32 ip;
+        DTun::UInt16 port;
+    };
+    #pragma pack()
+
+    /*
+     * Far end of a UDP tunnel from a peer node. Keeps a NAT table of the
+     * tunnel's flows, each flow has a socket of its own towards its
+     * destination, so replies find their way back to the flow.
+     */
+    class UdpProxySession : boost::noncopyable
+    {
+    public:
+        typedef boost::function<void ()> DoneCallback;
+
+        explicit UdpProxySession(DTun::SManager& localMgr);
+        ~UdpProxySession();
+
+        // 'remoteHandle' is a datagram handle, 'remoteIp'/'remotePort' - peer node.
+        bool start(const boost::shared_ptr<DTun::SHandle>& remoteHandle,
+            DTun::UInt32 remoteIp, DTun::UInt16 remotePort, const DoneCallback& callback);
+
+    private:
+        struct Flow
+        {
+            Flow()
+            : flowId(0)
+            , ip(0)
+            , port(0)
+            , active(true) {}
+
+            DTun::UInt32 flowId;
+            DTun::UInt32 ip;
+            DTun::UInt16 port;
+            // datagrams since the last idle check.
+            bool active;
+            // header + datagram.
+            std::vector<char> rcvBuff;
+            boost::shared_ptr<DTun::SConnection> conn;
+        };
+
+        typedef std::map<DTun::UInt32, boost::shared_ptr<Flow> > Flows;
+
+        void onLocalSend(int err);
+        void onLocalRecv(const boost::shared_ptr<Flow>& flow, int err, int numBytes, DTun::UInt32 ip, DTun::UInt16 port);
+
+        void onRemoteSend(const boost::shared_ptr<Flow>& flow, int err);
+        void onRemoteRecv(int err, int numBytes, DTun::UInt32 ip, DTun::UInt16 port);
+
+        void onIdleTimeout();
+
+        boost::shared_ptr<Flow> openFlow(DTun::UInt32 flowId, DTun::UInt32 ip, DTun::UInt16 port);
+
+        void recvLocal(const boost::shared_ptr<Flow>& flow);
+        void recvRemote();
+
+        void done(boost::mutex::scoped_lock& lock);
+
+        DTun::SManager& localMgr_;
+        DoneCallback callback_;
+
+        DTun::UInt32 remoteIp_;
+        DTun::UInt16 remotePort_;
+
+        boost::mutex m_;
+        bool done_;
+        bool active_;
+
+        Flows flows_;
+
+        // header + datagram.
+        std::vector<char> remoteRcvBuff_;
+
+        boost::shared_ptr<DTun::SConnection> remoteConn_;
+        boost::shared_ptr<DTun::OpWatch> watch_;
+    };
+}
+
+#endif
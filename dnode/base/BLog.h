@@ -51,8 +51,13 @@
 #define BLOG_INFO 4
 #define BLOG_DEBUG 5
 
-#define BLog(...) BLog_LogToChannel(BLOG_CURRENT_CHANNEL, __VA_ARGS__)
-#define BContextLog(context, ...) BLog_ContextLog((context), BLOG_CURRENT_CHANNEL, __VA_ARGS__)
+// messages above this level are compiled out
+#ifndef BLOG_MAX_LEVEL
+#define BLOG_MAX_LEVEL BLOG_DEBUG
+#endif
+
+#define BLog(level, ...) do { if ((level) <= BLOG_MAX_LEVEL) BLog_LogToChannel(BLOG_CURRENT_CHANNEL, (level), __VA_ARGS__); } while (0)
+#define BContextLog(context, level, ...) do { if ((level) <= BLOG_MAX_LEVEL) BLog_ContextLog((context), BLOG_CURRENT_CHANNEL, (level), __VA_ARGS__); } while (0)
 #define BLOG_CCCC(context) BLog_MakeChannelContext((context), BLOG_CURRENT_CHANNEL)
 
 typedef void (*_BLog_log_func) (int channel, int level, const char *msg);
@@ -184,7 +189,7 @@ int BLog_WouldLog (int channel, int level)
     ASSERT(channel >= 0 && channel < BLOG_NUM_CHANNELS)
     ASSERT(level >= BLOG_ERROR && level <= BLOG_DEBUG)
 
-    return (level <= blog_global.channels[channel].loglevel);
+    return (level <= BLOG_MAX_LEVEL && level <= blog_global.channels[channel].loglevel);
 }
 
 void BLog_Begin (void)
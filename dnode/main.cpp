@@ -15,8 +15,15 @@
 #include <boost/make_shared.hpp>
 #include <log4cplus/configurator.h>
 #include <iostream>
+#include <sys/stat.h>
 
-extern "C" int tun2socks_main(int argc, char **argv, int is_debugged, void (*stats_handler)(void*));
+extern "C" int tun2socks_main(int argc, char **argv, int is_debugged, void (*stats_handler)(void*), void (*reload_handler)(int));
+
+static std::string appConfigFile = "config.ini";
+static struct stat appConfigStat;
+// change seen on the last poll, reloaded once the file stays like this
+static bool appConfigChanging = false;
+static struct stat appConfigChangingStat;
 
 static void udtReactorThreadFn(DTun::UDTReactor& reactor)
 {
@@ -33,6 +40,62 @@ extern "C" void theStatsHandler(void*)
     DNode::theMasterClient->dump();
 }
 
+static bool statDiffers(const struct stat& st1, const struct stat& st2)
+{
+    return (st1.st_ino != st2.st_ino) || (st1.st_size != st2.st_size) ||
+        (st1.st_mtim.tv_sec != st2.st_mtim.tv_sec) || (st1.st_mtim.tv_nsec != st2.st_mtim.tv_nsec);
+}
+
+// 'force' is set on SIGHUP, otherwise only reload if the file was changed
+// and then stayed the same for a poll, so that a file being written isn't
+// picked up half way.
+extern "C" void theReloadHandler(int force)
+{
+    struct stat st;
+
+    if (::stat(appConfigFile.c_str(), &st) != 0) {
+        if (force) {
+            LOG4CPLUS_WARN(DNode::logger(), "App config file " << appConfigFile << " not found, not reloading");
+        }
+        return;
+    }
+
+    if (!force) {
+        if (!statDiffers(st, appConfigStat)) {
+            appConfigChanging = false;
+            return;
+        }
+
+        if (!appConfigChanging || statDiffers(st, appConfigChangingStat)) {
+            appConfigChanging = true;
+            appConfigChangingStat = st;
+            return;
+        }
+    }
+
+    appConfigChanging = false;
+    appConfigStat = st;
+
+    boost::shared_ptr<DTun::StreamAppConfig> appConfig =
+        boost::make_shared<DTun::StreamAppConfig>();
+
+    std::ifstream is(appConfigFile.c_str());
+
+    if (!is || !appConfig->load(is)) {
+        LOG4CPLUS_WARN(DNode::logger(), "Cannot parse app config file " << appConfigFile << ", not reloading");
+        return;
+    }
+
+    // an empty or truncated file parses fine, don't let it wipe routes and ports
+    if (!appConfig->isPresent("node.numSymmPorts") || !appConfig->isPresent("node.numFastPorts") ||
+        !appConfig->isPresent("node.decayTimeoutMs")) {
+        LOG4CPLUS_WARN(DNode::logger(), "App config file " << appConfigFile << " has no node.numSymmPorts, node.numFastPorts or node.decayTimeoutMs, not reloading");
+        return;
+    }
+
+    DNode::theMasterClient->reloadConfig(appConfig);
+}
+
 extern "C" int tun2socks_needs_proxy(uint32_t ip)
 {
     DTun::UInt32 tmp = 0;
@@ -44,30 +107,48 @@ namespace DNode
     DTun::SManager* theRemoteMgr = NULL;
 }
 
+// flushes queued log events on every way out of main.
+struct LogShutdown
+{
+    ~LogShutdown()
+    {
+        log4cplus::Logger::shutdown();
+    }
+};
+
 int main(int argc, char* argv[])
 {
     boost::program_options::variables_map vm;
-    std::string logLevel = "TRACE";
-    std::string appConfigFile = "config.ini";
+    std::string logLevel = "INFO";
+    bool logSync = false;
     bool ltudp = false;
     bool utp = false;
+    std::string udtCCStr = "udt";
+    DTun::UDTManager::CongestionControl udtCC = DTun::UDTManager::CongestionControlUDT;
 
     try {
         boost::program_options::options_description desc("Options");
 
         desc.add_options()
             ("log4cplus_level", boost::program_options::value<std::string>(&logLevel), "Log level")
+            ("log_sync", "Write log from the logging thread, not from a background one")
             ("app_config", boost::program_options::value<std::string>(&appConfigFile), "App config")
             ("ltudp", "LTUDP")
-            ("utp", "UTP");
+            ("utp", "UTP")
+            ("udt_cc", boost::program_options::value<std::string>(&udtCCStr), "UDT congestion control: udt, bbr or cubic");
 
         boost::program_options::store(boost::program_options::command_line_parser(
             argc, argv).options(desc).allow_unregistered().run(), vm);
 
         boost::program_options::notify(vm);
 
+        logSync = (vm.count("log_sync") > 0);
         ltudp = (vm.count("ltudp") > 0);
         utp = (vm.count("utp") > 0);
+
+        if (!DTun::UDTManager::parseCongestionControl(udtCCStr, udtCC)) {
+            throw boost::program_options::error("udt_cc must be udt, bbr or cubic");
+        }
     } catch (const boost::program_options::error& e) {
         std::cerr << "Invalid command line arguments: " << e.what() << std::endl;
         return 1;
@@ -79,16 +160,31 @@ int main(int argc, char* argv[])
     log4cplus::helpers::Properties props;
 
     props.setProperty("log4cplus.rootLogger", logLevel + ", console");
-    props.setProperty("log4cplus.appender.console", "log4cplus::ConsoleAppender");
-    props.setProperty("log4cplus.appender.console.layout", "log4cplus::PatternLayout");
-    props.setProperty("log4cplus.appender.console.layout.ConversionPattern", "%D{%m/%d/%y %H:%M:%S.%q} %-5p %c [%x] - %m%n");
+    if (logSync) {
+        props.setProperty("log4cplus.appender.console", "log4cplus::ConsoleAppender");
+        props.setProperty("log4cplus.appender.console.layout", "log4cplus::PatternLayout");
+        props.setProperty("log4cplus.appender.console.layout.ConversionPattern", "%D{%m/%d/%y %H:%M:%S.%q} %-5p %c [%x] - %m%n");
+    } else {
+        // events are queued and written by the appender's own thread, so
+        // reactor threads don't block on the console.
+        props.setProperty("log4cplus.appender.console", "log4cplus::AsyncAppender");
+        props.setProperty("log4cplus.appender.console.QueueLimit", "10000");
+        props.setProperty("log4cplus.appender.console.Appender", "log4cplus::ConsoleAppender");
+        props.setProperty("log4cplus.appender.console.Appender.layout", "log4cplus::PatternLayout");
+        props.setProperty("log4cplus.appender.console.Appender.layout.ConversionPattern", "%D{%m/%d/%y %H:%M:%S.%q} %-5p %c [%x] - %m%n");
+    }
 
     log4cplus::PropertyConfigurator propConf(props);
     propConf.configure();
 
+    LogShutdown logShutdown;
+
     boost::shared_ptr<DTun::StreamAppConfig> appConfig =
         boost::make_shared<DTun::StreamAppConfig>();
 
+    // stays zeroed if missing, so the file showing up later triggers a reload.
+    ::stat(appConfigFile.c_str(), &appConfigStat);
+
     std::ifstream is(appConfigFile.c_str());
 
     if (is) {
@@ -146,7 +242,7 @@ int main(int argc, char* argv[])
                     return 1;
                 }
             } else {
-                remoteMgr.reset(new DTun::UDTManager(*udtReactor));
+                remoteMgr.reset(new DTun::UDTManager(*udtReactor, udtCC));
             }
 
             DTun::SysManager sysManager(sysReactor);
@@ -171,7 +267,7 @@ int main(int argc, char* argv[])
             DNode::theMasterClient = &masterClient;
             DNode::theRemoteMgr = remoteMgr.get();
 
-            res = tun2socks_main(argc, argv, isDebugged, &theStatsHandler);
+            res = tun2socks_main(argc, argv, isDebugged, &theStatsHandler, &theReloadHandler);
 
             DNode::theMasterClient = NULL;
             DNode::theRemoteMgr = NULL;
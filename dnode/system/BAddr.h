@@ -279,6 +279,12 @@ static int BAddr_Compare (BAddr *addr1, BAddr *addr2);
 
 static int BAddr_CompareOrder (BAddr *addr1, BAddr *addr2);
 
+/**
+ * Hashes an address. Addresses equal according to {@link BAddr_Compare}
+ * hash the same.
+ */
+static size_t BAddr_Hash (BAddr *addr);
+
 void BIPAddr_InitInvalid (BIPAddr *addr)
 {
     addr->type = BADDR_TYPE_NONE;
@@ -805,4 +811,38 @@ int BAddr_CompareOrder (BAddr *addr1, BAddr *addr2)
     }
 }
 
+size_t BAddr_Hash (BAddr *addr)
+{
+    BAddr_Assert(addr);
+    
+    // FNV-1a
+    const uint8_t *data;
+    size_t len;
+    uint32_t h = 2166136261u;
+    
+    switch (addr->type) {
+        case BADDR_TYPE_IPV4: {
+            data = (const uint8_t *)&addr->ipv4.ip;
+            len = sizeof(addr->ipv4.ip);
+            h = (h ^ (addr->ipv4.port & 0xFF)) * 16777619u;
+            h = (h ^ (addr->ipv4.port >> 8)) * 16777619u;
+        } break;
+        case BADDR_TYPE_IPV6: {
+            data = addr->ipv6.ip;
+            len = sizeof(addr->ipv6.ip);
+            h = (h ^ (addr->ipv6.port & 0xFF)) * 16777619u;
+            h = (h ^ (addr->ipv6.port >> 8)) * 16777619u;
+        } break;
+        default: {
+            return 0;
+        } break;
+    }
+    
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    
+    return h;
+}
+
 #endif
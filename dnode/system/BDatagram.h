@@ -132,6 +132,22 @@ int BDatagram_GetLastReceiveAddrs (BDatagram *o, BAddr *remote_addr, BIPAddr *lo
  * @return file descriptor
  */
 int BDatagram_GetFd (BDatagram *o);
+
+/**
+ * Sends a datagram to the address set with {@link BDatagram_SetSendAddrs}
+ * right away, without going through the send interface, so the data need
+ * not stay around. Nothing is reported via the handler.
+ * The send interface must not be initialized, and send addresses must have
+ * been set.
+ * Available on Unix-like systems only.
+ * 
+ * @param o the object
+ * @param data data to send
+ * @param data_len length of data. Must be >=0.
+ * @return 1 if sent, 0 if the datagram was dropped because the socket send
+ *         buffer is full, -1 on error
+ */
+int BDatagram_SendNow (BDatagram *o, const uint8_t *data, int data_len);
 #endif
 
 /**
@@ -64,6 +64,8 @@ static void addr_socket_to_sys (struct sys_addr *out, BAddr addr);
 static void addr_sys_to_socket (BAddr *out, struct sys_addr addr);
 static void set_pktinfo (int fd, int family);
 static void report_error (BDatagram *o);
+static int send_packet (BDatagram *o, const uint8_t *data, int data_len);
+static void start_recv (BDatagram *o);
 static void do_send (BDatagram *o);
 static void do_recv (BDatagram *o);
 static void fd_handler (BDatagram *o, int events);
@@ -238,28 +240,17 @@ static void report_error (BDatagram *o)
     return;
 }
 
-static void do_send (BDatagram *o)
+static int send_packet (BDatagram *o, const uint8_t *data, int data_len)
 {
-    DebugError_AssertNoError(&o->d_err);
-    ASSERT(o->send.inited)
-    ASSERT(o->send.busy)
     ASSERT(o->send.have_addrs)
     
-    // limit
-    if (!BReactorLimit_Increment(&o->send.limit)) {
-        // wait for fd
-        o->wait_events |= BREACTOR_WRITE;
-        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
-        return;
-    }
-    
     // convert destination address
     struct sys_addr sysaddr;
     addr_socket_to_sys(&sysaddr, o->send.remote_addr);
     
     struct iovec iov;
-    iov.iov_base = (uint8_t *)o->send.busy_data;
-    iov.iov_len = o->send.busy_data_len;
+    iov.iov_base = (uint8_t *)data;
+    iov.iov_len = data_len;
     
     union {
 #ifdef BADVPN_FREEBSD
@@ -322,7 +313,40 @@ static void do_send (BDatagram *o)
     }
     
     // send
-    int bytes = sendmsg(o->fd, &msg, 0);
+    return sendmsg(o->fd, &msg, 0);
+}
+
+static void start_recv (BDatagram *o)
+{
+    // if recv wasn't started yet, start it
+    if (!o->recv.started) {
+        // set recv started
+        o->recv.started = 1;
+        
+        // continue receiving
+        if (o->recv.inited && o->recv.busy) {
+            BPending_Set(&o->recv.job);
+        }
+    }
+}
+
+static void do_send (BDatagram *o)
+{
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->send.inited)
+    ASSERT(o->send.busy)
+    ASSERT(o->send.have_addrs)
+    
+    // limit
+    if (!BReactorLimit_Increment(&o->send.limit)) {
+        // wait for fd
+        o->wait_events |= BREACTOR_WRITE;
+        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->wait_events);
+        return;
+    }
+    
+    // send
+    int bytes = send_packet(o, o->send.busy_data, o->send.busy_data_len);
     if (bytes < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             // wait for fd
@@ -342,16 +366,8 @@ static void do_send (BDatagram *o)
         BLog(BLOG_ERROR, "send sent too little");
     }
     
-    // if recv wasn't started yet, start it
-    if (!o->recv.started) {
-        // set recv started
-        o->recv.started = 1;
-        
-        // continue receiving
-        if (o->recv.inited && o->recv.busy) {
-            BPending_Set(&o->recv.job);
-        }
-    }
+    // start receiving
+    start_recv(o);
     
     // set not busy
     o->send.busy = 0;
@@ -739,6 +755,33 @@ int BDatagram_GetFd (BDatagram *o)
     return o->fd;
 }
 
+int BDatagram_SendNow (BDatagram *o, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(!o->send.inited)
+    ASSERT(o->send.have_addrs)
+    ASSERT(data_len >= 0)
+    
+    int bytes = send_packet(o, data, data_len);
+    if (bytes < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        
+        return -1;
+    }
+    
+    if (bytes < data_len) {
+        BLog(BLOG_ERROR, "send sent too little");
+    }
+    
+    // start receiving
+    start_recv(o);
+    
+    return 1;
+}
+
 int BDatagram_SetReuseAddr (BDatagram *o, int reuse)
 {
     DebugObject_Access(&o->d_obj);
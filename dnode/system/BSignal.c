@@ -92,7 +92,7 @@ static BOOL WINAPI ctrl_handler (DWORD type)
 
 static void unix_signal_handler (void *user, int signo)
 {
-    ASSERT(signo == SIGTERM || signo == SIGINT || signo == SIGHUP)
+    ASSERT(signo == SIGTERM || signo == SIGINT)
     ASSERT(bsignal_global.initialized)
     ASSERT(!bsignal_global.finished)
     
@@ -139,7 +139,6 @@ int BSignal_Init (BReactor *reactor, BSignal_handler handler, void *user)
     ASSERT_FORCE(sigemptyset(&sset) == 0)
     ASSERT_FORCE(sigaddset(&sset, SIGTERM) == 0)
     ASSERT_FORCE(sigaddset(&sset, SIGINT) == 0)
-    ASSERT_FORCE(sigaddset(&sset, SIGHUP) == 0)
     
     // init BUnixSignal
     if (!BUnixSignal_Init(&bsignal_global.signal, bsignal_global.reactor, sset, unix_signal_handler, NULL)) {
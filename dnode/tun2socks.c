@@ -27,6 +27,7 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <string.h>
@@ -43,6 +44,7 @@
 #include <misc/udp_proto.h>
 #include <misc/byteorder.h>
 #include <misc/balloc.h>
+#include <misc/balign.h>
 #include <misc/open_standard_streams.h>
 #include <misc/read_file.h>
 #include <misc/ipaddr6.h>
@@ -51,11 +53,12 @@
 #include <base/BLog.h>
 #include <system/BReactor.h>
 #include <system/BSignal.h>
+#include <system/BUnixSignal.h>
 #include <system/BAddr.h>
 #include <system/BNetwork.h>
-#include <flow/SinglePacketBuffer.h>
 #include <DNodeDirectTCPClient.h>
 #include <DNodeProxyTCPClient.h>
+#include <DNodeProxyUdpClient.h>
 #include <tuntap/BTap.h>
 #include <lwip/init.h>
 #include <lwip/ip_addr.h>
@@ -65,8 +68,8 @@
 #include <lwip/ip4_frag.h>
 #include <lwip/nd6.h>
 #include <lwip/ip6_frag.h>
+#include <lwip/stats.h>
 #include <udpgw/udpgw.h>
-#include <DNodeUdpGwClient.h>
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
@@ -103,6 +106,10 @@ struct {
     int loglevel;
     int loglevels[BLOG_NUM_CHANNELS];
     char *tundev;
+    int tun_offload;
+    int tcp_wnd;
+    int tcp_snd_buf;
+    int tcp_max_connections;
     char *netif_ipaddr;
     char *netif_netmask;
     char *tun_ns;
@@ -123,14 +130,19 @@ struct tcp_client {
     BAddr remote_addr;
     struct tcp_pcb *pcb;
     int client_closed;
-    uint8_t buf[TCP_WND];
+    // pbufs received from the client, held until DTCP takes the data,
+    // a queue of packets rather than one chain since it may exceed 64 KB
+    struct pbuf *buf;
+    struct pbuf *buf_last;
     int buf_used;
+    // part of lwIP's window kept back so that it's the configured one
+    int rcv_wnd_held;
     struct DNodeTCPClient* dtcp_client;
     int dtcp_up;
     int dtcp_closed;
-    StreamPassInterface *dtcp_send_if;
     StreamRecvInterface *dtcp_recv_if;
-    uint8_t dtcp_recv_buf[CLIENT_DTCP_RECV_BUF_SIZE];
+    // allocated once DTCP is up
+    uint8_t *dtcp_recv_buf;
     int dtcp_recv_buf_used;
     int dtcp_recv_buf_sent;
     int dtcp_recv_waiting;
@@ -161,14 +173,44 @@ BTap device;
 // device write buffer
 uint8_t *device_write_buf;
 
-// device reading
-SinglePacketBuffer device_read_buffer;
-PacketPassInterface device_read_interface;
+// TCP segments coalesced into one TSO packet, sent when a segment can't be
+// appended or by the flush job, after the current burst of jobs
+uint8_t *gso_buf;
+int gso_len;
+int gso_type;
+int gso_ip_header_len;
+int gso_header_len;
+int gso_segment_size;
+int gso_num_segments;
+int gso_closed;
+uint32_t gso_next_seqno;
+BPending gso_flush_job;
+
+// device reading, packets are read into a chain of pool pbufs, the part
+// a packet takes goes to lwip and the chain is topped up again;
+// the buffer is for when pbufs run out and for UDP spanning pbufs
+int device_read_size;
+struct pbuf *device_read_pbuf;
+uint8_t *device_read_buf;
+
+// device I/O counters, logged and reset by the stats timer
+struct {
+    uint64_t read_calls;
+    uint64_t read_packets;
+    uint64_t write_calls;
+    uint64_t write_packets;
+} device_stats;
+
+// TCP counters, logged by the stats timer
+struct {
+    uint64_t rejected_connections;
+} tcp_stats;
 
-// udpgw client
-DNodeUdpGwClient udpgw_client;
 int udp_mtu;
 
+// UDP flows to routed prefixes, tunnelled peer-to-peer
+struct DNodeProxyUdpClient *udp_proxy_client;
+
 // TCP timer
 BTimer tcp_timer;
 int tcp_timer_mod4;
@@ -194,6 +236,11 @@ int num_clients;
 
 BTimer stats_timer;
 
+// config reloading, on SIGHUP and on a timer to catch file changes
+void (*reload_handler) (int force);
+BUnixSignal reload_signal;
+BTimer reload_timer;
+
 int tun2socks_needs_proxy(uint32_t ip);
 
 static void terminate (void);
@@ -202,16 +249,29 @@ static void print_version (void);
 static int parse_arguments (int argc, char *argv[]);
 static int process_arguments (void);
 static void signal_handler (void *unused);
+static void reload_signal_handler (void *unused, int signo);
+static void reload_timer_handler (void *unused);
 static BAddr baddr_from_lwip (const ip_addr_t *ip_addr, uint16_t port_hostorder);
 static void lwip_init_job_hadler (void *unused);
 static void tcp_timer_handler (void *unused);
 static void device_error_handler (void *unused);
-static void device_read_handler_send (void *unused, uint8_t *data, int data_len);
+static void device_readable_handler (void *unused);
+static int device_read_pbuf_fill (void);
+static struct pbuf * device_read_pbuf_take (int data_len);
+static int device_packet_is_udp (const uint8_t *data, int data_len);
+static void process_device_pbuf (struct pbuf *p);
+static void process_device_packet (uint8_t *data, int data_len);
+static int gso_num_packets (const struct BTap_gso *gso, int data_len);
 static int process_device_udp_packet (uint8_t *data, int data_len);
 static err_t netif_init_func (struct netif *netif);
 static err_t netif_output_func (struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr);
 static err_t netif_output_ip6_func (struct netif *netif, struct pbuf *p, const ip6_addr_t *ipaddr);
 static err_t common_netif_output (struct netif *netif, struct pbuf *p);
+static int parse_tcp_headers (const uint8_t *data, int data_len, int *out_type, int *out_ip_header_len, int *out_header_len);
+static void device_send_pbuf (struct pbuf *p);
+static void device_output_offload (struct pbuf *p);
+static void gso_flush (void);
+static void gso_flush_job_handler (void *unused);
 static err_t netif_input_func (struct pbuf *p, struct netif *inp);
 static void client_logfunc (struct tcp_client *client);
 static void client_log (struct tcp_client *client, int level, const char *fmt, ...);
@@ -232,16 +292,33 @@ static void client_dtcp_recv_initiate (struct tcp_client *client);
 static void client_dtcp_recv_handler_done (struct tcp_client *client, int data_len);
 static int client_dtcp_recv_send_out (struct tcp_client *client);
 static err_t client_sent_func (void *arg, struct tcp_pcb *tpcb, u16_t len);
-static void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
+static void udp_client_handler_received (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
 
 static void stats_handler_wrapper(void* tmp)
 {
     void (*stats_handler)(void*) = tmp;
     BReactor_SetTimer(&ss, &stats_timer);
+
+    BLog(BLOG_INFO, "device: read %"PRIu64" packets in %"PRIu64" calls (%.2f per call), wrote %"PRIu64" packets in %"PRIu64" calls (%.2f per call)",
+         device_stats.read_packets, device_stats.read_calls,
+         (device_stats.read_calls ? (double)device_stats.read_packets / device_stats.read_calls : 0.0),
+         device_stats.write_packets, device_stats.write_calls,
+         (device_stats.write_calls ? (double)device_stats.write_packets / device_stats.write_calls : 0.0));
+    memset(&device_stats, 0, sizeof(device_stats));
+
+    BLog(BLOG_INFO, "lwip: %d clients, pbufs %d (max %d, %"PRIu32" failed), pcbs %d (max %d, %"PRIu32" failed), segments %d (max %d, %"PRIu32" failed), %"PRIu64" connections rejected",
+         num_clients,
+         (int)lwip_stats.memp[MEMP_PBUF_POOL]->used, (int)lwip_stats.memp[MEMP_PBUF_POOL]->max, lwip_stats.memp[MEMP_PBUF_POOL]->err,
+         (int)lwip_stats.memp[MEMP_TCP_PCB]->used, (int)lwip_stats.memp[MEMP_TCP_PCB]->max, lwip_stats.memp[MEMP_TCP_PCB]->err,
+         (int)lwip_stats.memp[MEMP_TCP_SEG]->used, (int)lwip_stats.memp[MEMP_TCP_SEG]->max, lwip_stats.memp[MEMP_TCP_SEG]->err,
+         tcp_stats.rejected_connections);
+
+    udpgw_log_stats();
+
     stats_handler(NULL);
 }
 
-int tun2socks_main (int argc, char **argv, int is_debugged, void (*stats_handler)(void*))
+int tun2socks_main (int argc, char **argv, int is_debugged, void (*stats_handler)(void*), void (*config_reload_handler)(int))
 {
     if (argc <= 0) {
         return 1;
@@ -330,11 +407,21 @@ int tun2socks_main (int argc, char **argv, int is_debugged, void (*stats_handler
             BLog(BLOG_ERROR, "BSignal_Init failed");
             goto fail2;
         }
+
+        // reload config on SIGHUP
+        sigset_t sset;
+        ASSERT_FORCE(sigemptyset(&sset) == 0)
+        ASSERT_FORCE(sigaddset(&sset, SIGHUP) == 0)
+        if (!BUnixSignal_Init(&reload_signal, &ss, sset, reload_signal_handler, NULL)) {
+            BLog(BLOG_ERROR, "BUnixSignal_Init failed");
+            BSignal_Finish();
+            goto fail2;
+        }
     }
 
     // init TUN device
-    if (!BTap_Init(&device, &ss, options.tundev, options.tun_ns, device_error_handler, NULL, 1)) {
-        BLog(BLOG_ERROR, "BTap_Init failed");
+    if (!BTap_InitOffload(&device, &ss, options.tundev, options.tun_ns, device_error_handler, NULL, 1, options.tun_offload)) {
+        BLog(BLOG_ERROR, "BTap_InitOffload failed");
         goto fail3;
     }
 
@@ -343,12 +430,15 @@ int tun2socks_main (int argc, char **argv, int is_debugged, void (*stats_handler
     // then lwip (so it can send packets to the device),
     // then device reading (so it can pass received packets to lwip).
 
-    // init device reading
-    PacketPassInterface_Init(&device_read_interface, BTap_GetMTU(&device), device_read_handler_send, NULL, BReactor_PendingGroup(&ss));
-    if (!SinglePacketBuffer_Init(&device_read_buffer, BTap_GetOutput(&device), &device_read_interface, BReactor_PendingGroup(&ss))) {
-        BLog(BLOG_ERROR, "SinglePacketBuffer_Init failed");
+    // init device reading, pbufs come once lwip is initialized
+    device_read_size = (BTap_GetOffload(&device) ? BTAP_GSO_MAX_SIZE : BTap_GetMTU(&device));
+    device_read_pbuf = NULL;
+    if (!(device_read_buf = (uint8_t *)BAlloc(device_read_size))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
         goto fail4;
     }
+    BTap_EnableBatchRead(&device, device_readable_handler, NULL);
+    memset(&device_stats, 0, sizeof(device_stats));
 
     // init lwip init job
     BPending_Init(&lwip_init_job, BReactor_PendingGroup(&ss), lwip_init_job_hadler, NULL);
@@ -360,6 +450,15 @@ int tun2socks_main (int argc, char **argv, int is_debugged, void (*stats_handler
         goto fail5;
     }
 
+    // init TSO buffer
+    gso_buf = NULL;
+    gso_len = 0;
+    if (BTap_GetOffload(&device) && !(gso_buf = (uint8_t *)BAlloc(BTAP_GSO_MAX_SIZE))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail6;
+    }
+    BPending_Init(&gso_flush_job, BReactor_PendingGroup(&ss), gso_flush_job_handler, NULL);
+
     // init TCP timer
     // it won't trigger before lwip is initialized, becuase the lwip init is a job
     BTimer_Init(&tcp_timer, TCP_TMR_INTERVAL, tcp_timer_handler, NULL);
@@ -391,23 +490,30 @@ int tun2socks_main (int argc, char **argv, int is_debugged, void (*stats_handler
         udp_mtu = 0;
     }
 
-    udpgw_init(argc, argv, &ss, udp_mtu);
-
-    // init udpgw client
-    if (!DNodeUdpGwClient_Init(&udpgw_client, udp_mtu, DEFAULT_UDPGW_MAX_CONNECTIONS, DEFAULT_UDPGW_CONNECTION_BUFFER_SIZE, UDPGW_KEEPALIVE_TIME,
-                               &ss, NULL, udpgw_client_handler_received
-    )) {
-        BLog(BLOG_ERROR, "SocksUdpGwClient_Init failed");
+    // init udpgw, UDP goes from the device straight to its sockets
+    if (!udpgw_init(argc, argv, &ss, udp_mtu, NULL, udp_client_handler_received)) {
+        BLog(BLOG_ERROR, "udpgw_init failed");
         goto fail4a;
     }
 
+    // init UDP proxy client
+    if (!(udp_proxy_client = DNodeProxyUdpClient_Create(udp_mtu, DEFAULT_UDP_PROXY_MAX_FLOWS, &ss, NULL, udp_client_handler_received))) {
+        BLog(BLOG_ERROR, "DNodeProxyUdpClient_Create failed");
+        goto fail4b;
+    }
+
     BTimer_Init(&stats_timer, 5000, &stats_handler_wrapper, stats_handler);
     BReactor_SetTimer(&ss, &stats_timer);
 
+    reload_handler = config_reload_handler;
+    BTimer_Init(&reload_timer, CONFIG_CHECK_INTERVAL, reload_timer_handler, NULL);
+    BReactor_SetTimer(&ss, &reload_timer);
+
     // enter event loop
     BLog(BLOG_NOTICE, "entering event loop");
     BReactor_Exec(&ss);
 
+    BReactor_RemoveTimer(&ss, &reload_timer);
     BReactor_RemoveTimer(&ss, &stats_timer);
 
     // free clients
@@ -431,18 +537,27 @@ int tun2socks_main (int argc, char **argv, int is_debugged, void (*stats_handler
     }
 
     BReactor_RemoveTimer(&ss, &tcp_timer);
+    BPending_Free(&gso_flush_job);
+    if (gso_buf) {
+        BFree(gso_buf);
+    }
+fail6:
     BFree(device_write_buf);
 fail5:
     BPending_Free(&lwip_init_job);
-    DNodeUdpGwClient_Free(&udpgw_client);
-fail4a:
+    DNodeProxyUdpClient_Destroy(udp_proxy_client);
+fail4b:
     udpgw_cleanup();
-    SinglePacketBuffer_Free(&device_read_buffer);
+fail4a:
+    if (device_read_pbuf) {
+        pbuf_free(device_read_pbuf);
+    }
+    BFree(device_read_buf);
 fail4:
-    PacketPassInterface_Free(&device_read_interface);
     BTap_Free(&device);
 fail3:
     if (!is_debugged) {
+        BUnixSignal_Free(&reload_signal, 0);
         BSignal_Finish();
     }
 fail2:
@@ -487,6 +602,10 @@ void print_help (const char *name)
         "        [--loglevel <0-5/none/error/warning/notice/info/debug>]\n"
         "        [--channel-loglevel <channel-name> <0-5/none/error/warning/notice/info/debug>] ...\n"
         "        [--tundev <name>]\n"
+        "        [--tun-offload]\n"
+        "        [--tcp-wnd <bytes>]\n"
+        "        [--tcp-snd-buf <bytes>]\n"
+        "        [--tcp-max-connections <number>]\n"
         "        --netif-ipaddr <ipaddr>\n"
         "        --netif-netmask <ipnetmask>\n"
         "        --inner-ipaddr <ipaddr>\n"
@@ -523,6 +642,10 @@ int parse_arguments (int argc, char *argv[])
         options.loglevels[i] = -1;
     }
     options.tundev = NULL;
+    options.tun_offload = 0;
+    options.tcp_wnd = DEFAULT_TCP_WND;
+    options.tcp_snd_buf = DEFAULT_TCP_SND_BUF;
+    options.tcp_max_connections = DEFAULT_TCP_MAX_CONNECTIONS;
     options.netif_ipaddr = NULL;
     options.netif_netmask = NULL;
     options.tun_ns = NULL;
@@ -617,6 +740,42 @@ int parse_arguments (int argc, char *argv[])
             options.tundev = argv[i + 1];
             i++;
         }
+        else if (!strcmp(arg, "--tun-offload")) {
+            options.tun_offload = 1;
+        }
+        else if (!strcmp(arg, "--tcp-wnd")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_wnd = atoi(argv[i + 1])) < 2 * TCP_MSS || options.tcp_wnd > TCP_WND) {
+                fprintf(stderr, "%s: wrong argument, must be %d-%d\n", arg, 2 * TCP_MSS, TCP_WND);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-snd-buf")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_snd_buf = atoi(argv[i + 1])) < 2 * TCP_MSS || options.tcp_snd_buf > TCP_SND_BUF) {
+                fprintf(stderr, "%s: wrong argument, must be %d-%d\n", arg, 2 * TCP_MSS, TCP_SND_BUF);
+                return 0;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--tcp-max-connections")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return 0;
+            }
+            if ((options.tcp_max_connections = atoi(argv[i + 1])) < 1) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return 0;
+            }
+            i++;
+        }
         else if (!strcmp(arg, "--netif-ipaddr")) {
             if (1 >= argc - i) {
                 fprintf(stderr, "%s: requires an argument\n", arg);
@@ -763,6 +922,22 @@ void signal_handler (void *unused)
     terminate();
 }
 
+void reload_signal_handler (void *unused, int signo)
+{
+    ASSERT(signo == SIGHUP)
+
+    BLog(BLOG_NOTICE, "config reload requested");
+
+    reload_handler(1);
+}
+
+void reload_timer_handler (void *unused)
+{
+    BReactor_SetTimer(&ss, &reload_timer);
+
+    reload_handler(0);
+}
+
 BAddr baddr_from_lwip (const ip_addr_t *ip_addr, uint16_t port_hostorder)
 {
     BAddr addr;
@@ -806,6 +981,12 @@ void lwip_init_job_hadler (void *unused)
     }
     have_netif = 1;
 
+    if (options.tun_offload) {
+        // the device finishes TCP checksums of what we send, and what we receive
+        // comes from the local stack, may be unchecksummed
+        NETIF_SET_CHECKSUM_CTRL(&the_netif, NETIF_CHECKSUM_ENABLE_ALL & ~(NETIF_CHECKSUM_GEN_TCP|NETIF_CHECKSUM_CHECK_TCP));
+    }
+
     // set netif up
     netif_set_up(&the_netif);
 
@@ -930,15 +1111,158 @@ void device_error_handler (void *unused)
     return;
 }
 
-void device_read_handler_send (void *unused, uint8_t *data, int data_len)
+void device_readable_handler (void *unused)
+{
+    ASSERT(!quitting)
+
+    // feed a batch of packets to lwip back to back, whatever is left
+    // is read on the next reactor iteration
+    for (int i = 0; i < DEVICE_READ_BATCH; i++) {
+        struct BTap_gso gso;
+        int data_len;
+
+        int have_pbuf = device_read_pbuf_fill();
+        if (have_pbuf) {
+            // read straight into the pbufs
+            struct iovec iov[BTAP_MAX_IOV];
+            int iov_count = 0;
+            for (struct pbuf *q = device_read_pbuf; q && iov_count < BTAP_MAX_IOV; q = q->next) {
+                iov[iov_count].iov_base = q->payload;
+                iov[iov_count].iov_len = q->len;
+                iov_count++;
+            }
+            data_len = BTap_RecvV(&device, iov, iov_count, &gso);
+        } else {
+            // out of pbufs, still read so UDP can go to udpgw
+            data_len = BTap_Recv(&device, device_read_buf, &gso);
+        }
+        device_stats.read_calls++;
+        if (data_len == 0) {
+            break;
+        }
+        if (data_len < 0) {
+            device_error_handler(NULL);
+            return;
+        }
+
+        device_stats.read_packets += gso_num_packets(&gso, data_len);
+
+        if (have_pbuf) {
+            process_device_pbuf(device_read_pbuf_take(data_len));
+        } else {
+            process_device_packet(device_read_buf, data_len);
+        }
+
+        if (quitting) {
+            return;
+        }
+    }
+}
+
+int gso_num_packets (const struct BTap_gso *gso, int data_len)
+{
+    if (gso->type == BTAP_GSO_NONE || gso->segment_size <= 0 || data_len <= gso->header_len) {
+        return 1;
+    }
+
+    return bdivide_up(data_len - gso->header_len, gso->segment_size);
+}
+
+int device_read_pbuf_fill (void)
+{
+    int have = (device_read_pbuf ? device_read_pbuf->tot_len : 0);
+    if (have >= device_read_size) {
+        return 1;
+    }
+
+    // allocate what the last packet took
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, device_read_size - have, PBUF_POOL);
+    if (!p) {
+        return 0;
+    }
+
+    if (device_read_pbuf) {
+        pbuf_cat(device_read_pbuf, p);
+    } else {
+        device_read_pbuf = p;
+    }
+
+    return 1;
+}
+
+struct pbuf * device_read_pbuf_take (int data_len)
+{
+    ASSERT(device_read_pbuf)
+    ASSERT(data_len > 0)
+    ASSERT(data_len <= device_read_pbuf->tot_len)
+
+    // cut the chain after the pbuf with the last byte, the rest
+    // stays for the next packet
+    struct pbuf *p = device_read_pbuf;
+    struct pbuf *q = p;
+    int left = data_len;
+    while (left > q->len) {
+        q->tot_len = left;
+        left -= q->len;
+        q = q->next;
+    }
+    q->tot_len = left;
+    q->len = left;
+
+    device_read_pbuf = q->next;
+    q->next = NULL;
+
+    return p;
+}
+
+int device_packet_is_udp (const uint8_t *data, int data_len)
+{
+    if (data_len < 1) {
+        return 0;
+    }
+
+    switch (data[0] >> 4) {
+        case 4:
+            return (data_len >= sizeof(struct ipv4_header) && data[offsetof(struct ipv4_header, protocol)] == IPV4_PROTOCOL_UDP);
+        case 6:
+            return (data_len >= sizeof(struct ipv6_header) && data[offsetof(struct ipv6_header, next_header)] == IPV6_NEXT_UDP);
+        default:
+            return 0;
+    }
+}
+
+void process_device_pbuf (struct pbuf *p)
 {
     ASSERT(!quitting)
-    ASSERT(data_len >= 0)
 
     BLog(BLOG_DEBUG, "device: received packet");
 
-    // accept packet
-    PacketPassInterface_Done(&device_read_interface);
+    // process UDP directly, in place unless a large datagram spans pbufs
+    if (device_packet_is_udp((uint8_t *)p->payload, p->len)) {
+        uint8_t *data = (uint8_t *)p->payload;
+        if (p->len < p->tot_len) {
+            data = device_read_buf;
+            ASSERT_FORCE(pbuf_copy_partial(p, data, p->tot_len, 0) == p->tot_len)
+        }
+        if (process_device_udp_packet(data, p->tot_len)) {
+            pbuf_free(p);
+            return;
+        }
+    }
+
+    // pass pbuf to input
+    if (the_netif.input(p, &the_netif) != ERR_OK) {
+        BLog(BLOG_WARNING, "device read: input failed");
+        pbuf_free(p);
+    }
+}
+
+void process_device_packet (uint8_t *data, int data_len)
+{
+    ASSERT(!quitting)
+    ASSERT(data_len >= 0)
+
+    BLog(BLOG_DEBUG, "device: received packet");
 
     // process UDP directly
     if (process_device_udp_packet(data, data_len)) {
@@ -998,12 +1322,15 @@ int process_device_udp_packet (uint8_t *data, int data_len)
                 goto fail;
             }
 
-            // verify UDP checksum
-            uint16_t checksum_in_packet = udp_header.checksum;
-            udp_header.checksum = 0;
-            uint16_t checksum_computed = udp_checksum(&udp_header, data, data_len, ipv4_header.source_address, ipv4_header.destination_address);
-            if (checksum_in_packet != checksum_computed) {
-                goto fail;
+            // verify UDP checksum, with offloads it may be left for us to
+            // compute, the packet comes from the local stack anyway
+            if (!BTap_GetOffload(&device)) {
+                uint16_t checksum_in_packet = udp_header.checksum;
+                udp_header.checksum = 0;
+                uint16_t checksum_computed = udp_checksum(&udp_header, data, data_len, ipv4_header.source_address, ipv4_header.destination_address);
+                if (checksum_in_packet != checksum_computed) {
+                    goto fail;
+                }
             }
 
             BLog(BLOG_INFO, "UDP: from device %d bytes", data_len);
@@ -1042,12 +1369,15 @@ int process_device_udp_packet (uint8_t *data, int data_len)
                 goto fail;
             }
 
-            // verify UDP checksum
-            uint16_t checksum_in_packet = udp_header.checksum;
-            udp_header.checksum = 0;
-            uint16_t checksum_computed = udp_ip6_checksum(&udp_header, data, data_len, ipv6_header.source_address, ipv6_header.destination_address);
-            if (checksum_in_packet != checksum_computed) {
-                goto fail;
+            // verify UDP checksum, with offloads it may be left for us to
+            // compute, the packet comes from the local stack anyway
+            if (!BTap_GetOffload(&device)) {
+                uint16_t checksum_in_packet = udp_header.checksum;
+                udp_header.checksum = 0;
+                uint16_t checksum_computed = udp_ip6_checksum(&udp_header, data, data_len, ipv6_header.source_address, ipv6_header.destination_address);
+                if (checksum_in_packet != checksum_computed) {
+                    goto fail;
+                }
             }
 
             BLog(BLOG_INFO, "UDP/IPv6: from device %d bytes", data_len);
@@ -1071,8 +1401,14 @@ int process_device_udp_packet (uint8_t *data, int data_len)
         goto fail;
     }
 
+    // UDP to routed prefixes goes straight to the peer node
+    if (local_addr.type == BADDR_TYPE_IPV4 && !is_dns && tun2socks_needs_proxy(remote_addr.ipv4.ip)) {
+        DNodeProxyUdpClient_SubmitPacket(udp_proxy_client, local_addr, remote_addr, data, data_len);
+        return 1;
+    }
+
     // submit packet to udpgw
-    DNodeUdpGwClient_SubmitPacket(&udpgw_client, local_addr, remote_addr, is_dns, data, data_len);
+    udpgw_submit_packet(local_addr, remote_addr, is_dns, data, data_len);
 
     return 1;
 
@@ -1105,42 +1441,247 @@ err_t netif_output_ip6_func (struct netif *netif, struct pbuf *p, const ip6_addr
 
 err_t common_netif_output (struct netif *netif, struct pbuf *p)
 {
-    SYNC_DECL
-
     BLog(BLOG_DEBUG, "device write: send packet");
 
     if (quitting) {
         return ERR_OK;
     }
 
-    // if there is just one chunk, send it directly, else via buffer
-    if (!p->next) {
-        if (p->len > BTap_GetMTU(&device)) {
-            BLog(BLOG_WARNING, "netif func output: no space left");
-            goto out;
-        }
+    if (BTap_GetOffload(&device)) {
+        device_output_offload(p);
 
-        SYNC_FROMHERE
-        BTap_Send(&device, (uint8_t *)p->payload, p->len);
-        SYNC_COMMIT
+        // send what's coalesced once the current burst of jobs is done
+        if (gso_len > 0 && !BPending_IsSet(&gso_flush_job)) {
+            BPending_Set(&gso_flush_job);
+        }
     } else {
-        int len = 0;
-        do {
-            if (p->len > BTap_GetMTU(&device) - len) {
-                BLog(BLOG_WARNING, "netif func output: no space left");
-                goto out;
+        device_send_pbuf(p);
+    }
+
+    return ERR_OK;
+}
+
+void device_send_pbuf (struct pbuf *p)
+{
+    SYNC_DECL
+
+    if (p->tot_len > BTap_GetMTU(&device)) {
+        BLog(BLOG_WARNING, "netif func output: no space left");
+        return;
+    }
+
+    // gather the chunks into one write
+    struct iovec iov[BTAP_MAX_IOV];
+    int iov_count = 0;
+    for (struct pbuf *q = p; q; q = q->next) {
+        if (iov_count == BTAP_MAX_IOV) {
+            BLog(BLOG_WARNING, "netif func output: too many chunks");
+            return;
+        }
+        iov[iov_count].iov_base = q->payload;
+        iov[iov_count].iov_len = q->len;
+        iov_count++;
+    }
+
+    SYNC_FROMHERE
+    BTap_SendV(&device, iov, iov_count, NULL);
+    SYNC_COMMIT
+
+    device_stats.write_calls++;
+    device_stats.write_packets++;
+}
+
+int parse_tcp_headers (const uint8_t *data, int data_len, int *out_type, int *out_ip_header_len, int *out_header_len)
+{
+    int ip_header_len;
+
+    if (data_len < 1) {
+        return 0;
+    }
+
+    switch (data[0] >> 4) {
+        case 4: {
+            // lwIP never sends options or fragments TCP
+            if (data_len < sizeof(struct ipv4_header) ||
+                IPV4_GET_IHL(*(const struct ipv4_header *)data) * 4 != sizeof(struct ipv4_header) ||
+                data[offsetof(struct ipv4_header, protocol)] != IP_PROTO_TCP ||
+                (badvpn_read_be16((const char *)data + offsetof(struct ipv4_header, flags3_fragmentoffset13)) & 0x3FFF)
+            ) {
+                return 0;
+            }
+            *out_type = BTAP_GSO_TCPV4;
+            ip_header_len = sizeof(struct ipv4_header);
+        } break;
+
+        case 6: {
+            if (data_len < sizeof(struct ipv6_header) ||
+                data[offsetof(struct ipv6_header, next_header)] != IP_PROTO_TCP
+            ) {
+                return 0;
             }
-            memcpy(device_write_buf + len, p->payload, p->len);
-            len += p->len;
-        } while ((p = p->next));
+            *out_type = BTAP_GSO_TCPV6;
+            ip_header_len = sizeof(struct ipv6_header);
+        } break;
 
-        SYNC_FROMHERE
-        BTap_Send(&device, device_write_buf, len);
-        SYNC_COMMIT
+        default:
+            return 0;
     }
 
-out:
-    return ERR_OK;
+    if (data_len < ip_header_len + sizeof(struct tcp_hdr)) {
+        return 0;
+    }
+
+    int header_len = ip_header_len + TCPH_HDRLEN_BYTES((const struct tcp_hdr *)(data + ip_header_len));
+    if (header_len < ip_header_len + sizeof(struct tcp_hdr) || header_len > data_len) {
+        return 0;
+    }
+
+    *out_ip_header_len = ip_header_len;
+    *out_header_len = header_len;
+
+    return 1;
+}
+
+void device_output_offload (struct pbuf *p)
+{
+    ASSERT(BTap_GetOffload(&device))
+
+    // IPv4 and TCP headers are at most 60 bytes each
+    uint8_t hdr[120];
+    int hdr_len = pbuf_copy_partial(p, hdr, bmin_int(p->tot_len, sizeof(hdr)), 0);
+
+    int type;
+    int ip_header_len;
+    int header_len;
+    if (!parse_tcp_headers(hdr, hdr_len, &type, &ip_header_len, &header_len)) {
+        // not TCP, send as it is, after anything before it
+        gso_flush();
+        device_send_pbuf(p);
+        return;
+    }
+
+    const struct tcp_hdr *tcph = (const struct tcp_hdr *)(hdr + ip_header_len);
+    int payload_len = p->tot_len - header_len;
+    uint8_t flags = TCPH_FLAGS(tcph);
+    int is_data = (payload_len > 0 && (flags & ~TCP_PSH) == TCP_ACK);
+
+    // append to the coalesced segments if this is the next segment of the same
+    // connection with the same headers, only sequence number and PSH may differ
+    if (gso_len > 0 && is_data && !gso_closed &&
+        type == gso_type && header_len == gso_header_len &&
+        payload_len <= gso_segment_size && gso_len + payload_len <= BTAP_GSO_MAX_SIZE &&
+        lwip_ntohl(tcph->seqno) == gso_next_seqno
+    ) {
+        const struct tcp_hdr *gso_tcph = (const struct tcp_hdr *)(gso_buf + ip_header_len);
+        int same;
+        if (type == BTAP_GSO_TCPV4) {
+            same = !memcmp(hdr + offsetof(struct ipv4_header, source_address), gso_buf + offsetof(struct ipv4_header, source_address), 8);
+        } else {
+            same = !memcmp(hdr + offsetof(struct ipv6_header, source_address), gso_buf + offsetof(struct ipv6_header, source_address), 32);
+        }
+        same = same && tcph->src == gso_tcph->src && tcph->dest == gso_tcph->dest &&
+               tcph->ackno == gso_tcph->ackno && tcph->wnd == gso_tcph->wnd &&
+               !memcmp(tcph + 1, gso_tcph + 1, header_len - ip_header_len - sizeof(struct tcp_hdr));
+
+        if (same) {
+            ASSERT_FORCE(pbuf_copy_partial(p, gso_buf + gso_len, payload_len, header_len) == payload_len)
+            gso_len += payload_len;
+            gso_num_segments++;
+            gso_next_seqno += payload_len;
+
+            // PSH of any segment goes on the coalesced one, the kernel
+            // only leaves it on the last segment
+            if ((flags & TCP_PSH)) {
+                gso_buf[ip_header_len + 13] |= TCP_PSH;
+            }
+
+            // segments are cut at the first one's size, a shorter one must be last
+            if (payload_len < gso_segment_size) {
+                gso_closed = 1;
+            }
+            return;
+        }
+    }
+
+    gso_flush();
+
+    // start coalescing from here, anything else goes out right away
+    // with just the checksum offloaded
+    ASSERT_FORCE(pbuf_copy_partial(p, gso_buf, p->tot_len, 0) == p->tot_len)
+    gso_len = p->tot_len;
+    gso_type = type;
+    gso_ip_header_len = ip_header_len;
+    gso_header_len = header_len;
+    gso_segment_size = payload_len;
+    gso_num_segments = 1;
+    gso_closed = 0;
+    gso_next_seqno = lwip_ntohl(tcph->seqno) + payload_len;
+
+    if (!is_data) {
+        gso_flush();
+    }
+}
+
+void gso_flush (void)
+{
+    ASSERT(BTap_GetOffload(&device))
+
+    SYNC_DECL
+
+    if (gso_len == 0) {
+        return;
+    }
+
+    int tcp_len = gso_len - gso_ip_header_len;
+
+    // fix up IP length and start the TCP checksum with the pseudo header,
+    // the device adds the rest
+    uint32_t sum = IP_PROTO_TCP + tcp_len;
+    if (gso_type == BTAP_GSO_TCPV4) {
+        struct ipv4_header *iph = (struct ipv4_header *)gso_buf;
+        iph->total_length = hton16(gso_len);
+        iph->checksum = 0;
+        iph->checksum = ipv4_checksum(iph, NULL, 0);
+        for (int i = 0; i < 4; i++) {
+            sum += badvpn_read_be16((const char *)&iph->source_address + 2 * i);
+        }
+    } else {
+        struct ipv6_header *iph = (struct ipv6_header *)gso_buf;
+        iph->payload_length = hton16(tcp_len);
+        for (int i = 0; i < 16; i++) {
+            sum += badvpn_read_be16((const char *)iph->source_address + 2 * i);
+        }
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    struct tcp_hdr *tcph = (struct tcp_hdr *)(gso_buf + gso_ip_header_len);
+    tcph->chksum = hton16(sum);
+
+    struct BTap_gso gso;
+    gso.type = (gso_num_segments > 1 ? gso_type : BTAP_GSO_NONE);
+    gso.segment_size = gso_segment_size;
+    gso.header_len = gso_header_len;
+    gso.csum_start = gso_ip_header_len;
+    gso.csum_offset = offsetof(struct tcp_hdr, chksum);
+
+    int len = gso_len;
+    gso_len = 0;
+
+    SYNC_FROMHERE
+    BTap_SendGSO(&device, gso_buf, len, &gso);
+    SYNC_COMMIT
+
+    device_stats.write_calls++;
+    device_stats.write_packets += gso_num_segments;
+}
+
+void gso_flush_job_handler (void *unused)
+{
+    ASSERT(!quitting)
+
+    gso_flush();
 }
 
 err_t netif_input_func (struct pbuf *p, struct netif *inp)
@@ -1187,6 +1728,13 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
 {
     ASSERT(err == ERR_OK)
 
+    // check connection limit, pools grow as needed so this is what bounds memory
+    if (num_clients >= options.tcp_max_connections) {
+        BLog(BLOG_WARNING, "listener accept: too many connections");
+        tcp_stats.rejected_connections++;
+        goto fail0;
+    }
+
     // allocate client structure
     struct tcp_client *client = (struct tcp_client *)malloc(sizeof(*client));
     if (!client) {
@@ -1242,8 +1790,24 @@ err_t listener_accept_func (void *arg, struct tcp_pcb *newpcb, err_t err)
     tcp_err(client->pcb, client_err_func);
     tcp_recv(client->pcb, client_recv_func);
 
-    // setup buffer
+    // lwIP starts connections at its maximum window and send buffer, cut them
+    // down to the configured ones; nothing was received or queued yet
+    tcpwnd_size_t wnd_max = TCP_WND_MAX(client->pcb);
+    client->rcv_wnd_held = (options.tcp_wnd < wnd_max) ? wnd_max - options.tcp_wnd : 0;
+    client->pcb->rcv_wnd -= client->rcv_wnd_held;
+    // the SYN-ACK window isn't scaled, so the client was offered at most
+    // 64 KB, not the full window lwIP thinks it announced
+    client->pcb->rcv_ann_wnd = (client->pcb->rcv_wnd > 0xFFFF) ? client->pcb->rcv_wnd : 0xFFFF;
+    client->pcb->rcv_ann_right_edge = client->pcb->rcv_nxt + client->pcb->rcv_ann_wnd;
+    if (client->pcb->snd_buf > options.tcp_snd_buf) {
+        client->pcb->snd_buf = options.tcp_snd_buf;
+    }
+
+    // setup buffers
+    client->buf = NULL;
+    client->buf_last = NULL;
     client->buf_used = 0;
+    client->dtcp_recv_buf = NULL;
 
     // set DTCP not up, not closed
     client->dtcp_up = 0;
@@ -1295,6 +1859,11 @@ void client_free_client (struct tcp_client *client)
     tcp_recv(client->pcb, NULL);
     tcp_sent(client->pcb, NULL);
 
+    // give back the window held since accept, lwIP resets instead of closing
+    // when the window isn't full since it means data wasn't taken
+    tcpwnd_size_t wnd_max = TCP_WND_MAX(client->pcb);
+    client->pcb->rcv_wnd = (client->pcb->rcv_wnd + client->rcv_wnd_held < wnd_max) ? client->pcb->rcv_wnd + client->rcv_wnd_held : wnd_max;
+
     // free pcb
     err_t err = tcp_close(client->pcb);
     if (err != ERR_OK) {
@@ -1415,6 +1984,10 @@ void client_dealloc (struct tcp_client *client)
     }
 
     // free memory
+    free(client->dtcp_recv_buf);
+    if (client->buf) {
+        pbuf_free(client->buf);
+    }
     free(client);
 }
 
@@ -1445,19 +2018,21 @@ err_t client_recv_func (void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t e
         ASSERT(p->tot_len > 0)
 
         // check if we have enough buffer
-        if (p->tot_len > sizeof(client->buf) - client->buf_used) {
+        if (p->tot_len > options.tcp_wnd - client->buf_used) {
             client_log(client, BLOG_ERROR, "no buffer for data !?!");
             DEAD_LEAVE2(client->dead_aborted)
             return ERR_MEM;
         }
 
-        // copy data to buffer
-        ASSERT_EXECUTE(pbuf_copy_partial(p, client->buf + client->buf_used, p->tot_len, 0) == p->tot_len)
-        client->buf_used += p->tot_len;
-
-        // free pbuff
+        // append to buffer, DTCP sends straight from the pbufs
         int p_tot_len = p->tot_len;
-        pbuf_free(p);
+        if (client->buf) {
+            client->buf_last->next = p;
+        } else {
+            client->buf = p;
+        }
+        for (client->buf_last = p; client->buf_last->next; client->buf_last = client->buf_last->next);
+        client->buf_used += p_tot_len;
 
         // if there was nothing in the buffer before, and DTCP is up, start send data
         if (client->buf_used == p_tot_len && client->dtcp_up) {
@@ -1492,9 +2067,16 @@ void client_dtcp_handler (struct tcp_client *client, int event)
 
             client_log(client, BLOG_INFO, "DTCP up");
 
+            // allocate receive buffer, connections waiting for DTCP don't need it
+            if (!(client->dtcp_recv_buf = (uint8_t *)malloc(CLIENT_DTCP_RECV_BUF_SIZE))) {
+                client_log(client, BLOG_ERROR, "malloc failed");
+
+                client_free_dtcp(client);
+                return;
+            }
+
             // init sending
-            client->dtcp_send_if = DNodeTCPClient_GetSendInterface(client->dtcp_client);
-            StreamPassInterface_Sender_Init(client->dtcp_send_if, (StreamPassInterface_handler_done)client_dtcp_send_handler_done, client);
+            DNodeTCPClient_SendV_Init(client->dtcp_client, (DNodeTCPClient_send_handler_done)client_dtcp_send_handler_done, client);
 
             // init receiving
             client->dtcp_recv_if = DNodeTCPClient_GetRecvInterface(client->dtcp_client);
@@ -1538,8 +2120,19 @@ void client_send_to_dtcp (struct tcp_client *client)
     ASSERT(client->dtcp_up)
     ASSERT(client->buf_used > 0)
 
-    // schedule sending
-    StreamPassInterface_Sender_Send(client->dtcp_send_if, client->buf, client->buf_used);
+    // send straight from the pbufs, what doesn't fit goes next time
+    struct iovec iov[DNODE_TCPCLIENT_MAX_IOV];
+    int iov_count = 0;
+    for (struct pbuf *q = client->buf; q && iov_count < DNODE_TCPCLIENT_MAX_IOV; q = q->next) {
+        if (q->len > 0) {
+            iov[iov_count].iov_base = q->payload;
+            iov[iov_count].iov_len = q->len;
+            iov_count++;
+        }
+    }
+    ASSERT(iov_count > 0)
+
+    DNodeTCPClient_SendV(client->dtcp_client, iov, iov_count);
 }
 
 void client_dtcp_send_handler_done (struct tcp_client *client, int data_len)
@@ -1550,20 +2143,33 @@ void client_dtcp_send_handler_done (struct tcp_client *client, int data_len)
     ASSERT(data_len > 0)
     ASSERT(data_len <= client->buf_used)
 
-    // remove sent data from buffer
-    memmove(client->buf, client->buf + data_len, client->buf_used - data_len);
+    // release sent pbufs
+    for (int left = data_len; left > 0; left -= 0xFFFF) {
+        client->buf = pbuf_free_header(client->buf, bmin_int(left, 0xFFFF));
+    }
     client->buf_used -= data_len;
 
     if (!client->client_closed) {
         // confirm sent data
-        tcp_recved(client->pcb, data_len);
+        for (int left = data_len; left > 0; left -= 0xFFFF) {
+            tcp_recved(client->pcb, bmin_int(left, 0xFFFF));
+        }
     }
 
     if (client->buf_used > 0) {
         // send any further data
-        StreamPassInterface_Sender_Send(client->dtcp_send_if, client->buf, client->buf_used);
+        client_send_to_dtcp(client);
+        return;
+    }
+
+    // drop any empty pbufs left over
+    if (client->buf) {
+        pbuf_free(client->buf);
+        client->buf = NULL;
     }
-    else if (client->client_closed) {
+    client->buf_last = NULL;
+
+    if (client->client_closed) {
         // client was closed we've sent everything we had buffered; we're done with it
         client_log(client, BLOG_INFO, "removing after client went down");
 
@@ -1578,13 +2184,13 @@ void client_dtcp_recv_initiate (struct tcp_client *client)
     ASSERT(client->dtcp_up)
     ASSERT(client->dtcp_recv_buf_used == -1)
 
-    StreamRecvInterface_Receiver_Recv(client->dtcp_recv_if, client->dtcp_recv_buf, sizeof(client->dtcp_recv_buf));
+    StreamRecvInterface_Receiver_Recv(client->dtcp_recv_if, client->dtcp_recv_buf, CLIENT_DTCP_RECV_BUF_SIZE);
 }
 
 void client_dtcp_recv_handler_done (struct tcp_client *client, int data_len)
 {
     ASSERT(data_len > 0)
-    ASSERT(data_len <= sizeof(client->dtcp_recv_buf))
+    ASSERT(data_len <= CLIENT_DTCP_RECV_BUF_SIZE)
     ASSERT(!client->dtcp_closed)
     ASSERT(client->dtcp_up)
     ASSERT(client->dtcp_recv_buf_used == -1)
@@ -1724,7 +2330,7 @@ out:
     return (DEAD_KILLED > 0) ? ERR_ABRT : ERR_OK;
 }
 
-void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
+void udp_client_handler_received (void *unused, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len)
 {
     ASSERT(local_addr.type == BADDR_TYPE_IPV4 || local_addr.type == BADDR_TYPE_IPV6)
     ASSERT(local_addr.type == remote_addr.type)
@@ -1734,7 +2340,7 @@ void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote
 
     switch (local_addr.type) {
         case BADDR_TYPE_IPV4: {
-            BLog(BLOG_INFO, "UDP: from udpgw %d bytes", data_len);
+            BLog(BLOG_INFO, "UDP: to device %d bytes", data_len);
 
             if (data_len > UINT16_MAX - (sizeof(struct ipv4_header) + sizeof(struct udp_header)) ||
                 data_len > BTap_GetMTU(&device) - (int)(sizeof(struct ipv4_header) + sizeof(struct udp_header))
@@ -1773,7 +2379,7 @@ void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote
         } break;
 
         case BADDR_TYPE_IPV6: {
-            BLog(BLOG_INFO, "UDP/IPv6: from udpgw %d bytes", data_len);
+            BLog(BLOG_INFO, "UDP/IPv6: to device %d bytes", data_len);
 
             if (!options.netif_ip6addr) {
                 BLog(BLOG_ERROR, "got IPv6 packet from udpgw but IPv6 is disabled");
@@ -1816,4 +2422,7 @@ void udpgw_client_handler_received (void *unused, BAddr local_addr, BAddr remote
 
     // submit packet
     BTap_Send(&device, device_write_buf, packet_length);
+
+    device_stats.write_calls++;
+    device_stats.write_packets++;
 }
@@ -27,17 +27,26 @@
 // name of the program
 #define PROGRAM_NAME "tun2socks"
 
+// default TCP receive window, also the most data held for passing to the DTCP server
+#define DEFAULT_TCP_WND (256 * 1024)
+
+// default TCP send buffer
+#define DEFAULT_TCP_SND_BUF (256 * 1024)
+
+// default maximum number of TCP connections
+#define DEFAULT_TCP_MAX_CONNECTIONS 4096
+
 // size of temporary buffer for passing data from the DTCP server to TCP for sending
 #define CLIENT_DTCP_RECV_BUF_SIZE 8192
 
-// maximum number of udpgw connections
-#define DEFAULT_UDPGW_MAX_CONNECTIONS 256
+// maximum number of UDP flows tunnelled peer-to-peer
+#define DEFAULT_UDP_PROXY_MAX_FLOWS 256
 
-// udpgw per-connection send buffer size, in number of packets
-#define DEFAULT_UDPGW_CONNECTION_BUFFER_SIZE 8
+// maximum number of packets read from the device per reactor iteration
+#define DEVICE_READ_BATCH 64
 
-// udpgw keepalive sending interval
-#define UDPGW_KEEPALIVE_TIME 10000
+// interval of checking the app config file for changes
+#define CONFIG_CHECK_INTERVAL 2000
 
 // option to override the destination addresses to give the SOCKS server
 //#define OVERRIDE_DEST_ADDR "10.111.0.2:2000"
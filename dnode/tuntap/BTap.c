@@ -45,10 +45,12 @@
     #include <sys/types.h>
     #include <sys/stat.h>
     #include <sys/socket.h>
+    #include <sys/uio.h>
     #include <net/if.h>
     #include <net/if_arp.h>
     #ifdef BADVPN_LINUX
         #include <linux/if_tun.h>
+        #include <linux/virtio_net.h>
     #endif
     #ifdef BADVPN_FREEBSD
         #include <net/if_tun.h>
@@ -89,6 +91,153 @@ static void recv_olap_handler (BTap *o, int event, DWORD bytes)
 
 #else
 
+static void gso_from_hdr (const void *hdr_data, struct BTap_gso *out_gso)
+{
+    out_gso->type = BTAP_GSO_NONE;
+    out_gso->segment_size = 0;
+    out_gso->header_len = 0;
+    out_gso->csum_start = -1;
+    out_gso->csum_offset = 0;
+
+#ifdef BADVPN_LINUX
+    if (!hdr_data) {
+        return;
+    }
+
+    const struct virtio_net_hdr *hdr = hdr_data;
+    switch (hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+        case VIRTIO_NET_HDR_GSO_TCPV4: out_gso->type = BTAP_GSO_TCPV4; break;
+        case VIRTIO_NET_HDR_GSO_TCPV6: out_gso->type = BTAP_GSO_TCPV6; break;
+    }
+    if (out_gso->type != BTAP_GSO_NONE) {
+        out_gso->segment_size = hdr->gso_size;
+    }
+    out_gso->header_len = hdr->hdr_len;
+    if ((hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+        out_gso->csum_start = hdr->csum_start;
+        out_gso->csum_offset = hdr->csum_offset;
+    }
+#endif
+}
+
+// Returns packet length, 0 if there is no packet or -1 on error.
+static int read_packet (BTap *o, const struct iovec *iov, int iov_count, struct BTap_gso *out_gso)
+{
+    ASSERT(iov_count >= 1)
+    ASSERT(iov_count <= BTAP_MAX_IOV)
+
+    // loop only to skip packets without a usable virtio-net header
+    while (1) {
+        int bytes;
+#ifdef BADVPN_LINUX
+        struct virtio_net_hdr hdr;
+        if (o->offload) {
+            // the header only tells how the packet was segmented and checksummed,
+            // IP lengths are already right and checksums are never verified
+            struct iovec all_iov[1 + BTAP_MAX_IOV];
+            all_iov[0].iov_base = &hdr;
+            all_iov[0].iov_len = sizeof(hdr);
+            memcpy(all_iov + 1, iov, iov_count * sizeof(iov[0]));
+            bytes = readv(o->fd, all_iov, 1 + iov_count);
+            if (bytes > 0) {
+                if (bytes < (int)sizeof(hdr)) {
+                    BLog(BLOG_WARNING, "short read, no virtio-net header");
+                    continue;
+                }
+                bytes -= sizeof(hdr);
+                if (bytes == 0) {
+                    continue;
+                }
+            }
+        } else
+#endif
+        bytes = readv(o->fd, iov, iov_count);
+        if (bytes <= 0) {
+            // Treat zero return value the same as EAGAIN.
+            // See: https://bugzilla.kernel.org/show_bug.cgi?id=96381
+            if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+
+        if (out_gso) {
+#ifdef BADVPN_LINUX
+            gso_from_hdr((o->offload ? &hdr : NULL), out_gso);
+#else
+            gso_from_hdr(NULL, out_gso);
+#endif
+        }
+
+        return bytes;
+    }
+}
+
+static void write_packet (BTap *o, const struct iovec *iov, int iov_count, const struct BTap_gso *gso)
+{
+    ASSERT(iov_count >= 1)
+    ASSERT(iov_count <= BTAP_MAX_IOV)
+
+    struct iovec all_iov[1 + BTAP_MAX_IOV];
+    int all_count = 0;
+
+    int expected = 0;
+    for (int i = 0; i < iov_count; i++) {
+        expected += iov[i].iov_len;
+    }
+
+#ifdef BADVPN_LINUX
+    struct virtio_net_hdr hdr;
+    if (o->offload) {
+        memset(&hdr, 0, sizeof(hdr));
+        if (gso) {
+            switch (gso->type) {
+                case BTAP_GSO_TCPV4: hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4; break;
+                case BTAP_GSO_TCPV6: hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV6; break;
+                default: hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE; break;
+            }
+            if (gso->type != BTAP_GSO_NONE) {
+                hdr.gso_size = gso->segment_size;
+            }
+            hdr.hdr_len = gso->header_len;
+            if (gso->csum_start >= 0) {
+                hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+                hdr.csum_start = gso->csum_start;
+                hdr.csum_offset = gso->csum_offset;
+            }
+        }
+
+        all_iov[all_count].iov_base = &hdr;
+        all_iov[all_count].iov_len = sizeof(hdr);
+        all_count++;
+        expected += sizeof(hdr);
+    }
+#endif
+
+    memcpy(all_iov + all_count, iov, iov_count * sizeof(iov[0]));
+    all_count += iov_count;
+
+    int bytes = writev(o->fd, all_iov, all_count);
+    if (bytes < 0) {
+        // malformed packets will cause errors, ignore them and act like
+        // the packet was accepeted
+    } else {
+        if (bytes != expected) {
+            BLog(BLOG_WARNING, "written %d expected %d", bytes, expected);
+        }
+    }
+}
+
+static void set_read_events (BTap *o, int enable)
+{
+    if (enable) {
+        o->poll_events |= BREACTOR_READ;
+    } else {
+        o->poll_events &= ~BREACTOR_READ;
+    }
+    BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->poll_events);
+}
+
 static void fd_handler (BTap *o, int events)
 {
     DebugObject_Access(&o->d_obj);
@@ -98,31 +247,34 @@ static void fd_handler (BTap *o, int events)
         BLog(BLOG_WARNING, "device fd reports error?");
     }
 
+    if ((events&BREACTOR_READ) && o->handler_readable) {
+        o->handler_readable(o->handler_readable_user);
+        return;
+    }
+
     if (events&BREACTOR_READ) do {
         ASSERT(o->output_packet)
 
         // try reading into the buffer
-        int bytes = read(o->fd, o->output_packet, o->frame_mtu);
-        if (bytes <= 0) {
-            // Treat zero return value the same as EAGAIN.
-            // See: https://bugzilla.kernel.org/show_bug.cgi?id=96381
-            if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
-                // retry later
-                break;
-            }
+        struct iovec iov;
+        iov.iov_base = o->output_packet;
+        iov.iov_len = o->output_mtu;
+        int bytes = read_packet(o, &iov, 1, NULL);
+        if (bytes == 0) {
+            // retry later
+            break;
+        }
+        if (bytes < 0) {
             // report fatal error
             report_error(o);
             return;
         }
 
-        ASSERT_FORCE(bytes <= o->frame_mtu)
-
         // set no output packet
         o->output_packet = NULL;
 
         // update events
-        o->poll_events &= ~BREACTOR_READ;
-        BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->poll_events);
+        set_read_events(o, 0);
 
         // inform receiver we finished the packet
         PacketRecvInterface_Done(&o->output, bytes);
@@ -160,25 +312,24 @@ void output_handler_recv (BTap *o, uint8_t *data)
 #else
 
     // attempt read
-    int bytes = read(o->fd, data, o->frame_mtu);
-    if (bytes <= 0) {
-        if (bytes == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
-            // See note about zero return in fd_handler.
-            // retry later in fd_handler
-            // remember packet
-            o->output_packet = data;
-            // update events
-            o->poll_events |= BREACTOR_READ;
-            BReactor_SetFileDescriptorEvents(o->reactor, &o->bfd, o->poll_events);
-            return;
-        }
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = o->output_mtu;
+    int bytes = read_packet(o, &iov, 1, NULL);
+    if (bytes == 0) {
+        // retry later in fd_handler
+        // remember packet
+        o->output_packet = data;
+        // update events
+        set_read_events(o, 1);
+        return;
+    }
+    if (bytes < 0) {
         // report fatal error
         report_error(o);
         return;
     }
 
-    ASSERT_FORCE(bytes <= o->frame_mtu)
-
     PacketRecvInterface_Done(&o->output, bytes);
 
 #endif
@@ -192,6 +343,21 @@ int BTap_Init (BTap *o, BReactor *reactor, char *devname, char* nsname, BTap_han
     init_data.dev_type = tun ? BTAP_DEV_TUN : BTAP_DEV_TAP;
     init_data.init_type = BTAP_INIT_STRING;
     init_data.init.string = devname;
+    init_data.offload = 0;
+
+    return BTap_Init2(o, reactor, init_data, nsname, handler_error, handler_error_user);
+}
+
+int BTap_InitOffload (BTap *o, BReactor *reactor, char *devname, char* nsname, BTap_handler_error handler_error, void *handler_error_user, int tun, int offload)
+{
+    ASSERT(tun == 0 || tun == 1)
+    ASSERT(offload == 0 || offload == 1)
+
+    struct BTap_init_data init_data;
+    init_data.dev_type = tun ? BTAP_DEV_TUN : BTAP_DEV_TAP;
+    init_data.init_type = BTAP_INIT_STRING;
+    init_data.init.string = devname;
+    init_data.offload = offload;
 
     return BTap_Init2(o, reactor, init_data, nsname, handler_error, handler_error_user);
 }
@@ -208,6 +374,7 @@ int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, cha
     #ifdef BADVPN_USE_WINAPI
 
     ASSERT(init_data.init_type == BTAP_INIT_STRING)
+    ASSERT(!init_data.offload)
 
     // parse device specification
 
@@ -279,6 +446,8 @@ int BTap_Init2 (BTap *o, BReactor *reactor, struct BTap_init_data init_data, cha
         o->frame_mtu = umtu + BTAP_ETHERNET_HEADER_LENGTH;
     }
 
+    o->output_mtu = o->frame_mtu;
+
     // set connected
 
     ULONG upstatus = TRUE;
@@ -320,6 +489,8 @@ fail0:
     #if defined(BADVPN_LINUX) || defined(BADVPN_FREEBSD)
 
     o->close_fd = (init_data.init_type != BTAP_INIT_FD);
+    o->offload = init_data.offload;
+    o->handler_readable = NULL;
     int old_ns_fd = -1;
     int ns_fd = -1;
     int cur_ns_fd = -1;
@@ -329,6 +500,7 @@ fail0:
             ASSERT(init_data.init.fd.fd >= 0)
             ASSERT(init_data.init.fd.mtu >= 0)
             ASSERT(init_data.dev_type != BTAP_DEV_TAP || init_data.init.fd.mtu >= BTAP_ETHERNET_HEADER_LENGTH)
+            ASSERT(!init_data.offload)
 
             o->fd = init_data.init.fd.fd;
             o->frame_mtu = init_data.init.fd.mtu;
@@ -379,6 +551,9 @@ fail0:
             } else {
                 ifr.ifr_flags |= IFF_TAP;
             }
+            if (init_data.offload) {
+                ifr.ifr_flags |= IFF_VNET_HDR;
+            }
             if (init_data.init.string) {
                 snprintf(ifr.ifr_name, IFNAMSIZ, "%s", init_data.init.string);
             }
@@ -388,6 +563,19 @@ fail0:
                 goto fail1;
             }
 
+            if (init_data.offload) {
+                int hdr_size = sizeof(struct virtio_net_hdr);
+                if (ioctl(o->fd, TUNSETVNETHDRSZ, &hdr_size) < 0) {
+                    BLog(BLOG_ERROR, "error setting virtio-net header size");
+                    goto fail1;
+                }
+
+                if (ioctl(o->fd, TUNSETOFFLOAD, (unsigned long)(TUN_F_CSUM|TUN_F_TSO4|TUN_F_TSO6)) < 0) {
+                    BLog(BLOG_ERROR, "error enabling offloads: %s", strerror(errno));
+                    goto fail1;
+                }
+            }
+
             strcpy(devname_real, ifr.ifr_name);
 
             #endif
@@ -406,6 +594,11 @@ fail0:
 
             // open device
 
+            if (init_data.offload) {
+                BLog(BLOG_ERROR, "offload not supported on FreeBSD");
+                goto fail0;
+            }
+
             char devnode[10 + IFNAMSIZ];
             snprintf(devnode, sizeof(devnode), "/dev/%s", init_data.init.string);
 
@@ -464,6 +657,8 @@ fail0:
         default: ASSERT(0);
     }
 
+    o->output_mtu = (o->offload ? BTAP_GSO_MAX_SIZE : o->frame_mtu);
+
     // set non-blocking
     if (fcntl(o->fd, F_SETFL, O_NONBLOCK) < 0) {
         BLog(BLOG_ERROR, "cannot set non-blocking");
@@ -478,6 +673,10 @@ fail0:
     }
     o->poll_events = 0;
 
+    if (o->offload) {
+        BLog(BLOG_INFO, "checksum and TSO offloads enabled");
+    }
+
     goto success;
 
 fail1:
@@ -502,7 +701,7 @@ fail0:
 
 success:
     // init output
-    PacketRecvInterface_Init(&o->output, o->frame_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, BReactor_PendingGroup(o->reactor));
+    PacketRecvInterface_Init(&o->output, o->output_mtu, (PacketRecvInterface_handler_recv)output_handler_recv, o, BReactor_PendingGroup(o->reactor));
 
     // set no output packet
     o->output_packet = NULL;
@@ -560,6 +759,17 @@ int BTap_GetMTU (BTap *o)
     return o->frame_mtu;
 }
 
+int BTap_GetOffload (BTap *o)
+{
+    DebugObject_Access(&o->d_obj);
+
+#ifdef BADVPN_USE_WINAPI
+    return 0;
+#else
+    return o->offload;
+#endif
+}
+
 void BTap_Send (BTap *o, uint8_t *data, int data_len)
 {
     DebugObject_Access(&o->d_obj);
@@ -601,19 +811,87 @@ void BTap_Send (BTap *o, uint8_t *data, int data_len)
 
 #else
 
-    int bytes = write(o->fd, data, data_len);
-    if (bytes < 0) {
-        // malformed packets will cause errors, ignore them and act like
-        // the packet was accepeted
-    } else {
-        if (bytes != data_len) {
-            BLog(BLOG_WARNING, "written %d expected %d", bytes, data_len);
-        }
-    }
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = data_len;
+    write_packet(o, &iov, 1, NULL);
 
 #endif
 }
 
+void BTap_SendGSO (BTap *o, uint8_t *data, int data_len, const struct BTap_gso *gso)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(BTap_GetOffload(o))
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= BTAP_GSO_MAX_SIZE)
+    ASSERT(gso)
+    ASSERT(gso->type == BTAP_GSO_NONE || gso->type == BTAP_GSO_TCPV4 || gso->type == BTAP_GSO_TCPV6)
+
+#ifndef BADVPN_USE_WINAPI
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = data_len;
+    write_packet(o, &iov, 1, gso);
+#endif
+}
+
+#ifndef BADVPN_USE_WINAPI
+
+void BTap_SendV (BTap *o, const struct iovec *iov, int iov_count, const struct BTap_gso *gso)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(iov_count >= 1)
+    ASSERT(iov_count <= BTAP_MAX_IOV)
+    ASSERT(!gso || o->offload)
+
+    write_packet(o, iov, iov_count, gso);
+}
+
+void BTap_EnableBatchRead (BTap *o, BTap_handler_readable handler, void *user)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(handler)
+    ASSERT(!o->handler_readable)
+    ASSERT(!o->output_packet)
+
+    o->handler_readable = handler;
+    o->handler_readable_user = user;
+
+    // events stay enabled for good, the handler decides how much to read
+    set_read_events(o, 1);
+}
+
+int BTap_Recv (BTap *o, uint8_t *data, struct BTap_gso *out_gso)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->handler_readable)
+    ASSERT(data)
+
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = o->output_mtu;
+
+    return read_packet(o, &iov, 1, out_gso);
+}
+
+int BTap_RecvV (BTap *o, const struct iovec *iov, int iov_count, struct BTap_gso *out_gso)
+{
+    DebugObject_Access(&o->d_obj);
+    DebugError_AssertNoError(&o->d_err);
+    ASSERT(o->handler_readable)
+    ASSERT(iov_count >= 1)
+    ASSERT(iov_count <= BTAP_MAX_IOV)
+
+    return read_packet(o, iov, iov_count, out_gso);
+}
+
+#endif
+
 PacketRecvInterface * BTap_GetOutput (BTap *o)
 {
     DebugObject_Access(&o->d_obj);
@@ -43,6 +43,7 @@
 #ifdef BADVPN_USE_WINAPI
 #else
 #include <net/if.h>
+#include <sys/uio.h>
 #endif
 
 #include <misc/debug.h>
@@ -53,6 +54,32 @@
 
 #define BTAP_ETHERNET_HEADER_LENGTH 14
 
+// maximum number of buffers passed to BTap_SendV and BTap_RecvV
+#define BTAP_MAX_IOV 64
+
+// largest packet passed with offload enabled, TSO/GRO segments included
+#define BTAP_GSO_MAX_SIZE 65535
+
+#define BTAP_GSO_NONE 0
+#define BTAP_GSO_TCPV4 1
+#define BTAP_GSO_TCPV6 2
+
+/**
+ * Offload parameters of a packet sent with {@link BTap_SendGSO}.
+ */
+struct BTap_gso {
+    // one of BTAP_GSO_*
+    int type;
+    // payload size of each segment the packet is cut into, for BTAP_GSO_TCPV*
+    int segment_size;
+    // length of IP and TCP headers
+    int header_len;
+    // checksum over [csum_start, end) is stored at csum_start + csum_offset,
+    // csum_start -1 - packet is fully checksummed
+    int csum_start;
+    int csum_offset;
+};
+
 /**
  * Handler called when an error occurs on the device.
  * The object must be destroyed from the job context of this
@@ -62,11 +89,19 @@
  */
 typedef void (*BTap_handler_error) (void *used);
 
-typedef struct {
+/**
+ * Handler called when the device has packets to read, see {@link BTap_EnableBatchRead}.
+ *
+ * @param user as in {@link BTap_EnableBatchRead}
+ */
+typedef void (*BTap_handler_readable) (void *user);
+
+typedef struct BTap_s {
     BReactor *reactor;
     BTap_handler_error handler_error;
     void *handler_error_user;
     int frame_mtu;
+    int output_mtu;
     PacketRecvInterface output;
     uint8_t *output_packet;
 
@@ -79,6 +114,9 @@ typedef struct {
     int fd;
     BFileDescriptor bfd;
     int poll_events;
+    int offload;
+    BTap_handler_readable handler_readable;
+    void *handler_readable_user;
 #endif
 
     DebugError d_err;
@@ -107,6 +145,12 @@ typedef struct {
  */
 int BTap_Init (BTap *o, BReactor *bsys, char *devname, char* nsname, BTap_handler_error handler_error, void *handler_error_user, int tun) WARN_UNUSED;
 
+/**
+ * Like {@link BTap_Init}, but enables offloads if 'offload' is 1.
+ * See {@link BTap_Init2} for details.
+ */
+int BTap_InitOffload (BTap *o, BReactor *bsys, char *devname, char* nsname, BTap_handler_error handler_error, void *handler_error_user, int tun, int offload) WARN_UNUSED;
+
 enum BTap_dev_type {BTAP_DEV_TUN, BTAP_DEV_TAP};
 
 enum BTap_init_type {
@@ -119,6 +163,7 @@ enum BTap_init_type {
 struct BTap_init_data {
     enum BTap_dev_type dev_type;
     enum BTap_init_type init_type;
+    int offload;
     union {
         char *string;
         struct {
@@ -153,6 +198,10 @@ struct BTap_init_data {
  *                  and init_data.init.fd.mtu must be set to the largest IP packet or
  *                  Ethernet frame supported, for a TUN or TAP device, respectively.
  *                  File descriptor initialization is not supported on Windows.
+ *                  init_data.offload enables the virtio-net header (IFF_VNET_HDR) and
+ *                  checksum and TSO offloads, only supported on Linux with
+ *                  BTAP_INIT_STRING. The device then passes unchecksummed packets
+ *                  and TCP segments up to BTAP_GSO_MAX_SIZE in both directions.
  * @param handler_error error handler function
  * @param handler_error_user value passed to error handler
  * @return 1 on success, 0 on failure
@@ -174,6 +223,14 @@ void BTap_Free (BTap *o);
  */
 int BTap_GetMTU (BTap *o);
 
+/**
+ * Returns whether the device was opened with offloads.
+ *
+ * @param o the object
+ * @return 1 if offloads are enabled, 0 if not
+ */
+int BTap_GetOffload (BTap *o);
+
 /**
  * Sends a packet to the device.
  * Any errors will be reported via a job.
@@ -184,9 +241,76 @@ int BTap_GetMTU (BTap *o);
  */
 void BTap_Send (BTap *o, uint8_t *data, int data_len);
 
+/**
+ * Sends a packet to the device, letting the kernel finish its checksum
+ * and cut it into segments.
+ * Offloads must be enabled.
+ *
+ * @param o the object
+ * @param data packet to send
+ * @param data_len length of packet. Must be >=0 and <=BTAP_GSO_MAX_SIZE.
+ * @param gso offload parameters
+ */
+void BTap_SendGSO (BTap *o, uint8_t *data, int data_len, const struct BTap_gso *gso);
+
+#ifndef BADVPN_USE_WINAPI
+
+/**
+ * Sends a packet gathered from several buffers to the device, with one system call.
+ * Any errors will be reported via a job.
+ *
+ * @param o the object
+ * @param iov buffers of the packet
+ * @param iov_count number of buffers, must be >=1 and <=BTAP_MAX_IOV
+ * @param gso offload parameters, or NULL. Must be NULL if offloads are not enabled.
+ */
+void BTap_SendV (BTap *o, const struct iovec *iov, int iov_count, const struct BTap_gso *gso);
+
+/**
+ * Switches the device to batched reading. Instead of going through
+ * {@link BTap_GetOutput}, 'handler' is called from the reactor whenever the
+ * device is readable, and it reads any number of packets with {@link BTap_Recv}.
+ * Packets left unread make the handler be called again on the next reactor
+ * iteration. Must be called right after init, and the output interface
+ * must not be used.
+ *
+ * @param o the object
+ * @param handler readability handler
+ * @param user value passed to the handler
+ */
+void BTap_EnableBatchRead (BTap *o, BTap_handler_readable handler, void *user);
+
+/**
+ * Reads one packet.
+ * Only in batched reading mode.
+ *
+ * @param o the object
+ * @param data buffer for the packet, of at least the output interface's MTU
+ * @param out_gso receives how the packet was segmented and checksummed if offloads
+ *                are enabled, otherwise is set to no offload. May be NULL.
+ * @return packet length, 0 if there is no packet to read, or -1 on a fatal error,
+ *         in which case the object should be freed
+ */
+int BTap_Recv (BTap *o, uint8_t *data, struct BTap_gso *out_gso);
+
+/**
+ * Like {@link BTap_Recv}, but scatters the packet over several buffers,
+ * with one system call.
+ *
+ * @param o the object
+ * @param iov buffers for the packet, of at least the output interface's MTU in total
+ * @param iov_count number of buffers, must be >=1 and <=BTAP_MAX_IOV
+ * @param out_gso as in {@link BTap_Recv}
+ * @return as in {@link BTap_Recv}
+ */
+int BTap_RecvV (BTap *o, const struct iovec *iov, int iov_count, struct BTap_gso *out_gso);
+
+#endif
+
 /**
  * Returns a {@link PacketRecvInterface} for reading packets from the device.
- * The MTU of the interface will be {@link BTap_GetMTU}.
+ * The MTU of the interface will be {@link BTap_GetMTU}, or BTAP_GSO_MAX_SIZE
+ * if offloads are enabled.
  *
  * @param o the object
  * @return output interface
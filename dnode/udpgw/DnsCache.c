@@ -0,0 +1,612 @@
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include <misc/offset.h>
+#include <misc/balloc.h>
+#include <misc/bsize.h>
+#include <base/BLog.h>
+
+#include <udpgw/DnsCache.h>
+
+#define DNS_HEADER_LEN 12
+#define DNS_MAX_NAME_LEN 255
+#define DNS_MAX_QUESTION_LEN (DNS_MAX_NAME_LEN + 4)
+
+#define DNS_TYPE_SOA 6
+#define DNS_TYPE_OPT 41
+
+// header flags
+#define DNS_FLAG_RD 0x0100
+#define DNS_FLAG_CD 0x0010
+// EDNS flags in the OPT TTL field
+#define DNS_EDNS_FLAG_DO 0x8000
+
+#define DNS_RCODE_NOERROR 0
+#define DNS_RCODE_NXDOMAIN 3
+
+#define DNS_SECTION_ANSWER 0
+#define DNS_SECTION_AUTHORITY 1
+#define DNS_SECTION_ADDITIONAL 2
+
+struct rr_iter {
+    const uint8_t *data;
+    int data_len;
+    int pos;
+    int section;
+    int left[3];
+};
+
+struct rr {
+    int section;
+    uint16_t type;
+    int ttl_pos;
+    int rdata_pos;
+    int rdlength;
+};
+
+static size_t key_hash (struct DnsCache__key key);
+static uint16_t read16 (const uint8_t *p);
+static uint32_t read32 (const uint8_t *p);
+static void write32 (uint8_t *p, uint32_t v);
+static int parse_header_and_question (const uint8_t *data, int data_len, int qr, uint8_t *out_question, int *out_question_len);
+static int plain_recursive (const uint8_t *data, int data_len, int question_len);
+static int skip_name (const uint8_t *data, int data_len, int pos);
+static void rr_iter_init (struct rr_iter *it, const uint8_t *data, int data_len, int pos);
+static int rr_iter_next (struct rr_iter *it, struct rr *out);
+static uint32_t response_ttl (const uint8_t *data, int data_len, int question_len);
+static size_t entry_bytes (struct DnsCache_entry *e);
+static struct DnsCache_entry * find_entry (DnsCache *o, const uint8_t *question, int question_len);
+static struct DnsCache_entry * new_entry (DnsCache *o, const uint8_t *question, int question_len, btime_t now);
+static void free_entry (DnsCache *o, struct DnsCache_entry *e);
+static int make_room (DnsCache *o, struct DnsCache_entry *keep);
+static void answer (DnsCache *o, const uint8_t *response, int response_len, int question_len, uint32_t elapsed,
+                    BAddr local_addr, BAddr orig_addr, uint16_t id, const uint8_t *question);
+
+static size_t key_hash (struct DnsCache__key key)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < key.len; i++) {
+        h = (h ^ key.data[i]) * 16777619u;
+    }
+    return h;
+}
+
+#include "DnsCache_hash.h"
+#include <structure/CHash_impl.h>
+
+static uint16_t read16 (const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t read32 (const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void write32 (uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// Checks this is a standard query (qr=0) or response (qr=1) with a
+// single question and extracts the question with the name lowercased.
+static int parse_header_and_question (const uint8_t *data, int data_len, int qr, uint8_t *out_question, int *out_question_len)
+{
+    if (data_len < DNS_HEADER_LEN) {
+        return 0;
+    }
+
+    // QR and opcode
+    if ((data[2] >> 7) != qr || ((data[2] >> 3) & 0xF) != 0) {
+        return 0;
+    }
+
+    // QDCOUNT
+    if (read16(data + 4) != 1) {
+        return 0;
+    }
+
+    int pos = DNS_HEADER_LEN;
+    int len = 0;
+
+    while (1) {
+        if (pos >= data_len) {
+            return 0;
+        }
+        uint8_t label_len = data[pos];
+
+        // no compression in the question of queries we cache
+        if ((label_len & 0xC0)) {
+            return 0;
+        }
+        if (pos + 1 + label_len > data_len || len + 1 + label_len > DNS_MAX_NAME_LEN) {
+            return 0;
+        }
+
+        out_question[len++] = label_len;
+        pos++;
+
+        for (int i = 0; i < label_len; i++) {
+            uint8_t c = data[pos++];
+            out_question[len++] = (c >= 'A' && c <= 'Z') ? (c + ('a' - 'A')) : c;
+        }
+
+        if (label_len == 0) {
+            break;
+        }
+    }
+
+    // QTYPE and QCLASS
+    if (pos + 4 > data_len) {
+        return 0;
+    }
+    memcpy(out_question + len, data + pos, 4);
+    len += 4;
+
+    *out_question_len = len;
+    return 1;
+}
+
+// Checks RD is set, CD is clear and DO isn't set in an EDNS OPT record,
+// other combinations have different answers, so aren't cached.
+static int plain_recursive (const uint8_t *data, int data_len, int question_len)
+{
+    uint16_t flags = read16(data + 2);
+    if (!(flags & DNS_FLAG_RD) || (flags & DNS_FLAG_CD)) {
+        return 0;
+    }
+
+    struct rr_iter it;
+    rr_iter_init(&it, data, data_len, DNS_HEADER_LEN + question_len);
+
+    struct rr rr;
+    int res;
+    while ((res = rr_iter_next(&it, &rr)) > 0) {
+        // OPT TTL is extended RCODE, version and flags
+        if (rr.type == DNS_TYPE_OPT && (read16(data + rr.ttl_pos + 2) & DNS_EDNS_FLAG_DO)) {
+            return 0;
+        }
+    }
+
+    return (res == 0);
+}
+
+static int skip_name (const uint8_t *data, int data_len, int pos)
+{
+    while (1) {
+        if (pos >= data_len) {
+            return -1;
+        }
+        uint8_t b = data[pos];
+
+        if ((b & 0xC0) == 0xC0) {
+            return (pos + 2 <= data_len) ? pos + 2 : -1;
+        }
+        if ((b & 0xC0)) {
+            return -1;
+        }
+        if (b == 0) {
+            return pos + 1;
+        }
+
+        pos += 1 + b;
+    }
+}
+
+static void rr_iter_init (struct rr_iter *it, const uint8_t *data, int data_len, int pos)
+{
+    ASSERT(data_len >= DNS_HEADER_LEN)
+
+    it->data = data;
+    it->data_len = data_len;
+    it->pos = pos;
+    it->section = DNS_SECTION_ANSWER;
+    it->left[DNS_SECTION_ANSWER] = read16(data + 6);
+    it->left[DNS_SECTION_AUTHORITY] = read16(data + 8);
+    it->left[DNS_SECTION_ADDITIONAL] = read16(data + 10);
+}
+
+// Returns 1 with the next record, 0 at the end, -1 if malformed.
+static int rr_iter_next (struct rr_iter *it, struct rr *out)
+{
+    while (it->section <= DNS_SECTION_ADDITIONAL && it->left[it->section] == 0) {
+        it->section++;
+    }
+    if (it->section > DNS_SECTION_ADDITIONAL) {
+        return 0;
+    }
+
+    int pos = skip_name(it->data, it->data_len, it->pos);
+    if (pos < 0 || pos + 10 > it->data_len) {
+        return -1;
+    }
+
+    out->section = it->section;
+    out->type = read16(it->data + pos);
+    out->ttl_pos = pos + 4;
+    out->rdlength = read16(it->data + pos + 8);
+    out->rdata_pos = pos + 10;
+
+    if (out->rdata_pos + out->rdlength > it->data_len) {
+        return -1;
+    }
+
+    it->pos = out->rdata_pos + out->rdlength;
+    it->left[it->section]--;
+
+    return 1;
+}
+
+// Returns how long a response may be cached, in seconds, 0 if not at all.
+// Negative answers live for the SOA minimum, as in RFC 2308.
+static uint32_t response_ttl (const uint8_t *data, int data_len, int question_len)
+{
+    // truncated
+    if ((data[2] & 0x02)) {
+        return 0;
+    }
+
+    int rcode = data[3] & 0xF;
+    if (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN) {
+        return 0;
+    }
+
+    int negative = (rcode == DNS_RCODE_NXDOMAIN || read16(data + 6) == 0);
+
+    uint32_t min_ttl = UINT32_MAX;
+    uint32_t soa_ttl = UINT32_MAX;
+
+    struct rr_iter it;
+    rr_iter_init(&it, data, data_len, DNS_HEADER_LEN + question_len);
+
+    struct rr rr;
+    int res;
+    while ((res = rr_iter_next(&it, &rr)) > 0) {
+        // OPT has flags where the TTL would be
+        if (rr.type == DNS_TYPE_OPT) {
+            continue;
+        }
+
+        uint32_t ttl = read32(data + rr.ttl_pos);
+        if (ttl < min_ttl) {
+            min_ttl = ttl;
+        }
+
+        // SOA RDATA ends with the 32-bit MINIMUM
+        if (rr.type == DNS_TYPE_SOA && rr.section == DNS_SECTION_AUTHORITY && rr.rdlength >= 22) {
+            uint32_t minimum = read32(data + rr.rdata_pos + rr.rdlength - 4);
+            soa_ttl = (ttl < minimum) ? ttl : minimum;
+        }
+    }
+    if (res < 0) {
+        return 0;
+    }
+
+    if (negative) {
+        if (soa_ttl == UINT32_MAX) {
+            return 0;
+        }
+        return (soa_ttl > DNSCACHE_MAX_NEGATIVE_TTL) ? DNSCACHE_MAX_NEGATIVE_TTL : soa_ttl;
+    }
+
+    if (min_ttl == UINT32_MAX) {
+        return 0;
+    }
+    return (min_ttl > DNSCACHE_MAX_TTL) ? DNSCACHE_MAX_TTL : min_ttl;
+}
+
+static size_t entry_bytes (struct DnsCache_entry *e)
+{
+    return sizeof(*e) + e->question_len + (e->pending ? 0 : e->response_len);
+}
+
+static struct DnsCache_entry * find_entry (DnsCache *o, const uint8_t *question, int question_len)
+{
+    struct DnsCache__key key;
+    key.data = question;
+    key.len = question_len;
+
+    return DnsCache__Hash_Lookup(&o->entries_hash, 0, key).ptr;
+}
+
+static struct DnsCache_entry * new_entry (DnsCache *o, const uint8_t *question, int question_len, btime_t now)
+{
+    struct DnsCache_entry *e = (struct DnsCache_entry *)BAllocSize(bsize_add(bsize_fromsize(sizeof(*e)), bsize_fromint(question_len)));
+    if (!e) {
+        return NULL;
+    }
+
+    struct DnsCache__key key;
+    key.data = question;
+    key.len = question_len;
+
+    e->hash = key_hash(key);
+    e->pending = 1;
+    e->id = 0;
+    e->time = now;
+    e->expire_time = 0;
+    e->num_waiters = 0;
+    e->response = NULL;
+    e->response_len = 0;
+    e->question_len = question_len;
+    memcpy(e->question, question, question_len);
+
+    ASSERT_EXECUTE(DnsCache__Hash_Insert(&o->entries_hash, 0, DnsCache__HashDerefNonNull(0, e), NULL))
+    LinkedList1_Append(&o->entries_list, &e->lru_list_node);
+    o->num_entries++;
+    o->num_bytes += entry_bytes(e);
+
+    if (!make_room(o, e)) {
+        free_entry(o, e);
+        return NULL;
+    }
+
+    return e;
+}
+
+static void free_entry (DnsCache *o, struct DnsCache_entry *e)
+{
+    o->num_bytes -= entry_bytes(e);
+    o->num_entries--;
+    LinkedList1_Remove(&o->entries_list, &e->lru_list_node);
+    DnsCache__Hash_Remove(&o->entries_hash, 0, DnsCache__HashDerefNonNull(0, e));
+
+    if (e->response) {
+        BFree(e->response);
+    }
+
+    BFree(e);
+}
+
+// Evicts least recently used entries other than 'keep' until within limits.
+static int make_room (DnsCache *o, struct DnsCache_entry *keep)
+{
+    while (o->num_entries > o->max_entries || o->num_bytes > o->max_bytes) {
+        LinkedList1Node *node = LinkedList1_GetFirst(&o->entries_list);
+        struct DnsCache_entry *e = UPPER_OBJECT(node, struct DnsCache_entry, lru_list_node);
+
+        if (e == keep) {
+            node = LinkedList1Node_Next(node);
+            if (!node) {
+                return 0;
+            }
+            e = UPPER_OBJECT(node, struct DnsCache_entry, lru_list_node);
+        }
+
+        free_entry(o, e);
+        o->stats.evictions++;
+    }
+
+    return 1;
+}
+
+static void answer (DnsCache *o, const uint8_t *response, int response_len, int question_len, uint32_t elapsed,
+                    BAddr local_addr, BAddr orig_addr, uint16_t id, const uint8_t *question)
+{
+    ASSERT(response_len <= o->max_response_len)
+
+    uint8_t *out = o->answer_buf;
+    memcpy(out, response, response_len);
+
+    out[0] = id >> 8;
+    out[1] = id;
+
+    // echo the question as asked, resolvers may check the case of the name
+    if (question) {
+        memcpy(out + DNS_HEADER_LEN, question, question_len);
+    }
+
+    if (elapsed > 0) {
+        struct rr_iter it;
+        rr_iter_init(&it, out, response_len, DNS_HEADER_LEN + question_len);
+
+        struct rr rr;
+        while (rr_iter_next(&it, &rr) > 0) {
+            if (rr.type == DNS_TYPE_OPT) {
+                continue;
+            }
+            uint32_t ttl = read32(out + rr.ttl_pos);
+            write32(out + rr.ttl_pos, (ttl > elapsed) ? ttl - elapsed : 0);
+        }
+    }
+
+    o->handler_answer(o->user, local_addr, orig_addr, out, response_len);
+}
+
+int DnsCache_Init (DnsCache *o, int max_entries, size_t max_bytes, int max_response_len, void *user,
+                   DnsCache_handler_answer handler_answer)
+{
+    ASSERT(max_entries > 0)
+    ASSERT(max_response_len >= 0)
+
+    o->max_entries = max_entries;
+    o->max_bytes = max_bytes;
+    o->max_response_len = max_response_len;
+    o->user = user;
+    o->handler_answer = handler_answer;
+
+    if (!DnsCache__Hash_Init(&o->entries_hash, o->max_entries)) {
+        BLog(BLOG_ERROR, "DnsCache__Hash_Init failed");
+        goto fail0;
+    }
+
+    if (!(o->answer_buf = (uint8_t *)BAlloc(o->max_response_len > 0 ? o->max_response_len : 1))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        goto fail1;
+    }
+
+    LinkedList1_Init(&o->entries_list);
+    o->num_entries = 0;
+    o->num_bytes = 0;
+    memset(&o->stats, 0, sizeof(o->stats));
+
+    DebugObject_Init(&o->d_obj);
+    return 1;
+
+fail1:
+    DnsCache__Hash_Free(&o->entries_hash);
+fail0:
+    return 0;
+}
+
+void DnsCache_Free (DnsCache *o)
+{
+    DebugObject_Free(&o->d_obj);
+
+    LinkedList1Node *node;
+    while ((node = LinkedList1_GetFirst(&o->entries_list))) {
+        free_entry(o, UPPER_OBJECT(node, struct DnsCache_entry, lru_list_node));
+    }
+
+    BFree(o->answer_buf);
+    DnsCache__Hash_Free(&o->entries_hash);
+}
+
+int DnsCache_Query (DnsCache *o, BAddr local_addr, BAddr orig_addr, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+
+    uint8_t question[DNS_MAX_QUESTION_LEN];
+    int question_len;
+    if (!parse_header_and_question(data, data_len, 0, question, &question_len) ||
+        !plain_recursive(data, data_len, question_len)) {
+        return DNSCACHE_RESULT_MISS;
+    }
+
+    uint16_t id = read16(data);
+    btime_t now = btime_gettime();
+
+    struct DnsCache_entry *e = find_entry(o, question, question_len);
+
+    if (e && !e->pending) {
+        if (now < e->expire_time) {
+            o->stats.hits++;
+
+            LinkedList1_Remove(&o->entries_list, &e->lru_list_node);
+            LinkedList1_Append(&o->entries_list, &e->lru_list_node);
+
+            answer(o, e->response, e->response_len, e->question_len, (uint32_t)((now - e->time) / 1000),
+                   local_addr, orig_addr, id, data + DNS_HEADER_LEN);
+            return DNSCACHE_RESULT_HIT;
+        }
+
+        // expired, ask again
+        free_entry(o, e);
+        e = NULL;
+    }
+
+    if (e) {
+        ASSERT(e->pending)
+
+        if (now - e->time >= DNSCACHE_PENDING_TIMEOUT) {
+            // upstream query may be lost, this one takes its place
+            o->stats.misses++;
+            e->id = id;
+            e->time = now;
+            return DNSCACHE_RESULT_MISS;
+        }
+
+        if (e->num_waiters < DNSCACHE_MAX_WAITERS) {
+            o->stats.coalesced++;
+
+            struct DnsCache_waiter *w = &e->waiters[e->num_waiters++];
+            w->local_addr = local_addr;
+            w->id = id;
+            w->orig_addr = orig_addr;
+            return DNSCACHE_RESULT_COALESCED;
+        }
+
+        // too many waiting, let this one through uncached
+        o->stats.misses++;
+        return DNSCACHE_RESULT_MISS;
+    }
+
+    o->stats.misses++;
+
+    if (!(e = new_entry(o, question, question_len, now))) {
+        BLog(BLOG_WARNING, "dns cache: cannot track query");
+        return DNSCACHE_RESULT_MISS;
+    }
+
+    e->id = id;
+
+    return DNSCACHE_RESULT_MISS;
+}
+
+void DnsCache_Response (DnsCache *o, const uint8_t *data, int data_len)
+{
+    DebugObject_Access(&o->d_obj);
+    ASSERT(data_len >= 0)
+
+    if (data_len > o->max_response_len) {
+        return;
+    }
+
+    uint8_t question[DNS_MAX_QUESTION_LEN];
+    int question_len;
+    if (!parse_header_and_question(data, data_len, 1, question, &question_len)) {
+        return;
+    }
+
+    // only answers to the queries we forwarded, so a response to some
+    // other query for the same name (or a forged one) isn't taken
+    struct DnsCache_entry *e = find_entry(o, question, question_len);
+    if (!e || !e->pending || read16(data) != e->id || !plain_recursive(data, data_len, question_len)) {
+        return;
+    }
+
+    // answer coalesced askers
+    for (int i = 0; i < e->num_waiters; i++) {
+        struct DnsCache_waiter *w = &e->waiters[i];
+        answer(o, data, data_len, question_len, 0, w->local_addr, w->orig_addr, w->id, NULL);
+    }
+    e->num_waiters = 0;
+
+    uint32_t ttl = response_ttl(data, data_len, question_len);
+    if (ttl == 0) {
+        o->stats.uncacheable++;
+        free_entry(o, e);
+        return;
+    }
+
+    if (!(e->response = (uint8_t *)BAlloc(data_len > 0 ? data_len : 1))) {
+        BLog(BLOG_ERROR, "BAlloc failed");
+        free_entry(o, e);
+        return;
+    }
+    memcpy(e->response, data, data_len);
+
+    btime_t now = btime_gettime();
+
+    o->num_bytes -= entry_bytes(e);
+    e->pending = 0;
+    e->response_len = data_len;
+    e->time = now;
+    e->expire_time = now + (btime_t)ttl * 1000;
+    o->num_bytes += entry_bytes(e);
+
+    LinkedList1_Remove(&o->entries_list, &e->lru_list_node);
+    LinkedList1_Append(&o->entries_list, &e->lru_list_node);
+
+    if (!make_room(o, e)) {
+        o->stats.uncacheable++;
+        free_entry(o, e);
+    }
+}
+
+void DnsCache_LogStats (DnsCache *o)
+{
+    DebugObject_Access(&o->d_obj);
+
+    BLog(BLOG_INFO, "dns cache: %d entries, %zu bytes, %"PRIu64" hits, %"PRIu64" misses, %"PRIu64" coalesced, %"PRIu64" uncacheable, %"PRIu64" evicted",
+         o->num_entries, o->num_bytes, o->stats.hits, o->stats.misses, o->stats.coalesced, o->stats.uncacheable, o->stats.evictions);
+
+    memset(&o->stats, 0, sizeof(o->stats));
+}
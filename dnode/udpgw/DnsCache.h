@@ -0,0 +1,130 @@
+#ifndef DNODE_UDPGW_DNSCACHE_H
+#define DNODE_UDPGW_DNSCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <misc/debug.h>
+#include <structure/LinkedList1.h>
+#include <structure/CHash.h>
+#include <base/DebugObject.h>
+#include <system/BAddr.h>
+#include <system/BTime.h>
+
+// Cache of DNS responses keyed by question (lowercased name, type, class),
+// with identical questions in flight coalesced into one upstream query.
+// Only plain recursive queries are handled (RD set, CD clear, no EDNS DO),
+// anything else goes upstream untouched, since its answer differs.
+
+#define DNSCACHE_RESULT_MISS 0
+#define DNSCACHE_RESULT_HIT 1
+#define DNSCACHE_RESULT_COALESCED 2
+
+// askers of an in-flight question answered from its upstream response
+#define DNSCACHE_MAX_WAITERS 8
+
+// the next asker retries upstream if no response came in this long
+#define DNSCACHE_PENDING_TIMEOUT 2000
+
+// caps on TTL of positive and negative answers, in seconds
+#define DNSCACHE_MAX_TTL 3600
+#define DNSCACHE_MAX_NEGATIVE_TTL 300
+
+typedef void (*DnsCache_handler_answer) (void *user, BAddr local_addr, BAddr orig_addr, const uint8_t *data, int data_len);
+
+struct DnsCache_entry;
+typedef struct DnsCache_entry *DnsCache__hash_link;
+
+struct DnsCache__key {
+    const uint8_t *data;
+    int len;
+};
+
+#include "DnsCache_hash.h"
+#include <structure/CHash_decl.h>
+
+struct DnsCache_waiter {
+    BAddr local_addr;
+    BAddr orig_addr;
+    uint16_t id;
+};
+
+struct DnsCache_entry {
+    LinkedList1Node lru_list_node;
+    DnsCache__hash_link hash_next;
+    size_t hash;
+    int pending;
+    // pending: ID of the query sent upstream, only its response is taken
+    uint16_t id;
+    // pending: when the upstream query went out, else when the response came
+    btime_t time;
+    btime_t expire_time;
+    int num_waiters;
+    struct DnsCache_waiter waiters[DNSCACHE_MAX_WAITERS];
+    uint8_t *response;
+    int response_len;
+    int question_len;
+    uint8_t question[];
+};
+
+typedef struct {
+    int max_entries;
+    size_t max_bytes;
+    int max_response_len;
+    void *user;
+    DnsCache_handler_answer handler_answer;
+    DnsCache__Hash entries_hash;
+    LinkedList1 entries_list;
+    int num_entries;
+    size_t num_bytes;
+    uint8_t *answer_buf;
+    struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t coalesced;
+        uint64_t uncacheable;
+        uint64_t evictions;
+    } stats;
+    DebugObject d_obj;
+} DnsCache;
+
+/**
+ * Initializes the cache.
+ *
+ * @param max_entries maximum number of questions cached or in flight, >0
+ * @param max_bytes maximum memory used by entries and responses
+ * @param max_response_len longest response passed to {@link DnsCache_Response}
+ * @param handler_answer called with answers for askers, from
+ *                       {@link DnsCache_Query} on a hit and from
+ *                       {@link DnsCache_Response} for coalesced queries
+ * @return 1 on success, 0 on failure
+ */
+int DnsCache_Init (DnsCache *o, int max_entries, size_t max_bytes, int max_response_len, void *user,
+                   DnsCache_handler_answer handler_answer) WARN_UNUSED;
+
+void DnsCache_Free (DnsCache *o);
+
+/**
+ * Looks up a query from an asker.
+ *
+ * @return DNSCACHE_RESULT_HIT if it was answered via handler_answer,
+ *         DNSCACHE_RESULT_COALESCED if the same question is in flight and
+ *         the asker will be answered when it completes, the query must be
+ *         dropped then, or DNSCACHE_RESULT_MISS if the query must be sent
+ *         upstream (also for anything the cache doesn't understand)
+ */
+int DnsCache_Query (DnsCache *o, BAddr local_addr, BAddr orig_addr, const uint8_t *data, int data_len);
+
+/**
+ * Passes a response from the DNS server, caches it if possible and answers
+ * coalesced askers of its question. Responses not matching the ID of the
+ * pending query are ignored.
+ */
+void DnsCache_Response (DnsCache *o, const uint8_t *data, int data_len);
+
+/**
+ * Logs counters and resets them.
+ */
+void DnsCache_LogStats (DnsCache *o);
+
+#endif
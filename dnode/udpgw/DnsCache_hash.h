@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME DnsCache__Hash
+#define CHASH_PARAM_ENTRY struct DnsCache_entry
+#define CHASH_PARAM_LINK DnsCache__hash_link
+#define CHASH_PARAM_KEY struct DnsCache__key
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((DnsCache__hash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->hash)
+#define CHASH_PARAM_KEYHASH(arg, key) key_hash((key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) ((entry1).ptr->question_len == (entry2).ptr->question_len && !memcmp((entry1).ptr->question, (entry2).ptr->question, (entry1).ptr->question_len))
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) ((key1).len == (entry2).ptr->question_len && !memcmp((key1).data, (entry2).ptr->question, (key1).len))
+#define CHASH_PARAM_ENTRY_NEXT hash_next
@@ -25,14 +25,12 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <limits.h>
 
-#include <protocol/udpgw_proto.h>
 #include <misc/debug.h>
 #include <misc/version.h>
 #include <misc/loggers_string.h>
@@ -45,17 +43,11 @@
 #include <misc/compare.h>
 #include <misc/print_macros.h>
 #include <structure/LinkedList1.h>
-#include <structure/BAVL.h>
+#include <structure/CHash.h>
 #include <base/BLog.h>
 #include <system/BNetwork.h>
-#include <system/BConnection.h>
 #include <system/BDatagram.h>
 #include <system/BSignal.h>
-#include <flow/PacketProtoDecoder.h>
-#include <flow/PacketPassFairQueue.h>
-#include <flow/PacketStreamSender.h>
-#include <flow/PacketProtoFlowPassthru.h>
-#include <flow/SinglePacketBuffer.h>
 
 #ifndef BADVPN_USE_WINAPI
 #include <base/BLog_syslog.h>
@@ -64,63 +56,71 @@
 #endif
 
 #include <udpgw/udpgw.h>
+#include <udpgw/DnsCache.h>
 
 #define DNS_UPDATE_TIME 2000
 
-struct client {
-    PacketPassConnector send_connector;
-    PacketPassConnector recv_connector;
-    PacketPassInterface recv_if;
-    PacketPassFairQueue send_queue;
-    BAVL connections_tree;
-    LinkedList1 connections_list;
-    int num_connections;
-    LinkedList1 closing_connections_list;
-    LinkedList1Node clients_list_node;
+struct udpgw_conaddr {
+    BAddr local_addr;
+    BAddr remote_addr;
 };
 
+struct connection;
+typedef struct connection *udpgw__conaddrhash_link;
+
+#include "udpgw_conaddrhash.h"
+#include <structure/CHash_decl.h>
+
+struct remote;
+typedef struct remote *udpgw__remotehash_link;
+
+#include "udpgw_remotehash.h"
+#include <structure/CHash_decl.h>
+
+// A UDP flow from the device, mapped to its own socket. Datagrams are sent
+// straight from the device's buffer and received into recv_buf, from which
+// they go straight to the device.
 struct connection {
-    struct client *client;
-    uint16_t conid;
+    // device side source and original destination
+    struct udpgw_conaddr conaddr;
+    size_t conaddr_hash;
+    // where datagrams actually go, the DNS server for DNS
+    BAddr addr;
+    int is_dns;
+    BDatagram udp_dgram;
+    int local_port_index;
+    struct remote *remote;
+    LinkedList1Node remote_list_node;
+    udpgw__conaddrhash_link conaddr_hash_next;
+    LinkedList1Node connections_list_node;
+    uint8_t recv_buf[];
+};
+
+// Local ports in use towards one remote address (or IP, with
+// --unique-local-ports), kept up to date as connections come and go.
+struct remote {
     BAddr addr;
-    BAddr orig_addr;
-    const uint8_t *first_data;
-    int first_data_len;
-    btime_t last_use_time;
-    int closing;
-    BPending first_job;
-    BufferWriter *send_if;
-    PacketProtoFlowPassthru send_ppflow;
-    PacketPassFairQueueFlow send_qflow;
-    union {
-        struct {
-            BDatagram udp_dgram;
-            int local_port_index;
-            BufferWriter udp_send_writer;
-            PacketBuffer udp_send_buffer;
-            SinglePacketBuffer udp_recv_buffer;
-            PacketPassInterface udp_recv_if;
-            BAVLNode connections_tree_node;
-            LinkedList1Node connections_list_node;
-        };
-        struct {
-            LinkedList1Node closing_connections_list_node;
-        };
-    };
+    size_t addr_hash;
+    int refs;
+    // connections bound to a local port, least recently used first
+    LinkedList1 connections_list;
+    udpgw__remotehash_link hash_next;
+    uint8_t port_usage[];
 };
 
 static struct {
-    int max_connections_for_client;
+    int max_connections;
     int local_udp_num_ports;
     char *local_udp_addr;
     int local_udp_ip6_num_ports;
     char *local_udp_ip6_addr;
     int unique_local_ports;
+    int dns_cache_entries;
+    int dns_cache_size;
 } options;
 
-// MTUs
+// MTU
 static int udp_mtu;
-static int udpgw_mtu;
 
 // local UDP port range, if options.local_udp_num_ports>=0
 static BAddr local_udp_addr;
@@ -132,40 +132,56 @@ static BAddr local_udp_ip6_addr;
 static BAddr dns_addr;
 static btime_t last_dns_update_time;
 
+// DNS cache, if options.dns_cache_entries>0
+static int have_dns_cache;
+static DnsCache dns_cache;
+
 // reactor
 static BReactor* ss;
 
-// the one and only client
-static struct client the_client;
+// where datagrams from the sockets go
+static void *user;
+static udpgw_handler_received handler_received;
+
+// connections
+static udpgw__ConaddrHash connections_hash;
+static udpgw__RemoteHash remotes_hash;
+static LinkedList1 connections_list;
+static int num_connections;
 
 static void parse_arguments (int argc, char *argv[]);
 static void process_arguments (void);
-static void client_init (struct client *client);
-static void client_free (struct client *client);
-static void client_logfunc (struct client *client);
-static void client_log (struct client *client, int level, const char *fmt, ...);
-static void client_recv_if_handler_send (struct client *client, uint8_t *data, int data_len);
+static size_t conaddr_hash (struct udpgw_conaddr *conaddr);
+static int conaddr_equal (struct udpgw_conaddr *v1, struct udpgw_conaddr *v2);
 static int get_local_num_ports (int addr_type);
 static BAddr get_local_addr (int addr_type);
-static uint8_t * build_port_usage_array_and_find_least_used_connection (BAddr remote_addr, struct connection **out_con);
-static void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, const uint8_t *data, int data_len);
+static struct remote * remote_ref (BAddr addr);
+static void remote_unref (struct remote *r);
+static struct connection * connection_init (struct udpgw_conaddr conaddr, BAddr addr, int is_dns);
 static void connection_free (struct connection *con);
 static void connection_logfunc (struct connection *con);
 static void connection_log (struct connection *con, int level, const char *fmt, ...);
-static void connection_free_udp (struct connection *con);
-static void connection_first_job_handler (struct connection *con);
-static void connection_send_to_client (struct connection *con, uint8_t flags, const uint8_t *data, int data_len);
-static int connection_send_to_udp (struct connection *con, const uint8_t *data, int data_len);
-static void connection_close (struct connection *con);
-static void connection_send_qflow_busy_handler (struct connection *con);
+static void connection_bind (struct connection *con);
+static void connection_release_port (struct connection *con);
+static void connection_touch (struct connection *con);
+static void connection_send_to_udp (struct connection *con, const uint8_t *data, int data_len);
 static void connection_dgram_handler_event (struct connection *con, int event);
-static void connection_udp_recv_if_handler_send (struct connection *con, uint8_t *data, int data_len);
-static struct connection * find_connection (struct client *client, uint16_t conid);
-static int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2);
+static void connection_recv_if_handler_done (struct connection *con, int data_len);
+static struct connection * find_connection (struct udpgw_conaddr *conaddr);
 static void maybe_update_dns (void);
+static void dns_cache_handler_answer (void *unused, BAddr local_addr, BAddr orig_addr, const uint8_t *data, int data_len);
+
+#include "udpgw_conaddrhash.h"
+#include <structure/CHash_impl.h>
+
+#include "udpgw_remotehash.h"
+#include <structure/CHash_impl.h>
 
-void udpgw_init (int argc, char **argv, BReactor* udpgw_reactor, int udp_mtu_)
+int udpgw_init (int argc, char **argv, BReactor* udpgw_reactor, int udp_mtu_, void *user_, udpgw_handler_received handler_received_)
 {
+    ASSERT(udp_mtu_ >= 0)
+    ASSERT(handler_received_)
+
     // parse command-line arguments
     parse_arguments(argc, argv);
 
@@ -173,35 +189,139 @@ void udpgw_init (int argc, char **argv, BReactor* udpgw_reactor, int udp_mtu_)
     process_arguments();
 
     ss = udpgw_reactor;
-
-    // compute MTUs
     udp_mtu = udp_mtu_;
-    udpgw_mtu = udpgw_compute_mtu(udp_mtu);
-    if (udpgw_mtu < 0 || udpgw_mtu > PACKETPROTO_MAXPAYLOAD) {
-        udpgw_mtu = PACKETPROTO_MAXPAYLOAD;
-    }
+    user = user_;
+    handler_received = handler_received_;
 
     // init DNS forwarding
     BAddr_InitNone(&dns_addr);
     last_dns_update_time = INT64_MIN;
     maybe_update_dns();
 
-    client_init(&the_client);
+    // init connections hash
+    if (!udpgw__ConaddrHash_Init(&connections_hash, options.max_connections)) {
+        BLog(BLOG_ERROR, "udpgw__ConaddrHash_Init failed");
+        goto fail0;
+    }
+
+    // init remotes hash
+    if (!udpgw__RemoteHash_Init(&remotes_hash, options.max_connections)) {
+        BLog(BLOG_ERROR, "udpgw__RemoteHash_Init failed");
+        goto fail1;
+    }
+
+    // init connections list
+    LinkedList1_Init(&connections_list);
+
+    // set zero connections
+    num_connections = 0;
+
+    // init DNS cache
+    have_dns_cache = 0;
+    if (options.dns_cache_entries > 0) {
+        if (!DnsCache_Init(&dns_cache, options.dns_cache_entries, options.dns_cache_size, udp_mtu, NULL, dns_cache_handler_answer)) {
+            BLog(BLOG_ERROR, "DnsCache_Init failed");
+        } else {
+            have_dns_cache = 1;
+        }
+    }
+
+    return 1;
+
+fail1:
+    udpgw__ConaddrHash_Free(&connections_hash);
+fail0:
+    return 0;
 }
 
-PacketPassInterface* udpgw_get_input ()
+void udpgw_cleanup ()
 {
-    return PacketPassConnector_GetInput(&the_client.recv_connector);
+    // free connections
+    while (!LinkedList1_IsEmpty(&connections_list)) {
+        struct connection *con = UPPER_OBJECT(LinkedList1_GetFirst(&connections_list), struct connection, connections_list_node);
+        connection_free(con);
+    }
+
+    if (have_dns_cache) {
+        DnsCache_Free(&dns_cache);
+    }
+
+    // free remotes hash, freeing connections released all remotes
+    udpgw__RemoteHash_Free(&remotes_hash);
+
+    // free connections hash
+    udpgw__ConaddrHash_Free(&connections_hash);
 }
 
-PacketPassConnector* udpgw_get_output ()
+void udpgw_log_stats ()
 {
-    return &the_client.send_connector;
+    if (have_dns_cache) {
+        DnsCache_LogStats(&dns_cache);
+    }
 }
 
-void udpgw_cleanup ()
+void udpgw_submit_packet (BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len)
 {
-    client_free(&the_client);
+    ASSERT(local_addr.type == BADDR_TYPE_IPV4 || local_addr.type == BADDR_TYPE_IPV6)
+    ASSERT(remote_addr.type == local_addr.type)
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= udp_mtu)
+
+    struct udpgw_conaddr conaddr;
+    conaddr.local_addr = local_addr;
+    conaddr.remote_addr = remote_addr;
+
+    // find connection
+    struct connection *con = find_connection(&conaddr);
+
+    if (con) {
+        is_dns = con->is_dns;
+    }
+    else if (is_dns) {
+        // if this is DNS, it goes to the DNS server, but is answered from
+        // the original address
+        maybe_update_dns();
+        if (dns_addr.type == BADDR_TYPE_NONE) {
+            BLog(BLOG_WARNING, "received DNS packet, but no DNS server available");
+            is_dns = 0;
+        } else {
+            BLog(BLOG_DEBUG, "received DNS");
+        }
+    }
+
+    // answer from the DNS cache, or wait for the same question already
+    // asked, without needing a socket
+    if (is_dns && have_dns_cache) {
+        switch (DnsCache_Query(&dns_cache, local_addr, remote_addr, data, data_len)) {
+            case DNSCACHE_RESULT_HIT:
+                BLog(BLOG_DEBUG, "answered from DNS cache");
+                if (con) {
+                    connection_touch(con);
+                }
+                return;
+            case DNSCACHE_RESULT_COALESCED:
+                BLog(BLOG_DEBUG, "DNS query coalesced");
+                if (con) {
+                    connection_touch(con);
+                }
+                return;
+        }
+    }
+
+    // if connection doesn't exists, create it
+    if (!con) {
+        // check number of connections
+        if (num_connections == options.max_connections) {
+            // close least recently used connection
+            connection_free(UPPER_OBJECT(LinkedList1_GetFirst(&connections_list), struct connection, connections_list_node));
+        }
+
+        if (!(con = connection_init(conaddr, (is_dns ? dns_addr : remote_addr), is_dns))) {
+            return;
+        }
+    }
+
+    connection_send_to_udp(con, data, data_len);
 }
 
 void parse_arguments (int argc, char *argv[])
@@ -210,10 +330,12 @@ void parse_arguments (int argc, char *argv[])
         return;
     }
 
-    options.max_connections_for_client = DEFAULT_MAX_CONNECTIONS_FOR_CLIENT;
+    options.max_connections = DEFAULT_MAX_CONNECTIONS;
     options.local_udp_num_ports = -1;
     options.local_udp_ip6_num_ports = -1;
     options.unique_local_ports = 0;
+    options.dns_cache_entries = DEFAULT_DNS_CACHE_ENTRIES;
+    options.dns_cache_size = DEFAULT_DNS_CACHE_SIZE;
 
     int i;
     for (i = 1; i < argc; i++) {
@@ -224,7 +346,7 @@ void parse_arguments (int argc, char *argv[])
                 fprintf(stderr, "%s: requires an argument\n", arg);
                 return;
             }
-            if ((options.max_connections_for_client = atoi(argv[i + 1])) <= 0) {
+            if ((options.max_connections = atoi(argv[i + 1])) <= 0) {
                 fprintf(stderr, "%s: wrong argument\n", arg);
                 return;
             }
@@ -257,6 +379,28 @@ void parse_arguments (int argc, char *argv[])
         else if (!strcmp(arg, "--unique-local-ports")) {
             options.unique_local_ports = 1;
         }
+        else if (!strcmp(arg, "--dns-cache-entries")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return;
+            }
+            if ((options.dns_cache_entries = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return;
+            }
+            i++;
+        }
+        else if (!strcmp(arg, "--dns-cache-size")) {
+            if (1 >= argc - i) {
+                fprintf(stderr, "%s: requires an argument\n", arg);
+                return;
+            }
+            if ((options.dns_cache_size = atoi(argv[i + 1])) < 0) {
+                fprintf(stderr, "%s: wrong argument\n", arg);
+                return;
+            }
+            i++;
+        }
     }
 }
 
@@ -287,167 +431,15 @@ void process_arguments (void)
     }
 }
 
-void client_init (struct client *client)
-{
-    memset(client, 0, sizeof(*client));
-
-    PacketPassConnector_Init(&client->send_connector, udpgw_mtu, BReactor_PendingGroup(ss));
-    PacketPassConnector_Init(&client->recv_connector, udpgw_mtu, BReactor_PendingGroup(ss));
-
-    // init recv interface
-    PacketPassInterface_Init(&client->recv_if, udpgw_mtu, (PacketPassInterface_handler_send)client_recv_if_handler_send, client, BReactor_PendingGroup(ss));
-    PacketPassConnector_ConnectOutput(&client->recv_connector, &client->recv_if);
-
-    // init send queue
-    if (!PacketPassFairQueue_Init(&client->send_queue, PacketPassConnector_GetInput(&client->send_connector), BReactor_PendingGroup(ss), 0, 1)) {
-        BLog(BLOG_ERROR, "PacketPassFairQueue_Init failed");
-    }
-
-    // init connections tree
-    BAVL_Init(&client->connections_tree, OFFSET_DIFF(struct connection, conid, connections_tree_node), (BAVL_comparator)uint16_comparator, NULL);
 
-    // init connections list
-    LinkedList1_Init(&client->connections_list);
-
-    // set zero connections
-    client->num_connections = 0;
-
-    // init closing connections list
-    LinkedList1_Init(&client->closing_connections_list);
-}
-
-void client_free (struct client *client)
+size_t conaddr_hash (struct udpgw_conaddr *conaddr)
 {
-    // allow freeing send queue flows
-    PacketPassFairQueue_PrepareFree(&client->send_queue);
-
-    // free connections
-    while (!LinkedList1_IsEmpty(&client->connections_list)) {
-        struct connection *con = UPPER_OBJECT(LinkedList1_GetFirst(&client->connections_list), struct connection, connections_list_node);
-        connection_free(con);
-    }
-
-    // free closing connections
-    while (!LinkedList1_IsEmpty(&client->closing_connections_list)) {
-        struct connection *con = UPPER_OBJECT(LinkedList1_GetFirst(&client->closing_connections_list), struct connection, closing_connections_list_node);
-        connection_free(con);
-    }
-
-    // free send queue
-    PacketPassFairQueue_Free(&client->send_queue);
-
-    PacketPassConnector_Free(&client->send_connector);
-    PacketPassConnector_Free(&client->recv_connector);
-    PacketPassInterface_Free(&client->recv_if);
+    return BAddr_Hash(&conaddr->remote_addr) * 31 + BAddr_Hash(&conaddr->local_addr);
 }
 
-void client_logfunc (struct client *client)
+int conaddr_equal (struct udpgw_conaddr *v1, struct udpgw_conaddr *v2)
 {
-    BLog_Append("udpgw client: ");
-}
-
-void client_log (struct client *client, int level, const char *fmt, ...)
-{
-    va_list vl;
-    va_start(vl, fmt);
-    BLog_LogViaFuncVarArg((BLog_logfunc)client_logfunc, client, BLOG_CURRENT_CHANNEL, level, fmt, vl);
-    va_end(vl);
-}
-
-void client_recv_if_handler_send (struct client *client, uint8_t *data, int data_len)
-{
-    ASSERT(data_len >= 0)
-    ASSERT(data_len <= udpgw_mtu)
-
-    // accept packet
-    PacketPassInterface_Done(&client->recv_if);
-
-    // parse header
-    if (data_len < sizeof(struct udpgw_header)) {
-        client_log(client, BLOG_ERROR, "missing header");
-        return;
-    }
-    struct udpgw_header header;
-    memcpy(&header, data, sizeof(header));
-    data += sizeof(header);
-    data_len -= sizeof(header);
-    uint8_t flags = ltoh8(header.flags);
-    uint16_t conid = ltoh16(header.conid);
-
-    // if this is keepalive, ignore any payload
-    if ((flags & UDPGW_CLIENT_FLAG_KEEPALIVE)) {
-        client_log(client, BLOG_DEBUG, "received keepalive");
-        return;
-    }
-
-    // parse address
-    BAddr orig_addr;
-    if ((flags & UDPGW_CLIENT_FLAG_IPV6)) {
-        if (data_len < sizeof(struct udpgw_addr_ipv6)) {
-            client_log(client, BLOG_ERROR, "missing ipv6 address");
-            return;
-        }
-        struct udpgw_addr_ipv6 addr_ipv6;
-        memcpy(&addr_ipv6, data, sizeof(addr_ipv6));
-        data += sizeof(addr_ipv6);
-        data_len -= sizeof(addr_ipv6);
-        BAddr_InitIPv6(&orig_addr, addr_ipv6.addr_ip, addr_ipv6.addr_port);
-    } else {
-        if (data_len < sizeof(struct udpgw_addr_ipv4)) {
-            client_log(client, BLOG_ERROR, "missing ipv4 address");
-            return;
-        }
-        struct udpgw_addr_ipv4 addr_ipv4;
-        memcpy(&addr_ipv4, data, sizeof(addr_ipv4));
-        data += sizeof(addr_ipv4);
-        data_len -= sizeof(addr_ipv4);
-        BAddr_InitIPv4(&orig_addr, addr_ipv4.addr_ip, addr_ipv4.addr_port);
-    }
-
-    // check payload length
-    if (data_len > udp_mtu) {
-        client_log(client, BLOG_ERROR, "too much data");
-        return;
-    }
-
-    // find connection
-    struct connection *con = find_connection(client, conid);
-    ASSERT(!con || !con->closing)
-
-    // if connection exists, close it if needed
-    if (con && ((flags & UDPGW_CLIENT_FLAG_REBIND) || !BAddr_Compare(&con->orig_addr, &orig_addr))) {
-        connection_log(con, BLOG_DEBUG, "close old");
-        connection_close(con);
-        con = NULL;
-    }
-
-    // if connection doesn't exists, create it
-    if (!con) {
-        // check number of connections
-        if (client->num_connections == options.max_connections_for_client) {
-            // close least recently used connection
-            con = UPPER_OBJECT(LinkedList1_GetFirst(&client->connections_list), struct connection, connections_list_node);
-            connection_close(con);
-        }
-
-        // if this is DNS, replace actual address, but keep still remember the orig_addr
-        BAddr addr = orig_addr;
-        if ((flags & UDPGW_CLIENT_FLAG_DNS)) {
-            maybe_update_dns();
-            if (dns_addr.type == BADDR_TYPE_NONE) {
-                client_log(client, BLOG_WARNING, "received DNS packet, but no DNS server available");
-            } else {
-                client_log(client, BLOG_DEBUG, "received DNS");
-                addr = dns_addr;
-            }
-        }
-
-        // create new connection
-        connection_init(client, conid, addr, orig_addr, data, data_len);
-    } else {
-        // submit packet to existing connection
-        connection_send_to_udp(con, data, data_len);
-    }
+    return (BAddr_Compare(&v1->remote_addr, &v2->remote_addr) && BAddr_Compare(&v1->local_addr, &v2->local_addr));
 }
 
 int get_local_num_ports (int addr_type)
@@ -470,185 +462,87 @@ BAddr get_local_addr (int addr_type)
     }
 }
 
-uint8_t * build_port_usage_array_and_find_least_used_connection (BAddr remote_addr, struct connection **out_con)
+struct remote * remote_ref (BAddr addr)
 {
-    ASSERT(remote_addr.type == BADDR_TYPE_IPV4 || remote_addr.type == BADDR_TYPE_IPV6)
-    ASSERT(get_local_num_ports(remote_addr.type) >= 0)
+    ASSERT(addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6)
+    ASSERT(get_local_num_ports(addr.type) >= 0)
 
-    int local_num_ports = get_local_num_ports(remote_addr.type);
+    // a local port can be shared by different remote addresses, or only
+    // by different remote IPs with --unique-local-ports
+    if (options.unique_local_ports) {
+        BAddr_SetPort(&addr, 0);
+    }
 
-    // allocate port usage array
-    uint8_t *port_usage = (uint8_t *)BAllocSize(bsize_fromint(local_num_ports));
-    if (!port_usage) {
-        return NULL;
+    struct remote *r = udpgw__RemoteHash_Lookup(&remotes_hash, 0, &addr).ptr;
+    if (r) {
+        r->refs++;
+        return r;
     }
 
-    // zero array
-    memset(port_usage, 0, local_num_ports);
+    int local_num_ports = get_local_num_ports(addr.type);
 
-    struct connection *least_con = NULL;
+    if (!(r = (struct remote *)BAllocSize(bsize_add(bsize_fromsize(sizeof(*r)), bsize_fromint(local_num_ports))))) {
+        return NULL;
+    }
 
-    // flag inappropriate ports (those with the same remote address)
-    {
-        struct client *client = &the_client;
+    r->addr = addr;
+    r->addr_hash = BAddr_Hash(&r->addr);
+    r->refs = 1;
+    LinkedList1_Init(&r->connections_list);
+    memset(r->port_usage, 0, local_num_ports);
 
-        for (LinkedList1Node *ln2 = LinkedList1_GetFirst(&client->connections_list); ln2; ln2 = LinkedList1Node_Next(ln2)) {
-            struct connection *con = UPPER_OBJECT(ln2, struct connection, connections_list_node);
-            ASSERT(con->client == client)
-            ASSERT(!con->closing)
+    ASSERT_EXECUTE(udpgw__RemoteHash_Insert(&remotes_hash, 0, udpgw__RemoteHashDerefNonNull(0, r), NULL))
 
-            if (con->addr.type != remote_addr.type || con->local_port_index < 0) {
-                continue;
-            }
-            ASSERT(con->local_port_index < local_num_ports)
-
-            if (options.unique_local_ports) {
-                BIPAddr ip1;
-                BIPAddr ip2;
-                BAddr_GetIPAddr(&con->addr, &ip1);
-                BAddr_GetIPAddr(&remote_addr, &ip2);
-                if (!BIPAddr_Compare(&ip1, &ip2)) {
-                    continue;
-                }
-            } else {
-                if (!BAddr_Compare(&con->addr, &remote_addr)) {
-                    continue;
-                }
-            }
+    return r;
+}
 
-            port_usage[con->local_port_index] = 1;
+void remote_unref (struct remote *r)
+{
+    ASSERT(r->refs > 0)
 
-            if (!PacketPassFairQueueFlow_IsBusy(&con->send_qflow)) {
-                if (!least_con || con->last_use_time < least_con->last_use_time) {
-                    least_con = con;
-                }
-            }
-        }
+    if (--r->refs > 0) {
+        return;
     }
 
-    *out_con = least_con;
-    return port_usage;
+    ASSERT(LinkedList1_IsEmpty(&r->connections_list))
+
+    udpgw__RemoteHash_Remove(&remotes_hash, 0, udpgw__RemoteHashDerefNonNull(0, r));
+
+    BFree(r);
 }
 
-void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr orig_addr, const uint8_t *data, int data_len)
+struct connection * connection_init (struct udpgw_conaddr conaddr, BAddr addr, int is_dns)
 {
-    ASSERT(client->num_connections < options.max_connections_for_client)
-    ASSERT(!find_connection(client, conid))
+    ASSERT(num_connections < options.max_connections)
+    ASSERT(!find_connection(&conaddr))
     BAddr_Assert(&addr);
     ASSERT(addr.type == BADDR_TYPE_IPV4 || addr.type == BADDR_TYPE_IPV6)
-    ASSERT(orig_addr.type == BADDR_TYPE_IPV4 || orig_addr.type == BADDR_TYPE_IPV6)
-    ASSERT(data_len >= 0)
-    ASSERT(data_len <= udp_mtu)
 
-    // allocate structure
-    struct connection *con = (struct connection *)malloc(sizeof(*con));
+    // allocate structure, with the receive buffer
+    struct connection *con = (struct connection *)BAllocSize(bsize_add(bsize_fromsize(sizeof(*con)), bsize_fromint(udp_mtu)));
     if (!con) {
-        client_log(client, BLOG_ERROR, "malloc failed");
+        BLog(BLOG_ERROR, "BAllocSize failed");
         goto fail0;
     }
 
     // init arguments
-    con->client = client;
-    con->conid = conid;
+    con->conaddr = conaddr;
+    con->conaddr_hash = conaddr_hash(&con->conaddr);
     con->addr = addr;
-    con->orig_addr = orig_addr;
-    con->first_data = data;
-    con->first_data_len = data_len;
-
-    // set last use time
-    con->last_use_time = btime_gettime();
-
-    // set not closing
-    con->closing = 0;
-
-    // init first job
-    BPending_Init(&con->first_job, BReactor_PendingGroup(ss), (BPending_handler)connection_first_job_handler, con);
-    BPending_Set(&con->first_job);
-
-    // init send queue flow
-    PacketPassFairQueueFlow_Init(&con->send_qflow, &client->send_queue);
-
-    // init send PacketProtoFlow
-    if (!PacketProtoFlowPassthru_Init(&con->send_ppflow, udpgw_mtu, CONNECTION_CLIENT_BUFFER_SIZE, PacketPassFairQueueFlow_GetInput(&con->send_qflow), BReactor_PendingGroup(ss))) {
-        client_log(client, BLOG_ERROR, "PacketProtoFlow_Init failed");
-        goto fail1;
-    }
-    con->send_if = PacketProtoFlowPassthru_GetInput(&con->send_ppflow);
+    con->is_dns = is_dns;
 
     // init UDP dgram
     if (!BDatagram_Init(&con->udp_dgram, addr.type, ss, con, (BDatagram_handler)connection_dgram_handler_event)) {
-        client_log(client, BLOG_ERROR, "BDatagram_Init failed");
-        goto fail2;
+        BLog(BLOG_ERROR, "BDatagram_Init failed");
+        goto fail1;
     }
 
     con->local_port_index = -1;
+    con->remote = NULL;
 
-    int local_num_ports = get_local_num_ports(addr.type);
-
-    if (local_num_ports >= 0) {
-        // build port usage array, find least used connection
-        struct connection *least_con;
-        uint8_t *port_usage = build_port_usage_array_and_find_least_used_connection(addr, &least_con);
-        if (!port_usage) {
-            client_log(client, BLOG_ERROR, "build_port_usage_array failed");
-            goto failed;
-        }
-
-        // set SO_REUSEADDR
-        if (!BDatagram_SetReuseAddr(&con->udp_dgram, 1)) {
-            client_log(client, BLOG_ERROR, "set SO_REUSEADDR failed");
-            goto failed;
-        }
-
-        // get starting local address
-        BAddr local_addr = get_local_addr(addr.type);
-
-        // try different ports
-        for (int i = 0; i < local_num_ports; i++) {
-            // skip inappropriate ports
-            if (port_usage[i]) {
-                continue;
-            }
-
-            BAddr bind_addr = local_addr;
-            BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)i));
-            if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
-                // remember which port we're using
-                con->local_port_index = i;
-                goto cont;
-            }
-        }
-
-        // try closing an unused connection with the same remote addr
-        if (!least_con) {
-            goto failed;
-        }
-
-        ASSERT(least_con->addr.type == addr.type)
-        ASSERT(least_con->local_port_index >= 0)
-        ASSERT(least_con->local_port_index < local_num_ports)
-        ASSERT(!PacketPassFairQueueFlow_IsBusy(&least_con->send_qflow))
-
-        int i = least_con->local_port_index;
-
-        BLog(BLOG_INFO, "closing connection for its remote address");
-
-        // close the offending connection
-        connection_close(least_con);
-
-        // try binding to its port
-        BAddr bind_addr = local_addr;
-        BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)i));
-        if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
-            // remember which port we're using
-            con->local_port_index = i;
-            goto cont;
-        }
-
-    failed:
-        client_log(client, BLOG_WARNING, "failed to bind to any local address; proceeding regardless");
-    cont:;
-        BFree(port_usage);
+    // bind to a port from the local range, if there is one
+    if (get_local_num_ports(addr.type) >= 0) {
+        connection_bind(con);
     }
 
     // set UDP dgram send address
@@ -656,103 +550,60 @@ void connection_init (struct client *client, uint16_t conid, BAddr addr, BAddr o
     BIPAddr_InitInvalid(&ipaddr);
     BDatagram_SetSendAddrs(&con->udp_dgram, addr, ipaddr);
 
-    // init UDP dgram interfaces
-    BDatagram_SendAsync_Init(&con->udp_dgram, udp_mtu);
+    // receive into our buffer, sending doesn't use the interface
     BDatagram_RecvAsync_Init(&con->udp_dgram, udp_mtu);
+    PacketRecvInterface_Receiver_Init(BDatagram_RecvAsync_GetIf(&con->udp_dgram), (PacketRecvInterface_handler_done)connection_recv_if_handler_done, con);
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&con->udp_dgram), con->recv_buf);
 
-    // init UDP writer
-    BufferWriter_Init(&con->udp_send_writer, udp_mtu, BReactor_PendingGroup(ss));
+    // insert to connections hash
+    ASSERT_EXECUTE(udpgw__ConaddrHash_Insert(&connections_hash, 0, udpgw__ConaddrHashDerefNonNull(0, con), NULL))
 
-    // init UDP buffer
-    if (!PacketBuffer_Init(&con->udp_send_buffer, BufferWriter_GetOutput(&con->udp_send_writer), BDatagram_SendAsync_GetIf(&con->udp_dgram), CONNECTION_UDP_BUFFER_SIZE, BReactor_PendingGroup(ss))) {
-        client_log(client, BLOG_ERROR, "PacketBuffer_Init failed");
-        goto fail4;
-    }
-
-    // init UDP recv interface
-    PacketPassInterface_Init(&con->udp_recv_if, udp_mtu, (PacketPassInterface_handler_send)connection_udp_recv_if_handler_send, con, BReactor_PendingGroup(ss));
-
-    // init UDP recv buffer
-    if (!SinglePacketBuffer_Init(&con->udp_recv_buffer, BDatagram_RecvAsync_GetIf(&con->udp_dgram), &con->udp_recv_if, BReactor_PendingGroup(ss))) {
-        client_log(client, BLOG_ERROR, "SinglePacketBuffer_Init failed");
-        goto fail5;
-    }
-
-    // insert to client's connections tree
-    ASSERT_EXECUTE(BAVL_Insert(&client->connections_tree, &con->connections_tree_node, NULL))
-
-    // insert to client's connections list
-    LinkedList1_Append(&client->connections_list, &con->connections_list_node);
+    // insert to connections list
+    LinkedList1_Append(&connections_list, &con->connections_list_node);
 
     // increment number of connections
-    client->num_connections++;
+    num_connections++;
 
     connection_log(con, BLOG_DEBUG, "initialized");
 
-    return;
+    return con;
 
-fail5:
-    PacketPassInterface_Free(&con->udp_recv_if);
-    PacketBuffer_Free(&con->udp_send_buffer);
-fail4:
-    BufferWriter_Free(&con->udp_send_writer);
-    BDatagram_RecvAsync_Free(&con->udp_dgram);
-    BDatagram_SendAsync_Free(&con->udp_dgram);
-    BDatagram_Free(&con->udp_dgram);
-fail2:
-    PacketProtoFlowPassthru_Free(&con->send_ppflow);
 fail1:
-    PacketPassFairQueueFlow_Free(&con->send_qflow);
-    BPending_Free(&con->first_job);
-    free(con);
+    BFree(con);
 fail0:
-    return;
+    return NULL;
 }
 
 void connection_free (struct connection *con)
 {
-    struct client *client = con->client;
-    PacketPassFairQueueFlow_AssertFree(&con->send_qflow);
-
-    if (con->closing) {
-        // remove from client's closing connections list
-        LinkedList1_Remove(&client->closing_connections_list, &con->closing_connections_list_node);
-    } else {
-        // decrement number of connections
-        client->num_connections--;
-
-        // remove from client's connections list
-        LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
+    // decrement number of connections
+    num_connections--;
 
-        // remove from client's connections tree
-        BAVL_Remove(&client->connections_tree, &con->connections_tree_node);
+    // remove from connections list
+    LinkedList1_Remove(&connections_list, &con->connections_list_node);
 
-        // free UDP
-        connection_free_udp(con);
-    }
+    // remove from connections hash
+    udpgw__ConaddrHash_Remove(&connections_hash, 0, udpgw__ConaddrHashDerefNonNull(0, con));
 
-    // free send PacketProtoFlow
-    PacketProtoFlowPassthru_Free(&con->send_ppflow);
-
-    // free send queue flow
-    PacketPassFairQueueFlow_Free(&con->send_qflow);
+    // free UDP dgram
+    BDatagram_RecvAsync_Free(&con->udp_dgram);
+    BDatagram_Free(&con->udp_dgram);
 
-    // free first job
-    BPending_Free(&con->first_job);
+    // release local port
+    connection_release_port(con);
 
     // free structure
-    free(con);
+    BFree(con);
 }
 
 void connection_logfunc (struct connection *con)
 {
-    client_logfunc(con->client);
+    char local_str[BADDR_MAX_PRINT_LEN];
+    char remote_str[BADDR_MAX_PRINT_LEN];
+    BAddr_Print(&con->conaddr.local_addr, local_str);
+    BAddr_Print(&con->conaddr.remote_addr, remote_str);
 
-    if (con->closing) {
-        BLog_Append("old connection %"PRIu16": ", con->conid);
-    } else {
-        BLog_Append("connection %"PRIu16": ", con->conid);
-    }
+    BLog_Append("udpgw connection %s->%s: ", local_str, remote_str);
 }
 
 void connection_log (struct connection *con, int level, const char *fmt, ...)
@@ -763,223 +614,184 @@ void connection_log (struct connection *con, int level, const char *fmt, ...)
     va_end(vl);
 }
 
-void connection_free_udp (struct connection *con)
+void connection_bind (struct connection *con)
 {
-    // free UDP receive buffer
-    SinglePacketBuffer_Free(&con->udp_recv_buffer);
-
-    // free UDP receive interface
-    PacketPassInterface_Free(&con->udp_recv_if);
+    ASSERT(con->local_port_index == -1)
+    ASSERT(!con->remote)
 
-    // free UDP buffer
-    PacketBuffer_Free(&con->udp_send_buffer);
-
-    // free UDP writer
-    BufferWriter_Free(&con->udp_send_writer);
-
-    // free UDP dgram interfaces
-    BDatagram_RecvAsync_Free(&con->udp_dgram);
-    BDatagram_SendAsync_Free(&con->udp_dgram);
+    BAddr addr = con->addr;
+    int local_num_ports = get_local_num_ports(addr.type);
+    ASSERT(local_num_ports >= 0)
 
-    // free UDP dgram
-    BDatagram_Free(&con->udp_dgram);
-}
+    // hold the remote while choosing a port, so that closing its least
+    // used connection below doesn't free it
+    struct remote *r = remote_ref(addr);
+    if (!r) {
+        connection_log(con, BLOG_ERROR, "remote_ref failed");
+        goto failed;
+    }
 
-void connection_first_job_handler (struct connection *con)
-{
-    ASSERT(!con->closing)
+    // set SO_REUSEADDR
+    if (!BDatagram_SetReuseAddr(&con->udp_dgram, 1)) {
+        connection_log(con, BLOG_ERROR, "set SO_REUSEADDR failed");
+        goto failed;
+    }
 
-    connection_send_to_udp(con, con->first_data, con->first_data_len);
-}
+    // get starting local address
+    BAddr local_addr = get_local_addr(addr.type);
 
-void connection_send_to_client (struct connection *con, uint8_t flags, const uint8_t *data, int data_len)
-{
-    ASSERT(data_len >= 0)
-    ASSERT(data_len <= udp_mtu)
+    // try ports not yet used towards this remote
+    for (int i = 0; i < local_num_ports; i++) {
+        if (r->port_usage[i]) {
+            continue;
+        }
 
-    size_t addr_len = (con->orig_addr.type == BADDR_TYPE_IPV6) ? sizeof(struct udpgw_addr_ipv6) :
-                      (con->orig_addr.type == BADDR_TYPE_IPV4) ? sizeof(struct udpgw_addr_ipv4) : 0;
-    if (data_len > udpgw_mtu - (int)(sizeof(struct udpgw_header) + addr_len)) {
-        connection_log(con, BLOG_WARNING, "packet is too large, cannot send to client");
-        return;
+        BAddr bind_addr = local_addr;
+        BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)i));
+        if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
+            // remember which port we're using
+            con->local_port_index = i;
+            goto cont;
+        }
     }
 
-    // get buffer location
-    uint8_t *out;
-    if (!BufferWriter_StartPacket(con->send_if, &out)) {
-        connection_log(con, BLOG_ERROR, "out of client buffer");
-        return;
+    // try closing the least recently used connection with the same remote addr
+    if (LinkedList1_IsEmpty(&r->connections_list)) {
+        goto failed;
     }
-    int out_pos = 0;
-
-    if (con->orig_addr.type == BADDR_TYPE_IPV6) {
-        flags |= UDPGW_CLIENT_FLAG_IPV6;
-    }
-
-    // write header
-    struct udpgw_header header;
-    header.flags = htol8(flags);
-    header.conid = htol16(con->conid);
-    memcpy(out + out_pos, &header, sizeof(header));
-    out_pos += sizeof(header);
-
-    // write address
-    switch (con->orig_addr.type) {
-        case BADDR_TYPE_IPV4: {
-            struct udpgw_addr_ipv4 addr_ipv4;
-            addr_ipv4.addr_ip = con->orig_addr.ipv4.ip;
-            addr_ipv4.addr_port = con->orig_addr.ipv4.port;
-            memcpy(out + out_pos, &addr_ipv4, sizeof(addr_ipv4));
-            out_pos += sizeof(addr_ipv4);
-        } break;
-        case BADDR_TYPE_IPV6: {
-            struct udpgw_addr_ipv6 addr_ipv6;
-            memcpy(addr_ipv6.addr_ip, con->orig_addr.ipv6.ip, sizeof(addr_ipv6.addr_ip));
-            addr_ipv6.addr_port = con->orig_addr.ipv6.port;
-            memcpy(out + out_pos, &addr_ipv6, sizeof(addr_ipv6));
-            out_pos += sizeof(addr_ipv6);
-        } break;
-    }
-
-    // write message
-    memcpy(out + out_pos, data, data_len);
-    out_pos += data_len;
-
-    // submit written message
-    ASSERT(out_pos <= udpgw_mtu)
-    BufferWriter_EndPacket(con->send_if, out_pos);
-}
 
-int connection_send_to_udp (struct connection *con, const uint8_t *data, int data_len)
-{
-    struct client *client = con->client;
-    ASSERT(!con->closing)
-    ASSERT(data_len >= 0)
-    ASSERT(data_len <= udp_mtu)
+    struct connection *least_con = UPPER_OBJECT(LinkedList1_GetFirst(&r->connections_list), struct connection, remote_list_node);
+    ASSERT(least_con->remote == r)
+    ASSERT(least_con->addr.type == addr.type)
+    ASSERT(least_con->local_port_index >= 0)
+    ASSERT(least_con->local_port_index < local_num_ports)
 
-    connection_log(con, BLOG_DEBUG, "from client %d bytes", data_len);
+    int i = least_con->local_port_index;
 
-    // set last use time
-    con->last_use_time = btime_gettime();
+    connection_log(con, BLOG_INFO, "closing connection for its remote address");
 
-    // move connection to front
-    LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
-    LinkedList1_Append(&client->connections_list, &con->connections_list_node);
+    // close the offending connection
+    connection_free(least_con);
 
-    // get buffer location
-    uint8_t *out;
-    if (!BufferWriter_StartPacket(&con->udp_send_writer, &out)) {
-        connection_log(con, BLOG_ERROR, "out of UDP buffer");
-        return 0;
+    // try binding to its port
+    BAddr bind_addr = local_addr;
+    BAddr_SetPort(&bind_addr, hton16(ntoh16(BAddr_GetPort(&bind_addr)) + (uint16_t)i));
+    if (BDatagram_Bind(&con->udp_dgram, bind_addr)) {
+        // remember which port we're using
+        con->local_port_index = i;
+        goto cont;
     }
 
-    // write message
-    memcpy(out, data, data_len);
-
-    // submit written message
-    BufferWriter_EndPacket(&con->udp_send_writer, data_len);
-
-    return 1;
+failed:
+    connection_log(con, BLOG_WARNING, "failed to bind to any local address; proceeding regardless");
+cont:
+    if (con->local_port_index >= 0) {
+        // mark the port used, our reference goes to the connection
+        ASSERT(!r->port_usage[con->local_port_index])
+        r->port_usage[con->local_port_index] = 1;
+        LinkedList1_Append(&r->connections_list, &con->remote_list_node);
+        con->remote = r;
+    } else if (r) {
+        remote_unref(r);
+    }
 }
 
-void connection_close (struct connection *con)
+void connection_release_port (struct connection *con)
 {
-    struct client *client = con->client;
-    ASSERT(!con->closing)
-
-    // if possible, free connection immediately
-    if (!PacketPassFairQueueFlow_IsBusy(&con->send_qflow)) {
-        connection_free(con);
+    struct remote *r = con->remote;
+    if (!r) {
         return;
     }
 
-    connection_log(con, BLOG_DEBUG, "closing later");
-
-    // decrement number of connections
-    client->num_connections--;
-
-    // remove from client's connections list
-    LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
-
-    // remove from client's connections tree
-    BAVL_Remove(&client->connections_tree, &con->connections_tree_node);
+    ASSERT(r->port_usage[con->local_port_index])
 
-    // free UDP
-    connection_free_udp(con);
+    r->port_usage[con->local_port_index] = 0;
+    LinkedList1_Remove(&r->connections_list, &con->remote_list_node);
+    con->remote = NULL;
 
-    // insert to client's closing connections list
-    LinkedList1_Append(&client->closing_connections_list, &con->closing_connections_list_node);
-
-    // set busy handler
-    PacketPassFairQueueFlow_SetBusyHandler(&con->send_qflow, (PacketPassFairQueue_handler_busy)connection_send_qflow_busy_handler, con);
+    remote_unref(r);
+}
 
-    // unset first job
-    BPending_Unset(&con->first_job);
+void connection_touch (struct connection *con)
+{
+    // move connection to front
+    LinkedList1_Remove(&connections_list, &con->connections_list_node);
+    LinkedList1_Append(&connections_list, &con->connections_list_node);
 
-    // set closing
-    con->closing = 1;
+    // same in the remote's list, which keeps its least used connection first
+    if (con->remote) {
+        LinkedList1_Remove(&con->remote->connections_list, &con->remote_list_node);
+        LinkedList1_Append(&con->remote->connections_list, &con->remote_list_node);
+    }
 }
 
-void connection_send_qflow_busy_handler (struct connection *con)
+void connection_send_to_udp (struct connection *con, const uint8_t *data, int data_len)
 {
-    ASSERT(con->closing)
-    PacketPassFairQueueFlow_AssertFree(&con->send_qflow);
+    ASSERT(data_len >= 0)
+    ASSERT(data_len <= udp_mtu)
 
-    connection_log(con, BLOG_DEBUG, "closing finally");
+    connection_log(con, BLOG_DEBUG, "from device %d bytes", data_len);
 
-    // free connection
-    connection_free(con);
+    // move connection to front
+    connection_touch(con);
+
+    // send right away, the data is only good until we return
+    switch (BDatagram_SendNow(&con->udp_dgram, data, data_len)) {
+        case 0:
+            connection_log(con, BLOG_INFO, "UDP send buffer full, dropping");
+            break;
+        case -1:
+            connection_log(con, BLOG_INFO, "UDP error");
+            connection_free(con);
+            break;
+    }
 }
 
 void connection_dgram_handler_event (struct connection *con, int event)
 {
-    ASSERT(!con->closing)
-
     connection_log(con, BLOG_INFO, "UDP error");
 
     // close connection
-    connection_close(con);
+    connection_free(con);
 }
 
-void connection_udp_recv_if_handler_send (struct connection *con, uint8_t *data, int data_len)
+void connection_recv_if_handler_done (struct connection *con, int data_len)
 {
-    struct client *client = con->client;
-    ASSERT(!con->closing)
     ASSERT(data_len >= 0)
     ASSERT(data_len <= udp_mtu)
 
     connection_log(con, BLOG_DEBUG, "from UDP %d bytes", data_len);
 
-    // set last use time
-    con->last_use_time = btime_gettime();
+    // DNS answers only from the server queried, the socket is unconnected
+    if (con->is_dns) {
+        BAddr remote_addr;
+        BIPAddr local_addr;
+        if (!BDatagram_GetLastReceiveAddrs(&con->udp_dgram, &remote_addr, &local_addr) ||
+            !BAddr_Compare(&remote_addr, &con->addr)) {
+            connection_log(con, BLOG_INFO, "DNS response not from the server, dropping");
+            PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&con->udp_dgram), con->recv_buf);
+            return;
+        }
+    }
 
     // move connection to front
-    LinkedList1_Remove(&client->connections_list, &con->connections_list_node);
-    LinkedList1_Append(&client->connections_list, &con->connections_list_node);
+    connection_touch(con);
 
-    // accept packet
-    PacketPassInterface_Done(&con->udp_recv_if);
+    // pass to the device, answered from the original address
+    handler_received(user, con->conaddr.local_addr, con->conaddr.remote_addr, con->recv_buf, data_len);
 
-    // send packet to client
-    connection_send_to_client(con, 0, data, data_len);
-}
-
-struct connection * find_connection (struct client *client, uint16_t conid)
-{
-    BAVLNode *tree_node = BAVL_LookupExact(&client->connections_tree, &conid);
-    if (!tree_node) {
-        return NULL;
+    // cache DNS response, answer queries waiting for it
+    if (con->is_dns && have_dns_cache) {
+        DnsCache_Response(&dns_cache, con->recv_buf, data_len);
     }
-    struct connection *con = UPPER_OBJECT(tree_node, struct connection, connections_tree_node);
-    ASSERT(con->conid == conid)
-    ASSERT(!con->closing)
 
-    return con;
+    // receive the next datagram
+    PacketRecvInterface_Receiver_Recv(BDatagram_RecvAsync_GetIf(&con->udp_dgram), con->recv_buf);
 }
 
-int uint16_comparator (void *unused, uint16_t *v1, uint16_t *v2)
+struct connection * find_connection (struct udpgw_conaddr *conaddr)
 {
-    return B_COMPARE(*v1, *v2);
+    return udpgw__ConaddrHash_Lookup(&connections_hash, 0, conaddr).ptr;
 }
 
 void maybe_update_dns (void)
@@ -1018,3 +830,8 @@ fail:
     BAddr_InitNone(&dns_addr);
 #endif
 }
+
+void dns_cache_handler_answer (void *unused, BAddr local_addr, BAddr orig_addr, const uint8_t *data, int data_len)
+{
+    handler_received(user, local_addr, orig_addr, data, data_len);
+}
@@ -24,25 +24,39 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <system/BReactor.h>
-#include <flow/PacketPassInterface.h>
-#include <flow/PacketPassConnector.h>
+#include <stdint.h>
 
-// connection buffer size for sending to client, in packets
-#define CONNECTION_CLIENT_BUFFER_SIZE 1
+#include <system/BAddr.h>
+#include <system/BReactor.h>
 
-// connection buffer size for sending to UDP, in packets
-#define CONNECTION_UDP_BUFFER_SIZE 1
+// maximum number of connections, i.e. UDP flows with a socket
+#define DEFAULT_MAX_CONNECTIONS 256
 
-// maximum connections for client
-#define DEFAULT_MAX_CONNECTIONS_FOR_CLIENT 256
+// DNS cache size for transparent DNS, in questions and in bytes,
+// 0 entries to disable
+#define DEFAULT_DNS_CACHE_ENTRIES 1024
+#define DEFAULT_DNS_CACHE_SIZE (1024 * 1024)
 
-// SO_SNDBFUF socket option for clients, 0 to not set
-#define CLIENT_DEFAULT_SOCKET_SEND_BUFFER 1048576
+typedef void (*udpgw_handler_received) (void *user, BAddr local_addr, BAddr remote_addr, const uint8_t *data, int data_len);
 
-void udpgw_init (int argc, char **argv, BReactor* udpgw_reactor, int udp_mtu_);
+/**
+ * Initializes the UDP gateway, which maps UDP flows from the device to
+ * sockets of their own. Datagrams received on them are passed to
+ * handler_received, with the flow's addresses.
+ *
+ * @param udp_mtu largest UDP payload passed either way
+ * @return 1 on success, 0 on failure
+ */
+int udpgw_init (int argc, char **argv, BReactor* udpgw_reactor, int udp_mtu, void *user, udpgw_handler_received handler_received);
 
-PacketPassInterface* udpgw_get_input ();
-PacketPassConnector* udpgw_get_output ();
+/**
+ * Sends a datagram of the flow from local_addr to remote_addr, creating
+ * its connection if needed. The data is not used after this returns.
+ *
+ * @param is_dns the datagram is for the DNS server and is answered from remote_addr
+ */
+void udpgw_submit_packet (BAddr local_addr, BAddr remote_addr, int is_dns, const uint8_t *data, int data_len);
 
 void udpgw_cleanup ();
+
+void udpgw_log_stats ();
@@ -0,0 +1,13 @@
+#define CHASH_PARAM_NAME udpgw__RemoteHash
+#define CHASH_PARAM_ENTRY struct remote
+#define CHASH_PARAM_LINK udpgw__remotehash_link
+#define CHASH_PARAM_KEY BAddr *
+#define CHASH_PARAM_ARG int
+#define CHASH_PARAM_NULL ((udpgw__remotehash_link)NULL)
+#define CHASH_PARAM_DEREF(arg, link) (link)
+#define CHASH_PARAM_ENTRYHASH(arg, entry) ((entry).ptr->addr_hash)
+#define CHASH_PARAM_KEYHASH(arg, key) BAddr_Hash((key))
+#define CHASH_PARAM_ENTRYHASH_IS_CHEAP 1
+#define CHASH_PARAM_COMPARE_ENTRIES(arg, entry1, entry2) BAddr_Compare(&(entry1).ptr->addr, &(entry2).ptr->addr)
+#define CHASH_PARAM_COMPARE_KEY_ENTRY(arg, key1, entry2) BAddr_Compare((key1), &(entry2).ptr->addr)
+#define CHASH_PARAM_ENTRY_NEXT hash_next
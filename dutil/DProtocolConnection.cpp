@@ -0,0 +1,267 @@
+#include "DTun/DProtocolConnection.h"
+#include "Logger.h"
+#include <boost/bind.hpp>
+#include <cstring>
+
+namespace DTun
+{
+    DProtocolConnection::DProtocolConnection(const boost::shared_ptr<SConnection>& conn)
+    : conn_(conn)
+    , rcvBuff_(4096)
+    , rcvStart_(0)
+    , rcvEnd_(0)
+    , recvBatched_(false)
+    , closed_(false)
+    , sendBatched_(false)
+    , writing_(false)
+    , numMsgs_(0)
+    , numWrites_(0)
+    {
+    }
+
+    DProtocolConnection::~DProtocolConnection()
+    {
+        // connection first, it may still reference our buffers.
+        conn_.reset();
+    }
+
+    void DProtocolConnection::start()
+    {
+        startRead();
+    }
+
+    void DProtocolConnection::sendMsg(UInt8 msgCode, const void* msg, int msgSize)
+    {
+        boost::mutex::scoped_lock lock(m_);
+
+        if (closed_) {
+            return;
+        }
+
+        size_t off = sndBuff_.size();
+
+        if (sendBatched_) {
+            DProtocolFrameHeader header;
+
+            header.msgSize = msgSize;
+            header.msgCode = msgCode;
+
+            sndBuff_.resize(off + sizeof(header) + msgSize);
+            memcpy(&sndBuff_[off], &header, sizeof(header));
+            off += sizeof(header);
+        } else {
+            DProtocolHeader header;
+
+            header.msgCode = msgCode;
+
+            sndBuff_.resize(off + sizeof(header) + msgSize);
+            memcpy(&sndBuff_[off], &header, sizeof(header));
+            off += sizeof(header);
+        }
+
+        if (msgSize > 0) {
+            memcpy(&sndBuff_[off], msg, msgSize);
+        }
+
+        ++numMsgs_;
+
+        if (!writing_) {
+            flush();
+        }
+    }
+
+    void DProtocolConnection::setSendBatched()
+    {
+        boost::mutex::scoped_lock lock(m_);
+        sendBatched_ = true;
+    }
+
+    void DProtocolConnection::setRecvBatched()
+    {
+        recvBatched_ = true;
+    }
+
+    void DProtocolConnection::close()
+    {
+        {
+            boost::mutex::scoped_lock lock(m_);
+            closed_ = true;
+        }
+        // always close, this waits for callbacks in progress on other threads.
+        conn_->close();
+    }
+
+    void DProtocolConnection::getStats(UInt64& numMsgs, UInt64& numWrites) const
+    {
+        boost::mutex::scoped_lock lock(m_);
+        numMsgs = numMsgs_;
+        numWrites = numWrites_;
+    }
+
+    void DProtocolConnection::startRead()
+    {
+        if (rcvStart_ > 0) {
+            // at most one partial message left.
+            memmove(&rcvBuff_[0], &rcvBuff_[rcvStart_], rcvEnd_ - rcvStart_);
+            rcvEnd_ -= rcvStart_;
+            rcvStart_ = 0;
+        }
+
+        if (rcvEnd_ >= (int)rcvBuff_.size()) {
+            rcvBuff_.resize(rcvBuff_.size() * 2);
+        }
+
+        conn_->read(&rcvBuff_[0] + rcvEnd_, &rcvBuff_[0] + rcvBuff_.size(),
+            boost::bind(&DProtocolConnection::onRead, boost::weak_ptr<DProtocolConnection>(shared_from_this()), _1, _2),
+            false);
+    }
+
+    void DProtocolConnection::flush()
+    {
+        sndBuff_.swap(wrBuff_);
+        writing_ = true;
+        ++numWrites_;
+
+        conn_->write(&wrBuff_[0], &wrBuff_[0] + wrBuff_.size(),
+            boost::bind(&DProtocolConnection::onWrite, boost::weak_ptr<DProtocolConnection>(shared_from_this()), _1));
+    }
+
+    void DProtocolConnection::fail(int err)
+    {
+        boost::mutex::scoped_lock lock(m_);
+        if (closed_) {
+            return;
+        }
+        closed_ = true;
+        lock.unlock();
+
+        if (errorCallback_) {
+            errorCallback_(err);
+        }
+    }
+
+    void DProtocolConnection::onRead(const boost::weak_ptr<DProtocolConnection>& weakThis, int err, int numBytes)
+    {
+        // keep alive while dispatching, callbacks may drop the last reference.
+        boost::shared_ptr<DProtocolConnection> this_ = weakThis.lock();
+        if (this_) {
+            this_->handleRead(err, numBytes);
+        }
+    }
+
+    void DProtocolConnection::onWrite(const boost::weak_ptr<DProtocolConnection>& weakThis, int err)
+    {
+        boost::shared_ptr<DProtocolConnection> this_ = weakThis.lock();
+        if (this_) {
+            this_->handleWrite(err);
+        }
+    }
+
+    void DProtocolConnection::handleRead(int err, int numBytes)
+    {
+        LOG4CPLUS_TRACE(logger(), "DProtocolConnection::handleRead(" << err << ", " << numBytes << ")");
+
+        {
+            boost::mutex::scoped_lock lock(m_);
+            if (closed_) {
+                return;
+            }
+        }
+
+        if (err) {
+            fail(err);
+            return;
+        }
+
+        rcvEnd_ += numBytes;
+
+        while (true) {
+            int avail = rcvEnd_ - rcvStart_;
+            const char* p = &rcvBuff_[0] + rcvStart_;
+            UInt8 msgCode;
+            int headerSize;
+            int msgSize;
+
+            if (recvBatched_) {
+                DProtocolFrameHeader header;
+                if (avail < (int)sizeof(header)) {
+                    break;
+                }
+                memcpy(&header, p, sizeof(header));
+                msgCode = header.msgCode;
+                msgSize = header.msgSize;
+                headerSize = sizeof(header);
+            } else {
+                DProtocolHeader header;
+                if (avail < (int)sizeof(header)) {
+                    break;
+                }
+                memcpy(&header, p, sizeof(header));
+                msgCode = header.msgCode;
+                msgSize = protocolMsgSize(msgCode);
+                headerSize = sizeof(header);
+                if (msgSize < 0) {
+                    LOG4CPLUS_ERROR(logger(), "bad msg code: " << (int)msgCode);
+                    fail(1);
+                    return;
+                }
+            }
+
+            if (avail < (headerSize + msgSize)) {
+                if ((headerSize + msgSize) > (int)rcvBuff_.size()) {
+                    rcvBuff_.resize(headerSize + msgSize);
+                }
+                break;
+            }
+
+            rcvStart_ += headerSize + msgSize;
+
+            int expectedSize = protocolMsgSize(msgCode);
+
+            if (expectedSize < 0) {
+                LOG4CPLUS_TRACE(logger(), "skipping unknown msg code: " << (int)msgCode);
+                continue;
+            }
+
+            if (msgSize < expectedSize) {
+                LOG4CPLUS_ERROR(logger(), "msg " << (int)msgCode << " too short: " << msgSize);
+                fail(1);
+                return;
+            }
+
+            if (messageCallback_) {
+                messageCallback_(msgCode, p + headerSize, msgSize);
+            }
+
+            boost::mutex::scoped_lock lock(m_);
+            if (closed_) {
+                return;
+            }
+        }
+
+        startRead();
+    }
+
+    void DProtocolConnection::handleWrite(int err)
+    {
+        boost::mutex::scoped_lock lock(m_);
+
+        writing_ = false;
+        wrBuff_.clear();
+
+        if (closed_) {
+            return;
+        }
+
+        if (err) {
+            lock.unlock();
+            LOG4CPLUS_TRACE(logger(), "DProtocolConnection::handleWrite(" << err << ")");
+            fail(err);
+            return;
+        }
+
+        if (!sndBuff_.empty()) {
+            flush();
+        }
+    }
+}
@@ -13,7 +13,8 @@ namespace DTun
     , pcbRemoteIp_(0)
     , pcbRemotePort_(0)
     , eof_(false)
-    , rcvBuff_(TCP_WND)
+    , rcvWndHeld_(0)
+    , rcvBuff_(LTUDP_WND)
     {
     }
 
@@ -25,7 +26,8 @@ namespace DTun
     , pcbRemoteIp_(0)
     , pcbRemotePort_(0)
     , eof_(false)
-    , rcvBuff_(TCP_WND)
+    , rcvWndHeld_(0)
+    , rcvBuff_(LTUDP_WND)
     , conn_(conn)
     {
         ip_addr_t tcpAddr;
@@ -39,6 +41,8 @@ namespace DTun
         tcp_recv(pcb_, &LTUDPHandleImpl::recvFunc);
         tcp_sent(pcb_, &LTUDPHandleImpl::sentFunc);
         tcp_err(pcb_, &LTUDPHandleImpl::errorFunc);
+
+        setupWindow();
     }
 
     LTUDPHandleImpl::~LTUDPHandleImpl()
@@ -68,6 +72,11 @@ namespace DTun
             if (abort) {
                 tcp_abort(pcb_);
             } else {
+                // give back the held window, lwIP resets instead of closing
+                // when the window isn't full.
+                tcpwnd_size_t wndMax = TCP_WND_MAX(pcb_);
+                pcb_->rcv_wnd = (pcb_->rcv_wnd + rcvWndHeld_ < wndMax) ? pcb_->rcv_wnd + rcvWndHeld_ : wndMax;
+                rcvWndHeld_ = 0;
                 if (tcp_close(pcb_) != ERR_OK) {
                     LOG4CPLUS_FATAL(logger(), "tcp_close failed");
                     tcp_abort(pcb_);
@@ -384,7 +393,7 @@ namespace DTun
             rcvBuff_.erase_begin(numRead);
 
             if (!eof_ && pcb_) {
-                tcp_recved(pcb_, numRead);
+                recved(numRead);
             }
         }
 
@@ -443,6 +452,7 @@ namespace DTun
         if (err == ERR_OK) {
             tcp_recv(this_->pcb_, &LTUDPHandleImpl::recvFunc);
             tcp_sent(this_->pcb_, &LTUDPHandleImpl::sentFunc);
+            this_->setupWindow();
         }
         cb(err);
 
@@ -541,4 +551,29 @@ namespace DTun
         pcb->keep_cnt = 4;
         pcb->keep_idle = 10000;
     }
+
+    void LTUDPHandleImpl::setupWindow()
+    {
+        // called right after the handshake, nothing was received or queued
+        // yet. SYN windows aren't scaled so the peer was never offered more
+        // than 64 KB, announcing LTUDP_WND from here on doesn't shrink it.
+        tcpwnd_size_t wndMax = TCP_WND_MAX(pcb_);
+        rcvWndHeld_ = (wndMax > LTUDP_WND) ? wndMax - LTUDP_WND : 0;
+        pcb_->rcv_wnd -= rcvWndHeld_;
+        pcb_->rcv_ann_wnd = pcb_->rcv_wnd;
+        pcb_->rcv_ann_right_edge = pcb_->rcv_nxt + pcb_->rcv_ann_wnd;
+        if (pcb_->snd_buf > LTUDP_SND_BUF) {
+            pcb_->snd_buf = LTUDP_SND_BUF;
+        }
+    }
+
+    void LTUDPHandleImpl::recved(int len)
+    {
+        // tcp_recved takes u16_t.
+        while (len > 0) {
+            int tmp = std::min(len, 0xFFFF);
+            tcp_recved(pcb_, tmp);
+            len -= tmp;
+        }
+    }
 }
@@ -2,8 +2,9 @@
 
 namespace DTun
 {
-    log4cplus::Logger logger()
+    const log4cplus::Logger& logger()
     {
-        return log4cplus::Logger::getInstance("DTun");
+        static const log4cplus::Logger instance = log4cplus::Logger::getInstance("DTun");
+        return instance;
     }
 }
@@ -7,7 +7,7 @@
 
 namespace DTun
 {
-    log4cplus::Logger logger();
+    const log4cplus::Logger& logger();
 }
 
 #endif
@@ -73,7 +73,10 @@ namespace DTun
         memcpy(&(*sndBuff)[0] + probeReplyTransportHeader_.size(), &replyHeader, sizeof(replyHeader));
 
         boost::shared_ptr<SConnection> conn = conn_.lock();
-        assert(conn);
+        if (!conn) {
+            // transport connection is gone, handle is being closed.
+            return;
+        }
 
         conn->writeTo(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
             destIp_, destPort_,
@@ -148,7 +151,10 @@ namespace DTun
         memset(&(*sndBuff)[0] + probeTransportHeader_.size() + sizeof(header), 0xAA, curMTU_ - probeTransportHeader_.size() - sizeof(header));
 
         boost::shared_ptr<SConnection> conn = conn_.lock();
-        assert(conn);
+        if (!conn) {
+            // transport connection is gone, handle is being closed.
+            return;
+        }
 
         conn->writeTo(&(*sndBuff)[0], &(*sndBuff)[0] + sndBuff->size(),
             destIp_, destPort_,
@@ -0,0 +1,43 @@
+#include "DTun/SConnection.h"
+#include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
+
+namespace DTun
+{
+    namespace
+    {
+        struct WriteVState
+        {
+            WriteVState(int numLeft, const SConnection::WriteCallback& callback)
+            : numLeft(numLeft)
+            , err(0)
+            , callback(callback) {}
+
+            int numLeft;
+            int err;
+            SConnection::WriteCallback callback;
+        };
+
+        // all parts complete on the connection's reactor thread, no locking needed.
+        void onWriteVPart(int err, const boost::shared_ptr<WriteVState>& state)
+        {
+            if (err && !state->err) {
+                state->err = err;
+            }
+            if (--state->numLeft == 0) {
+                state->callback(state->err);
+            }
+        }
+    }
+
+    void SConnection::writev(const Buffers& buffers, const WriteCallback& callback)
+    {
+        assert(!buffers.empty());
+
+        boost::shared_ptr<WriteVState> state = boost::make_shared<WriteVState>(buffers.size(), callback);
+
+        for (Buffers::const_iterator it = buffers.begin(); it != buffers.end(); ++it) {
+            write(it->first, it->second, boost::bind(&onWriteVPart, _1, state));
+        }
+    }
+}
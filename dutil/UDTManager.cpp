@@ -2,11 +2,13 @@
 #include "DTun/UDTHandle.h"
 #include "Logger.h"
 #include <boost/make_shared.hpp>
+#include <ccc.h>
 
 namespace DTun
 {
-    UDTManager::UDTManager(UDTReactor& reactor)
+    UDTManager::UDTManager(UDTReactor& reactor, CongestionControl cc)
     : reactor_(reactor)
+    , cc_(cc)
     {
     }
 
@@ -14,6 +16,20 @@ namespace DTun
     {
     }
 
+    bool UDTManager::parseCongestionControl(const std::string& str, CongestionControl& cc)
+    {
+        if (str == "udt") {
+            cc = CongestionControlUDT;
+        } else if (str == "bbr") {
+            cc = CongestionControlBBR;
+        } else if (str == "cubic") {
+            cc = CongestionControlCubic;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
     SReactor& UDTManager::reactor()
     {
         return reactor_;
@@ -26,6 +42,10 @@ namespace DTun
             LOG4CPLUS_ERROR(logger(), "Cannot create UDT socket: " << UDT::getlasterror().getErrorMessage());
             return boost::shared_ptr<SHandle>();
         }
+        if (!setCongestionControl(sock)) {
+            UDT::close(sock);
+            return boost::shared_ptr<SHandle>();
+        }
         return boost::make_shared<UDTHandle>(boost::ref(reactor_), sock);
     }
 
@@ -38,4 +58,32 @@ namespace DTun
     void UDTManager::enablePortRemap(UInt16 dstPort)
     {
     }
+
+    bool UDTManager::setCongestionControl(UDTSOCKET sock)
+    {
+        int res = 0;
+
+        // UDT clones the factory.
+        switch (cc_) {
+        case CongestionControlBBR: {
+            CCCFactory<CBBRCC> factory;
+            res = UDT::setsockopt(sock, 0, UDT_CC, &factory, sizeof(factory));
+            break;
+        }
+        case CongestionControlCubic: {
+            CCCFactory<CCubicCC> factory;
+            res = UDT::setsockopt(sock, 0, UDT_CC, &factory, sizeof(factory));
+            break;
+        }
+        default:
+            break;
+        }
+
+        if (res == UDT::ERROR) {
+            LOG4CPLUS_ERROR(logger(), "Cannot set UDT congestion control: " << UDT::getlasterror().getErrorMessage());
+            return false;
+        }
+
+        return true;
+    }
 }
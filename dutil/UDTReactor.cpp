@@ -1,6 +1,7 @@
 #include "DTun/UDTReactor.h"
 #include "DTun/Utils.h"
 #include "Logger.h"
+#include <set>
 
 namespace DTun
 {
@@ -8,11 +9,12 @@ namespace DTun
     : eid_(UDT::ERROR)
     , stopping_(false)
     , nextCookie_(0)
-    , signalWrSock_(UDT::INVALID_SOCK)
-    , signalRdSock_(UDT::INVALID_SOCK)
+    , signalWrSock_(SYS_INVALID_SOCKET)
+    , signalRdSock_(SYS_INVALID_SOCKET)
     , inPoll_(false)
     , pollIteration_(0)
     , currentlyHandling_(NULL)
+    , nextTokenId_(0)
     {
     }
 
@@ -36,111 +38,52 @@ namespace DTun
             return false;
         }
 
-        signalRdSock_ = UDT::socket(AF_INET, SOCK_STREAM, 0);
-        if (signalRdSock_ == UDT::INVALID_SOCK) {
-            LOG4CPLUS_ERROR(logger(), "Cannot create UDT socket: " << UDT::getlasterror().getErrorMessage());
+        signalRdSock_ = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (signalRdSock_ == SYS_INVALID_SOCKET) {
+            LOG4CPLUS_ERROR(logger(), "Cannot create UDP socket: " << strerror(errno));
             reset();
             return false;
         }
 
-        signalWrSock_ = UDT::socket(AF_INET, SOCK_STREAM, 0);
-        if (signalWrSock_ == UDT::INVALID_SOCK) {
-            LOG4CPLUS_ERROR(logger(), "Cannot create UDT socket: " << UDT::getlasterror().getErrorMessage());
-            reset();
-            return false;
-        }
-
-        bool optval = false;
-        if (UDT::setsockopt(signalWrSock_, 0, UDT_RCVSYN, &optval, sizeof(optval)) == UDT::ERROR) {
-            LOG4CPLUS_ERROR(logger(), "Cannot setsockopt on UDT socket: " << UDT::getlasterror().getErrorMessage());
+        signalWrSock_ = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (signalWrSock_ == SYS_INVALID_SOCKET) {
+            LOG4CPLUS_ERROR(logger(), "Cannot create UDP socket: " << strerror(errno));
             reset();
             return false;
         }
 
         struct sockaddr_in addr, addrRead;
-        int addrLen;
+        socklen_t addrLen;
 
         memset(&addr, 0, sizeof(addr));
         addr.sin_family = AF_INET;
         addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
 
-        if (UDT::bind(signalRdSock_, (struct sockaddr*)&addr, sizeof(addr)) == UDT::ERROR) {
-            LOG4CPLUS_ERROR(logger(), "Cannot bind UDT socket: " << UDT::getlasterror().getErrorMessage());
+        if (::bind(signalRdSock_, (struct sockaddr*)&addr, sizeof(addr)) == SYS_SOCKET_ERROR) {
+            LOG4CPLUS_ERROR(logger(), "Cannot bind UDP socket: " << strerror(errno));
             reset();
             return false;
         }
 
         addrLen = sizeof(addrRead);
 
-        if (UDT::getsockname(signalRdSock_, (struct sockaddr*)&addrRead, &addrLen) == UDT::ERROR) {
-            LOG4CPLUS_ERROR(logger(), "Cannot get UDT sock name: " << UDT::getlasterror().getErrorMessage());
-            reset();
-            return false;
-        }
-
-        if (UDT::listen(signalRdSock_, 1) == UDT::ERROR) {
-           LOG4CPLUS_ERROR(logger(), "Cannot listen UDT socket: " << UDT::getlasterror().getErrorMessage());
-           reset();
-           return false;
-        }
-
-        int events = UDT_EPOLL_OUT;
-        if (UDT::epoll_add_usock(eid_, signalWrSock_, &events) == UDT::ERROR) {
-            LOG4CPLUS_ERROR(logger(), "Cannot add UDT sock to epoll: " << UDT::getlasterror().getErrorMessage());
-            reset();
-            return false;
-        }
-
-        if (UDT::connect(signalWrSock_, (const struct sockaddr*)&addrRead, sizeof(addrRead)) == UDT::ERROR) {
-            LOG4CPLUS_ERROR(logger(), "Cannot connect UDT socket: " << UDT::getlasterror().getErrorMessage());
-            reset();
-            return false;
-        }
-
-        sockaddr_storage clientaddr;
-        int addrlen = sizeof(clientaddr);
-
-        UDTSOCKET client;
-
-        if ((client = UDT::accept(signalRdSock_, (sockaddr*)&clientaddr, &addrlen)) == UDT::INVALID_SOCK) {
-            LOG4CPLUS_ERROR(logger(), "Cannot accept UDT socket: " << UDT::getlasterror().getErrorMessage());
-            reset();
-            return false;
-        }
-
-        DTun::closeUDTSocketChecked(signalRdSock_);
-        signalRdSock_ = client;
-
-        std::set<UDTSOCKET> readfds, writefds;
-
-        if (UDT::epoll_wait(eid_, &readfds, &writefds, -1) == UDT::ERROR) {
-            LOG4CPLUS_ERROR(logger(), "epoll_wait error: " << UDT::getlasterror().getErrorMessage());
+        if (::getsockname(signalRdSock_, (struct sockaddr*)&addrRead, &addrLen) == SYS_SOCKET_ERROR) {
+            LOG4CPLUS_ERROR(logger(), "Cannot get UDP sock name: " << strerror(errno));
             reset();
             return false;
         }
 
-        if (writefds.empty() || (writefds.count(signalWrSock_) == 0)) {
-            LOG4CPLUS_ERROR(logger(), "epoll_wait: sock not connected");
+        if (::connect(signalWrSock_, (const struct sockaddr*)&addrRead, sizeof(addrRead)) == SYS_SOCKET_ERROR) {
+            LOG4CPLUS_ERROR(logger(), "Cannot connect UDP socket: " << strerror(errno));
             reset();
             return false;
         }
 
-        if (UDT::epoll_remove_usock(eid_, signalWrSock_) == UDT::ERROR) {
-            LOG4CPLUS_ERROR(logger(), "Cannot remove UDT sock from epoll: " << UDT::getlasterror().getErrorMessage());
-            reset();
-            return false;
-        }
-
-        optval = true;
-        if (UDT::setsockopt(signalWrSock_, 0, UDT_RCVSYN, &optval, sizeof(optval)) == UDT::ERROR) {
-            LOG4CPLUS_ERROR(logger(), "Cannot setsockopt on UDT socket: " << UDT::getlasterror().getErrorMessage());
-            reset();
-            return false;
-        }
-
-        events = UDT_EPOLL_IN;
-        if (UDT::epoll_add_usock(eid_, signalRdSock_, &events) == UDT::ERROR) {
-            LOG4CPLUS_ERROR(logger(), "Cannot add UDT sock to epoll: " << UDT::getlasterror().getErrorMessage());
+        // UDT epoll sleeps in a kernel epoll, the signal socket wakes it up
+        // along with UDT sockets getting ready
+        int events = UDT_EPOLL_IN;
+        if (UDT::epoll_add_ssock(eid_, signalRdSock_, &events) == UDT::ERROR) {
+            LOG4CPLUS_ERROR(logger(), "Cannot add UDP sock to epoll: " << UDT::getlasterror().getErrorMessage());
             reset();
             return false;
         }
@@ -154,20 +97,42 @@ namespace DTun
 
         log4cplus::NDCContextCreator ndc("UDTReactor");
 
+        processTokens();
+
         processUpdates();
 
-        std::set<UDTSOCKET> readfds, writefds;
+        std::vector<UDTSOCKET> readfds, writefds;
 
         while (!stopping_) {
-            readfds.clear();
-            writefds.clear();
+            readfds.resize(pollHandlers_.size() + 1);
+            writefds.resize(pollHandlers_.size() + 1);
+
+            int rnum = readfds.size();
+            int wnum = writefds.size();
+            SYSSOCKET lrfd;
+            int lrnum = 1;
+
+            // broken sockets are only noticed below, so wake up at least once a second.
+            int timeout = 1000;
 
             {
                 boost::mutex::scoped_lock lock(m_);
                 inPoll_ = true;
+                wakeupTime_.reset();
+                if (!tokens_.empty()) {
+                    wakeupTime_ = tokens_.begin()->scheduledTime;
+                    boost::chrono::steady_clock::time_point now =
+                        boost::chrono::steady_clock::now();
+                    if (*wakeupTime_ > now) {
+                        timeout = std::min<int>(timeout, boost::chrono::duration_cast<boost::chrono::milliseconds>(
+                            *wakeupTime_ - now).count() + 1);
+                    } else {
+                        timeout = 0;
+                    }
+                }
             }
 
-            int err = UDT::epoll_wait(eid_, &readfds, &writefds, 1000);
+            int err = UDT::epoll_wait2(eid_, &readfds[0], &rnum, &writefds[0], &wnum, timeout, &lrfd, &lrnum);
 
             {
                 boost::mutex::scoped_lock lock(m_);
@@ -181,32 +146,33 @@ namespace DTun
                     LOG4CPLUS_ERROR(logger(), "epoll_wait error: " << UDT::getlasterror().getErrorMessage());
                     break;
                 }
+                rnum = wnum = lrnum = 0;
             }
 
-            for (std::set<UDTSOCKET>::const_iterator it = readfds.begin(); it != readfds.end(); ++it) {
-                if (*it == signalRdSock_) {
-                    //LOG4CPLUS_TRACE(logger(), "epoll rd: signal");
-                    signalRd();
-                } else {
-                    //LOG4CPLUS_TRACE(logger(), "epoll rd: " << *it);
-                    PollHandlerMap::iterator psIt = pollHandlers_.find(*it);
-                    if ((psIt != pollHandlers_.end()) && ((psIt->second.pollEvents & UDT_EPOLL_IN) != 0)) {
-                        boost::mutex::scoped_lock lock(m_);
-                        HandlerMap::iterator sIt = handlers_.find(psIt->second.cookie);
-                        if (sIt != handlers_.end()) {
-                            currentlyHandling_ = sIt->second.handler;
-                            lock.unlock();
-                            currentlyHandling_->handleRead();
-                            lock.lock();
-                            currentlyHandling_ = NULL;
-                            c_.notify_all();
-                        }
+            if (lrnum > 0) {
+                //LOG4CPLUS_TRACE(logger(), "epoll rd: signal");
+                signalRd();
+            }
+
+            for (int i = 0; i < rnum; ++i) {
+                //LOG4CPLUS_TRACE(logger(), "epoll rd: " << readfds[i]);
+                PollHandlerMap::iterator psIt = pollHandlers_.find(readfds[i]);
+                if ((psIt != pollHandlers_.end()) && ((psIt->second.pollEvents & UDT_EPOLL_IN) != 0)) {
+                    boost::mutex::scoped_lock lock(m_);
+                    HandlerMap::iterator sIt = handlers_.find(psIt->second.cookie);
+                    if (sIt != handlers_.end()) {
+                        currentlyHandling_ = sIt->second.handler;
+                        lock.unlock();
+                        currentlyHandling_->handleRead();
+                        lock.lock();
+                        currentlyHandling_ = NULL;
+                        c_.notify_all();
                     }
                 }
             }
-            for (std::set<UDTSOCKET>::const_iterator it = writefds.begin(); it != writefds.end(); ++it) {
-                //LOG4CPLUS_TRACE(logger(), "epoll wr: " << *it);
-                PollHandlerMap::iterator psIt = pollHandlers_.find(*it);
+            for (int i = 0; i < wnum; ++i) {
+                //LOG4CPLUS_TRACE(logger(), "epoll wr: " << writefds[i]);
+                PollHandlerMap::iterator psIt = pollHandlers_.find(writefds[i]);
                 if ((psIt != pollHandlers_.end()) && ((psIt->second.pollEvents & UDT_EPOLL_OUT) != 0)) {
                     boost::mutex::scoped_lock lock(m_);
                     HandlerMap::iterator sIt = handlers_.find(psIt->second.cookie);
@@ -257,6 +223,8 @@ namespace DTun
                 c_.notify_all();
             }
 
+            processTokens();
+
             processUpdates();
 
             //LOG4CPLUS_TRACE(logger(), "epoll run done");
@@ -275,19 +243,67 @@ namespace DTun
 
     void UDTReactor::post(const Callback& callback, UInt32 timeoutMs)
     {
-        assert(false);
+        boost::chrono::steady_clock::time_point scheduledTime =
+            boost::chrono::steady_clock::now() + boost::chrono::milliseconds(timeoutMs);
+
+        boost::mutex::scoped_lock lock(m_);
+
+        tokens_.insert(DispatchToken(scheduledTime, callback, nextTokenId_++));
+
+        if (!isSameThread()) {
+            if (!wakeupTime_ || (scheduledTime < *wakeupTime_)) {
+                signalWr();
+            }
+        }
     }
 
     void UDTReactor::dispatch(const Callback& callback)
     {
-        assert(false);
+        if (isSameThread()) {
+            callback();
+        } else {
+            post(callback);
+        }
     }
 
     std::string UDTReactor::dump()
     {
         CUDTStats udtStats = UDT::getstats();
+
+        // congestion control state of the connected sockets, RTT and window
+        // averaged, pacing rate summed up.
+        int numConns = 0;
+        double rttMs = 0, cwnd = 0, pacePps = 0;
+
+        {
+            boost::mutex::scoped_lock lock(m_);
+
+            std::set<UDTSOCKET> socks;
+            for (HandlerMap::const_iterator it = handlers_.begin(); it != handlers_.end(); ++it) {
+                socks.insert(it->second.handler->udtHandle()->sock());
+            }
+
+            for (std::set<UDTSOCKET>::const_iterator it = socks.begin(); it != socks.end(); ++it) {
+                UDT::TRACEINFO perf;
+                if (UDT::perfmon(*it, &perf, false) == UDT::ERROR) {
+                    continue;
+                }
+                ++numConns;
+                rttMs += perf.msRTT;
+                cwnd += perf.pktCongestionWindow;
+                if (perf.usPktSndPeriod > 0) {
+                    pacePps += 1000000.0 / perf.usPktSndPeriod;
+                }
+            }
+        }
+
         std::ostringstream os;
-        os << "udtSocks=" << udtStats.numSockets << ", udtCsocks=" << udtStats.numClosedSockets << ", udtMult=" << udtStats.numMultiplexers;
+        os << "udtSocks=" << udtStats.numSockets << ", udtCsocks=" << udtStats.numClosedSockets << ", udtMult=" << udtStats.numMultiplexers
+            << ", udtConns=" << numConns;
+        if (numConns > 0) {
+            os << ", udtRtt=" << (rttMs / numConns) << "ms, udtCwnd=" << static_cast<int>(cwnd / numConns)
+                << ", udtPace=" << static_cast<UInt64>(pacePps) << "pps";
+        }
         return os.str();
     }
 
@@ -366,6 +382,7 @@ namespace DTun
 
     void UDTReactor::reset()
     {
+        tokens_.clear();
         assert(handlers_.empty());
         assert(pollHandlers_.empty());
         if (eid_ != UDT::ERROR) {
@@ -373,13 +390,13 @@ namespace DTun
             eid_ = UDT::ERROR;
         }
         stopping_ = false;
-        if (signalWrSock_ != UDT::INVALID_SOCK) {
-            DTun::closeUDTSocketChecked(signalWrSock_);
-            signalWrSock_ = UDT::INVALID_SOCK;
+        if (signalWrSock_ != SYS_INVALID_SOCKET) {
+            closeSysSocketChecked(signalWrSock_);
+            signalWrSock_ = SYS_INVALID_SOCKET;
         }
-        if (signalRdSock_ != UDT::INVALID_SOCK) {
-            DTun::closeUDTSocketChecked(signalRdSock_);
-            signalRdSock_ = UDT::INVALID_SOCK;
+        if (signalRdSock_ != SYS_INVALID_SOCKET) {
+            closeSysSocketChecked(signalRdSock_);
+            signalRdSock_ = SYS_INVALID_SOCKET;
         }
     }
 
@@ -392,7 +409,7 @@ namespace DTun
     void UDTReactor::signalWr()
     {
         char c = '\0';
-        if (UDT::send(signalWrSock_, &c, 1, 0) == UDT::ERROR) {
+        if (::send(signalWrSock_, &c, 1, 0) == SYS_SOCKET_ERROR) {
             LOG4CPLUS_ERROR(logger(), "cannot write signalWrSock");
         }
     }
@@ -400,7 +417,7 @@ namespace DTun
     void UDTReactor::signalRd()
     {
         char c = '\0';
-        if (UDT::recv(signalRdSock_, &c, 1, 0) != 1) {
+        if (::recv(signalRdSock_, &c, 1, 0) != 1) {
             LOG4CPLUS_ERROR(logger(), "cannot read signalRdSock");
         }
     }
@@ -463,4 +480,31 @@ namespace DTun
             }
         }
     }
+
+    void UDTReactor::processTokens()
+    {
+        boost::mutex::scoped_lock lock(m_);
+
+        int count = tokens_.size() * 2;
+
+        while (!tokens_.empty() && (count-- > 0)) {
+            boost::chrono::steady_clock::time_point now =
+                boost::chrono::steady_clock::now();
+
+            const DispatchToken& first = *(tokens_.begin());
+
+            if (first.scheduledTime > now) {
+                break;
+            }
+
+            Callback cb = first.callback;
+
+            tokens_.erase(tokens_.begin());
+
+            lock.unlock();
+            cb();
+            cb = Callback();
+            lock.lock();
+        }
+    }
 }
@@ -6,6 +6,10 @@
 
 namespace DTun
 {
+    static void writeNoop(int err)
+    {
+    }
+
     UTPConnection::UTPConnection(const boost::shared_ptr<UTPHandle>& handle)
     : handle_(handle)
     , watch_(boost::make_shared<OpWatch>(boost::ref(handle->reactor())))
@@ -34,6 +38,12 @@ namespace DTun
             boost::bind(&UTPConnection::onWrite, this, first, last, callback)));
     }
 
+    void UTPConnection::writev(const Buffers& buffers, const WriteCallback& callback)
+    {
+        handle_->reactor().post(watch_->wrap(
+            boost::bind(&UTPConnection::onWriteV, this, buffers, callback)));
+    }
+
     void UTPConnection::read(char* first, char* last, const ReadCallback& callback, bool readAll)
     {
         handle_->reactor().post(watch_->wrap(
@@ -68,6 +78,30 @@ namespace DTun
         }
     }
 
+    void UTPConnection::onWriteV(const Buffers& buffers, const WriteCallback& callback)
+    {
+        assert(!buffers.empty());
+
+        bool wasEmpty = writeQueue_.empty();
+
+        // only the last request reports, errors fail all queued requests
+        // in order, so it sees them too.
+        for (Buffers::const_iterator it = buffers.begin(); it != buffers.end(); ++it) {
+            WriteReq req;
+
+            req.first = it->first;
+            req.last = it->second;
+            req.callback = (it + 1 == buffers.end()) ? callback : WriteCallback(&writeNoop);
+
+            writeQueue_.push_back(req);
+            writeOutQueue_.push_back(*it);
+        }
+
+        if (wasEmpty) {
+            onHandleWrite(0, 0);
+        }
+    }
+
     void UTPConnection::onRead(char* first, char* last, const ReadCallback& callback, bool readAll)
     {
         ReadReq req;
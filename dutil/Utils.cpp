@@ -103,4 +103,27 @@ namespace DTun
             LOG4CPLUS_TRACE(logger(), "Error closing UDT socket: " << UDT::getlasterror().getErrorMessage());
         }
     }
+
+    std::string buildProfile()
+    {
+        std::ostringstream os;
+
+#ifdef DTUN_PERF
+        os << "perf";
+#else
+        os << "default";
+#endif
+#if defined(DTUN_PGO_GENERATE)
+        os << ", pgo generate";
+#elif defined(DTUN_PGO_USE)
+        os << ", pgo use";
+#endif
+#ifdef NDEBUG
+        os << ", asserts off";
+#else
+        os << ", asserts on";
+#endif
+
+        return os.str();
+    }
 }
@@ -18,6 +18,11 @@ namespace DTun
     #define DPROTOCOL_MSG_SYMM 0xA
     #define DPROTOCOL_MSG_READY 0xB
     #define DPROTOCOL_MSG_NEXT 0xC
+    #define DPROTOCOL_MSG_RELAY 0xD
+    // Same as HELLO, but also announces batched framing support
+    #define DPROTOCOL_MSG_HELLO_BATCH 0xE
+    // Reply to HELLO_BATCH, everything after it uses batched framing
+    #define DPROTOCOL_MSG_BATCH 0xF
 
     #define DPROTOCOL_STATUS_PENDING 0x0
     #define DPROTOCOL_STATUS_ESTABLISHED 0x1
@@ -35,6 +40,21 @@ namespace DTun
     #define DPROTOCOL_RMODE_SYMM_CONN 0x1
     // Symmetrical NAT acceptor, use window ping, send port updates
     #define DPROTOCOL_RMODE_SYMM_ACC 0x2
+    // Both peers behind symmetrical NAT, traffic goes through dmaster relay
+    #define DPROTOCOL_RMODE_RELAY 0x3
+
+    // CONN_CREATE/CONN flags. The byte used to be a bestEffort bool, older
+    // dmasters and dnodes collapse it to 0/1, so a UDP flow comes out at
+    // the far end as a TCP one. dmaster and all dnodes must be upgraded in
+    // lockstep before dnodes tunnel UDP.
+
+    // Don't fail when port reservations can't be fully satisfied
+    #define DPROTOCOL_CONN_FLAG_BEST_EFFORT 0x1
+    // UDP tunnel, all UDP flows to the node share the hole-punched socket
+    #define DPROTOCOL_CONN_FLAG_UDP 0x2
+
+    // First 4 bytes of a relay bind datagram
+    #define DPROTOCOL_RELAY_MAGIC 0xEEDDCCAA
 
     #pragma pack(1)
     struct DProtocolConnId
@@ -48,6 +68,14 @@ namespace DTun
         UInt8 msgCode;
     };
 
+    // Batched framing: [DProtocolFrameHeader][msgSize bytes of body],
+    // unknown messages can be skipped.
+    struct DProtocolFrameHeader
+    {
+        UInt16 msgSize;
+        UInt8 msgCode;
+    };
+
     // OUT MSGS
 
     struct DProtocolMsgHello
@@ -75,7 +103,7 @@ namespace DTun
         UInt32 dstNodeId;
         UInt32 remoteIp;
         UInt16 remotePort;
-        UInt8 bestEffort;
+        UInt8 flags;
     };
 
     struct DProtocolMsgConnClose
@@ -99,7 +127,7 @@ namespace DTun
         UInt16 port;
         UInt8 mode;
         UInt32 srcIp;
-        UInt8 bestEffort;
+        UInt8 flags;
     };
 
     struct DProtocolMsgConnStatus
@@ -124,6 +152,25 @@ namespace DTun
         UInt16 nodePort;
     };
 
+    // relayIp == 0 means relay is at dmaster's address, token is this
+    // node's secret for binding to the relay
+    struct DProtocolMsgRelay
+    {
+        DProtocolConnId connId;
+        UInt32 relayIp;
+        UInt16 relayPort;
+        UInt64 token;
+    };
+
+    // UDP, node -> relay, echoed back once both nodes are bound
+    struct DProtocolRelayBind
+    {
+        UInt32 magic;
+        DProtocolConnId connId;
+        UInt32 nodeId;
+        UInt64 token;
+    };
+
     // IN/OUT MSGS
 
     struct DProtocolMsgReady
@@ -137,6 +184,30 @@ namespace DTun
     };
     #pragma pack()
 
+    // Body size of a message in legacy framing, -1 if msgCode is unknown
+    inline int protocolMsgSize(UInt8 msgCode)
+    {
+        switch (msgCode) {
+        case DPROTOCOL_MSG_HELLO: return sizeof(DProtocolMsgHello);
+        case DPROTOCOL_MSG_HELLO_PROBE: return 0;
+        case DPROTOCOL_MSG_HELLO_FAST: return sizeof(DProtocolMsgHelloFast);
+        case DPROTOCOL_MSG_HELLO_SYMM: return sizeof(DProtocolMsgHelloSymm);
+        case DPROTOCOL_MSG_CONN_CREATE: return sizeof(DProtocolMsgConnCreate);
+        case DPROTOCOL_MSG_CONN_CLOSE: return sizeof(DProtocolMsgConnClose);
+        case DPROTOCOL_MSG_PROBE: return sizeof(DProtocolMsgProbe);
+        case DPROTOCOL_MSG_CONN: return sizeof(DProtocolMsgConn);
+        case DPROTOCOL_MSG_CONN_STATUS: return sizeof(DProtocolMsgConnStatus);
+        case DPROTOCOL_MSG_FAST: return sizeof(DProtocolMsgFast);
+        case DPROTOCOL_MSG_SYMM: return sizeof(DProtocolMsgSymm);
+        case DPROTOCOL_MSG_READY: return sizeof(DProtocolMsgReady);
+        case DPROTOCOL_MSG_NEXT: return sizeof(DProtocolMsgNext);
+        case DPROTOCOL_MSG_RELAY: return sizeof(DProtocolMsgRelay);
+        case DPROTOCOL_MSG_HELLO_BATCH: return sizeof(DProtocolMsgHello);
+        case DPROTOCOL_MSG_BATCH: return 0;
+        default: return -1;
+        }
+    }
+
     inline DProtocolConnId toProtocolConnId(const ConnId& connId)
     {
         DProtocolConnId res;
@@ -0,0 +1,91 @@
+#ifndef _DTUN_DPROTOCOLCONNECTION_H_
+#define _DTUN_DPROTOCOLCONNECTION_H_
+
+#include "DTun/DProtocol.h"
+#include "DTun/SConnection.h"
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+#include <vector>
+
+namespace DTun
+{
+    /*
+     * DProtocol message stream on top of SConnection.
+     *
+     * Outgoing messages are appended to a pending buffer, while a write is in
+     * flight everything sent is coalesced and goes out in one write once the
+     * current one completes. Incoming data is read in chunks and every
+     * complete message in a chunk is dispatched before the next read.
+     *
+     * Starts in legacy framing ([header][body], body size implied by msgCode),
+     * each direction can be switched to batched framing
+     * ([DProtocolFrameHeader][body]) once HELLO_BATCH/BATCH are exchanged.
+     *
+     * Must be created with make_shared. sendMsg can be called from any thread,
+     * callbacks come on the reactor thread and may drop the last reference.
+     */
+    class DTUN_API DProtocolConnection : boost::noncopyable,
+        public boost::enable_shared_from_this<DProtocolConnection>
+    {
+    public:
+        typedef boost::function<void (UInt8, const char*, int)> MessageCallback;
+        typedef boost::function<void (int)> ErrorCallback;
+
+        explicit DProtocolConnection(const boost::shared_ptr<SConnection>& conn);
+        ~DProtocolConnection();
+
+        inline void setMessageCallback(const MessageCallback& cb) { messageCallback_ = cb; }
+        inline void setErrorCallback(const ErrorCallback& cb) { errorCallback_ = cb; }
+
+        inline const boost::shared_ptr<SConnection>& conn() const { return conn_; }
+
+        void start();
+
+        void sendMsg(UInt8 msgCode, const void* msg, int msgSize);
+
+        // Messages sent after this call use batched framing.
+        void setSendBatched();
+
+        // Data following the message being dispatched uses batched framing,
+        // call from message callback only.
+        void setRecvBatched();
+
+        // No callbacks after this.
+        void close();
+
+        // Number of messages and writes so far, for stats.
+        void getStats(UInt64& numMsgs, UInt64& numWrites) const;
+
+    private:
+        void startRead();
+        void flush();
+        void fail(int err);
+
+        static void onRead(const boost::weak_ptr<DProtocolConnection>& weakThis, int err, int numBytes);
+        static void onWrite(const boost::weak_ptr<DProtocolConnection>& weakThis, int err);
+
+        void handleRead(int err, int numBytes);
+        void handleWrite(int err);
+
+        boost::shared_ptr<SConnection> conn_;
+        MessageCallback messageCallback_;
+        ErrorCallback errorCallback_;
+
+        // reactor thread only.
+        std::vector<char> rcvBuff_;
+        int rcvStart_;
+        int rcvEnd_;
+        bool recvBatched_;
+
+        mutable boost::mutex m_;
+        bool closed_;
+        bool sendBatched_;
+        bool writing_;
+        std::vector<char> sndBuff_;
+        std::vector<char> wrBuff_;
+        UInt64 numMsgs_;
+        UInt64 numWrites_;
+    };
+}
+
+#endif
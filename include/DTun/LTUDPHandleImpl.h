@@ -13,6 +13,11 @@
 #include <lwip/tcp.h>
 #include <vector>
 
+// lwIP's TCP_WND and TCP_SND_BUF are sized for tun2socks, LTUDP connections
+// keep the unscaled 64 KB window and send buffer they always had.
+#define LTUDP_WND 0xFFFF
+#define LTUDP_SND_BUF 0xFFFF
+
 namespace DTun
 {
     class LTUDPManager;
@@ -76,12 +81,19 @@ namespace DTun
 
         void setupPCB(struct tcp_pcb* pcb);
 
+        // cuts an established pcb down to LTUDP_WND and LTUDP_SND_BUF.
+        void setupWindow();
+
+        void recved(int len);
+
         LTUDPManager& mgr_;
         struct tcp_pcb* pcb_;
         uint16_t pcbLocalPort_;
         uint32_t pcbRemoteIp_;
         uint16_t pcbRemotePort_;
         bool eof_;
+        // part of lwIP's window never opened, given back before close.
+        tcpwnd_size_t rcvWndHeld_;
         boost::circular_buffer<char> rcvBuff_;
         SAcceptor::ListenCallback listenCallback_;
         SConnector::ConnectCallback connectCallback_;
@@ -37,6 +37,12 @@ namespace DTun
             return boost::bind(&OpWatch::onWrappedCallback2<A1, A2>, shared_from_this(), callback, _1, _2);
         }
 
+        template <class A1, class A2, class A3, class A4>
+        boost::function<void(A1, A2, A3, A4)> wrap(const boost::function<void(A1, A2, A3, A4)>& callback)
+        {
+            return boost::bind(&OpWatch::onWrappedCallback4<A1, A2, A3, A4>, shared_from_this(), callback, _1, _2, _3, _4);
+        }
+
     private:
         enum State
         {
@@ -101,6 +107,25 @@ namespace DTun
             }
         }
 
+        template <class A1, class A2, class A3, class A4>
+        void onWrappedCallback4(const boost::function<void(A1, A2, A3, A4)>& callback, const A1& a1, const A2& a2, const A3& a3, const A4& a4)
+        {
+            boost::mutex::scoped_lock lock(m_);
+            if (state_ != StateActive) {
+                return;
+            }
+            inCallback_ = true;
+            lock.unlock();
+            callback(a1, a2, a3, a4);
+            lock.lock();
+            inCallback_ = false;
+            bool signal = (state_ == StateClosing);
+            lock.unlock();
+            if (signal) {
+                c_.notify_all();
+            }
+        }
+
         SReactor& reactor_;
         boost::mutex m_;
         boost::condition_variable c_;
@@ -3,6 +3,7 @@
 
 #include "DTun/SHandler.h"
 #include <boost/function.hpp>
+#include <vector>
 
 namespace DTun
 {
@@ -14,12 +15,17 @@ namespace DTun
         typedef boost::function<void (int)> WriteCallback;
         typedef boost::function<void (int, int)> ReadCallback;
         typedef boost::function<void (int, int, UInt32, UInt16)> ReadFromCallback;
+        typedef std::vector<std::pair<const char*, const char*> > Buffers;
 
         SConnection() {}
         virtual ~SConnection() {}
 
         virtual void write(const char* first, const char* last, const WriteCallback& callback) = 0;
 
+        // Writes 'buffers' in order, 'callback' is called once after all of them
+        // are written or with the first error. Default is one write() per buffer.
+        virtual void writev(const Buffers& buffers, const WriteCallback& callback);
+
         virtual void read(char* first, char* last, const ReadCallback& callback, bool readAll) = 0;
 
         virtual void writeTo(const char* first, const char* last, UInt32 destIp, UInt16 destPort, const WriteCallback& callback) = 0;
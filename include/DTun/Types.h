@@ -3,6 +3,7 @@
 
 #include <string>
 #include <ostream>
+#include <boost/functional/hash.hpp>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -84,6 +85,16 @@ namespace DTun
         UInt32 nodeId;
         UInt32 connIdx;
     };
+
+    inline std::size_t hash_value(const ConnId& value)
+    {
+        std::size_t seed = 0;
+
+        boost::hash_combine(seed, value.nodeId);
+        boost::hash_combine(seed, value.connIdx);
+
+        return seed;
+    }
 }
 
 namespace std
@@ -9,9 +9,20 @@ namespace DTun
     class DTUN_API UDTManager : public SManager
     {
     public:
-        explicit UDTManager(UDTReactor& reactor);
+        // Congestion control of the sockets created, accepted ones take it from the listener.
+        enum CongestionControl
+        {
+            CongestionControlUDT = 0,
+            CongestionControlBBR,
+            CongestionControlCubic
+        };
+
+        explicit UDTManager(UDTReactor& reactor, CongestionControl cc = CongestionControlUDT);
         ~UDTManager();
 
+        // "udt", "bbr" or "cubic".
+        static bool parseCongestionControl(const std::string& str, CongestionControl& cc);
+
         virtual SReactor& reactor();
 
         virtual boost::shared_ptr<SHandle> createStreamSocket();
@@ -21,7 +32,10 @@ namespace DTun
         virtual void enablePortRemap(UInt16 dstPort);
 
     private:
+        bool setCongestionControl(UDTSOCKET sock);
+
         UDTReactor& reactor_;
+        CongestionControl cc_;
     };
 }
 
@@ -6,7 +6,10 @@
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/thread.hpp>
+#include <boost/chrono.hpp>
+#include <boost/optional.hpp>
 #include <map>
+#include <set>
 
 namespace DTun
 {
@@ -68,11 +71,37 @@ namespace DTun
             bool notInEpoll;
         };
 
+        struct DispatchToken
+        {
+            DispatchToken(const boost::chrono::steady_clock::time_point& scheduledTime,
+                const Callback& callback, uint64_t id)
+            : scheduledTime(scheduledTime)
+            , callback(callback)
+            , id(id) {}
+            ~DispatchToken() {}
+
+            inline bool operator<(const DispatchToken& rhs) const
+            {
+                if (scheduledTime < rhs.scheduledTime) {
+                    return true;
+                } else if (scheduledTime > rhs.scheduledTime) {
+                    return false;
+                }
+                return id < rhs.id;
+            }
+
+            boost::chrono::steady_clock::time_point scheduledTime;
+            Callback callback;
+            uint64_t id;
+        };
+
         typedef std::map<uint64_t, HandlerInfo> HandlerMap;
         typedef std::map<UDTSOCKET, PollHandlerInfo> PollHandlerMap;
 
         void reset();
 
+        void processTokens();
+
         void signalWr();
         void signalRd();
 
@@ -83,13 +112,16 @@ namespace DTun
         int eid_;
         bool stopping_;
         uint64_t nextCookie_;
-        UDTSOCKET signalWrSock_;
-        UDTSOCKET signalRdSock_;
+        SYSSOCKET signalWrSock_;
+        SYSSOCKET signalRdSock_;
         HandlerMap handlers_;
         PollHandlerMap pollHandlers_;
         bool inPoll_;
         uint64_t pollIteration_;
         UDTHandler* currentlyHandling_;
+        std::set<DispatchToken> tokens_;
+        uint64_t nextTokenId_;
+        boost::optional<boost::chrono::steady_clock::time_point> wakeupTime_;
     };
 }
 
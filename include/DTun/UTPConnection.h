@@ -20,6 +20,8 @@ namespace DTun
 
         virtual void write(const char* first, const char* last, const WriteCallback& callback);
 
+        virtual void writev(const Buffers& buffers, const WriteCallback& callback);
+
         virtual void read(char* first, char* last, const ReadCallback& callback, bool readAll);
 
         virtual void writeTo(const char* first, const char* last, UInt32 destIp, UInt16 destPort, const WriteCallback& callback);
@@ -47,6 +49,8 @@ namespace DTun
 
         void onWrite(const char* first, const char* last, const WriteCallback& callback);
 
+        void onWriteV(const Buffers& buffers, const WriteCallback& callback);
+
         void onRead(char* first, char* last, const ReadCallback& callback, bool readAll);
 
         void onHandleWrite(int err, int numBytes);
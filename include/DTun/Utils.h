@@ -17,6 +17,9 @@ namespace DTun
 
     DTUN_API void closeSysSocketChecked(SYSSOCKET sock);
     DTUN_API void closeUDTSocketChecked(int sock);
+
+    // build configuration for benchmark reports, e.g. "perf, pgo use".
+    DTUN_API std::string buildProfile();
 }
 
 #endif
@@ -62,19 +62,36 @@
 #define LWIP_IPV6_AUTOCONFIG 0
 
 #define PBUF_POOL_SIZE 1024
+// a full sized packet read from the device fits in one pbuf
+#define PBUF_POOL_BUFSIZE 1500
 #define MEMP_NUM_TCP_PCB_LISTEN 16
 #define MEMP_NUM_TCP_PCB 1024
 #define TCP_MSS 1440
-#define TCP_WND 65535
-#define TCP_SND_BUF 65535
+// upper limits, tun2socks applies the configured window and send buffer
+// to each connection, scaling lets a flow have more than 64 KB in flight
+#define LWIP_WND_SCALE 1
+#define TCP_RCV_SCALE 5
+#define TCP_WND (1024 * 1024)
+#define TCP_SND_BUF (1024 * 1024)
 #define TCP_SND_QUEUELEN (16 * TCP_SND_BUF/TCP_MSS)
+// only used by the socket API, must stay below u16 overflow
+#define TCP_SNDLOWAT (16 * 1024)
 // TODO: Make proper fix, I don't understand WHY it works, but it works.
 #define TCP_WND_UPDATE_THRESHOLD 0
 
 #define MEM_LIBC_MALLOC 1
-#define MEMP_MEM_MALLOC 0
+// pool elements are malloc'd as needed, so pools grow with the number of
+// connections and the MEMP_NUM_* and PBUF_POOL_SIZE counts don't limit anything
+#define MEMP_MEM_MALLOC 1
 #define MEMP_NUM_TCP_SEG 1024
 
+// pool usage and allocation failures are logged by tun2socks
+#define MEMP_STATS 1
+#define LWIP_STATS_LARGE 1
+
+// lets tun2socks leave TCP checksums to the device when offloading
+#define LWIP_CHECKSUM_CTRL_PER_NETIF 1
+
 #define LWIP_PERF 0
 #define SYS_LIGHTWEIGHT_PROT 0
 #define LWIP_DONT_PROVIDE_BYTEORDER_FUNCTIONS
@@ -83,13 +100,15 @@
 // is used regardless of the platform
 #define IPV6_FRAG_COPYHEADER 1
 
-/*
+// DTUN_LWIP_DEBUG cmake option, off by default since every segment would
+// go through the debug paths
+#ifdef DTUN_LWIP_DEBUG
 #define LWIP_DEBUG 1
 #define IP_DEBUG LWIP_DBG_ON
 #define NETIF_DEBUG LWIP_DBG_ON
 #define TCP_DEBUG LWIP_DBG_ON
 #define TCP_INPUT_DEBUG LWIP_DBG_ON
 #define TCP_OUTPUT_DEBUG LWIP_DBG_ON
-*/
+#endif
 
 #endif
@@ -44,6 +44,9 @@ written by
 
 using namespace std;
 
+// initial size of the protocol buffer of CRcvBuffer, in packets
+static const int g_iInitRcvBufSize = 32;
+
 CSndBuffer::CSndBuffer(int size, int mss):
 m_BufLock(),
 m_pBlock(NULL),
@@ -216,6 +219,8 @@ int CSndBuffer::addBufferFromFile(fstream& ifs, int len)
 
 int CSndBuffer::readData(char** data, int32_t& msgno)
 {
+   CGuard bufferguard(m_BufLock);
+
    // No data to read
    if (m_pCurrBlock == m_pLastBlock)
       return 0;
@@ -282,6 +287,53 @@ int CSndBuffer::getCurrBufSize() const
    return m_iCount;
 }
 
+void CSndBuffer::shrink()
+{
+   CGuard bufferguard(m_BufLock);
+
+   // only an empty buffer is rebuilt, no block can be referenced by then
+   if ((m_iCount > 0) || (NULL == m_pBuffer->m_pNext))
+      return;
+
+   Block* pb = m_pBlock->m_pNext;
+   while (pb != m_pBlock)
+   {
+      Block* temp = pb;
+      pb = pb->m_pNext;
+      delete temp;
+   }
+
+   Buffer* pbuf = m_pBuffer->m_pNext;
+   while (pbuf != NULL)
+   {
+      Buffer* temp = pbuf;
+      pbuf = pbuf->m_pNext;
+      delete [] temp->m_pcData;
+      delete temp;
+   }
+   m_pBuffer->m_pNext = NULL;
+   m_iSize = m_pBuffer->m_iSize;
+
+   // a new circular list on the first physical buffer, as built by the constructor
+   pb = m_pBlock;
+   char* pc = m_pBuffer->m_pcData;
+   for (int i = 0; i < m_iSize; ++ i)
+   {
+      pb->m_pcData = pc;
+      pb->m_iMsgNo = 0;
+      pc += m_iMSS;
+
+      if (i < m_iSize - 1)
+      {
+         pb->m_pNext = new Block;
+         pb = pb->m_pNext;
+      }
+   }
+   pb->m_pNext = m_pBlock;
+
+   m_pFirstBlock = m_pCurrBlock = m_pLastBlock = m_pBlock;
+}
+
 void CSndBuffer::increase()
 {
    int unitsize = m_pBuffer->m_iSize;
@@ -344,17 +396,27 @@ void CSndBuffer::increase()
 ////////////////////////////////////////////////////////////////////////////////
 
 CRcvBuffer::CRcvBuffer(CUnitQueue* queue, int bufsize):
+m_BufLock(),
 m_pUnit(NULL),
-m_iSize(bufsize),
+m_iSize(0),
+m_iMaxSize(bufsize),
 m_pUnitQueue(queue),
 m_iStartPos(0),
 m_iLastAckPos(0),
 m_iMaxPos(0),
 m_iNotch(0)
 {
+   // the protocol buffer starts small and grows with the data in flight, up to "bufsize"
+   m_iSize = (bufsize < g_iInitRcvBufSize) ? bufsize : g_iInitRcvBufSize;
    m_pUnit = new CUnit* [m_iSize];
    for (int i = 0; i < m_iSize; ++ i)
       m_pUnit[i] = NULL;
+
+   #ifndef WIN32
+      pthread_mutex_init(&m_BufLock, NULL);
+   #else
+      m_BufLock = CreateMutex(NULL, false, NULL);
+   #endif
 }
 
 CRcvBuffer::~CRcvBuffer()
@@ -369,10 +431,26 @@ CRcvBuffer::~CRcvBuffer()
    }
 
    delete [] m_pUnit;
+
+   #ifndef WIN32
+      pthread_mutex_destroy(&m_BufLock);
+   #else
+      CloseHandle(m_BufLock);
+   #endif
 }
 
 int CRcvBuffer::addData(CUnit* unit, int offset)
 {
+   // one slot stays empty, see getAvailBufSize()
+   int span = getDataSize() + offset + 2;
+   if (span > m_iSize)
+   {
+      int size = m_iSize * 2;
+      while (size < span)
+         size *= 2;
+      resize(((size > m_iMaxSize) && (m_iMaxSize >= span)) ? m_iMaxSize : size);
+   }
+
    int pos = (m_iLastAckPos + offset) % m_iSize;
    if (offset > m_iMaxPos)
       m_iMaxPos = offset;
@@ -390,6 +468,8 @@ int CRcvBuffer::addData(CUnit* unit, int offset)
 
 int CRcvBuffer::readBuffer(char* data, int len)
 {
+   CGuard bufferguard(m_BufLock);
+
    int p = m_iStartPos;
    int lastack = m_iLastAckPos;
    int rs = len;
@@ -427,6 +507,8 @@ int CRcvBuffer::readBuffer(char* data, int len)
 
 int CRcvBuffer::readBufferToFile(fstream& ofs, int len)
 {
+   CGuard bufferguard(m_BufLock);
+
    int p = m_iStartPos;
    int lastack = m_iLastAckPos;
    int rs = len;
@@ -477,10 +559,17 @@ void CRcvBuffer::ackData(int len)
 int CRcvBuffer::getAvailBufSize() const
 {
    // One slot must be empty in order to tell the difference between "empty buffer" and "full buffer"
-   return m_iSize - getRcvDataSize() - 1;
+   return m_iMaxSize - getDataSize() - 1;
 }
 
 int CRcvBuffer::getRcvDataSize() const
+{
+   CGuard bufferguard(m_BufLock);
+
+   return getDataSize();
+}
+
+int CRcvBuffer::getDataSize() const
 {
    if (m_iLastAckPos >= m_iStartPos)
       return m_iLastAckPos - m_iStartPos;
@@ -497,6 +586,8 @@ void CRcvBuffer::dropMsg(int32_t msgno)
 
 int CRcvBuffer::readMsg(char* data, int len)
 {
+   CGuard bufferguard(m_BufLock);
+
    int p, q;
    bool passack;
    if (!scanMsg(p, q, passack))
@@ -538,6 +629,8 @@ int CRcvBuffer::readMsg(char* data, int len)
 
 int CRcvBuffer::getRcvMsgNum()
 {
+   CGuard bufferguard(m_BufLock);
+
    int p, q;
    bool passack;
    return scanMsg(p, q, passack) ? 1 : 0;
@@ -598,7 +691,7 @@ bool CRcvBuffer::scanMsg(int& p, int& q, bool& passack)
    bool found = false;
 
    // looking for the first message
-   for (int i = 0, n = m_iMaxPos + getRcvDataSize(); i <= n; ++ i)
+   for (int i = 0, n = m_iMaxPos + getDataSize(); i <= n; ++ i)
    {
       if ((NULL != m_pUnit[q]) && (1 == m_pUnit[q]->m_iFlag))
       {
@@ -650,3 +743,34 @@ bool CRcvBuffer::scanMsg(int& p, int& q, bool& passack)
 
    return found;
 }
+
+void CRcvBuffer::shrink()
+{
+   // the buffer must be read out and nothing may be waiting beyond the ACK point
+   if ((m_iSize > g_iInitRcvBufSize) && (m_iStartPos == m_iLastAckPos) && (0 == m_iMaxPos) && (NULL == m_pUnit[m_iLastAckPos]))
+      resize(g_iInitRcvBufSize);
+}
+
+void CRcvBuffer::resize(int size)
+{
+   CGuard bufferguard(m_BufLock);
+
+   // move the buffer content so that it starts at position 0
+   CUnit** unit = new CUnit* [size];
+   int n = m_iSize - 1;
+   if (n > size - 1)
+      n = size - 1;
+   for (int i = 0; i < n; ++ i)
+      unit[i] = m_pUnit[(m_iStartPos + i) % m_iSize];
+   for (int i = n; i < size; ++ i)
+      unit[i] = NULL;
+
+   int datasize = getDataSize();
+
+   delete [] m_pUnit;
+   m_pUnit = unit;
+   m_iSize = size;
+
+   m_iStartPos = 0;
+   m_iLastAckPos = datasize;
+}
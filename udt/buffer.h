@@ -115,6 +115,15 @@ public:
 
    int getCurrBufSize() const;
 
+      // Functionality:
+      //    Release the memory of an empty buffer that has grown beyond its initial size.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    None.
+
+   void shrink();
+
 private:
    void increase();
 
@@ -250,12 +259,26 @@ public:
 
    int getRcvMsgNum();
 
+      // Functionality:
+      //    Release the memory of an empty buffer that has grown beyond its initial size.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    None.
+
+   void shrink();
+
 private:
    bool scanMsg(int& start, int& end, bool& passack);
+   int getDataSize() const;
+   void resize(int size);
 
 private:
+   mutable pthread_mutex_t m_BufLock;   // protects the protocol buffer against resizing while it is read
+
    CUnit** m_pUnit;                     // pointer to the protocol buffer
    int m_iSize;                         // size of the protocol buffer
+   int m_iMaxSize;                      // size the protocol buffer may grow to
    CUnitQueue* m_pUnitQueue;		// the shared unit queue
 
    int m_iStartPos;                     // the head position for I/O (inclusive)
@@ -312,3 +312,420 @@ void CUDTCC::onTimeout()
       */
    }
 }
+
+//
+// gains of the BBR phases, 2/ln(2) doubles the delivery rate every round in startup
+static const double BBR_HIGH_GAIN = 2.885;
+static const int BBR_CYCLE_LENGTH = 8;
+static const double BBR_CYCLE_GAIN[BBR_CYCLE_LENGTH] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+static const uint64_t BBR_MIN_RTT_WINDOW = 10000000;
+static const uint64_t BBR_PROBE_RTT_TIME = 200000;
+static const double BBR_MIN_CWND = 4;
+
+CBBRCC::CBBRCC():
+m_State(STARTUP),
+m_dPacingGain(),
+m_dCWndGain(),
+m_dBtlBw(),
+m_iRound(),
+m_iRoundEndSeq(),
+m_iRoundStartAck(),
+m_RoundStartTime(),
+m_iRoundLoss(),
+m_iLastMarkSeq(),
+m_iMinRTT(),
+m_MinRTTTime(),
+m_dFullBW(),
+m_iFullBWRounds(),
+m_bFullPipe(),
+m_iCycleIndex(),
+m_CycleTime(),
+m_ProbeRTTDone()
+{
+   for (int i = 0; i < m_iBWRounds; ++ i)
+      m_adRoundBW[i] = 0;
+   for (int i = 0; i < m_iSendMarks; ++ i)
+      m_aiMarkSeq[i] = -1;
+}
+
+void CBBRCC::init()
+{
+   uint64_t currtime = CTimer::getTime();
+
+   m_State = STARTUP;
+   m_dPacingGain = BBR_HIGH_GAIN;
+   m_dCWndGain = BBR_HIGH_GAIN;
+
+   m_dBtlBw = 0;
+   m_iRound = 0;
+   m_iRoundEndSeq = m_iSndCurrSeqNo;
+   m_iRoundStartAck = m_iSndCurrSeqNo;
+   m_RoundStartTime = currtime;
+   m_iRoundLoss = 0;
+   m_iLastMarkSeq = m_iSndCurrSeqNo;
+
+   m_iMinRTT = m_iRTT;
+   m_MinRTTTime = currtime;
+
+   m_dFullBW = 0;
+   m_iFullBWRounds = 0;
+   m_bFullPipe = false;
+
+   // no bandwidth estimation yet, send out the initial window at once
+   m_dCWndSize = 16;
+   m_dPktSndPeriod = 1;
+}
+
+void CBBRCC::onACK(int32_t ack)
+{
+   uint64_t currtime = CTimer::getTime();
+
+   // m_iRTT is smoothed, its minimum still follows the propagation delay
+   if ((m_iRTT <= m_iMinRTT) || (currtime - m_MinRTTTime > BBR_MIN_RTT_WINDOW))
+   {
+      if ((m_iRTT > m_iMinRTT) && (PROBE_RTT != m_State) && (STARTUP != m_State))
+      {
+         // the minimum has not been seen for a while, drain the queue to measure it again
+         m_State = PROBE_RTT;
+         m_dPacingGain = 1;
+         m_dCWndGain = 1;
+         m_ProbeRTTDone = currtime + BBR_PROBE_RTT_TIME;
+      }
+      else
+      {
+         m_iMinRTT = m_iRTT;
+         m_MinRTTTime = currtime;
+      }
+   }
+
+   if (CSeqNo::seqcmp(ack, m_iRoundEndSeq) > 0)
+      onRoundEnd(ack, currtime);
+
+   switch (m_State)
+   {
+   case DRAIN:
+      if (getFlightSize(ack) <= getBDP())
+         enterProbeBW(currtime);
+      break;
+
+   case PROBE_BW:
+      // move to the next phase after a minimum RTT, or as soon as the queue
+      // built up by probing is gone
+      if ((currtime - m_CycleTime > (uint64_t)(m_iMinRTT + m_iSYNInterval)) ||
+          ((BBR_CYCLE_GAIN[m_iCycleIndex] < 1) && (getFlightSize(ack) <= getBDP())))
+      {
+         m_iCycleIndex = (m_iCycleIndex + 1) % BBR_CYCLE_LENGTH;
+         m_CycleTime = currtime;
+         m_dPacingGain = BBR_CYCLE_GAIN[m_iCycleIndex];
+      }
+      break;
+
+   case PROBE_RTT:
+      if (currtime > m_ProbeRTTDone)
+      {
+         m_iMinRTT = m_iRTT;
+         m_MinRTTTime = currtime;
+
+         if (m_bFullPipe)
+            enterProbeBW(currtime);
+         else
+         {
+            m_State = STARTUP;
+            m_dPacingGain = BBR_HIGH_GAIN;
+            m_dCWndGain = BBR_HIGH_GAIN;
+         }
+      }
+      break;
+
+   default:
+      break;
+   }
+
+   setControl();
+}
+
+void CBBRCC::onLoss(const int32_t* losslist, int size)
+{
+   for (int i = 0; i < size; ++ i)
+   {
+      if (0 != (losslist[i] & 0x80000000))
+      {
+         m_iRoundLoss += CSeqNo::seqlen(losslist[i] & 0x7FFFFFFF, losslist[i + 1]);
+         ++ i;
+      }
+      else
+         ++ m_iRoundLoss;
+   }
+}
+
+void CBBRCC::onPktSent(const CPacket* pkt)
+{
+   // keep the sending time of every 16th new packet, retransmissions do not count
+   int32_t seqno = pkt->m_iSeqNo;
+   if ((0 != (seqno & 0xF)) || (CSeqNo::seqcmp(seqno, m_iLastMarkSeq) <= 0))
+      return;
+
+   int i = (seqno >> 4) % m_iSendMarks;
+   m_aiMarkSeq[i] = seqno;
+   m_aMarkTime[i] = CTimer::getTime();
+   m_iLastMarkSeq = seqno;
+}
+
+bool CBBRCC::getSendTime(int32_t seqno, uint64_t& time) const
+{
+   seqno &= ~0xF;
+
+   int i = (seqno >> 4) % m_iSendMarks;
+   if (m_aiMarkSeq[i] != seqno)
+      return false;
+
+   time = m_aMarkTime[i];
+   return true;
+}
+
+void CBBRCC::onRoundEnd(int32_t ack, uint64_t currtime)
+{
+   int delivered = CSeqNo::seqoff(m_iRoundStartAck, ack);
+
+   // a round losing more than a few percent with the RTT up by a quarter means
+   // the queue overflows, the estimation must have been too high, losses
+   // without a queue are left to retransmission
+   bool overflow = (m_iRoundLoss * 50 > delivered) && (m_iRTT * 4 > m_iMinRTT * 5);
+   if (overflow)
+   {
+      for (int i = 0; i < m_iBWRounds; ++ i)
+         m_adRoundBW[i] = 0;
+   }
+
+   // delivery rate of the round, over the time it took to acknowledge the
+   // packets or to send them, whichever is longer, so that an ACK filling a
+   // hole does not count the whole hole as delivered in this round
+   double& sample = m_adRoundBW[m_iRound % m_iBWRounds];
+   sample = 0;
+
+   uint64_t firstsent, lastsent;
+   if (getSendTime(m_iRoundStartAck, firstsent) && getSendTime(CSeqNo::decseq(ack), lastsent))
+   {
+      double elapsed = double(currtime - m_RoundStartTime);
+      if (lastsent > firstsent + elapsed)
+         elapsed = double(lastsent - firstsent);
+
+      if (elapsed > 0)
+         sample = delivered * 1000000.0 / elapsed;
+   }
+
+   double bw = 0;
+   for (int i = 0; i < m_iBWRounds; ++ i)
+   {
+      if (m_adRoundBW[i] > bw)
+         bw = m_adRoundBW[i];
+   }
+   if (bw > 0)
+      m_dBtlBw = bw;
+
+   ++ m_iRound;
+   m_iRoundEndSeq = m_iSndCurrSeqNo;
+   m_iRoundStartAck = ack;
+   m_RoundStartTime = currtime;
+   m_iRoundLoss = 0;
+
+   if ((PROBE_BW == m_State) && overflow)
+   {
+      // drain the queue
+      m_iCycleIndex = 1;
+      m_CycleTime = currtime;
+      m_dPacingGain = BBR_CYCLE_GAIN[m_iCycleIndex];
+   }
+
+   if (STARTUP != m_State)
+      return;
+
+   // the pipe is full when the bandwidth has not grown by a quarter for 3 rounds,
+   // or as soon as it overflows
+   if (overflow)
+      m_iFullBWRounds = 3;
+   else if (m_dBtlBw >= m_dFullBW * 1.25)
+   {
+      m_dFullBW = m_dBtlBw;
+      m_iFullBWRounds = 0;
+   }
+   else
+      ++ m_iFullBWRounds;
+
+   if (m_iFullBWRounds >= 3)
+   {
+      m_bFullPipe = true;
+      m_State = DRAIN;
+      m_dPacingGain = 1 / BBR_HIGH_GAIN;
+      m_dCWndGain = BBR_HIGH_GAIN;
+   }
+}
+
+void CBBRCC::enterProbeBW(uint64_t currtime)
+{
+   m_State = PROBE_BW;
+   m_dCWndGain = 2;
+
+   // start at a random phase other than the draining one
+   m_iCycleIndex = rand() % (BBR_CYCLE_LENGTH - 1);
+   if (m_iCycleIndex >= 1)
+      ++ m_iCycleIndex;
+   m_CycleTime = currtime;
+   m_dPacingGain = BBR_CYCLE_GAIN[m_iCycleIndex];
+}
+
+double CBBRCC::getBDP() const
+{
+   // ACKs come once per SYN interval, the window has to cover that as well
+   return m_dBtlBw * (m_iMinRTT + m_iSYNInterval) / 1000000.0;
+}
+
+int CBBRCC::getFlightSize(int32_t ack) const
+{
+   int size = CSeqNo::seqoff(ack, m_iSndCurrSeqNo) + 1;
+   return (size > 0) ? size : 0;
+}
+
+void CBBRCC::setControl()
+{
+   if (m_dBtlBw <= 0)
+      return;
+
+   m_dPktSndPeriod = 1000000.0 / (m_dBtlBw * m_dPacingGain);
+
+   if (PROBE_RTT == m_State)
+      m_dCWndSize = BBR_MIN_CWND;
+   else
+   {
+      m_dCWndSize = getBDP() * m_dCWndGain;
+      if (m_dCWndSize < 16)
+         m_dCWndSize = 16;
+   }
+
+   if (m_dCWndSize > m_dMaxCWndSize)
+      m_dCWndSize = m_dMaxCWndSize;
+}
+
+//
+// scaling constant and multiplicative decrease of CUBIC
+static const double CUBIC_C = 0.4;
+static const double CUBIC_BETA = 0.7;
+
+CCubicCC::CCubicCC():
+m_iLastAck(),
+m_iLastDecSeq(),
+m_dSSThresh(),
+m_dLastMaxCWnd(),
+m_dOriginPoint(),
+m_dK(),
+m_dTCPCWnd(),
+m_EpochStart()
+{
+}
+
+void CCubicCC::init()
+{
+   m_iLastAck = m_iSndCurrSeqNo;
+   m_iLastDecSeq = CSeqNo::decseq(m_iLastAck);
+   m_dSSThresh = m_dMaxCWndSize;
+   m_dLastMaxCWnd = 0;
+   m_EpochStart = 0;
+
+   m_dCWndSize = 16;
+   setControl();
+}
+
+void CCubicCC::onACK(int32_t ack)
+{
+   int acked = CSeqNo::seqoff(m_iLastAck, ack);
+   if (acked <= 0)
+      return;
+   m_iLastAck = ack;
+
+   if (m_dCWndSize < m_dSSThresh)
+   {
+      // slow start
+      m_dCWndSize += acked;
+   }
+   else
+   {
+      uint64_t currtime = CTimer::getTime();
+
+      if (0 == m_EpochStart)
+      {
+         m_EpochStart = currtime;
+         if (m_dCWndSize < m_dLastMaxCWnd)
+         {
+            m_dK = pow((m_dLastMaxCWnd - m_dCWndSize) / CUBIC_C, 1.0 / 3);
+            m_dOriginPoint = m_dLastMaxCWnd;
+         }
+         else
+         {
+            m_dK = 0;
+            m_dOriginPoint = m_dCWndSize;
+         }
+         m_dTCPCWnd = m_dCWndSize;
+      }
+
+      // window the cubic function gives one RTT from now
+      double t = (currtime + m_iRTT - m_EpochStart) / 1000000.0 - m_dK;
+      double target = m_dOriginPoint + CUBIC_C * t * t * t;
+
+      // at most 1.5 times per RTT
+      double inc = (target > m_dCWndSize) ? (target - m_dCWndSize) / m_dCWndSize : 0.01 / m_dCWndSize;
+      if (inc > 0.5)
+         inc = 0.5;
+      m_dCWndSize += inc * acked;
+
+      // never slower than a standard TCP on the same path
+      m_dTCPCWnd += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * acked / m_dTCPCWnd;
+      if (m_dTCPCWnd > m_dCWndSize)
+         m_dCWndSize = m_dTCPCWnd;
+   }
+
+   setControl();
+}
+
+void CCubicCC::onLoss(const int32_t* losslist, int)
+{
+   // one decrease per congestion event, i.e. for losses of packets sent after the last decrease
+   if (CSeqNo::seqcmp(losslist[0] & 0x7FFFFFFF, m_iLastDecSeq) <= 0)
+      return;
+
+   m_EpochStart = 0;
+
+   // release bandwidth faster if the window was still below the last maximum
+   if (m_dCWndSize < m_dLastMaxCWnd)
+      m_dLastMaxCWnd = m_dCWndSize * (1 + CUBIC_BETA) / 2;
+   else
+      m_dLastMaxCWnd = m_dCWndSize;
+
+   m_dCWndSize *= CUBIC_BETA;
+   if (m_dCWndSize < 16)
+      m_dCWndSize = 16;
+   m_dSSThresh = m_dCWndSize;
+
+   m_iLastDecSeq = m_iSndCurrSeqNo;
+
+   setControl();
+}
+
+void CCubicCC::onTimeout()
+{
+   // the receiver does not repeat NAKs, so a timeout is how lost retransmissions
+   // are recovered, take it as a congestion event rather than restarting
+   int32_t losslist[1] = {CSeqNo::incseq(m_iLastDecSeq)};
+   if (CSeqNo::seqcmp(m_iSndCurrSeqNo, m_iLastDecSeq) > 0)
+      onLoss(losslist, 1);
+}
+
+void CCubicCC::setControl()
+{
+   if (m_dCWndSize > m_dMaxCWndSize)
+      m_dCWndSize = m_dMaxCWndSize;
+
+   // pace the window over an RTT, ahead of it so that the window stays the limit,
+   // ACKs come once per SYN interval
+   double gain = (m_dCWndSize < m_dSSThresh) ? 2 : 1.2;
+   m_dPktSndPeriod = (m_iRTT + m_iSYNInterval) / (m_dCWndSize * gain);
+}
@@ -275,4 +275,92 @@ private:
    int m_iDecCount;			// number of decreases in a congestion epoch
 };
 
+// Model based control in the manner of BBR: the bottleneck bandwidth and the
+// minimum RTT are tracked from ACKs, the sending period paces at the estimated
+// bandwidth and the window is kept around the bandwidth-delay product. Random
+// loss is not taken as a congestion signal, only rounds losing more than a few
+// percent end the probing for bandwidth.
+
+class CBBRCC: public CCC
+{
+public:
+   CBBRCC();
+
+public:
+   virtual void init();
+   virtual void onACK(int32_t);
+   virtual void onLoss(const int32_t*, int);
+   virtual void onPktSent(const CPacket*);
+
+private:
+   enum State {STARTUP, DRAIN, PROBE_BW, PROBE_RTT};
+
+   bool getSendTime(int32_t seqno, uint64_t& time) const;
+   void onRoundEnd(int32_t ack, uint64_t currtime);
+   void enterProbeBW(uint64_t currtime);
+   double getBDP() const;
+   int getFlightSize(int32_t ack) const;
+   void setControl();
+
+private:
+   static const int m_iBWRounds = 10;	// rounds the bandwidth estimation is the maximum of
+   static const int m_iSendMarks = 1024;	// sending times kept, one per 16 packets
+
+   State m_State;			// current phase
+   double m_dPacingGain;		// sending rate, relative to the estimated bandwidth
+   double m_dCWndGain;			// window size, relative to the bandwidth-delay product
+
+   double m_adRoundBW[m_iBWRounds];	// highest delivery rate of the last rounds, packets per second
+   double m_dBtlBw;			// estimated bottleneck bandwidth, packets per second
+   int m_iRound;			// number of rounds so far
+   int32_t m_iRoundEndSeq;		// the round ends when this seq no is acknowledged
+   int32_t m_iRoundStartAck;		// last ACK of the previous round
+   uint64_t m_RoundStartTime;		// when the round started
+   int m_iRoundLoss;			// number of packets reported lost in the round
+
+   int32_t m_aiMarkSeq[m_iSendMarks];	// seq no of the packets the sending time is kept for
+   uint64_t m_aMarkTime[m_iSendMarks];	// and their sending time
+   int32_t m_iLastMarkSeq;		// last seq no recorded
+
+   int m_iMinRTT;			// minimum RTT, microseconds
+   uint64_t m_MinRTTTime;		// when the minimum RTT was last lowered or confirmed
+
+   double m_dFullBW;			// bandwidth at the last significant increase in startup
+   int m_iFullBWRounds;			// rounds since then
+   bool m_bFullPipe;			// if the bandwidth has been reached
+
+   int m_iCycleIndex;			// phase in the gain cycle of PROBE_BW
+   uint64_t m_CycleTime;		// when the phase started
+   uint64_t m_ProbeRTTDone;		// when PROBE_RTT ends
+};
+
+// CUBIC window control: the window grows along a cubic function of the time
+// since the last decrease, centered on the window size at that decrease, and
+// the sending period spreads the window over an RTT.
+
+class CCubicCC: public CCC
+{
+public:
+   CCubicCC();
+
+public:
+   virtual void init();
+   virtual void onACK(int32_t);
+   virtual void onLoss(const int32_t*, int);
+   virtual void onTimeout();
+
+private:
+   void setControl();
+
+private:
+   int32_t m_iLastAck;			// last ACKed seq no
+   int32_t m_iLastDecSeq;		// max pkt seq no sent out when last decrease happened
+   double m_dSSThresh;			// slow start threshold, in packets
+   double m_dLastMaxCWnd;		// window size before the last decrease
+   double m_dOriginPoint;		// window size the cubic function is centered on
+   double m_dK;				// time to reach the origin point, in seconds
+   double m_dTCPCWnd;			// window size a standard TCP would have
+   uint64_t m_EpochStart;		// start of the current growth epoch, 0 if none
+};
+
 #endif
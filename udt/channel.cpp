@@ -55,6 +55,7 @@ written by
 #endif
 #include "channel.h"
 #include "packet.h"
+#include "common.h"
 
 #ifdef WIN32
    #define socklen_t int
@@ -179,6 +180,13 @@ void CChannel::setUDPSockOpt()
       if (0 != ::setsockopt(m_iSocket, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(timeval)))
          throw CUDTException(1, 3, NET_ERROR);
    #endif
+
+   #ifdef LINUX
+      // Packets received in one batch are timestamped by the kernel, the arrival time
+      // is what the receiving speed and bandwidth estimation is based on
+      int on = 1;
+      ::setsockopt(m_iSocket, SOL_SOCKET, SO_TIMESTAMP, (char *)&on, sizeof(int));
+   #endif
 }
 
 void CChannel::close() const
@@ -226,7 +234,7 @@ void CChannel::getPeerAddr(sockaddr* addr) const
    ::getpeername(m_iSocket, addr, &namelen);
 }
 
-int CChannel::sendto(const sockaddr* addr, CPacket& packet) const
+void CChannel::toNetworkOrder(CPacket& packet)
 {
    // convert control information into network order
    if (packet.getFlag())
@@ -242,6 +250,30 @@ int CChannel::sendto(const sockaddr* addr, CPacket& packet) const
       *p = htonl(*p);
       ++ p;
    }
+}
+
+void CChannel::toHostOrder(CPacket& packet)
+{
+   // convert back into local host order
+   //for (int k = 0; k < 4; ++ k)
+   //   packet.m_nHeader[k] = ntohl(packet.m_nHeader[k]);
+   uint32_t* p = packet.m_nHeader;
+   for (int k = 0; k < 4; ++ k)
+   {
+      *p = ntohl(*p);
+       ++ p;
+   }
+
+   if (packet.getFlag())
+   {
+      for (int l = 0, n = packet.getLength() / 4; l < n; ++ l)
+         *((uint32_t *)packet.m_pcData + l) = ntohl(*((uint32_t *)packet.m_pcData + l));
+   }
+}
+
+int CChannel::sendto(const sockaddr* addr, CPacket& packet) const
+{
+   toNetworkOrder(packet);
 
    #ifndef WIN32
       msghdr mh;
@@ -261,21 +293,7 @@ int CChannel::sendto(const sockaddr* addr, CPacket& packet) const
       res = (0 == res) ? size : -1;
    #endif
 
-   // convert back into local host order
-   //for (int k = 0; k < 4; ++ k)
-   //   packet.m_nHeader[k] = ntohl(packet.m_nHeader[k]);
-   p = packet.m_nHeader;
-   for (int k = 0; k < 4; ++ k)
-   {
-      *p = ntohl(*p);
-       ++ p;
-   }
-
-   if (packet.getFlag())
-   {
-      for (int l = 0, n = packet.getLength() / 4; l < n; ++ l)
-         *((uint32_t *)packet.m_pcData + l) = ntohl(*((uint32_t *)packet.m_pcData + l));
-   }
+   toHostOrder(packet);
 
    return res;
 }
@@ -319,22 +337,134 @@ int CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
    }
 
    packet.setLength(res - CPacket::m_iPktHdrSize);
+   packet.m_ullArrivalTime = CTimer::getTime();
 
-   // convert back into local host order
-   //for (int i = 0; i < 4; ++ i)
-   //   packet.m_nHeader[i] = ntohl(packet.m_nHeader[i]);
-   uint32_t* p = packet.m_nHeader;
-   for (int i = 0; i < 4; ++ i)
-   {
-      *p = ntohl(*p);
-      ++ p;
-   }
-
-   if (packet.getFlag())
-   {
-      for (int j = 0, n = packet.getLength() / 4; j < n; ++ j)
-         *((uint32_t *)packet.m_pcData + j) = ntohl(*((uint32_t *)packet.m_pcData + j));
-   }
+   toHostOrder(packet);
 
    return packet.getLength();
 }
+
+int CChannel::sendto(const sockaddr* const* addrs, CPacket* const* packets, int n) const
+{
+   #ifdef LINUX
+      mmsghdr mmh[UDT_CHANNEL_BATCH];
+
+      for (int i = 0; i < n; ++ i)
+      {
+         toNetworkOrder(*packets[i]);
+
+         msghdr& mh = mmh[i].msg_hdr;
+         mh.msg_name = (sockaddr*)addrs[i];
+         mh.msg_namelen = m_iSockAddrSize;
+         mh.msg_iov = (iovec*)packets[i]->m_PacketVector;
+         mh.msg_iovlen = 2;
+         mh.msg_control = NULL;
+         mh.msg_controllen = 0;
+         mh.msg_flags = 0;
+         mmh[i].msg_len = 0;
+      }
+
+      int sent = 0;
+      for (int i = 0; i < n; )
+      {
+         int res = ::sendmmsg(m_iSocket, mmh + i, n - i, 0);
+         if (res > 0)
+         {
+            sent += res;
+            i += res;
+         }
+         else
+         {
+            // skip the failed packet, as sendto() would drop it
+            ++ i;
+         }
+      }
+
+      for (int i = 0; i < n; ++ i)
+         toHostOrder(*packets[i]);
+
+      return sent;
+   #else
+      int sent = 0;
+      for (int i = 0; i < n; ++ i)
+      {
+         if (sendto(addrs[i], *packets[i]) >= 0)
+            ++ sent;
+      }
+
+      return sent;
+   #endif
+}
+
+int CChannel::recvfrom(sockaddr* const* addrs, CPacket* const* packets, int n) const
+{
+   #ifdef LINUX
+      mmsghdr mmh[UDT_CHANNEL_BATCH];
+      char control[UDT_CHANNEL_BATCH][CMSG_SPACE(sizeof(timeval))];
+
+      for (int i = 0; i < n; ++ i)
+      {
+         msghdr& mh = mmh[i].msg_hdr;
+         mh.msg_name = addrs[i];
+         mh.msg_namelen = m_iSockAddrSize;
+         mh.msg_iov = packets[i]->m_PacketVector;
+         mh.msg_iovlen = 2;
+         mh.msg_control = control[i];
+         mh.msg_controllen = sizeof(control[i]);
+         mh.msg_flags = 0;
+         mmh[i].msg_len = 0;
+      }
+
+      #ifdef UNIX
+         fd_set set;
+         timeval tv;
+         FD_ZERO(&set);
+         FD_SET(m_iSocket, &set);
+         tv.tv_sec = 0;
+         tv.tv_usec = 10000;
+         ::select(m_iSocket+1, &set, NULL, &set, &tv);
+      #endif
+
+      // wait for the first packet only, then take whatever else is queued
+      int res = ::recvmmsg(m_iSocket, mmh, n, MSG_WAITFORONE, NULL);
+      if (res <= 0)
+      {
+         packets[0]->setLength(-1);
+         return -1;
+      }
+
+      uint64_t currtime = CTimer::getTime();
+
+      for (int i = 0; i < res; ++ i)
+      {
+         if (mmh[i].msg_len <= 0)
+         {
+            packets[i]->setLength(-1);
+            continue;
+         }
+
+         packets[i]->setLength(mmh[i].msg_len - CPacket::m_iPktHdrSize);
+
+         // the kernel timestamp if there is one, all would look simultaneous otherwise
+         packets[i]->m_ullArrivalTime = currtime;
+         for (cmsghdr* cm = CMSG_FIRSTHDR(&mmh[i].msg_hdr); NULL != cm; cm = CMSG_NXTHDR(&mmh[i].msg_hdr, cm))
+         {
+            if ((SOL_SOCKET == cm->cmsg_level) && (SCM_TIMESTAMP == cm->cmsg_type))
+            {
+               timeval tv;
+               memcpy(&tv, CMSG_DATA(cm), sizeof(timeval));
+               packets[i]->m_ullArrivalTime = tv.tv_sec * 1000000ULL + tv.tv_usec;
+            }
+         }
+
+         toHostOrder(*packets[i]);
+      }
+
+      return res;
+   #else
+      if (recvfrom(addrs[0], *packets[0]) < 0)
+         return -1;
+
+      return 1;
+   #endif
+}
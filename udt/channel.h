@@ -45,6 +45,10 @@ written by
 #include "udt.h"
 #include "packet.h"
 
+// Largest number of packets sent or received in one system call.
+#ifndef UDT_CHANNEL_BATCH
+   #define UDT_CHANNEL_BATCH 32
+#endif
 
 class CChannel
 {
@@ -154,9 +158,34 @@ public:
 
    int recvfrom(sockaddr* addr, CPacket& packet) const;
 
+      // Functionality:
+      //    Send packets to the given addresses, in one system call where supported.
+      // Parameters:
+      //    0) [in] addrs: pointers to the destination addresses.
+      //    1) [in] packets: pointers to the CPacket entities.
+      //    2) [in] n: number of packets, at most UDT_CHANNEL_BATCH.
+      // Returned value:
+      //    Number of packets sent.
+
+   int sendto(const sockaddr* const* addrs, CPacket* const* packets, int n) const;
+
+      // Functionality:
+      //    Receive packets that have arrived, waiting for the first one as recvfrom() does.
+      // Parameters:
+      //    0) [in] addrs: pointers to the source addresses.
+      //    1) [in] packets: pointers to the CPacket entities.
+      //    2) [in] n: number of packets, at most UDT_CHANNEL_BATCH.
+      // Returned value:
+      //    Number of packets received, the ones with length -1 failed, or -1 if nothing has been received.
+
+   int recvfrom(sockaddr* const* addrs, CPacket* const* packets, int n) const;
+
 private:
    void setUDPSockOpt();
 
+   static void toNetworkOrder(CPacket& packet);
+   static void toHostOrder(CPacket& packet);
+
 private:
    int m_iIPversion;                    // IP version
    int m_iSockAddrSize;                 // socket address structure size (pre-defined to avoid run-time test)
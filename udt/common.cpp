@@ -58,6 +58,13 @@ written by
 #include "md5.h"
 #include "common.h"
 
+// Gaps up to this many microseconds are spun through in CTimer::sleepto(),
+// longer ones are slept through until this long before the deadline, as
+// waking up from a sleep is not more precise than that.
+#ifndef UDT_TIMER_SPIN_INTERVAL
+   #define UDT_TIMER_SPIN_INTERVAL 10
+#endif
+
 bool CTimer::m_bUseMicroSecond = false;
 uint64_t CTimer::s_ullCPUFrequency = CTimer::readCPUFrequency();
 #ifndef WIN32
@@ -75,7 +82,13 @@ m_TickLock()
 {
    #ifndef WIN32
       pthread_mutex_init(&m_TickLock, NULL);
-      pthread_cond_init(&m_TickCond, NULL);
+
+      // sleepto() waits against the monotonic clock
+      pthread_condattr_t attr;
+      pthread_condattr_init(&attr);
+      pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+      pthread_cond_init(&m_TickCond, &attr);
+      pthread_condattr_destroy(&attr);
    #else
       m_TickLock = CreateMutex(NULL, false, NULL);
       m_TickCond = CreateEvent(NULL, false, false, NULL);
@@ -190,35 +203,47 @@ void CTimer::sleepto(uint64_t nexttime)
 
    while (t < m_ullSchedTime)
    {
+      uint64_t left = (m_ullSchedTime - t) / s_ullCPUFrequency;
+
       #ifndef NO_BUSY_WAITING
-         #ifdef IA32
-            __asm__ volatile ("pause; rep; nop; nop; nop; nop; nop;");
-         #elif IA64
-            __asm__ volatile ("nop 0; nop 0; nop 0; nop 0; nop 0;");
-         #elif AMD64
-            __asm__ volatile ("nop; nop; nop; nop; nop;");
-         #endif
-      #else
-         #ifndef WIN32
-            timeval now;
-            timespec timeout;
-            gettimeofday(&now, 0);
-            if (now.tv_usec < 990000)
-            {
-               timeout.tv_sec = now.tv_sec;
-               timeout.tv_nsec = (now.tv_usec + 10000) * 1000;
-            }
-            else
-            {
-               timeout.tv_sec = now.tv_sec + 1;
-               timeout.tv_nsec = (now.tv_usec + 10000 - 1000000) * 1000;
-            }
-            pthread_mutex_lock(&m_TickLock);
+         // spin through short gaps only
+         if (left <= UDT_TIMER_SPIN_INTERVAL)
+         {
+            #ifdef IA32
+               __asm__ volatile ("pause; rep; nop; nop; nop; nop; nop;");
+            #elif IA64
+               __asm__ volatile ("nop 0; nop 0; nop 0; nop 0; nop 0;");
+            #elif AMD64
+               __asm__ volatile ("nop; nop; nop; nop; nop;");
+            #endif
+
+            rdtsc(t);
+            continue;
+         }
+
+         left -= UDT_TIMER_SPIN_INTERVAL;
+      #endif
+
+      #ifndef WIN32
+         timespec timeout;
+         clock_gettime(CLOCK_MONOTONIC, &timeout);
+         timeout.tv_sec += left / 1000000;
+         timeout.tv_nsec += (left % 1000000) * 1000;
+         if (timeout.tv_nsec >= 1000000000)
+         {
+            timeout.tv_sec ++;
+            timeout.tv_nsec -= 1000000000;
+         }
+
+         // check the time again under the lock, interrupt() moves the
+         // deadline and signals under it
+         pthread_mutex_lock(&m_TickLock);
+         rdtsc(t);
+         if (t < m_ullSchedTime)
             pthread_cond_timedwait(&m_TickCond, &m_TickLock, &timeout);
-            pthread_mutex_unlock(&m_TickLock);
-         #else
-            WaitForSingleObject(m_TickCond, 1);
-         #endif
+         pthread_mutex_unlock(&m_TickLock);
+      #else
+         WaitForSingleObject(m_TickCond, (DWORD)(left / 1000) + 1);
       #endif
 
       rdtsc(t);
@@ -228,8 +253,15 @@ void CTimer::sleepto(uint64_t nexttime)
 void CTimer::interrupt()
 {
    // schedule the sleepto time to the current CCs, so that it will stop
-   rdtsc(m_ullSchedTime);
-   tick();
+   #ifndef WIN32
+      pthread_mutex_lock(&m_TickLock);
+      rdtsc(m_ullSchedTime);
+      pthread_cond_signal(&m_TickCond);
+      pthread_mutex_unlock(&m_TickLock);
+   #else
+      rdtsc(m_ullSchedTime);
+      tick();
+   #endif
 }
 
 void CTimer::tick()
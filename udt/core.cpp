@@ -77,6 +77,7 @@ const int32_t CMsgNo::m_iMaxMsgNo = 0x1FFFFFFF;
 const int CUDT::m_iVersion = 4;
 const int CUDT::m_iSYNInterval = 10000;
 const int CUDT::m_iSelfClockInterval = 64;
+const int CUDT::m_iMinBufLimit = 256;
 
 
 CUDT::CUDT()
@@ -452,7 +453,7 @@ void CUDT::getOpt(UDTOpt optName, void* optval, int& optlen)
       {
          if (m_pRcvBuffer && (m_pRcvBuffer->getRcvDataSize() > 0))
             event |= UDT_EPOLL_IN;
-         if (m_pSndBuffer && (m_iSndBufSize > m_pSndBuffer->getCurrBufSize()))
+         if (m_pSndBuffer && (m_iSndBufLimit > m_pSndBuffer->getCurrBufSize()))
             event |= UDT_EPOLL_OUT;
       }
       *(int32_t*)optval = event;
@@ -542,6 +543,11 @@ void CUDT::open()
    m_ullTargetTime = 0;
    m_ullTimeDiff = 0;
 
+   m_ullNextShrinkTime = currtime + 1000000 * m_ullCPUFrequency;
+   m_iShrinkSndSeqNo = -1;
+   m_iShrinkRcvSeqNo = -1;
+   m_bSndShrink = false;
+
    // Now UDT is opened.
    m_bOpened = true;
 }
@@ -771,6 +777,9 @@ POST_CONNECT:
       throw CUDTException(3, 2, 0);
    }
 
+   m_iSndBufLimit = getBufLimit(0, m_iSndBufSize);
+   m_iRcvBufLimit = getBufLimit(0, m_iRcvBufSize);
+
    CInfoBlock ib;
    ib.m_iIPversion = m_iIPversion;
    CInfoBlock::convert(m_pPeerAddr, m_iIPversion, ib.m_piIP);
@@ -869,6 +878,9 @@ void CUDT::connect(const sockaddr* peer, CHandShake* hs)
       throw CUDTException(3, 2, 0);
    }
 
+   m_iSndBufLimit = getBufLimit(0, m_iSndBufSize);
+   m_iRcvBufLimit = getBufLimit(0, m_iRcvBufSize);
+
    CInfoBlock ib;
    ib.m_iIPversion = m_iIPversion;
    CInfoBlock::convert(peer, m_iIPversion, ib.m_piIP);
@@ -1034,10 +1046,14 @@ int CUDT::send(const char* data, int len)
       m_ullLastRspTime = currtime;
    }
 
-   if (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize())
+   if (m_iSndBufLimit <= m_pSndBuffer->getCurrBufSize())
    {
       if (!m_bSynSending)
+      {
+         // every ACK signals writing, but the limit may have come down below what is still buffered
+         s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_OUT, false);
          throw CUDTException(6, 1, 0);
+      }
       else
       {
          // wait here during a blocking sending
@@ -1045,7 +1061,7 @@ int CUDT::send(const char* data, int len)
             pthread_mutex_lock(&m_SendBlockLock);
             if (m_iSndTimeOut < 0) 
             { 
-               while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth)
+               while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufLimit <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth)
                   pthread_cond_wait(&m_SendBlockCond, &m_SendBlockLock);
             }
             else
@@ -1056,21 +1072,21 @@ int CUDT::send(const char* data, int len)
                locktime.tv_sec = exptime / 1000000;
                locktime.tv_nsec = (exptime % 1000000) * 1000;
 
-               while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth && (CTimer::getTime() < exptime))
+               while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufLimit <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth && (CTimer::getTime() < exptime))
                   pthread_cond_timedwait(&m_SendBlockCond, &m_SendBlockLock, &locktime);
             }
             pthread_mutex_unlock(&m_SendBlockLock);
          #else
             if (m_iSndTimeOut < 0)
             {
-               while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth)
+               while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufLimit <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth)
                   WaitForSingleObject(m_SendBlockCond, INFINITE);
             }
             else 
             {
                uint64_t exptime = CTimer::getTime() + m_iSndTimeOut * 1000ULL;
 
-               while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth && (CTimer::getTime() < exptime))
+               while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufLimit <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth && (CTimer::getTime() < exptime))
                   WaitForSingleObject(m_SendBlockCond, DWORD((exptime - CTimer::getTime()) / 1000)); 
             }
          #endif
@@ -1088,7 +1104,9 @@ int CUDT::send(const char* data, int len)
       }
    }
 
-   if (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize())
+   // the limit is moved by the ACK processing, read it once so the space checked is the space used
+   int avail = m_iSndBufLimit - m_pSndBuffer->getCurrBufSize();
+   if (avail <= 0)
    {
       if (m_iSndTimeOut >= 0)
          throw CUDTException(6, 3, 0); 
@@ -1096,7 +1114,7 @@ int CUDT::send(const char* data, int len)
       return 0;
    }
 
-   int size = (m_iSndBufSize - m_pSndBuffer->getCurrBufSize()) * m_iPayloadSize;
+   int size = avail * m_iPayloadSize;
    if (size > len)
       size = len;
 
@@ -1110,7 +1128,7 @@ int CUDT::send(const char* data, int len)
    // insert this socket to snd list if it is not on the list yet
    m_pSndQueue->m_pSndUList->update(this, false);
 
-   if (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize())
+   if (m_iSndBufLimit <= m_pSndBuffer->getCurrBufSize())
    {
       // write is not available any more
       s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_OUT, false);
@@ -1457,11 +1475,11 @@ int64_t CUDT::sendfile(fstream& ifs, int64_t& offset, int64_t size, int block)
 
       #ifndef WIN32
          pthread_mutex_lock(&m_SendBlockLock);
-         while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth)
+         while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufLimit <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth)
             pthread_cond_wait(&m_SendBlockCond, &m_SendBlockLock);
          pthread_mutex_unlock(&m_SendBlockLock);
       #else
-         while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth)
+         while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufLimit <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth)
             WaitForSingleObject(m_SendBlockCond, INFINITE);
       #endif
 
@@ -1492,7 +1510,7 @@ int64_t CUDT::sendfile(fstream& ifs, int64_t& offset, int64_t size, int block)
       m_pSndQueue->m_pSndUList->update(this, false);
    }
 
-   if (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize())
+   if (m_iSndBufLimit <= m_pSndBuffer->getCurrBufSize())
    {
       // write is not available any more
       s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_OUT, false);
@@ -1626,7 +1644,8 @@ void CUDT::sample(CPerfMon* perf, bool clear)
       if (WAIT_OBJECT_0 == WaitForSingleObject(m_ConnectionLock, 0))
    #endif
    {
-      perf->byteAvailSndBuf = (NULL == m_pSndBuffer) ? 0 : (m_iSndBufSize - m_pSndBuffer->getCurrBufSize()) * m_iMSS;
+      int sndavail = (NULL == m_pSndBuffer) ? 0 : m_iSndBufLimit - m_pSndBuffer->getCurrBufSize();
+      perf->byteAvailSndBuf = (sndavail > 0) ? sndavail * m_iMSS : 0;
       perf->byteAvailRcvBuf = (NULL == m_pRcvBuffer) ? 0 : m_pRcvBuffer->getAvailBufSize() * m_iMSS;
 
       #ifndef WIN32
@@ -1809,6 +1828,9 @@ void CUDT::sendCtrl(int pkttype, void* lparam, void* rparam, int size)
          data[1] = m_iRTT;
          data[2] = m_iRTTVar;
          data[3] = m_pRcvBuffer->getAvailBufSize();
+         // unread data counts against the window limit, so that a slow reader does not pile up the whole buffer
+         if (data[3] > m_iRcvBufLimit - m_pRcvBuffer->getRcvDataSize())
+            data[3] = m_iRcvBufLimit - m_pRcvBuffer->getRcvDataSize();
          // a minimum flow window of 2 is used, even if buffer is full, to break potential deadlock
          if (data[3] < 2)
             data[3] = 2;
@@ -1819,6 +1841,8 @@ void CUDT::sendCtrl(int pkttype, void* lparam, void* rparam, int size)
             data[5] = m_pRcvTimeWindow->getBandwidth();
             ctrlpkt.pack(pkttype, &m_iAckSeqNo, data, 24);
 
+            m_iRcvBufLimit = getBufLimit(data[4], m_iRcvBufSize);
+
             CTimer::rdtsc(m_ullLastAckTime);
          }
          else
@@ -2071,6 +2095,8 @@ void CUDT::processCtrl(CPacket& ctrlpkt)
 
          m_pCC->setRcvRate(m_iDeliveryRate);
          m_pCC->setBandwidth(m_iBandwidth);
+
+         m_iSndBufLimit = getBufLimit(m_iDeliveryRate, m_iSndBufSize);
       }
 
       m_pCC->onACK(ack);
@@ -2328,6 +2354,27 @@ int CUDT::packData(CPacket& packet, uint64_t& ts)
          }
          else
          {
+            // an idle sender gives its buffer back once everything is acknowledged, this thread
+            // is the only one that reads the buffer and the application must not be adding to it
+            if (m_bSndShrink && (0 == m_pSndBuffer->getCurrBufSize()))
+            {
+               #ifndef WIN32
+                  if (0 == pthread_mutex_trylock(&m_SendLock))
+                  {
+                     m_pSndBuffer->shrink();
+                     m_pSndLossList->shrink();
+                     pthread_mutex_unlock(&m_SendLock);
+                  }
+               #else
+                  if (WAIT_OBJECT_0 == WaitForSingleObject(m_SendLock, 0))
+                  {
+                     m_pSndBuffer->shrink();
+                     m_pSndLossList->shrink();
+                     ReleaseMutex(m_SendLock);
+                  }
+               #endif
+            }
+
             m_ullTargetTime = 0;
             m_ullTimeDiff = 0;
             ts = 0;
@@ -2361,20 +2408,17 @@ int CUDT::packData(CPacket& packet, uint64_t& ts)
    }
    else
    {
-      #ifndef NO_BUSY_WAITING
-         ts = entertime + m_ullInterval;
-      #else
-         if (m_ullTimeDiff >= m_ullInterval)
-         {
-            ts = entertime;
-            m_ullTimeDiff -= m_ullInterval;
-         }
-         else
-         {
-            ts = entertime + m_ullInterval - m_ullTimeDiff;
-            m_ullTimeDiff = 0;
-         }
-      #endif
+      // the sending thread sleeps in either case and may be late, catch up
+      if (m_ullTimeDiff >= m_ullInterval)
+      {
+         ts = entertime;
+         m_ullTimeDiff -= m_ullInterval;
+      }
+      else
+      {
+         ts = entertime + m_ullInterval - m_ullTimeDiff;
+         m_ullTimeDiff = 0;
+      }
    }
 
    m_ullTargetTime = ts;
@@ -2394,14 +2438,14 @@ int CUDT::processData(CUnit* unit)
 
    m_pCC->onPktReceived(&packet);
    ++ m_iPktCount;
-   // update time information
-   m_pRcvTimeWindow->onPktArrival();
+   // update time information, packets received in one batch carry their own arrival time
+   m_pRcvTimeWindow->onPktArrival(packet.m_ullArrivalTime);
 
    // check if it is probing packet pair
    if (0 == (packet.m_iSeqNo & 0xF))
-      m_pRcvTimeWindow->probe1Arrival();
+      m_pRcvTimeWindow->probe1Arrival(packet.m_ullArrivalTime);
    else if (1 == (packet.m_iSeqNo & 0xF))
-      m_pRcvTimeWindow->probe2Arrival();
+      m_pRcvTimeWindow->probe2Arrival(packet.m_ullArrivalTime);
 
    ++ m_llTraceRecv;
    ++ m_llRecvTotal;
@@ -2639,6 +2683,43 @@ void CUDT::checkTimers()
       // Reset last response time since we just sent a heart-beat.
       m_ullLastRspTime = currtime;
    }
+
+   if (currtime > m_ullNextShrinkTime)
+   {
+      // release the buffer memory of a direction that has not carried new data for a whole second
+      if (m_iRcvCurrSeqNo == m_iShrinkRcvSeqNo)
+      {
+         m_pRcvBuffer->shrink();
+         m_pRcvLossList->shrink();
+      }
+
+      if (m_iSndCurrSeqNo != m_iShrinkSndSeqNo)
+         m_bSndShrink = false;
+      else if (!m_bSndShrink && (0 == m_pSndBuffer->getCurrBufSize()))
+      {
+         // the sending thread does it
+         m_bSndShrink = true;
+         m_pSndQueue->m_pSndUList->update(this, false);
+      }
+
+      m_iShrinkRcvSeqNo = m_iRcvCurrSeqNo;
+      m_iShrinkSndSeqNo = m_iSndCurrSeqNo;
+      m_ullNextShrinkTime = currtime + 1000000 * m_ullCPUFrequency;
+   }
+}
+
+int CUDT::getBufLimit(int rate, int size) const
+{
+   // messages must fit into the buffers as a whole, so only streams are limited
+   if (UDT_STREAM != m_iSockType)
+      return size;
+
+   // a few bandwidth-delay products at the given rate (packets per second), with the ACK period counted in the delay
+   int64_t limit = int64_t(rate) * (m_iRTT + m_iSYNInterval) * 4 / 1000000;
+   if (limit < m_iMinBufLimit)
+      limit = m_iMinBufLimit;
+
+   return (limit < size) ? int(limit) : size;
 }
 
 void CUDT::addEPoll(const int eid)
@@ -2655,7 +2736,7 @@ void CUDT::addEPoll(const int eid)
    {
       s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_IN, true);
    }
-   if (m_iSndBufSize > m_pSndBuffer->getCurrBufSize())
+   if (m_iSndBufLimit > m_pSndBuffer->getCurrBufSize())
    {
       s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_OUT, true);
    }
@@ -103,6 +103,7 @@ public: //API
    static int epoll_remove_usock(const int eid, const UDTSOCKET u);
    static int epoll_remove_ssock(const int eid, const SYSSOCKET s);
    static int epoll_wait(const int eid, std::set<UDTSOCKET>* readfds, std::set<UDTSOCKET>* writefds, int64_t msTimeOut, std::set<SYSSOCKET>* lrfds = NULL, std::set<SYSSOCKET>* wrfds = NULL);
+   static int epoll_wait2(const int eid, UDTSOCKET* readfds, int* rnum, UDTSOCKET* writefds, int* wnum, int64_t msTimeOut, SYSSOCKET* lrfds = NULL, int* lrnum = NULL, SYSSOCKET* lwfds = NULL, int* lwnum = NULL);
    static int epoll_release(const int eid);
    static CUDTException& getlasterror();
    static int perfmon(UDTSOCKET u, CPerfMon* perf, bool clear = true);
@@ -337,6 +338,7 @@ private: // Sending related data
    uint64_t m_ullTimeDiff;                      // aggregate difference in inter-packet time
 
    volatile int m_iFlowWindowSize;              // Flow control window size
+   volatile int m_iSndBufLimit;                 // Sender buffer size in use, a few BDPs of the path up to m_iSndBufSize
    volatile double m_dCongestionWindow;         // congestion window size
 
    volatile int32_t m_iSndLastAck;              // Last ACK received
@@ -361,6 +363,7 @@ private: // Receiving related data
    int32_t m_iRcvLastAckAck;                    // Last sent ACK that has been acknowledged
    int32_t m_iAckSeqNo;                         // Last ACK sequence number
    int32_t m_iRcvCurrSeqNo;                     // Largest received sequence number
+   int m_iRcvBufLimit;                          // Largest flow window advertised, a few BDPs of the path up to m_iRcvBufSize
 
    uint64_t m_ullLastWarningTime;               // Last time that a warning message is sent
 
@@ -422,6 +425,7 @@ private: // Timers
 
    static const int m_iSYNInterval;             // Periodical Rate Control Interval, 10000 microsecond
    static const int m_iSelfClockInterval;       // ACK interval for self-clocking
+   static const int m_iMinBufLimit;             // Lower bound of the BDP derived buffer limits, in packets
 
    uint64_t m_ullNextACKTime;			// Next ACK time, in CPU clock cycles, same below
    uint64_t m_ullNextNAKTime;			// Next NAK time
@@ -439,7 +443,13 @@ private: // Timers
 
    uint64_t m_ullTargetTime;			// scheduled time of next packet sending
 
+   uint64_t m_ullNextShrinkTime;		// Next time to release the buffers of an idle direction
+   int32_t m_iShrinkSndSeqNo;			// m_iSndCurrSeqNo at the last check
+   int32_t m_iShrinkRcvSeqNo;			// m_iRcvCurrSeqNo at the last check
+   volatile bool m_bSndShrink;			// the sending side is idle, the sender buffer can be released once drained
+
    void checkTimers();
+   int getBufLimit(int rate, int size) const;
 
 private: // for UDP multiplexer
    CSndQueue* m_pSndQueue;			// packet sending queue
@@ -40,6 +40,8 @@ written by
 
 #ifdef LINUX
    #include <sys/epoll.h>
+   #include <sys/eventfd.h>
+   #include <poll.h>
    #include <unistd.h>
 #endif
 #include <algorithm>
@@ -69,11 +71,33 @@ int CEPoll::create()
    CGuard pg(m_EPollLock);
 
    int localid = 0;
+   int eventfd = -1;
 
    #ifdef LINUX
    localid = epoll_create(1024);
    if (localid < 0)
       throw CUDTException(-1, 0, errno);
+
+   // waiters sleep in the local epoll, UDT sockets getting ready wake them up through this
+   eventfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (eventfd < 0)
+   {
+      int err = errno;
+      ::close(localid);
+      throw CUDTException(-1, 0, err);
+   }
+
+   epoll_event ev;
+   memset(&ev, 0, sizeof(epoll_event));
+   ev.events = EPOLLIN;
+   ev.data.fd = eventfd;
+   if (::epoll_ctl(localid, EPOLL_CTL_ADD, eventfd, &ev) < 0)
+   {
+      int err = errno;
+      ::close(eventfd);
+      ::close(localid);
+      throw CUDTException(-1, 0, err);
+   }
    #else
    // on BSD, use kqueue
    // on Solaris, use /dev/poll
@@ -86,6 +110,8 @@ int CEPoll::create()
    CEPollDesc desc;
    desc.m_iID = m_iIDSeed;
    desc.m_iLocalID = localid;
+   desc.m_iEventFD = eventfd;
+   desc.m_bEventSignalled = false;
    m_mPolls[desc.m_iID] = desc;
 
    return desc.m_iID;
@@ -178,18 +204,115 @@ int CEPoll::remove_ssock(const int eid, const SYSSOCKET& s)
    return 0;
 }
 
+struct CEPollSink
+{
+   CEPollSink(bool read, bool write, bool lread, bool lwrite):
+   m_bRead(read), m_bWrite(write), m_bLocalRead(lread), m_bLocalWrite(lwrite) {}
+   virtual ~CEPollSink() {}
+
+   virtual void read(const UDTSOCKET& u) = 0;
+   virtual void write(const UDTSOCKET& u) = 0;
+   virtual void lread(const SYSSOCKET& s) = 0;
+   virtual void lwrite(const SYSSOCKET& s) = 0;
+
+   bool m_bRead;                             // which of the results are wanted
+   bool m_bWrite;
+   bool m_bLocalRead;
+   bool m_bLocalWrite;
+};
+
+namespace
+{
+
+struct CEPollSetSink: public CEPollSink
+{
+   CEPollSetSink(set<UDTSOCKET>* readfds, set<UDTSOCKET>* writefds, set<SYSSOCKET>* lrfds, set<SYSSOCKET>* lwfds):
+   CEPollSink(NULL != readfds, NULL != writefds, NULL != lrfds, NULL != lwfds),
+   m_pReadFDs(readfds), m_pWriteFDs(writefds), m_pLReadFDs(lrfds), m_pLWriteFDs(lwfds)
+   {
+      // Clear these sets in case the app forget to do it.
+      if (readfds) readfds->clear();
+      if (writefds) writefds->clear();
+      if (lrfds) lrfds->clear();
+      if (lwfds) lwfds->clear();
+   }
+
+   virtual void read(const UDTSOCKET& u) {m_pReadFDs->insert(u);}
+   virtual void write(const UDTSOCKET& u) {m_pWriteFDs->insert(u);}
+   virtual void lread(const SYSSOCKET& s) {m_pLReadFDs->insert(s);}
+   virtual void lwrite(const SYSSOCKET& s) {m_pLWriteFDs->insert(s);}
+
+   set<UDTSOCKET>* m_pReadFDs;
+   set<UDTSOCKET>* m_pWriteFDs;
+   set<SYSSOCKET>* m_pLReadFDs;
+   set<SYSSOCKET>* m_pLWriteFDs;
+};
+
+template <class T>
+struct CEPollArray
+{
+   CEPollArray(T* fds, int* num): m_pFDs(fds), m_piNum(num), m_iSize(0)
+   {
+      if ((NULL == fds) || (NULL == num))
+         m_pFDs = NULL;
+      else
+      {
+         m_iSize = *num;
+         *num = 0;
+      }
+   }
+
+   void add(const T& fd)
+   {
+      // sockets beyond the size of the array are only counted
+      if (*m_piNum < m_iSize)
+         m_pFDs[(*m_piNum) ++] = fd;
+   }
+
+   T* m_pFDs;
+   int* m_piNum;
+   int m_iSize;
+};
+
+struct CEPollArraySink: public CEPollSink
+{
+   CEPollArraySink(UDTSOCKET* readfds, int* rnum, UDTSOCKET* writefds, int* wnum, SYSSOCKET* lrfds, int* lrnum, SYSSOCKET* lwfds, int* lwnum):
+   CEPollSink((NULL != readfds) && (NULL != rnum), (NULL != writefds) && (NULL != wnum), (NULL != lrfds) && (NULL != lrnum), (NULL != lwfds) && (NULL != lwnum)),
+   m_Read(readfds, rnum), m_Write(writefds, wnum), m_LRead(lrfds, lrnum), m_LWrite(lwfds, lwnum) {}
+
+   virtual void read(const UDTSOCKET& u) {m_Read.add(u);}
+   virtual void write(const UDTSOCKET& u) {m_Write.add(u);}
+   virtual void lread(const SYSSOCKET& s) {m_LRead.add(s);}
+   virtual void lwrite(const SYSSOCKET& s) {m_LWrite.add(s);}
+
+   CEPollArray<UDTSOCKET> m_Read;
+   CEPollArray<UDTSOCKET> m_Write;
+   CEPollArray<SYSSOCKET> m_LRead;
+   CEPollArray<SYSSOCKET> m_LWrite;
+};
+
+}  // namespace
+
 int CEPoll::wait(const int eid, set<UDTSOCKET>* readfds, set<UDTSOCKET>* writefds, int64_t msTimeOut, set<SYSSOCKET>* lrfds, set<SYSSOCKET>* lwfds)
+{
+   CEPollSetSink sink(readfds, writefds, lrfds, lwfds);
+
+   return wait(eid, msTimeOut, sink);
+}
+
+int CEPoll::wait(const int eid, UDTSOCKET* readfds, int* rnum, UDTSOCKET* writefds, int* wnum, int64_t msTimeOut, SYSSOCKET* lrfds, int* lrnum, SYSSOCKET* lwfds, int* lwnum)
+{
+   CEPollArraySink sink(readfds, rnum, writefds, wnum, lrfds, lrnum, lwfds, lwnum);
+
+   return wait(eid, msTimeOut, sink);
+}
+
+int CEPoll::wait(const int eid, int64_t msTimeOut, CEPollSink& sink)
 {
    // if all fields is NULL and waiting time is infinite, then this would be a deadlock
-   if (!readfds && !writefds && !lrfds && lwfds && (msTimeOut < 0))
+   if (!sink.m_bRead && !sink.m_bWrite && !sink.m_bLocalRead && !sink.m_bLocalWrite && (msTimeOut < 0))
       throw CUDTException(5, 3, 0);
 
-   // Clear these sets in case the app forget to do it.
-   if (readfds) readfds->clear();
-   if (writefds) writefds->clear();
-   if (lrfds) lrfds->clear();
-   if (lwfds) lwfds->clear();
-
    int total = 0;
 
    int64_t entertime = CTimer::getTime();
@@ -204,54 +327,82 @@ int CEPoll::wait(const int eid, set<UDTSOCKET>* readfds, set<UDTSOCKET>* writefd
          throw CUDTException(5, 13);
       }
 
-      if (p->second.m_sUDTSocksIn.empty() && p->second.m_sUDTSocksOut.empty() && p->second.m_sLocals.empty() && (msTimeOut < 0))
+      CEPollDesc& d = p->second;
+
+      if (d.m_sUDTSocksIn.empty() && d.m_sUDTSocksOut.empty() && d.m_sLocals.empty() && (msTimeOut < 0))
       {
          // no socket is being monitored, this may be a deadlock
          CGuard::leaveCS(m_EPollLock);
          throw CUDTException(5, 3);
       }
 
+      #ifdef LINUX
+      // consume the wakeup before looking at the sockets, any socket getting
+      // ready from now on signals the eventfd again
+      if (d.m_bEventSignalled)
+      {
+         uint64_t value;
+         ::read(d.m_iEventFD, &value, sizeof(value));
+         d.m_bEventSignalled = false;
+      }
+      #endif
+
       // Sockets with exceptions are returned to both read and write sets.
-      if ((NULL != readfds) && (!p->second.m_sUDTReads.empty() || !p->second.m_sUDTExcepts.empty()))
+      if (sink.m_bRead)
       {
-         *readfds = p->second.m_sUDTReads;
-         for (set<UDTSOCKET>::const_iterator i = p->second.m_sUDTExcepts.begin(); i != p->second.m_sUDTExcepts.end(); ++ i) {
-            if (p->second.m_sUDTSocksIn.count(*i) > 0) {
-               readfds->insert(*i);
-               ++total;
+         for (set<UDTSOCKET>::const_iterator i = d.m_sUDTReads.begin(); i != d.m_sUDTReads.end(); ++ i)
+         {
+            sink.read(*i);
+            ++ total;
+         }
+         for (set<UDTSOCKET>::const_iterator i = d.m_sUDTExcepts.begin(); i != d.m_sUDTExcepts.end(); ++ i)
+         {
+            if ((d.m_sUDTSocksIn.count(*i) > 0) && (d.m_sUDTReads.count(*i) == 0))
+            {
+               sink.read(*i);
+               ++ total;
             }
          }
-         total += p->second.m_sUDTReads.size();
       }
-      if ((NULL != writefds) && (!p->second.m_sUDTWrites.empty() || !p->second.m_sUDTExcepts.empty()))
+      if (sink.m_bWrite)
       {
-         *writefds = p->second.m_sUDTWrites;
-         for (set<UDTSOCKET>::const_iterator i = p->second.m_sUDTExcepts.begin(); i != p->second.m_sUDTExcepts.end(); ++ i) {
-            if (p->second.m_sUDTSocksOut.count(*i) > 0) {
-               writefds->insert(*i);
-               ++total;
+         for (set<UDTSOCKET>::const_iterator i = d.m_sUDTWrites.begin(); i != d.m_sUDTWrites.end(); ++ i)
+         {
+            sink.write(*i);
+            ++ total;
+         }
+         for (set<UDTSOCKET>::const_iterator i = d.m_sUDTExcepts.begin(); i != d.m_sUDTExcepts.end(); ++ i)
+         {
+            if ((d.m_sUDTSocksOut.count(*i) > 0) && (d.m_sUDTWrites.count(*i) == 0))
+            {
+               sink.write(*i);
+               ++ total;
             }
          }
-         total += p->second.m_sUDTWrites.size();
       }
 
-      if (lrfds || lwfds)
+      bool locals = (sink.m_bLocalRead || sink.m_bLocalWrite) && !d.m_sLocals.empty();
+
+      if (locals)
       {
          #ifdef LINUX
-         const int max_events = p->second.m_sLocals.size();
+         const int max_events = d.m_sLocals.size() + 1;
          epoll_event ev[max_events];
-         int nfds = ::epoll_wait(p->second.m_iLocalID, ev, max_events, 0);
+         int nfds = ::epoll_wait(d.m_iLocalID, ev, max_events, 0);
 
          for (int i = 0; i < nfds; ++ i)
          {
-            if ((NULL != lrfds) && (ev[i].events & EPOLLIN))
-           {
-               lrfds->insert(ev[i].data.fd);
+            if (ev[i].data.fd == d.m_iEventFD)
+               continue;
+
+            if (sink.m_bLocalRead && (ev[i].events & EPOLLIN))
+            {
+               sink.lread(ev[i].data.fd);
                ++ total;
             }
-            if ((NULL != lwfds) && (ev[i].events & EPOLLOUT))
+            if (sink.m_bLocalWrite && (ev[i].events & EPOLLOUT))
             {
-               lwfds->insert(ev[i].data.fd);
+               sink.lwrite(ev[i].data.fd);
                ++ total;
             }
          }
@@ -266,11 +417,11 @@ int CEPoll::wait(const int eid, set<UDTSOCKET>* readfds, set<UDTSOCKET>* writefd
          FD_ZERO(&readfds);
          FD_ZERO(&writefds);
 
-         for (set<SYSSOCKET>::const_iterator i = p->second.m_sLocals.begin(); i != p->second.m_sLocals.end(); ++ i)
+         for (set<SYSSOCKET>::const_iterator i = d.m_sLocals.begin(); i != d.m_sLocals.end(); ++ i)
          {
-            if (lrfds)
+            if (sink.m_bLocalRead)
                FD_SET(*i, &readfds);
-            if (lwfds)
+            if (sink.m_bLocalWrite)
                FD_SET(*i, &writefds);
          }
 
@@ -279,16 +430,16 @@ int CEPoll::wait(const int eid, set<UDTSOCKET>* readfds, set<UDTSOCKET>* writefd
          tv.tv_usec = 0;
          if (::select(0, &readfds, &writefds, NULL, &tv) > 0)
          {
-            for (set<SYSSOCKET>::const_iterator i = p->second.m_sLocals.begin(); i != p->second.m_sLocals.end(); ++ i)
+            for (set<SYSSOCKET>::const_iterator i = d.m_sLocals.begin(); i != d.m_sLocals.end(); ++ i)
             {
-               if (lrfds && FD_ISSET(*i, &readfds))
+               if (sink.m_bLocalRead && FD_ISSET(*i, &readfds))
                {
-                  lrfds->insert(*i);
+                  sink.lread(*i);
                   ++ total;
                }
-               if (lwfds && FD_ISSET(*i, &writefds))
+               if (sink.m_bLocalWrite && FD_ISSET(*i, &writefds))
                {
-                  lwfds->insert(*i);
+                  sink.lwrite(*i);
                   ++ total;
                }
             }
@@ -296,15 +447,43 @@ int CEPoll::wait(const int eid, set<UDTSOCKET>* readfds, set<UDTSOCKET>* writefd
          #endif
       }
 
+      #ifdef LINUX
+      int localid = d.m_iLocalID;
+      int eventfd = d.m_iEventFD;
+      #endif
+
       CGuard::leaveCS(m_EPollLock);
 
       if (total > 0)
          return total;
 
-      if ((msTimeOut >= 0) && (int64_t(CTimer::getTime() - entertime) >= msTimeOut * 1000LL))
-         throw CUDTException(6, 3, 0);
+      int timeout = -1;
+      if (msTimeOut >= 0)
+      {
+         int64_t left = msTimeOut * 1000LL - int64_t(CTimer::getTime() - entertime);
+         if (left <= 0)
+            throw CUDTException(6, 3, 0);
+         timeout = (left < 1000000000LL) ? int((left + 999) / 1000) : 1000000;
+      }
 
+      #ifdef LINUX
+      // sleep until a UDT socket gets ready, or a system one if those are waited for
+      if (locals)
+      {
+         epoll_event ev;
+         ::epoll_wait(localid, &ev, 1, timeout);
+      }
+      else
+      {
+         pollfd pfd;
+         pfd.fd = eventfd;
+         pfd.events = POLLIN;
+         pfd.revents = 0;
+         ::poll(&pfd, 1, timeout);
+      }
+      #else
       CTimer::waitForEvent();
+      #endif
    }
 
    return 0;
@@ -320,6 +499,7 @@ int CEPoll::release(const int eid)
 
    #ifdef LINUX
    // release local/system epoll descriptor
+   ::close(i->second.m_iEventFD);
    ::close(i->second.m_iLocalID);
    #endif
 
@@ -331,16 +511,18 @@ int CEPoll::release(const int eid)
 namespace
 {
 
-void update_epoll_sets(const UDTSOCKET& uid, const set<UDTSOCKET>& watch, set<UDTSOCKET>& result, bool enable)
+bool update_epoll_sets(const UDTSOCKET& uid, const set<UDTSOCKET>& watch, set<UDTSOCKET>& result, bool enable)
 {
    if (enable && (watch.find(uid) != watch.end()))
    {
-      result.insert(uid);
+      return result.insert(uid).second;
    }
    else if (!enable)
    {
       result.erase(uid);
    }
+
+   return false;
 }
 
 }  // namespace
@@ -361,12 +543,23 @@ int CEPoll::update_events(const UDTSOCKET& uid, std::set<int>& eids, int events,
       }
       else
       {
+         bool ready = false;
          if ((events & UDT_EPOLL_IN) != 0)
-            update_epoll_sets(uid, p->second.m_sUDTSocksIn, p->second.m_sUDTReads, enable);
+            ready |= update_epoll_sets(uid, p->second.m_sUDTSocksIn, p->second.m_sUDTReads, enable);
          if ((events & UDT_EPOLL_OUT) != 0)
-            update_epoll_sets(uid, p->second.m_sUDTSocksOut, p->second.m_sUDTWrites, enable);
+            ready |= update_epoll_sets(uid, p->second.m_sUDTSocksOut, p->second.m_sUDTWrites, enable);
          if ((events & UDT_EPOLL_ERR) != 0)
-            update_epoll_sets(uid, p->second.m_sUDTSocksEx, p->second.m_sUDTExcepts, enable);
+            ready |= update_epoll_sets(uid, p->second.m_sUDTSocksEx, p->second.m_sUDTExcepts, enable);
+
+         #ifdef LINUX
+         // wake up the waiter, once until it looks at the sockets again
+         if (ready && !p->second.m_bEventSignalled)
+         {
+            uint64_t value = 1;
+            ::write(p->second.m_iEventFD, &value, sizeof(value));
+            p->second.m_bEventSignalled = true;
+         }
+         #endif
       }
    }
 
@@ -55,6 +55,8 @@ struct CEPollDesc
    std::set<UDTSOCKET> m_sUDTSocksEx;        // set of UDT sockets waiting for exceptions
 
    int m_iLocalID;                           // local system epoll ID
+   int m_iEventFD;                           // eventfd in the local epoll, signalled when a UDT socket gets ready
+   bool m_bEventSignalled;                   // if the eventfd has been written since the last wait
    std::set<SYSSOCKET> m_sLocals;            // set of local (non-UDT) descriptors
 
    std::set<UDTSOCKET> m_sUDTWrites;         // UDT sockets ready for write
@@ -62,6 +64,8 @@ struct CEPollDesc
    std::set<UDTSOCKET> m_sUDTExcepts;        // UDT sockets with exceptions (connection broken, etc.)
 };
 
+struct CEPollSink;
+
 class CEPoll
 {
 friend class CUDT;
@@ -138,6 +142,24 @@ public: // for CUDTUnited API
 
    int wait(const int eid, std::set<UDTSOCKET>* readfds, std::set<UDTSOCKET>* writefds, int64_t msTimeOut, std::set<SYSSOCKET>* lrfds, std::set<SYSSOCKET>* lwfds);
 
+      // Functionality:
+      //    wait for EPoll events or timeout, returning the ready sockets in arrays.
+      // Parameters:
+      //    0) [in] eid: EPoll ID.
+      //    1) [out] readfds: UDT sockets available for reading.
+      //    2) [in, out] rnum: size of readfds, number of sockets returned in it.
+      //    3) [out] writefds: UDT sockets available for writing.
+      //    4) [in, out] wnum: size of writefds, number of sockets returned in it.
+      //    5) [in] msTimeOut: timeout threshold, in milliseconds.
+      //    6) [out] lrfds: system file descriptors for reading.
+      //    7) [in, out] lrnum: size of lrfds, number of descriptors returned in it.
+      //    8) [out] lwfds: system file descriptors for writing.
+      //    9) [in, out] lwnum: size of lwfds, number of descriptors returned in it.
+      // Returned value:
+      //    number of sockets available for IO, which may be more than returned.
+
+   int wait(const int eid, UDTSOCKET* readfds, int* rnum, UDTSOCKET* writefds, int* wnum, int64_t msTimeOut, SYSSOCKET* lrfds, int* lrnum, SYSSOCKET* lwfds, int* lwnum);
+
       // Functionality:
       //    close and release an EPoll.
       // Parameters:
@@ -161,6 +183,9 @@ public: // for CUDT to acknowledge IO status
 
    int update_events(const UDTSOCKET& uid, std::set<int>& eids, int events, bool enable);
 
+private:
+   int wait(const int eid, int64_t msTimeOut, CEPollSink& sink);
+
 private:
    int m_iIDSeed;                            // seed to generate a new ID
    pthread_mutex_t m_SeedLock;
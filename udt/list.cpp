@@ -40,26 +40,30 @@ written by
 
 #include "list.h"
 
+// loss lists start this small and grow with the window they have to cover
+static const int g_iInitLossListSize = 128;
+
+static int getGrowSize(int size, int maxsize, int span)
+{
+   // double until the span fits, stop at the configured size unless the span is even larger
+   while (size < span)
+      size *= 2;
+
+   return ((size > maxsize) && (maxsize >= span)) ? maxsize : size;
+}
+
 CSndLossList::CSndLossList(int size):
 m_piData1(NULL),
 m_piData2(NULL),
 m_piNext(NULL),
 m_iHead(-1),
 m_iLength(0),
-m_iSize(size),
+m_iSize(0),
+m_iMaxSize(size),
 m_iLastInsertPos(-1),
 m_ListLock()
 {
-   m_piData1 = new int32_t [m_iSize];
-   m_piData2 = new int32_t [m_iSize];
-   m_piNext = new int [m_iSize];
-
-   // -1 means there is no data in the node
-   for (int i = 0; i < size; ++ i)
-   {
-      m_piData1[i] = -1;
-      m_piData2[i] = -1;
-   }
+   resize(((size > 0) && (size < g_iInitLossListSize)) ? size : g_iInitLossListSize);
 
    // sender list needs mutex protection
    #ifndef WIN32
@@ -90,6 +94,9 @@ int CSndLossList::insert(int32_t seqno1, int32_t seqno2)
    {
       // insert data into an empty list
 
+      if (CSeqNo::seqlen(seqno1, seqno2) > m_iSize)
+         resize(getGrowSize(m_iSize, m_iMaxSize, CSeqNo::seqlen(seqno1, seqno2)));
+
       m_iHead = 0;
       m_piData1[m_iHead] = seqno1;
       if (seqno2 != seqno1)
@@ -103,9 +110,21 @@ int CSndLossList::insert(int32_t seqno1, int32_t seqno2)
       return m_iLength;
    }
 
+   // the array must cover the list from its head to the end of its last node
+   int offset = CSeqNo::seqoff(m_piData1[m_iHead], seqno1);
+   int span = CSeqNo::seqoff(m_piData1[m_iHead], seqno2) + 1;
+   if (offset < 0)
+   {
+      // the new node becomes the head
+      if (getSpan() > span)
+         span = getSpan();
+      span -= offset;
+   }
+   if (span > m_iSize)
+      resize(getGrowSize(m_iSize, m_iMaxSize, span));
+
    // otherwise find the position where the data can be inserted
    int origlen = m_iLength;
-   int offset = CSeqNo::seqoff(m_piData1[m_iHead], seqno1);
    int loc = (m_iHead + offset + m_iSize) % m_iSize;
 
    if (offset < 0)
@@ -417,6 +436,68 @@ int32_t CSndLossList::getLostSeq()
    return seqno;
 }
 
+void CSndLossList::shrink()
+{
+   CGuard listguard(m_ListLock);
+
+   if ((0 == m_iLength) && (m_iSize > g_iInitLossListSize))
+      resize(g_iInitLossListSize);
+}
+
+void CSndLossList::resize(int newsize)
+{
+   int32_t* data1 = new int32_t [newsize];
+   int32_t* data2 = new int32_t [newsize];
+   int* next = new int [newsize];
+
+   // -1 means there is no data in the node
+   for (int i = 0; i < newsize; ++ i)
+   {
+      data1[i] = -1;
+      data2[i] = -1;
+   }
+
+   // relocate the nodes relative to a head at position 0
+   int lastinsert = -1;
+   if (m_iLength > 0)
+   {
+      int prior = -1;
+      for (int i = m_iHead; -1 != i; i = m_piNext[i])
+      {
+         int loc = CSeqNo::seqoff(m_piData1[m_iHead], m_piData1[i]);
+         data1[loc] = m_piData1[i];
+         data2[loc] = m_piData2[i];
+         if (-1 != prior)
+            next[prior] = loc;
+         prior = loc;
+
+         if (i == m_iLastInsertPos)
+            lastinsert = loc;
+      }
+      next[prior] = -1;
+      m_iHead = 0;
+   }
+   m_iLastInsertPos = lastinsert;
+
+   delete [] m_piData1;
+   delete [] m_piData2;
+   delete [] m_piNext;
+
+   m_piData1 = data1;
+   m_piData2 = data2;
+   m_piNext = next;
+   m_iSize = newsize;
+}
+
+int CSndLossList::getSpan() const
+{
+   int i = m_iHead;
+   while (-1 != m_piNext[i])
+      i = m_piNext[i];
+
+   return CSeqNo::seqoff(m_piData1[m_iHead], (-1 == m_piData2[i]) ? m_piData1[i] : m_piData2[i]) + 1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 CRcvLossList::CRcvLossList(int size):
@@ -427,19 +508,10 @@ m_piPrior(NULL),
 m_iHead(-1),
 m_iTail(-1),
 m_iLength(0),
-m_iSize(size)
+m_iSize(0),
+m_iMaxSize(size)
 {
-   m_piData1 = new int32_t [m_iSize];
-   m_piData2 = new int32_t [m_iSize];
-   m_piNext = new int [m_iSize];
-   m_piPrior = new int [m_iSize];
-
-   // -1 means there is no data in the node
-   for (int i = 0; i < size; ++ i)
-   {
-      m_piData1[i] = -1;
-      m_piData2[i] = -1;
-   }
+   resize(((size > 0) && (size < g_iInitLossListSize)) ? size : g_iInitLossListSize);
 }
 
 CRcvLossList::~CRcvLossList()
@@ -458,6 +530,9 @@ void CRcvLossList::insert(int32_t seqno1, int32_t seqno2)
    if (0 == m_iLength)
    {
       // insert data into an empty list
+      if (CSeqNo::seqlen(seqno1, seqno2) > m_iSize)
+         resize(getGrowSize(m_iSize, m_iMaxSize, CSeqNo::seqlen(seqno1, seqno2)));
+
       m_iHead = 0;
       m_iTail = 0;
       m_piData1[m_iHead] = seqno1;
@@ -471,6 +546,11 @@ void CRcvLossList::insert(int32_t seqno1, int32_t seqno2)
       return;
    }
 
+   // the array must cover the list from its head to the end of the new node
+   int span = CSeqNo::seqoff(m_piData1[m_iHead], seqno2) + 1;
+   if (span > m_iSize)
+      resize(getGrowSize(m_iSize, m_iMaxSize, span));
+
    // otherwise searching for the position where the node should be
    int offset = CSeqNo::seqoff(m_piData1[m_iHead], seqno1);
    int loc = (m_iHead + offset) % m_iSize;
@@ -701,3 +781,54 @@ void CRcvLossList::getLossArray(int32_t* array, int& len, int limit)
       i = m_piNext[i];
    }
 }
+
+void CRcvLossList::shrink()
+{
+   if ((0 == m_iLength) && (m_iSize > g_iInitLossListSize))
+      resize(g_iInitLossListSize);
+}
+
+void CRcvLossList::resize(int newsize)
+{
+   int32_t* data1 = new int32_t [newsize];
+   int32_t* data2 = new int32_t [newsize];
+   int* next = new int [newsize];
+   int* prior = new int [newsize];
+
+   // -1 means there is no data in the node
+   for (int i = 0; i < newsize; ++ i)
+   {
+      data1[i] = -1;
+      data2[i] = -1;
+   }
+
+   // relocate the nodes relative to a head at position 0
+   if (m_iLength > 0)
+   {
+      int last = -1;
+      for (int i = m_iHead; -1 != i; i = m_piNext[i])
+      {
+         int loc = CSeqNo::seqoff(m_piData1[m_iHead], m_piData1[i]);
+         data1[loc] = m_piData1[i];
+         data2[loc] = m_piData2[i];
+         prior[loc] = last;
+         if (-1 != last)
+            next[last] = loc;
+         last = loc;
+      }
+      next[last] = -1;
+      m_iHead = 0;
+      m_iTail = last;
+   }
+
+   delete [] m_piData1;
+   delete [] m_piData2;
+   delete [] m_piNext;
+   delete [] m_piPrior;
+
+   m_piData1 = data1;
+   m_piData2 = data2;
+   m_piNext = next;
+   m_piPrior = prior;
+   m_iSize = newsize;
+}
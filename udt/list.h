@@ -89,6 +89,19 @@ public:
 
    int32_t getLostSeq();
 
+      // Functionality:
+      //    Release the memory of an empty list that has grown beyond its initial size.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    None.
+
+   void shrink();
+
+private:
+   void resize(int size);
+   int getSpan() const;
+
 private:
    int32_t* m_piData1;                  // sequence number starts
    int32_t* m_piData2;                  // seqnence number ends
@@ -97,6 +110,7 @@ private:
    int m_iHead;                         // first node
    int m_iLength;                       // loss length
    int m_iSize;                         // size of the static array
+   int m_iMaxSize;                      // size the array may grow to
    int m_iLastInsertPos;                // position of last insert node
 
    pthread_mutex_t m_ListLock;          // used to synchronize list operation
@@ -182,6 +196,18 @@ public:
 
    void getLossArray(int32_t* array, int& len, int limit);
 
+      // Functionality:
+      //    Release the memory of an empty list that has grown beyond its initial size.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    None.
+
+   void shrink();
+
+private:
+   void resize(int size);
+
 private:
    int32_t* m_piData1;                  // sequence number starts
    int32_t* m_piData2;                  // sequence number ends
@@ -192,6 +218,7 @@ private:
    int m_iTail;                         // last node in the list;
    int m_iLength;                       // loss length
    int m_iSize;                         // size of the static array
+   int m_iMaxSize;                      // size the array may grow to
 
 private:
    CRcvLossList(const CRcvLossList&);
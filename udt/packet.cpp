@@ -158,6 +158,7 @@ m_iMsgNo((int32_t&)(m_nHeader[1])),
 m_iTimeStamp((int32_t&)(m_nHeader[2])),
 m_iID((int32_t&)(m_nHeader[3])),
 m_pcData((char*&)(m_PacketVector[1].iov_base)),
+m_ullArrivalTime(0),
 __pad()
 {
    for (int i = 0; i < 4; ++ i)
@@ -350,6 +351,7 @@ CPacket* CPacket::clone() const
    pkt->m_pcData = new char[m_PacketVector[1].iov_len];
    memcpy(pkt->m_pcData, m_pcData, m_PacketVector[1].iov_len);
    pkt->m_PacketVector[1].iov_len = m_PacketVector[1].iov_len;
+   pkt->m_ullArrivalTime = m_ullArrivalTime;
 
    return pkt;
 }
@@ -67,6 +67,8 @@ public:
    int32_t& m_iID;			// alias: socket ID
    char*& m_pcData;                     // alias: data/control information
 
+   uint64_t m_ullArrivalTime;           // arrival time in microseconds, set by CChannel on receiving
+
    static const int m_iPktHdrSize;	// packet header size
 
 public:
@@ -53,6 +53,14 @@ written by
 
 using namespace std;
 
+// Without busy waiting, packets due sooner than this many microseconds after
+// the sending thread goes to sleep are sent in one batch when it wakes up, and
+// the sockets catch up with the time they fell behind (see CUDT::packData()).
+// Waking up for each of them costs more CPU than the sending itself.
+#ifndef UDT_SND_BATCH_INTERVAL
+   #define UDT_SND_BATCH_INTERVAL 1000
+#endif
+
 CUnitQueue::CUnitQueue():
 m_pQEntry(NULL),
 m_pCurrQueue(NULL),
@@ -187,8 +195,65 @@ int CUnitQueue::increase()
 
 int CUnitQueue::shrink()
 {
-   // currently queue cannot be shrunk.
-   return -1;
+   // adjust/correct m_iCount, as in increase()
+   int real_count = 0;
+   CQEntry* p = m_pQEntry;
+   do
+   {
+      CUnit* u = p->m_pUnit;
+      for (CUnit* end = u + p->m_iSize; u != end; ++ u)
+         if (u->m_iFlag != 0)
+            ++ real_count;
+
+      p = p->m_pNext;
+   } while (p != m_pQEntry);
+   m_iCount = real_count;
+
+   // release queues that hold no packet while the rest stays less than half full,
+   // the first queue is always kept
+   int released = 0;
+   CQEntry* prev = m_pQEntry;
+   p = m_pQEntry->m_pNext;
+   while ((p != m_pQEntry) && (m_iCount * 2 < m_iSize - p->m_iSize))
+   {
+      bool empty = true;
+      CUnit* u = p->m_pUnit;
+      for (CUnit* end = u + p->m_iSize; u != end; ++ u)
+      {
+         if (u->m_iFlag != 0)
+         {
+            empty = false;
+            break;
+         }
+      }
+
+      if (!empty)
+      {
+         prev = p;
+         p = p->m_pNext;
+         continue;
+      }
+
+      prev->m_pNext = p->m_pNext;
+      if (p == m_pLastQueue)
+         m_pLastQueue = prev;
+      if (p == m_pCurrQueue)
+      {
+         m_pCurrQueue = m_pQEntry;
+         m_pAvailUnit = m_pCurrQueue->m_pUnit;
+      }
+
+      m_iSize -= p->m_iSize;
+      ++ released;
+
+      delete [] p->m_pUnit;
+      delete [] p->m_pBuffer;
+      delete p;
+
+      p = prev->m_pNext;
+   }
+
+   return (released > 0) ? 0 : -1;
 }
 
 CUnit* CUnitQueue::getNextAvailUnit()
@@ -518,6 +583,10 @@ void CSndQueue::init(CChannel* c, CTimer* t)
 {
    CSndQueue* self = (CSndQueue*)param;
 
+   sockaddr* addrs[UDT_CHANNEL_BATCH];
+   CPacket pkts[UDT_CHANNEL_BATCH];
+   CPacket* packets[UDT_CHANNEL_BATCH];
+
    while (!self->m_bClosing)
    {
       uint64_t ts = self->m_pSndUList->getNextProcTime();
@@ -528,15 +597,31 @@ void CSndQueue::init(CChannel* c, CTimer* t)
          uint64_t currtime;
          CTimer::rdtsc(currtime);
          if (currtime < ts)
+         {
+            #ifdef NO_BUSY_WAITING
+               uint64_t batchtime = currtime + UDT_SND_BATCH_INTERVAL * CTimer::getCPUFrequency();
+               if (ts < batchtime)
+                  ts = batchtime;
+            #endif
+
             self->m_pTimer->sleepto(ts);
+         }
 
-         // it is time to send the next pkt
-         sockaddr* addr;
-         CPacket pkt;
-         if (self->m_pSndUList->pop(addr, pkt) < 0)
-            continue;
+         // it is time to send the next pkt, and any others that became
+         // due in the meantime, a batch per system call
+         int n;
+         do
+         {
+            for (n = 0; n < UDT_CHANNEL_BATCH; ++ n)
+            {
+               packets[n] = pkts + n;
+               if (self->m_pSndUList->pop(addrs[n], pkts[n]) < 0)
+                  break;
+            }
 
-         self->m_pChannel->sendto(addr, pkt);
+            if (n > 0)
+               self->m_pChannel->sendto(addrs, packets, n);
+         } while (UDT_CHANNEL_BATCH == n);
       }
       else
       {
@@ -974,16 +1059,21 @@ void CRcvQueue::init(int qsize, int payload, int version, int hsize, CChannel* c
 {
    CRcvQueue* self = (CRcvQueue*)param;
 
-   sockaddr* addr = (AF_INET == self->m_UnitQueue.m_iIPversion) ? (sockaddr*) new sockaddr_in : (sockaddr*) new sockaddr_in6;
+   // one address per packet of a batch, sockaddr_in6 has room for either version
+   sockaddr_in6* addrbuf = new sockaddr_in6[UDT_CHANNEL_BATCH];
+   sockaddr* addrs[UDT_CHANNEL_BATCH];
+   for (int i = 0; i < UDT_CHANNEL_BATCH; ++ i)
+      addrs[i] = (sockaddr*)(addrbuf + i);
+
+   CUnit* units[UDT_CHANNEL_BATCH];
+   CPacket* packets[UDT_CHANNEL_BATCH];
    CUDT* u = NULL;
    int32_t id;
 
+   uint64_t nextshrinktime = 0;
+
    while (!self->m_bClosing)
    {
-      #ifdef NO_BUSY_WAITING
-         self->m_pTimer->tick();
-      #endif
-
       // check waiting list, if new socket, insert it to the list
       while (self->ifNewEntry())
       {
@@ -995,75 +1085,104 @@ void CRcvQueue::init(int qsize, int payload, int version, int hsize, CChannel* c
          }
       }
 
-      // find next available slot for incoming packet
-      CUnit* unit = self->m_UnitQueue.getNextAvailUnit();
-      if (NULL == unit)
+      // find available slots for a batch of incoming packets, each is
+      // marked while searching so that the next search skips it
+      int slots = 0;
+      while (slots < UDT_CHANNEL_BATCH)
+      {
+         CUnit* unit = self->m_UnitQueue.getNextAvailUnit();
+         if (NULL == unit)
+            break;
+
+         unit->m_iFlag = 1;
+         ++ self->m_UnitQueue.m_iCount;
+         unit->m_Packet.setLength(self->m_iPayloadSize);
+         units[slots] = unit;
+         packets[slots] = &unit->m_Packet;
+         ++ slots;
+      }
+
+      // release them again, processData() takes the ones it stores
+      for (int i = 0; i < slots; ++ i)
+      {
+         units[i]->m_iFlag = 0;
+         -- self->m_UnitQueue.m_iCount;
+      }
+
+      if (0 == slots)
       {
          // no space, skip this packet
          CPacket temp;
          temp.m_pcData = new char[self->m_iPayloadSize];
          temp.setLength(self->m_iPayloadSize);
-         self->m_pChannel->recvfrom(addr, temp);
+         self->m_pChannel->recvfrom(addrs[0], temp);
          delete [] temp.m_pcData;
          goto TIMER_CHECK;
       }
 
-      unit->m_Packet.setLength(self->m_iPayloadSize);
+      // reading incoming packets, recvfrom returns -1 is nothing has been received
+      int count;
+      count = self->m_pChannel->recvfrom(addrs, packets, slots);
 
-      // reading next incoming packet, recvfrom returns -1 is nothing has been received
-      if (self->m_pChannel->recvfrom(addr, unit->m_Packet) < 0)
-         goto TIMER_CHECK;
+      for (int i = 0; i < count; ++ i)
+      {
+         CUnit* unit = units[i];
+         sockaddr* addr = addrs[i];
 
-      id = unit->m_Packet.m_iID;
+         if (unit->m_Packet.getLength() < 0)
+            continue;
 
-      // ID 0 is for connection request, which should be passed to the listening socket or rendezvous sockets
-      if (0 == id)
-      {
-         if (NULL != self->m_pListener)
-            self->m_pListener->listen(addr, unit->m_Packet);
-         else if (NULL != (u = self->m_pRendezvousQueue->retrieve(addr, id)))
+         id = unit->m_Packet.m_iID;
+
+         // ID 0 is for connection request, which should be passed to the listening socket or rendezvous sockets
+         if (0 == id)
          {
-            // asynchronous connect: call connect here
-            // otherwise wait for the UDT socket to retrieve this packet
-            if (!u->m_bSynRecving) {
-               try {
-                  u->connect(unit->m_Packet);
-               } catch (...) {
-                  printf("connect fail!\n");
-               }
-            } else
-               self->storePkt(id, unit->m_Packet.clone());
+            if (NULL != self->m_pListener)
+               self->m_pListener->listen(addr, unit->m_Packet);
+            else if (NULL != (u = self->m_pRendezvousQueue->retrieve(addr, id)))
+            {
+               // asynchronous connect: call connect here
+               // otherwise wait for the UDT socket to retrieve this packet
+               if (!u->m_bSynRecving) {
+                  try {
+                     u->connect(unit->m_Packet);
+                  } catch (...) {
+                     printf("connect fail!\n");
+                  }
+               } else
+                  self->storePkt(id, unit->m_Packet.clone());
+            }
          }
-      }
-      else if (id > 0)
-      {
-         if (NULL != (u = self->m_pHash->lookup(id)))
+         else if (id > 0)
          {
-            if (CIPAddress::ipcmp(addr, u->m_pPeerAddr, u->m_iIPversion))
+            if (NULL != (u = self->m_pHash->lookup(id)))
             {
-               if (u->m_bConnected && !u->m_bBroken && !u->m_bClosing)
+               if (CIPAddress::ipcmp(addr, u->m_pPeerAddr, u->m_iIPversion))
                {
-                  if (0 == unit->m_Packet.getFlag())
-                     u->processData(unit);
-                  else
-                     u->processCtrl(unit->m_Packet);
-
-                  u->checkTimers();
-                  self->m_pRcvUList->update(u);
+                  if (u->m_bConnected && !u->m_bBroken && !u->m_bClosing)
+                  {
+                     if (0 == unit->m_Packet.getFlag())
+                        u->processData(unit);
+                     else
+                        u->processCtrl(unit->m_Packet);
+
+                     u->checkTimers();
+                     self->m_pRcvUList->update(u);
+                  }
                }
             }
-         }
-         else if (NULL != (u = self->m_pRendezvousQueue->retrieve(addr, id)))
-         {
-            if (!u->m_bSynRecving)
+            else if (NULL != (u = self->m_pRendezvousQueue->retrieve(addr, id)))
             {
-               try {
-                  u->connect(unit->m_Packet);
-               } catch (...) {
-                  printf("connect fail!\n");
-               }
-            } else
-               self->storePkt(id, unit->m_Packet.clone());
+               if (!u->m_bSynRecving)
+               {
+                  try {
+                     u->connect(unit->m_Packet);
+                  } catch (...) {
+                     printf("connect fail!\n");
+                  }
+               } else
+                  self->storePkt(id, unit->m_Packet.clone());
+            }
          }
       }
 
@@ -1097,12 +1216,16 @@ TIMER_CHECK:
 
       // Check connection requests status for all sockets in the RendezvousQueue.
       self->m_pRendezvousQueue->updateConnStatus();
+
+      // the units are shared by all sockets of this multiplexer, give the idle ones back once a second
+      if (currtime > nextshrinktime)
+      {
+         self->m_UnitQueue.shrink();
+         nextshrinktime = currtime + 1000000 * CTimer::getCPUFrequency();
+      }
    }
 
-   if (AF_INET == self->m_UnitQueue.m_iIPversion)
-      delete (sockaddr_in*)addr;
-   else
-      delete (sockaddr_in6*)addr;
+   delete [] addrbuf;
 
    #ifndef WIN32
       return NULL;
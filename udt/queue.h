@@ -90,11 +90,11 @@ public:
    int increase();
 
       // Functionality:
-      //    Decrease (halve) the unit queue size.
+      //    Release the queues that hold no packet, as long as the rest stays less than half full.
       // Parameters:
       //    None.
       // Returned value:
-      //    0: success, -1: failure.
+      //    0: success, -1: nothing released.
 
    int shrink();
 
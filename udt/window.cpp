@@ -252,9 +252,9 @@ void CPktTimeWindow::onPktSent(int currtime)
    m_iLastSentTime = currtime;
 }
 
-void CPktTimeWindow::onPktArrival()
+void CPktTimeWindow::onPktArrival(uint64_t arrtime)
 {
-   m_CurrArrTime = CTimer::getTime();
+   m_CurrArrTime = arrtime;
 
    // record the packet interval between the current and the last one
    *(m_piPktWindow + m_iPktWindowPtr) = int(m_CurrArrTime - m_LastArrTime);
@@ -268,14 +268,14 @@ void CPktTimeWindow::onPktArrival()
    m_LastArrTime = m_CurrArrTime;
 }
 
-void CPktTimeWindow::probe1Arrival()
+void CPktTimeWindow::probe1Arrival(uint64_t arrtime)
 {
-   m_ProbeTime = CTimer::getTime();
+   m_ProbeTime = arrtime;
 }
 
-void CPktTimeWindow::probe2Arrival()
+void CPktTimeWindow::probe2Arrival(uint64_t arrtime)
 {
-   m_CurrArrTime = CTimer::getTime();
+   m_CurrArrTime = arrtime;
 
    // record the probing packets interval
    *(m_piProbeWindow + m_iProbeWindowPtr) = int(m_CurrArrTime - m_ProbeTime);